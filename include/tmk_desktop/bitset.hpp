@@ -7,15 +7,148 @@
 #pragma once
 
 #include <array>
+#include <bit>
+#include <iterator>
 #include <span>
+#include <type_traits>
+#include <cstddef>
 #include <cstdint>
 
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 namespace tmk_desktop {
+/**
+ * @brief ビットセットの差分を求める処理の実装
+ *
+ * ビット列を64ビットの値の配列として扱う。
+ * diff()がCPUに応じて選ぶが、ベンチマークのためにそれぞれを直接呼び出せるようにしておく。
+ */
+namespace bitset_simd {
+/**
+ * @brief 0から1と、1から0に変化したビットを抽出する (SIMDを使わない実装)
+ *
+ * @param prev 以前のビット列
+ * @param next 今回のビット列
+ * @param set 0から1に変化したビットを書き込む先
+ * @param reset 1から0に変化したビットを書き込む先
+ * @param count 値の数
+ */
+constexpr void diff_scalar(const uint64_t* prev, const uint64_t* next, uint64_t* set, uint64_t* reset, size_t count) noexcept {
+  for (size_t i = 0; i < count; ++i) {
+    set[i] = next[i] & ~prev[i];
+    reset[i] = prev[i] & ~next[i];
+  }
+}
+
+#if defined(_M_X64) || defined(__x86_64__)
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TMK_DESKTOP_TARGET_AVX2
+#else
+#define TMK_DESKTOP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/**
+ * @brief diff_scalar()のSSE2による実装
+ *
+ * x86-64では常に使える。countは2の倍数であること。
+ */
+inline void diff_sse2(const uint64_t* prev, const uint64_t* next, uint64_t* set, uint64_t* reset, size_t count) noexcept {
+  for (size_t i = 0; i < count; i += 2) {
+    const auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+    const auto n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(next + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(set + i), _mm_andnot_si128(p, n));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(reset + i), _mm_andnot_si128(n, p));
+  }
+}
+
+/**
+ * @brief diff_scalar()のAVX2による実装
+ *
+ * is_avx2_supported()がtrueを返すときのみ呼び出すこと。countは4の倍数であること。
+ */
+TMK_DESKTOP_TARGET_AVX2 inline void diff_avx2(const uint64_t* prev, const uint64_t* next, uint64_t* set, uint64_t* reset,
+                                              size_t count) noexcept {
+  for (size_t i = 0; i < count; i += 4) {
+    const auto p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i));
+    const auto n = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(set + i), _mm256_andnot_si256(p, n));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(reset + i), _mm256_andnot_si256(n, p));
+  }
+}
+#undef TMK_DESKTOP_TARGET_AVX2
+
+/**
+ * @brief CPUとOSがAVX2を使えるかどうかを調べる
+ */
+inline bool detect_avx2() noexcept {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  const bool osxsave = info[2] & (1 << 27);
+  const bool avx = info[2] & (1 << 28);
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+  __cpuidex(info, 7, 0);
+  return info[1] & (1 << 5);
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+/**
+ * @brief AVX2を使えるかどうかを取得する
+ *
+ * 最初の呼び出しで調べた結果を使い回す。
+ */
+inline bool is_avx2_supported() noexcept {
+  static const bool supported = detect_avx2();
+  return supported;
+}
+#endif
+
+/**
+ * @brief 0から1と、1から0に変化したビットを抽出する
+ *
+ * 使えるならAVX2かSSE2で処理する。
+ */
+constexpr void diff(const uint64_t* prev, const uint64_t* next, uint64_t* set, uint64_t* reset, size_t count) noexcept {
+#if defined(_M_X64) || defined(__x86_64__)
+  if (!std::is_constant_evaluated()) {
+    if (count % 4 == 0 && is_avx2_supported()) return diff_avx2(prev, next, set, reset, count);
+    if (count % 2 == 0) return diff_sse2(prev, next, set, reset, count);
+  }
+#endif
+  diff_scalar(prev, next, set, reset, count);
+}
+}  // namespace bitset_simd
+
+template <size_t N, typename ValueT>
+class Bitset;
+
+/**
+ * @brief ビットセットの変化
+ */
+template <size_t N, typename ValueT>
+struct BitsetDiff {
+  Bitset<N, ValueT> set;    ///< 0から1に変化したビット
+  Bitset<N, ValueT> reset;  ///< 1から0に変化したビット
+};
+
 /**
  * @brief ビットセット
  *
+ * ビット列は論理的にはValueTの値の配列として扱うが、実際には64ビットの値の配列に格納する。
+ * これにより、ValueTが小さくても列挙や演算は64ビットずつ進む。
+ * 範囲外のビットは常に0に保つ。
+ *
  * @tparam N ビット数
- * @tparam ValueT ビット列を格納する値の型
+ * @tparam ValueT ビット列を格納する値の型。Positionの行と列やvalue()の単位になる
  */
 template <size_t N, typename ValueT = uintmax_t>
 class Bitset {
@@ -30,6 +163,18 @@ public:
    */
   static constexpr size_t VALUE_COUNT = (N + VALUE_WIDTH - 1) / VALUE_WIDTH;
 
+  /**
+   * @brief 実際にビット列を格納する値のビット幅
+   */
+  static constexpr size_t WORD_WIDTH = 64;
+
+  /**
+   * @brief 実際にビット列を格納する値配列の長さ
+   */
+  static constexpr size_t WORD_COUNT = (N + WORD_WIDTH - 1) / WORD_WIDTH;
+
+  static_assert(std::is_unsigned_v<ValueT> && WORD_WIDTH % VALUE_WIDTH == 0, "ValueT must be an unsigned integer of up to 64 bits");
+
   /**
    * @brief ビット列における位置
    */
@@ -61,20 +206,76 @@ public:
     size_t index_;
   };
 
+  /**
+   * @brief 1になっているビットを順に指すイテレータ
+   */
+  class Iterator {
+  public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Position;
+    using difference_type = std::ptrdiff_t;
+    using reference = Position;
+
+    Iterator() = default;
+
+    constexpr Position operator*() const noexcept {
+      return Position{word_index_ * WORD_WIDTH + std::countr_zero(word_)};
+    }
+
+    constexpr Iterator& operator++() noexcept {
+      word_ &= word_ - 1;
+      skip_empty_words();
+      return *this;
+    }
+
+    constexpr Iterator operator++(int) noexcept {
+      auto prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    friend constexpr bool operator==(const Iterator& lhs, const Iterator& rhs) noexcept {
+      return lhs.word_index_ == rhs.word_index_ && lhs.word_ == rhs.word_;
+    }
+
+  private:
+    friend class Bitset;
+
+    constexpr Iterator(const Bitset* bitset, size_t word_index) noexcept
+        : bitset_(bitset), word_index_(word_index), word_(word_index < WORD_COUNT ? bitset->words_[word_index] : 0) {
+      skip_empty_words();
+    }
+
+    /**
+     * @brief 今の値を列挙し終えていれば、1のビットを持つ次の値に進む
+     */
+    constexpr void skip_empty_words() noexcept {
+      while (word_ == 0 && word_index_ < WORD_COUNT) {
+        if (++word_index_ < WORD_COUNT) word_ = bitset_->words_[word_index_];
+      }
+    }
+
+    const Bitset* bitset_ = nullptr;  ///< 列挙するビットセット
+    size_t word_index_ = WORD_COUNT;  ///< 列挙している値の位置
+    uint64_t word_ = 0;               ///< 列挙している値のうち、まだ列挙していないビット
+  };
+
   /**
    * @brief 全体を0で初期化する
    */
-  constexpr Bitset() noexcept : values_{} {}
+  constexpr Bitset() noexcept : words_{} {}
 
   /**
    * @brief 単一の値で全体を初期化する
    *
    * @param default_value 初期値
    */
-  constexpr explicit Bitset(ValueT default_value) noexcept {
-    for (auto& value : values_) {
-      value = default_value;
+  constexpr explicit Bitset(ValueT default_value) noexcept : words_{} {
+    for (size_t i = 0; i < VALUE_COUNT; ++i) {
+      set_value(i, default_value);
     }
+    mask_tail();
   }
 
   /**
@@ -82,10 +283,11 @@ public:
    *
    * @param values ビット列を格納する値の配列
    */
-  constexpr explicit Bitset(std::span<const ValueT, VALUE_COUNT> values) noexcept {
+  constexpr explicit Bitset(std::span<const ValueT, VALUE_COUNT> values) noexcept : words_{} {
     for (size_t i = 0; i < VALUE_COUNT; ++i) {
-      values_[i] = values[i];
+      set_value(i, values[i]);
     }
+    mask_tail();
   }
 
   /**
@@ -96,22 +298,22 @@ public:
   constexpr explicit Bitset(const ValueT (&values)[VALUE_COUNT]) noexcept : Bitset(std::span(values)) {}
 
   /**
-   * @brief ビット列を格納する数値列を取得する
-   *
-   * @return 値の配列
+   * @brief ビット列を格納する64ビットの値の配列を取得する
    */
-  constexpr std::span<const ValueT, VALUE_COUNT> values() const noexcept {
-    return values_;
+  constexpr std::span<const uint64_t, WORD_COUNT> words() const noexcept {
+    return words_;
   }
 
   /**
    * @brief ビット列を格納する数値を取得する
    *
-   * @return 値の配列
+   * @param i ValueT単位での位置
+   * @return 値。範囲外なら0
    */
   constexpr ValueT value(size_t i) const noexcept {
-    if (i >= values_.size()) return 0;
-    return values_[i];
+    if (i >= VALUE_COUNT) return 0;
+    const size_t offset = i * VALUE_WIDTH;
+    return static_cast<ValueT>(words_[offset / WORD_WIDTH] >> (offset % WORD_WIDTH));
   }
 
   /**
@@ -123,7 +325,7 @@ public:
    */
   constexpr bool operator[](const Position& pos) const noexcept {
     if (!pos.is_valid()) return false;
-    return !!(values_[pos.row()] & (static_cast<ValueT>(1) << pos.col()));
+    return !!(words_[pos.index() / WORD_WIDTH] & bit(pos));
   }
 
   /**
@@ -133,6 +335,60 @@ public:
     return N;
   }
 
+  /**
+   * @brief 1になっているビットの数を取得する
+   */
+  constexpr size_t popcount() const noexcept {
+    size_t count = 0;
+    for (auto word : words_) {
+      count += std::popcount(word);
+    }
+    return count;
+  }
+
+  /**
+   * @brief 1になっているビットがあるかどうかを調べる
+   */
+  constexpr bool any() const noexcept {
+    for (auto word : words_) {
+      if (word != 0) return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief すべてのビットが0かどうかを調べる
+   */
+  constexpr bool none() const noexcept {
+    return !any();
+  }
+
+  /**
+   * @brief 最初に1になっているビットを探す
+   *
+   * @return 見つかったビットの位置。なければ範囲外の位置
+   */
+  constexpr Position find_first() const noexcept {
+    for (size_t i = 0; i < WORD_COUNT; ++i) {
+      if (words_[i] != 0) return Position{i * WORD_WIDTH + std::countr_zero(words_[i])};
+    }
+    return Position{N};
+  }
+
+  /**
+   * @brief 1になっているビットを列挙するイテレータを取得する
+   */
+  constexpr Iterator begin() const noexcept {
+    return Iterator{this, 0};
+  }
+
+  /**
+   * @brief 列挙の終わりを示すイテレータを取得する
+   */
+  constexpr Iterator end() const noexcept {
+    return Iterator{};
+  }
+
   /**
    * @brief ビットを更新する
    *
@@ -154,7 +410,7 @@ public:
    */
   constexpr void set(const Position& pos) noexcept {
     if (!pos.is_valid()) return;
-    values_[pos.row()] |= static_cast<ValueT>(1) << pos.col();
+    words_[pos.index() / WORD_WIDTH] |= bit(pos);
   }
 
   /**
@@ -164,7 +420,7 @@ public:
    */
   constexpr void reset(const Position& pos) noexcept {
     if (!pos.is_valid()) return;
-    values_[pos.row()] &= ~(static_cast<ValueT>(1) << pos.col());
+    words_[pos.index() / WORD_WIDTH] &= ~bit(pos);
   }
 
   /**
@@ -174,36 +430,31 @@ public:
    */
   constexpr void flip(const Position& pos) noexcept {
     if (!pos.is_valid()) return;
-    values_[pos.row()] ^= static_cast<ValueT>(1) << pos.col();
+    words_[pos.index() / WORD_WIDTH] ^= bit(pos);
   }
 
   /**
    * @brief ビットをすべて0にする
    */
   constexpr void clear() noexcept {
-    for (auto& value : values_) {
-      value = 0;
+    for (auto& word : words_) {
+      word = 0;
     }
   }
 
   /**
    * @brief 1になっているビットを列挙する
    *
+   * 1のビットごとに1回だけ進むので、0のビットが多くても遅くならない。
+   *
    * @param pred Positionを引数とする関数オブジェクト
    */
   template <typename Pred>
   constexpr void scan(Pred pred) const noexcept {
-    size_t index = 0;
-    for (auto value : values_) {
-      const auto next_index = index + VALUE_WIDTH;
-      while (value != 0) {
-        if (value & 1) {
-          pred(Position{index});
-        }
-        value >>= 1;
-        index++;
+    for (size_t i = 0; i < WORD_COUNT; ++i) {
+      for (auto word = words_[i]; word != 0; word &= word - 1) {
+        pred(Position{i * WORD_WIDTH + std::countr_zero(word)});
       }
-      index = next_index;
     }
   }
 
@@ -212,15 +463,16 @@ public:
    *
    * @param lhs 左辺のビットセット
    * @param rhs 右辺のビットセット
-   * @param op ValueTの二項演算を行う関数オブジェクト
+   * @param op uint64_tの二項演算を行う関数オブジェクト
    * @return opの演算結果を格納するビットセットを返す
    */
   template <typename Op>
   friend constexpr Bitset binary_op(const Bitset& lhs, const Bitset& rhs, Op op) noexcept {
     Bitset result;
-    for (size_t i = 0; i < result.values_.size(); ++i) {
-      result.values_[i] = op(lhs.values_[i], rhs.values_[i]);
+    for (size_t i = 0; i < WORD_COUNT; ++i) {
+      result.words_[i] = op(lhs.words_[i], rhs.words_[i]);
     }
+    result.mask_tail();
     return result;
   }
 
@@ -246,7 +498,50 @@ public:
     return set_to_reset(next, prev);
   }
 
+  /**
+   * @brief 0から1と、1から0に変化するビットを一度に抽出する
+   *
+   * reset_to_set()とset_to_reset()を両方呼び出すのと同じ結果になる。使えるならAVX2かSSE2で処理する。
+   *
+   * @param prev 以前のビットセット
+   * @param next 今回のビットセット
+   * @return 変化したビット
+   */
+  friend constexpr BitsetDiff<N, ValueT> diff(const Bitset& prev, const Bitset& next) noexcept {
+    BitsetDiff<N, ValueT> result;
+    bitset_simd::diff(prev.words_.data(), next.words_.data(), result.set.words_.data(), result.reset.words_.data(), WORD_COUNT);
+    return result;
+  }
+
+  friend constexpr bool operator==(const Bitset& lhs, const Bitset& rhs) noexcept = default;
+
 private:
-  std::array<ValueT, VALUE_COUNT> values_;  ///< ビット列を格納する値の配列
+  /**
+   * @brief 位置が指すビットだけを1にした値を取得する
+   */
+  static constexpr uint64_t bit(const Position& pos) noexcept {
+    return uint64_t{1} << (pos.index() % WORD_WIDTH);
+  }
+
+  /**
+   * @brief ValueT単位で値を書き込む
+   *
+   * 書き込む先のビットは0であること。
+   */
+  constexpr void set_value(size_t i, ValueT value) noexcept {
+    const size_t offset = i * VALUE_WIDTH;
+    words_[offset / WORD_WIDTH] |= static_cast<uint64_t>(value) << (offset % WORD_WIDTH);
+  }
+
+  /**
+   * @brief 範囲外のビットを0にする
+   */
+  constexpr void mask_tail() noexcept {
+    if constexpr (N % WORD_WIDTH != 0) {
+      words_[WORD_COUNT - 1] &= (uint64_t{1} << (N % WORD_WIDTH)) - 1;
+    }
+  }
+
+  std::array<uint64_t, WORD_COUNT> words_;  ///< ビット列を格納する値の配列
 };
 }  // namespace tmk_desktop
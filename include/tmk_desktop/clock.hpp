@@ -0,0 +1,18 @@
+/**
+ * @file clock.hpp
+ * @brief エンジンの時計
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <chrono>
+
+namespace tmk_desktop {
+/**
+ * @brief エンジンの時計
+ *
+ * キーイベントの時刻やTMKのタイマーはすべてこの時計で表す。
+ */
+using Clock = std::chrono::steady_clock;
+}  // namespace tmk_desktop
@@ -0,0 +1,25 @@
+/**
+ * @file counter.hpp
+ * @brief 統計のカウンター
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace tmk_desktop {
+/**
+ * @brief 統計のカウンターを増やす
+ *
+ * 統計のカウンターに書き込むのは1つのスレッドだけなので、read-modify-writeは使わない。
+ * 他のスレッドはいつでも読み出せるが、書き込んではならない。
+ *
+ * @param counter 増やすカウンター
+ * @param value 増やす値
+ */
+inline void increment(std::atomic<uint64_t>& counter, uint64_t value = 1) noexcept {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+}  // namespace tmk_desktop
@@ -0,0 +1,80 @@
+/**
+ * @file event.hpp
+ * @brief Linux (evdev) のキーイベント
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "../clock.hpp"
+
+// linux/input.hのKEY_*マクロはTMKの名前 (KEY_DOWNなど) と衝突するので、公開ヘッダーではインクルードしない
+
+namespace tmk_desktop::inline evdev {
+/**
+ * @brief キーを表す値の型
+ *
+ * evdevのキーコードをそのまま使わず、Win32と同じくPS/2 Set1のスキャンコードに拡張キーなら0x100を足した値に変換する。
+ * これにより、Win32向けのキー配列の定義をそのまま使える。変換はsrc/evdev/key.hppで行う。
+ */
+using Key = uint16_t;
+
+/**
+ * @brief キーの個数
+ */
+static constexpr size_t KEY_COUNT = 0x200;
+
+/**
+ * @brief 対応するキーがないことを示す値
+ */
+static constexpr Key NO_KEY = 0;
+
+/**
+ * @brief キーイベントを格納するクラス
+ */
+class KeyEvent final {
+public:
+  KeyEvent() = default;
+
+  /**
+   * @param key キー
+   * @param pressed 押したかどうか
+   * @param timestamp キーを操作した時刻
+   */
+  constexpr KeyEvent(Key key, bool pressed, Clock::time_point timestamp) noexcept
+      : timestamp_(timestamp), key_(key), pressed_(pressed) {}
+
+  constexpr Key key() const noexcept {
+    return key_;
+  }
+
+  constexpr bool is_pressed() const noexcept {
+    return pressed_;
+  }
+
+  /**
+   * @brief キーを操作した時刻を取得する
+   */
+  constexpr Clock::time_point timestamp() const noexcept {
+    return timestamp_;
+  }
+
+private:
+  Clock::time_point timestamp_{};  ///< キーを操作した時刻
+  Key key_ = NO_KEY;               ///< キー
+  bool pressed_ = false;           ///< 押したかどうか
+};
+
+/**
+ * @brief Sinkで使うOSネイティブなイベント
+ *
+ * 時刻を除いたinput_eventであり、そのまま仮想キーボードに書き込まれる。
+ */
+struct NativeSinkEvent {
+  uint16_t type = 0;  ///< イベントの種類 (EV_KEYなど)
+  uint16_t code = 0;  ///< コード
+  int32_t value = 0;  ///< 値
+};
+}  // namespace tmk_desktop::inline evdev
@@ -6,6 +6,10 @@
  */
 #pragma once
 
-#ifdef _WIN32
+#if defined(TMK_DESKTOP_HEADLESS)
+#include "headless/event.hpp"
+#elif defined(TMK_DESKTOP_EVDEV)
+#include "evdev/event.hpp"
+#elif defined(_WIN32)
 #include "win32/event.hpp"
 #endif
@@ -0,0 +1,177 @@
+/**
+ * @file flight_recorder.hpp
+ * @brief 直近のパイプラインのイベントを記録するフライトレコーダー
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * Keyboardが受け取った入力、TMKが解決したアクション、Sinkに渡したイベントを、その時点のレイヤーと修飾キーの状態とともに
+ * 固定長のリングバッファに記録し続ける。ステージが異常停止したときや求められたときに、バイナリ形式のファイルに書き出す。
+ * ファイルはtools/flight_recorderで読める。
+ *
+ * ファイルの構成は以下の通りで、値はすべてリトルエンディアンで格納する。
+ * - FlightRecordFileHeader
+ * - 記録：FlightRecord[record_count] (古い順)
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <span>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include "spsc_queue.hpp"
+
+namespace tmk_desktop {
+static_assert(std::endian::native == std::endian::little, "flight record files are written in place as little endian");
+
+static constexpr std::array<char, 4> FLIGHT_RECORD_FILE_MAGIC{'T', 'K', 'F', 'R'};  ///< ファイルの先頭に置く識別子
+static constexpr uint16_t FLIGHT_RECORD_FILE_VERSION = 1;                           ///< ファイル形式のバージョン
+
+/**
+ * @brief 記録の種類
+ */
+enum class FlightRecordType : uint8_t {
+  NONE,        ///< 何もない
+  KEY_EVENT,   ///< Keyboardが受け取った入力
+  ACTION,      ///< TMKが解決したアクション
+  SINK_EVENT,  ///< Sinkに渡したイベント
+};
+
+/**
+ * @brief 1つの記録
+ *
+ * codeとdataの意味は種類によって異なる。
+ * - KEY_EVENT：codeはキー、data[0]は押したなら1、離したなら0
+ * - ACTION：codeはアクションコード、data[0]とdata[1]はキーの位置の列と行
+ * - SINK_EVENT：codeはSinkEventType、dataはイベントの中身の先頭のバイト列
+ */
+struct FlightRecord {
+  int64_t time_ns;               ///< 元になった入力か時間経過の時刻 [ns] (エンジンの時計の値)
+  uint32_t layer_state;          ///< レイヤーの状態
+  uint32_t default_layer_state;  ///< 既定レイヤーの状態
+  FlightRecordType type;         ///< 記録の種類
+  uint8_t mods;                  ///< 修飾キーの状態
+  uint8_t weak_mods;             ///< 一時的な修飾キーの状態
+  uint8_t reserved;              ///< 予約
+  uint16_t code;                 ///< 種類ごとの値
+  std::array<uint8_t, 10> data;  ///< 種類ごとの中身
+};
+static_assert(sizeof(FlightRecord) == 32);
+static_assert(std::is_trivially_copyable_v<FlightRecord>);
+
+/**
+ * @brief 記録を書き出した理由
+ */
+enum class FlightRecordReason : uint32_t {
+  REQUESTED,       ///< 求められた
+  SOURCE_ERROR,    ///< Sourceが異常停止した
+  KEYBOARD_ERROR,  ///< Keyboardが異常停止した
+  SINK_ERROR,      ///< Sinkが異常停止した
+};
+
+/**
+ * @brief フライトレコーダーのファイルのヘッダ
+ */
+struct FlightRecordFileHeader {
+  std::array<char, 4> magic;     ///< FLIGHT_RECORD_FILE_MAGIC
+  uint16_t version;              ///< FLIGHT_RECORD_FILE_VERSION
+  uint16_t record_size;          ///< 1つの記録の大きさ。sizeof(FlightRecord)と一致すること
+  FlightRecordReason reason;     ///< 書き出した理由
+  uint32_t record_count;         ///< 記録の数
+  uint64_t total_count;          ///< これまでに記録した数。record_countとの差が、上書きされて失われた記録の数になる
+  int64_t dumped_ns;             ///< 書き出した時刻 [ns] (エンジンの時計の値)
+  std::array<char, 64> message;  ///< 理由の説明 (例外のメッセージなど)。NUL終端
+};
+static_assert(sizeof(FlightRecordFileHeader) == 96);
+
+/**
+ * @brief 直近の記録を保持するリングバッファ
+ *
+ * 記録は単一のスレッドのみが、読み出しはどのスレッドからでもロックせずに行える。
+ * 記録は8バイトずつアトミックに書き込み、読み出しでは読んでいる間に上書きされた記録を捨てる (seqlockと同じ考え方)。
+ * 記録するスレッドは、ロックもメモリ確保もせず、数回のストアだけで済む。
+ */
+class FlightRecorder final {
+public:
+  static constexpr size_t CAPACITY = 1024;  ///< 保持する記録の数 (2のべき乗)
+
+  /**
+   * @brief 記録する
+   *
+   * 満杯のときは最も古い記録を上書きする。
+   */
+  void record(const FlightRecord& record) noexcept {
+    const uint64_t index = started_.load(std::memory_order_relaxed);
+    // 上書きし始めることを先に知らせ、読み出し側が書きかけの記録を捨てられるようにする
+    started_.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const auto words = std::bit_cast<std::array<uint64_t, WORD_COUNT>>(record);
+    auto& slot = slots_[index & MASK];
+    for (size_t i = 0; i < WORD_COUNT; ++i) slot[i].store(words[i], std::memory_order_relaxed);
+    committed_.store(index + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief 直近の記録を古い順に読み出す
+   *
+   * @param out 読み出した記録の格納先。大きさが足りなければ新しいものから詰める
+   * @return 読み出した記録の数
+   */
+  size_t read(std::span<FlightRecord> out) const noexcept {
+    const uint64_t committed = committed_.load(std::memory_order_acquire);
+    const uint64_t count = std::min<uint64_t>({committed, CAPACITY, out.size()});
+    const uint64_t begin = committed - count;
+    for (uint64_t index = begin; index < committed; ++index) {
+      std::array<uint64_t, WORD_COUNT> words;
+      const auto& slot = slots_[index & MASK];
+      for (size_t i = 0; i < WORD_COUNT; ++i) words[i] = slot[i].load(std::memory_order_relaxed);
+      out[index - begin] = std::bit_cast<FlightRecord>(words);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // 読んでいる間に上書きされ始めた記録を捨てる
+    const uint64_t started = started_.load(std::memory_order_relaxed);
+    const uint64_t valid_begin = std::max(begin, started > CAPACITY ? started - CAPACITY : 0);
+    if (valid_begin >= committed) return 0;
+    const auto dropped = static_cast<size_t>(valid_begin - begin);
+    if (dropped > 0) std::copy(out.begin() + dropped, out.begin() + count, out.begin());
+    return static_cast<size_t>(count) - dropped;
+  }
+
+  /**
+   * @brief これまでに記録した数を取得する
+   */
+  uint64_t total_count() const noexcept {
+    return committed_.load(std::memory_order_acquire);
+  }
+
+private:
+  static constexpr size_t MASK = CAPACITY - 1;
+  static constexpr size_t WORD_COUNT = sizeof(FlightRecord) / sizeof(uint64_t);
+  static_assert((CAPACITY & MASK) == 0, "CAPACITY must be a power of two");
+
+  using Slot = std::array<std::atomic<uint64_t>, WORD_COUNT>;  ///< 1つの記録を格納する場所
+
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> started_{0};    ///< 書き込み始めた記録の数
+  std::atomic<uint64_t> committed_{0};                           ///< 書き込み終えた記録の数
+  alignas(CACHE_LINE_SIZE) std::array<Slot, CAPACITY> slots_{};  ///< 記録
+};
+
+/**
+ * @brief フライトレコーダーの記録をファイルに書き出す
+ *
+ * どのスレッドからでも呼び出せる。ステージの異常停止の通知 (on_keyboard_error()など) からも呼び出せるよう、例外を投げない。
+ * 記録し続けながら書き出すので、書き出している間の記録は含むことも含まないこともある。
+ *
+ * @param path 書き出すファイルのパス (UTF-8)。ディレクトリは作らない
+ * @param reason 書き出す理由
+ * @param message 理由の説明。nullptrなら空とする。63バイトを超える部分は切り捨てる
+ * @retval true 成功
+ * @retval false ファイルに書き込めなかった
+ */
+bool dump_flight_recorder(const char* path, FlightRecordReason reason, const char* message = nullptr) noexcept;
+}  // namespace tmk_desktop
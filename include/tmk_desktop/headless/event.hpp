@@ -0,0 +1,71 @@
+/**
+ * @file event.hpp
+ * @brief ヘッドレス環境のキーイベント
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "../clock.hpp"
+
+namespace tmk_desktop::inline headless {
+/**
+ * @brief キーを表す値の型
+ *
+ * Win32と同じく、PS/2 Set1のスキャンコードに拡張キーなら0x100を足した値を使う。
+ * これにより、Win32向けのキー配列の定義をそのまま使える。
+ */
+using Key = uint16_t;
+
+/**
+ * @brief キーの個数
+ */
+static constexpr size_t KEY_COUNT = 0x200;
+
+/**
+ * @brief キーイベントを格納するクラス
+ */
+class KeyEvent final {
+public:
+  KeyEvent() = default;
+
+  /**
+   * @param key キー
+   * @param pressed 押したかどうか
+   * @param timestamp キーを操作した時刻
+   */
+  constexpr KeyEvent(Key key, bool pressed, Clock::time_point timestamp) noexcept
+      : timestamp_(timestamp), key_(key), pressed_(pressed) {}
+
+  KeyEvent(Key key, bool pressed) noexcept : KeyEvent(key, pressed, Clock::now()) {}
+
+  constexpr Key key() const noexcept {
+    return key_;
+  }
+
+  constexpr bool is_pressed() const noexcept {
+    return pressed_;
+  }
+
+  constexpr Clock::time_point timestamp() const noexcept {
+    return timestamp_;
+  }
+
+private:
+  Clock::time_point timestamp_{};  ///< キーを操作した時刻
+  Key key_ = 0;                    ///< キー
+  bool pressed_ = false;           ///< 押したかどうか
+};
+
+/**
+ * @brief Sinkで使うOSネイティブなイベント
+ *
+ * ヘッドレス環境では、キーの値をそのまま出力として記録する。
+ */
+struct NativeSinkEvent {
+  Key key = 0;           ///< キー
+  bool pressed = false;  ///< 押したかどうか
+};
+}  // namespace tmk_desktop::inline headless
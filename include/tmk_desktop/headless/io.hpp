@@ -0,0 +1,71 @@
+/**
+ * @file io.hpp
+ * @brief ヘッドレス環境の入出力
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * OSの代わりに、アプリケーションが入力イベントを与え、出力されたイベントを受け取る。
+ * 入力はSourceのスレッドを経由してKeyboardに届き、出力はSinkのスレッドで記録される。
+ */
+#pragma once
+
+#include <span>
+#include <cstddef>
+#include <cstdint>
+#include "../stage.hpp"
+#include "event.hpp"
+
+namespace tmk_desktop::inline headless {
+/**
+ * @brief 出力イベントの種類
+ */
+enum class OutputType : uint8_t {
+  KEY_PRESS,    ///< キーを押した
+  KEY_RELEASE,  ///< キーを離した
+  KEY_TAP,      ///< キーを押してすぐ離した
+  KEY_REPEAT,   ///< 最後に押したキーをリピートした
+  NATIVE,       ///< NativeSinkEventをそのまま出力した
+};
+
+/**
+ * @brief 出力イベント
+ */
+struct OutputEvent {
+  Clock::time_point timestamp;  ///< Sinkが出力した時刻
+  uint32_t batch_id;            ///< 送信の通し番号 (1から)。OSに1回で渡すイベントは同じ値を持つ
+  OutputType type;              ///< 種類
+  uint8_t keycode;              ///< キーコード (NATIVE以外)
+  NativeSinkEvent native;       ///< イベント (NATIVEのみ)
+};
+
+/**
+ * @brief Sourceに入力イベントを送る
+ *
+ * 単一のスレッドから呼び出すこと。
+ *
+ * @param event 入力イベント
+ * @retval true イベントを受け付けた
+ * @retval false キューが満杯でイベントを受け付けられなかった
+ */
+bool send_to_source(const KeyEvent& event) noexcept;
+
+/**
+ * @brief Sinkが記録した出力イベントを取り出す
+ *
+ * 単一のスレッドから呼び出すこと。記録用のバッファは固定長であり、溢れた分は捨てられる。
+ *
+ * @param events 出力イベントの格納先
+ * @return 取り出したイベント数
+ */
+size_t receive_from_sink(std::span<OutputEvent> events) noexcept;
+
+/**
+ * @brief 入力イベントのキューの統計を取得する
+ */
+QueueStats get_input_queue_stats() noexcept;
+
+/**
+ * @brief 出力イベントを記録するバッファの統計を取得する
+ */
+QueueStats get_output_queue_stats() noexcept;
+}  // namespace tmk_desktop::inline headless
@@ -7,18 +7,18 @@
 #pragma once
 
 #include <exception>
+#include <cstddef>
+#include <cstdint>
 #include "event.hpp"
+#include "latency.hpp"
+#include "stage.hpp"
+#include "timer_wheel.hpp"
 
 namespace tmk_desktop {
 /**
  * @brief Keyboardの状態
  */
-enum class KeyboardStatus {
-  RESET,     ///< リセット済み
-  RUNNING,   ///< 動作中
-  STOPPING,  ///< 停止しようとしている
-  STOPPED,   ///< 停止した
-};
+using KeyboardStatus = StageStatus;
 
 /**
  * @brief Keyboardを始動させる
@@ -42,11 +42,16 @@ bool stop_keyboard();
 /**
  * @brief Keyboardにイベントを送る
  *
+ * 単一のスレッドから呼び出すこと。
+ * イベントを固定長のキューに積むだけなので、フックプロシージャの中からでも呼び出せる。
+ * TMK_DESKTOP_FUSED_PIPELINEを定義したときは、Sourceのスレッドから呼び出すこと。
+ * このとき、Keyboardが動いていなければイベントを受け付けない。
+ *
  * @param event 入力イベント
- * @exception bad_alloc メモリ確保に失敗
- * @exception system_error mutexのロックに失敗
+ * @retval true イベントを受け付けた
+ * @retval false キューが満杯でイベントを受け付けられなかった
  */
-void send_to_keyboard(const KeyEvent& event);
+bool send_to_keyboard(const KeyEvent& event) noexcept;
 
 /**
  * @brief Keyboardの状態を取得する
@@ -55,6 +60,99 @@ void send_to_keyboard(const KeyEvent& event);
  */
 KeyboardStatus get_keyboard_status() noexcept;
 
+/**
+ * @brief Keyboardのスレッドがイベントを待つ方針を設定する
+ *
+ * 既定ではすぐにスレッドを眠らせる。
+ * 遅延を減らしたいときは、CPU時間と引き換えにスピンさせることができる。
+ * TMK_DESKTOP_FUSED_PIPELINEを定義したときは、Keyboardがスレッドを持たないので効果がない。
+ *
+ * @param policy 待機の方針
+ * @retval true 設定に成功
+ * @retval false Keyboardが動作中のため設定できない
+ */
+bool set_keyboard_wait_policy(const WaitPolicy& policy) noexcept;
+
+/**
+ * @brief Keyboardの統計を取得する
+ *
+ * 処理したイベント数、イベントキュー、待機の統計をまとめて返す。
+ *
+ * @return 現在の統計
+ */
+StageStats get_keyboard_stats() noexcept;
+
+/**
+ * @brief 期限を迎えたときにKeyboardで呼ぶ処理を予約する
+ *
+ * TMKのフックやキーマップの関数 (action_function()など) の中から、Keyboardの処理として呼び出すこと。
+ * 処理はKeyboardの時間経過による処理として、キーマップを参照できる状態で呼ばれる。処理の中で再び予約してもよい。
+ * 予約と取り消しは予約の数によらず一定の時間で済み、同時に予約した数が256を超えるまではメモリを確保しない。
+ * キーマップが切り替わったときと、Keyboardを停止させたときは、予約はすべて取り消される。
+ *
+ * @param deadline 期限。1ミリ秒単位に切り上げる
+ * @param callback 期限を迎えたときに呼ぶ関数
+ * @param context callbackに渡す値
+ * @return 予約したタイマー
+ * @exception bad_alloc メモリを確保できない
+ */
+TimerId schedule_keyboard_timer(Clock::time_point deadline, TimerCallback callback, void* context = nullptr);
+
+/**
+ * @brief schedule_keyboard_timer()で予約した処理を取り消す
+ *
+ * schedule_keyboard_timer()と同様に、Keyboardの処理として呼び出すこと。
+ *
+ * @param id 取り消すタイマー
+ * @retval true 取り消した
+ * @retval false すでに呼ばれたか取り消した
+ */
+bool cancel_keyboard_timer(TimerId id) noexcept;
+
+#ifdef TMK_DESKTOP_ACTION_CACHE
+/**
+ * @brief 解決したアクションのキャッシュの統計
+ *
+ * hit_countを参照の総数 (hit_countとmiss_countの和) で割ると命中率になる。
+ */
+struct ActionCacheStats {
+  uint64_t hit_count = 0;       ///< キャッシュから返した回数
+  uint64_t miss_count = 0;      ///< レイヤーを辿って解決し直した回数
+  uint64_t eviction_count = 0;  ///< 溢れたためにレイヤーの状態を捨てた回数
+};
+
+/**
+ * @brief 解決したアクションのキャッシュの統計を取得する
+ *
+ * TMK_DESKTOP_ACTION_CACHEを定義したときのみ使える。
+ *
+ * @return 現在の統計
+ */
+ActionCacheStats get_action_cache_stats() noexcept;
+#endif
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+/**
+ * @brief Keyboardを通る間の遅延の統計
+ */
+struct KeyboardLatencyStats {
+  LatencySnapshot capture;   ///< 入力をフックで受け取ってから、キューに積むまで
+  LatencySnapshot queue;     ///< キューに積んでから、取り出すまで
+  LatencySnapshot dispatch;  ///< キューから取り出してから、TMKの処理に入るまで
+  LatencySnapshot task;      ///< 入力によるTMKの処理に入ってから、出るまで。TMKを介さずに送信したときも含む
+  LatencySnapshot tick;      ///< 時間経過によるTMKの処理 (タップ判定の時間切れやマウスキー) に入ってから、出るまで
+};
+
+/**
+ * @brief Keyboardを通る間の遅延の統計を取得する
+ *
+ * TMK_DESKTOP_LATENCY_HISTOGRAMSを定義したときのみ使える。どのスレッドからでも呼び出せる。
+ *
+ * @return 現在の統計
+ */
+KeyboardLatencyStats get_keyboard_latency_stats() noexcept;
+#endif
+
 /**
  * @brief Keyboardが異常停止したときに呼ばれる関数
  *
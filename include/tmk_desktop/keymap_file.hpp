@@ -0,0 +1,307 @@
+/**
+ * @file keymap_file.hpp
+ * @brief バイナリ形式のキーマップファイル
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * キーマップファイルは、レイヤーごとのアクションの表、key_to_keypos_table、tapping_key_table、マクロをまとめたものである。
+ * エンジンはファイルをメモリにマップして読み込むときに一度だけ検証し、以降は複製も変換もせずにそのまま参照する。
+ * ファイルはtools/keymap_compilerでテキストから作る。
+ *
+ * ファイルの構成は以下の通りで、値はすべてリトルエンディアンで格納する。
+ * - KeymapFileHeader
+ * - アクションの表：uint16_t[layer_count][rows][cols]
+ * - キーからキーの位置への変換表：uint8_t[key_count][2] (col、rowの順)。対応がなければ0xff
+ * - 押すと同時に離すと解釈するかどうかのフラグ列：uint8_t[key_count]
+ * - マクロの位置：uint32_t[macro_count] (マクロ本体の先頭からのオフセット)。マクロがなければKEYMAP_FILE_NO_MACRO
+ * - マクロ本体：TMKのマクロのバイト列を並べたもの。キーを押したときに再生し、離したときには何もしない
+ */
+#pragma once
+
+#include <array>
+#include <bit>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "settings.hpp"
+
+extern "C" {
+#include <common/keyboard.h>
+#include <common/action_code.h>
+#include <common/action_macro.h>
+}  // extern "C"
+
+namespace tmk_desktop {
+static_assert(std::endian::native == std::endian::little, "keymap files are read in place as little endian");
+
+static constexpr std::array<char, 4> KEYMAP_FILE_MAGIC{'T', 'K', 'M', 'F'};  ///< ファイルの先頭に置く識別子
+static constexpr uint16_t KEYMAP_FILE_VERSION = 1;                           ///< ファイル形式のバージョン
+static constexpr uint32_t KEYMAP_FILE_NO_MACRO = 0xffffffff;                 ///< マクロがないことを示すオフセット
+static constexpr size_t KEYMAP_FILE_MAX_LAYER_COUNT = 32;                    ///< レイヤー数の上限
+
+/**
+ * @brief キーマップファイルのヘッダ
+ *
+ * オフセットはファイルの先頭からのバイト数で表す。
+ */
+struct KeymapFileHeader {
+  std::array<char, 4> magic;    ///< KEYMAP_FILE_MAGIC
+  uint16_t version;             ///< KEYMAP_FILE_VERSION
+  uint16_t layer_count;         ///< レイヤー数
+  uint16_t rows;                ///< 仮想キーボードの行数。MATRIX_ROWSと一致すること
+  uint16_t cols;                ///< 仮想キーボードの列数。MATRIX_COLSと一致すること
+  uint32_t key_count;           ///< 物理キーボードのキーの個数。KEY_COUNTと一致すること
+  uint32_t macro_count;         ///< マクロの個数
+  uint32_t actions_offset;      ///< アクションの表の位置
+  uint32_t keypos_offset;       ///< キーからキーの位置への変換表の位置
+  uint32_t tapping_offset;      ///< 押すと同時に離すと解釈するかどうかのフラグ列の位置
+  uint32_t macro_table_offset;  ///< マクロの位置の表の位置
+  uint32_t macro_data_offset;   ///< マクロ本体の位置
+  uint32_t macro_data_size;     ///< マクロ本体の大きさ
+  uint32_t file_size;           ///< ファイル全体の大きさ
+  uint32_t checksum;            ///< ヘッダより後ろのバイト列のFNV-1aハッシュ値
+};
+static_assert(sizeof(KeymapFileHeader) == 52);
+
+/**
+ * @brief キーマップファイルのチェックサムを計算する
+ *
+ * @param bytes ヘッダより後ろのバイト列
+ * @return FNV-1aハッシュ値
+ */
+inline uint32_t compute_keymap_file_checksum(std::span<const std::byte> bytes) noexcept {
+  uint32_t hash = 2166136261u;
+  for (auto byte : bytes) {
+    hash = (hash ^ static_cast<uint8_t>(byte)) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief 検証済みのキーマップファイルを参照するクラス
+ *
+ * バイト列を所有しないので、参照している間はバイト列を生存させること。
+ */
+class KeymapFileView final {
+public:
+  KeymapFileView() = default;
+
+  /**
+   * @brief バイト列がキーマップファイルとして正しいかどうかを調べる
+   *
+   * 仮想キーボードの大きさとキーの個数は、ビルドした設定と一致しなければならない。
+   * マクロは終端までバイト列に収まっていなければならない。
+   *
+   * @param bytes ファイルの内容
+   * @return 誤りの内容。正しければnullptr
+   */
+  static const char* validate(std::span<const std::byte> bytes) noexcept {
+    if (bytes.size() < sizeof(KeymapFileHeader)) return "file is too small";
+    KeymapFileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != KEYMAP_FILE_MAGIC) return "not a keymap file";
+    if (header.version != KEYMAP_FILE_VERSION) return "unsupported version";
+    if (header.file_size != bytes.size()) return "file size mismatch";
+    if (header.layer_count == 0 || header.layer_count > KEYMAP_FILE_MAX_LAYER_COUNT) return "invalid layer count";
+    if (header.rows != MATRIX_ROWS || header.cols != MATRIX_COLS) return "matrix size mismatch";
+    if (header.key_count != KEY_COUNT) return "key count mismatch";
+
+    const size_t action_count = size_t{header.layer_count} * MATRIX_ROWS * MATRIX_COLS;
+    if (!is_within(bytes, header.actions_offset, action_count * sizeof(uint16_t), alignof(uint16_t))) return "actions out of range";
+    if (!is_within(bytes, header.keypos_offset, KEY_COUNT * 2, 1)) return "key positions out of range";
+    if (!is_within(bytes, header.tapping_offset, KEY_COUNT, 1)) return "tapping keys out of range";
+    if (!is_within(bytes, header.macro_table_offset, size_t{header.macro_count} * sizeof(uint32_t), alignof(uint32_t))) {
+      return "macro table out of range";
+    }
+    if (!is_within(bytes, header.macro_data_offset, header.macro_data_size, 1)) return "macros out of range";
+
+    const auto payload = bytes.subspan(sizeof(KeymapFileHeader));
+    if (compute_keymap_file_checksum(payload) != header.checksum) return "checksum mismatch";
+
+    const auto* keyposes = reinterpret_cast<const uint8_t*>(bytes.data() + header.keypos_offset);
+    for (size_t key = 0; key < KEY_COUNT; ++key) {
+      const uint8_t col = keyposes[key * 2];
+      const uint8_t row = keyposes[key * 2 + 1];
+      if (col == 0xff && row == 0xff) continue;
+      if (col >= MATRIX_COLS || row >= MATRIX_ROWS) return "key position out of matrix";
+    }
+
+    const auto macro_data = bytes.subspan(header.macro_data_offset, header.macro_data_size);
+    const auto* macro_table = reinterpret_cast<const uint32_t*>(bytes.data() + header.macro_table_offset);
+    for (size_t id = 0; id < header.macro_count; ++id) {
+      if (macro_table[id] == KEYMAP_FILE_NO_MACRO) continue;
+      if (!is_terminated_macro(macro_data, macro_table[id])) return "unterminated macro";
+    }
+    return nullptr;
+  }
+
+  /**
+   * @param bytes validate()で検証済みのファイルの内容
+   */
+  explicit KeymapFileView(std::span<const std::byte> bytes) noexcept {
+    KeymapFileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    layer_count_ = header.layer_count;
+    macro_count_ = header.macro_count;
+    actions_ = reinterpret_cast<const uint16_t*>(bytes.data() + header.actions_offset);
+    keyposes_ = reinterpret_cast<const uint8_t*>(bytes.data() + header.keypos_offset);
+    tapping_keys_ = reinterpret_cast<const uint8_t*>(bytes.data() + header.tapping_offset);
+    macro_table_ = reinterpret_cast<const uint32_t*>(bytes.data() + header.macro_table_offset);
+    macro_data_ = reinterpret_cast<const macro_t*>(bytes.data() + header.macro_data_offset);
+  }
+
+  /**
+   * @brief レイヤーとキーの位置からアクションを取得する
+   *
+   * 範囲外ならACTION_NOを返す。
+   */
+  action_t action(uint8_t layer, keypos_t pos) const noexcept {
+    if (layer >= layer_count_ || pos.row >= MATRIX_ROWS || pos.col >= MATRIX_COLS) return ACTION_NO;
+    return action_t{.code = actions_[(size_t{layer} * MATRIX_ROWS + pos.row) * MATRIX_COLS + pos.col]};
+  }
+
+  /**
+   * @brief キーからキーの位置を取得する
+   *
+   * 対応がなければ{0xff, 0xff}を返す。
+   */
+  keypos_t keypos(Key key) const noexcept {
+    if (key >= KEY_COUNT) return keypos_t{0xff, 0xff};
+    return keypos_t{.col = keyposes_[key * 2], .row = keyposes_[key * 2 + 1]};
+  }
+
+  /**
+   * @brief キーを押すと同時に離すと解釈するかどうかを調べる
+   */
+  bool is_tapping_key(Key key) const noexcept {
+    return key < KEY_COUNT && tapping_keys_[key] != 0;
+  }
+
+  /**
+   * @brief マクロを取得する
+   *
+   * @return マクロのバイト列。なければMACRO_NONE
+   */
+  const macro_t* macro(uint8_t id) const noexcept {
+    if (id >= macro_count_ || macro_table_[id] == KEYMAP_FILE_NO_MACRO) return MACRO_NONE;
+    return macro_data_ + macro_table_[id];
+  }
+
+  /**
+   * @brief レイヤー数を取得する
+   */
+  size_t layer_count() const noexcept {
+    return layer_count_;
+  }
+
+private:
+  /**
+   * @brief 領域がバイト列に収まり、整列しているかどうかを調べる
+   */
+  static bool is_within(std::span<const std::byte> bytes, size_t offset, size_t size, size_t alignment) noexcept {
+    return offset >= sizeof(KeymapFileHeader) && offset % alignment == 0 && offset <= bytes.size() && size <= bytes.size() - offset;
+  }
+
+  /**
+   * @brief マクロが終端までバイト列に収まっているかどうかを調べる
+   *
+   * 引数を取るコマンドは引数も収まっていること。
+   */
+  static bool is_terminated_macro(std::span<const std::byte> data, size_t offset) noexcept {
+    while (offset < data.size()) {
+      const auto macro = static_cast<macro_t>(data[offset++]);
+      switch (macro) {
+        case KEY_DOWN:
+        case KEY_UP:
+        case WAIT:
+        case INTERVAL:
+          offset++;
+          break;
+        case MOD_STORE:
+        case MOD_RESTORE:
+        case MOD_CLEAR:
+          break;
+        default:
+          if ((0x04 <= macro && macro <= 0x73) || (0x84 <= macro && macro <= 0xF3)) break;
+          return true;
+      }
+    }
+    return false;
+  }
+
+  size_t layer_count_ = 0;                 ///< レイヤー数
+  size_t macro_count_ = 0;                 ///< マクロの個数
+  const uint16_t* actions_ = nullptr;      ///< アクションの表
+  const uint8_t* keyposes_ = nullptr;      ///< キーからキーの位置への変換表
+  const uint8_t* tapping_keys_ = nullptr;  ///< 押すと同時に離すと解釈するかどうかのフラグ列
+  const uint32_t* macro_table_ = nullptr;  ///< マクロの位置の表
+  const macro_t* macro_data_ = nullptr;    ///< マクロ本体
+};
+
+#ifdef TMK_DESKTOP_KEYMAP_FILE
+/**
+ * @brief キーマップファイルの統計
+ */
+struct KeymapFileStats {
+  uint64_t load_count = 0;         ///< 読み込んで切り替えた回数
+  uint64_t rejected_count = 0;     ///< 誤りがあって読み込まなかった回数
+  uint64_t last_load_time_ns = 0;  ///< 最後の読み込みにかかった時間 (マップ、検証、切り替えの合計)
+};
+
+/**
+ * @brief キーマップファイルを読み込み、キーボードのキーマップを切り替える
+ *
+ * Keyboardスレッドは切り替えを待たずに処理を続け、次のイベントから新しいキーマップを使う。
+ * 古いキーマップは、Keyboardスレッドが参照し終えたのを確かめてから解放する。
+ * 読み込みに失敗したときは、それまでのキーマップを使い続ける。
+ * ファイルはマップしたまま参照するので、書き換えるときは別のファイルに書いてから置き換えること。
+ * Keyboardスレッド以外から呼び出すこと。
+ *
+ * @param path ファイルのパス
+ * @exception system_error ファイルを開けないかマップできない
+ * @exception runtime_error ファイルの内容に誤りがある
+ */
+void load_keymap_file(const char* path);
+
+/**
+ * @brief キーマップファイルを手放し、キーマップライブラリのキーマップに戻す
+ *
+ * Keyboardスレッド以外から呼び出すこと。
+ */
+void unload_keymap_file() noexcept;
+
+/**
+ * @brief キーマップファイルを監視し、変更されるたびに読み込み直す
+ *
+ * 監視用のスレッドがファイルの更新時刻と大きさを定期的に調べる。
+ * 監視を始めた時点でも読み込みを試みる。読み込みに失敗したときは統計に数え、ファイルが再び変わるまで待つ。
+ *
+ * @param path ファイルのパス
+ * @param interval_ms 調べる間隔 [ms]
+ * @retval true 監視を始めた
+ * @retval false すでに監視している
+ * @exception system_error スレッドの生成に失敗
+ */
+bool watch_keymap_file(const char* path, uint32_t interval_ms = 200);
+
+/**
+ * @brief キーマップファイルの監視をやめる
+ *
+ * 読み込んだキーマップはそのまま使い続ける。
+ *
+ * @retval true 監視をやめた
+ * @retval false 監視していない
+ */
+bool unwatch_keymap_file();
+
+/**
+ * @brief キーマップファイルの統計を取得する
+ *
+ * TMK_DESKTOP_KEYMAP_FILEを定義したときのみ使える。
+ *
+ * @return 現在の統計
+ */
+KeymapFileStats get_keymap_file_stats() noexcept;
+#endif
+}  // namespace tmk_desktop
@@ -0,0 +1,114 @@
+/**
+ * @file keymap_plugin.h
+ * @brief キーマッププラグインのC ABI
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * キーマッププラグインは、キーマップを実行中に差し替えられる共有ライブラリである。
+ * tmk_desktop_get_keymap_plugin()を公開し、キーマップの関数と変換表をまとめた記述子を返す。
+ * プラグインからはTMKの関数 (layer_on()やregister_code()など) をそのまま呼び出せる。これらは実行ファイルが公開する。
+ * ただし、読み込みはKeyboardスレッドを止めずに行うので、静的変数の初期化でTMKの状態に触れてはならない。
+ *
+ * 記述子はABIのバージョンと構造体の大きさで照合する。
+ * 仮想キーボードの大きさとキーの個数は、エンジンのビルドした設定と一致しなければならない。
+ */
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <common/keyboard.h>
+#include <common/action.h>
+#include <common/action_macro.h>
+
+/**
+ * @brief 記述子のABIのバージョン
+ *
+ * 記述子の既存のメンバを変えたときに上げる。末尾にメンバを足すときはsizeで見分ける。
+ */
+#define TMK_DESKTOP_KEYMAP_PLUGIN_ABI_VERSION 1
+
+/**
+ * @brief 記述子を返す関数の名前
+ */
+#define TMK_DESKTOP_KEYMAP_PLUGIN_ENTRY_NAME "tmk_desktop_get_keymap_plugin"
+
+/**
+ * @brief プラグインが関数を公開するための指定
+ */
+#ifdef _WIN32
+#define TMK_DESKTOP_KEYMAP_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define TMK_DESKTOP_KEYMAP_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+/**
+ * @brief キーマッププラグインの記述子
+ *
+ * 関数はすべてKeyboardスレッドか、Keyboardスレッドを止めている間に呼び出される。
+ */
+typedef struct tmk_desktop_keymap_plugin {
+  uint32_t abi_version;  ///< TMK_DESKTOP_KEYMAP_PLUGIN_ABI_VERSION
+  uint32_t size;         ///< sizeof(tmk_desktop_keymap_plugin_t)
+  uint16_t matrix_rows;  ///< MATRIX_ROWS
+  uint16_t matrix_cols;  ///< MATRIX_COLS
+  uint32_t key_count;    ///< KEY_COUNT
+
+  const keypos_t* key_to_keypos_table;  ///< キーからkeypos_tへの変換表 (KEY_COUNT個)
+  const bool* tapping_key_table;        ///< キーを押すと同時に離すと解釈するかどうかのフラグ列 (KEY_COUNT個)
+
+  /**
+   * @brief プラグインを初期化する
+   *
+   * Keyboardスレッドを止めた後、古いプラグインを片付ける前に呼ばれる。0以外を返すと差し替えを取りやめる。NULLでもよい。
+   */
+  int (*init)(void);
+
+  /**
+   * @brief プラグインを片付ける
+   *
+   * 別のプラグインに差し替えたときか、プラグインを手放すときに呼ばれる。initが失敗したときは呼ばれない。NULLでもよい。
+   */
+  void (*deinit)(void);
+
+  action_t (*action_for_key)(uint8_t layer, keypos_t key);                           ///< TMKのaction_for_key()
+  const macro_t* (*action_get_macro)(keyrecord_t* record, uint8_t id, uint8_t opt);  ///< TMKのaction_get_macro()。NULLでもよい
+  void (*action_function)(keyrecord_t* record, uint8_t id, uint8_t opt);             ///< TMKのaction_function()。NULLでもよい
+} tmk_desktop_keymap_plugin_t;
+
+/**
+ * @brief 記述子を返す関数の型
+ *
+ * 返した記述子はプラグインを手放すまで有効であること。
+ */
+typedef const tmk_desktop_keymap_plugin_t* (*tmk_desktop_keymap_plugin_entry_t)(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+
+namespace tmk_desktop {
+/**
+ * @brief キーマップをプラグインとして作ったときに、初期化のために呼ばれる関数
+ *
+ * src/keymap_plugin_entry.cppを使うときは、キーマップ側で定義する。
+ *
+ * @retval true 初期化に成功
+ * @retval false 初期化に失敗。差し替えを取りやめる
+ */
+bool init_keymap_plugin() noexcept;
+
+/**
+ * @brief キーマップをプラグインとして作ったときに、片付けのために呼ばれる関数
+ *
+ * src/keymap_plugin_entry.cppを使うときは、キーマップ側で定義する。
+ */
+void deinit_keymap_plugin() noexcept;
+}  // namespace tmk_desktop
+#endif
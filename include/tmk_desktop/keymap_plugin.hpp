@@ -0,0 +1,59 @@
+/**
+ * @file keymap_plugin.hpp
+ * @brief キーマッププラグインの読み込みと差し替え
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * キーマッププラグインはaction_for_key()、action_get_macro()、action_function()と変換表をまとめて差し替える。
+ * キーマップファイルと違って任意のコードを実行できる代わりに、差し替えの間はKeyboardスレッドを止める。
+ * プラグインのC ABIはkeymap_plugin.hで定義する。
+ */
+#pragma once
+
+#include <cstdint>
+#include "keymap_plugin.h"
+
+namespace tmk_desktop {
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+/**
+ * @brief キーマッププラグインの統計
+ */
+struct KeymapPluginStats {
+  uint64_t load_count = 0;         ///< 読み込んで差し替えた回数
+  uint64_t rollback_count = 0;     ///< 初期化に失敗して差し替えを取りやめた回数
+  uint64_t last_swap_time_ns = 0;  ///< 最後の差し替えでKeyboardスレッドを止めた時間
+  uint64_t max_swap_time_ns = 0;   ///< 差し替えでKeyboardスレッドを止めた時間の最大値
+};
+
+/**
+ * @brief キーマッププラグインを読み込み、キーボードのキーマップを差し替える
+ *
+ * 読み込みと記述子の照合はKeyboardスレッドを止めずに行う。
+ * その後、Keyboardスレッドがkeyboard_task()の合間に止まるのを待ち、新しいプラグインを初期化してから差し替える。
+ * 初期化に失敗したときは差し替えを取りやめ、それまでのキーマップを使い続ける。
+ * 押しているキーとレイヤーの状態は引き継ぐ。
+ * Keyboardスレッド以外から呼び出すこと。
+ *
+ * @param path プラグインのパス
+ * @exception system_error プラグインを読み込めない
+ * @exception runtime_error 記述子がエンジンと合わないか、初期化に失敗した
+ */
+void load_keymap_plugin(const char* path);
+
+/**
+ * @brief キーマッププラグインを手放し、キーマップライブラリのキーマップに戻す
+ *
+ * Keyboardスレッド以外から呼び出すこと。
+ */
+void unload_keymap_plugin() noexcept;
+
+/**
+ * @brief キーマッププラグインの統計を取得する
+ *
+ * TMK_DESKTOP_KEYMAP_PLUGINを定義したときのみ使える。
+ *
+ * @return 現在の統計
+ */
+KeymapPluginStats get_keymap_plugin_stats() noexcept;
+#endif
+}  // namespace tmk_desktop
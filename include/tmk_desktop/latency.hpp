@@ -0,0 +1,189 @@
+/**
+ * @file latency.hpp
+ * @brief パイプラインの遅延の分布
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "clock.hpp"
+#include "counter.hpp"
+
+namespace tmk_desktop {
+/**
+ * @brief 遅延の分布を要約したもの
+ *
+ * 百分位数は値の属する区間の上端で表すので、実際の値より最大で1/LatencyHistogram::SUB_BUCKET_COUNTだけ大きい。
+ */
+struct LatencySnapshot {
+  uint64_t count;    ///< 記録した回数
+  uint64_t mean_ns;  ///< 平均値 [ns]
+  uint64_t p50_ns;   ///< 50パーセンタイル [ns]
+  uint64_t p99_ns;   ///< 99パーセンタイル [ns]
+  uint64_t p999_ns;  ///< 99.9パーセンタイル [ns]
+  uint64_t max_ns;   ///< 最大値 [ns]
+};
+
+/**
+ * @brief 遅延の分布を記録する対数線形のヒストグラム
+ *
+ * 2のべき乗ごとの区間をさらにSUB_BUCKET_COUNT等分し、どの大きさの値も相対誤差1/SUB_BUCKET_COUNT以内で数える。
+ * 区間の番号は値の上位ビットだけで決まるので、記録は数命令とカウンタ1つの更新で済む。
+ * record()は単一のスレッドのみが、snapshot()はどのスレッドからでも呼び出せる。
+ */
+class LatencyHistogram final {
+public:
+  static constexpr size_t SUB_BUCKET_BITS = 4;                                                   ///< 2のべき乗ごとの分割数のビット数
+  static constexpr size_t SUB_BUCKET_COUNT = size_t{1} << SUB_BUCKET_BITS;                       ///< 2のべき乗ごとの分割数
+  static constexpr size_t VALUE_BITS = 36;                                                       ///< 記録できる値のビット数 (約68秒)
+  static constexpr size_t BUCKET_COUNT = (VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;  ///< 区間の数
+  static constexpr uint64_t MAX_VALUE = (uint64_t{1} << VALUE_BITS) - 1;                         ///< 記録できる最大値。超えた値はこれとして数える
+
+  /**
+   * @brief 値を記録する
+   *
+   * @param ns 遅延 [ns]
+   */
+  void record(uint64_t ns) noexcept {
+    increment(buckets_[bucket_of(std::min(ns, MAX_VALUE))]);
+    increment(sum_ns_, ns);
+    if (ns > max_ns_.load(std::memory_order_relaxed)) max_ns_.store(ns, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 2つの時刻の間隔を記録する
+   *
+   * 時刻が前後しているときは0として記録する。
+   */
+  void record(Clock::time_point from, Clock::time_point to) noexcept {
+    record(to > from ? static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()) : 0);
+  }
+
+  /**
+   * @brief 現在の分布を要約する
+   *
+   * 記録と並行して呼び出したときは、途中の記録を含むことも含まないこともある。
+   */
+  LatencySnapshot snapshot() const noexcept {
+    std::array<uint64_t, BUCKET_COUNT> counts;
+    uint64_t count = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      count += counts[i];
+    }
+    const uint64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+    const auto percentile = [&](uint64_t numerator, uint64_t denominator) -> uint64_t {
+      if (count == 0) return 0;
+      // 順位がrank以上になる最初の区間を探す
+      const uint64_t rank = std::max<uint64_t>((count * numerator + denominator - 1) / denominator, 1);
+      uint64_t seen = 0;
+      for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen >= rank) return std::min(upper_bound_of(i), max_ns);
+      }
+      return max_ns;
+    };
+    return {
+        .count = count,
+        .mean_ns = count == 0 ? 0 : sum_ns_.load(std::memory_order_relaxed) / count,
+        .p50_ns = percentile(50, 100),
+        .p99_ns = percentile(99, 100),
+        .p999_ns = percentile(999, 1000),
+        .max_ns = max_ns,
+    };
+  }
+
+  /**
+   * @brief 値が属する区間の番号を求める
+   */
+  static constexpr size_t bucket_of(uint64_t ns) noexcept {
+    if (ns < 2 * SUB_BUCKET_COUNT) return static_cast<size_t>(ns);
+    // 上位SUB_BUCKET_BITS+1ビットを取り出し、桁数ごとにSUB_BUCKET_COUNT個ずつ区間を割り当てる
+    const auto shift = static_cast<size_t>(std::bit_width(ns)) - SUB_BUCKET_BITS - 1;
+    return shift * SUB_BUCKET_COUNT + static_cast<size_t>(ns >> shift);
+  }
+
+  /**
+   * @brief 区間に属する最小の値を求める
+   */
+  static constexpr uint64_t lower_bound_of(size_t bucket) noexcept {
+    if (bucket < 2 * SUB_BUCKET_COUNT) return bucket;
+    const size_t shift = bucket / SUB_BUCKET_COUNT - 1;
+    return static_cast<uint64_t>(SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+  }
+
+  /**
+   * @brief 区間に属する最大の値を求める
+   */
+  static constexpr uint64_t upper_bound_of(size_t bucket) noexcept {
+    if (bucket + 1 == BUCKET_COUNT) return MAX_VALUE;
+    return lower_bound_of(bucket + 1) - 1;
+  }
+
+private:
+  std::atomic<uint64_t> sum_ns_{0};                            ///< 値の合計 [ns]
+  std::atomic<uint64_t> max_ns_{0};                            ///< 最大値 [ns]
+  std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};  ///< 区間ごとの回数
+};
+
+static_assert(LatencyHistogram::bucket_of(LatencyHistogram::MAX_VALUE) + 1 == LatencyHistogram::BUCKET_COUNT);
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+/**
+ * @brief キューに積んだイベントに添える時刻
+ */
+struct LatencyStamp {
+  Clock::time_point captured;  ///< 元になった入力をフックで受け取った時刻。時間経過による処理で生じたときはClock::time_point{}
+  Clock::time_point enqueued;  ///< キューに積んだ時刻
+};
+
+/**
+ * @brief 時刻を添えたイベント
+ */
+template <typename Event>
+struct Stamped {
+  Event event;         ///< イベント
+  LatencyStamp stamp;  ///< 時刻
+};
+#endif
+
+/**
+ * @brief 処理中の入力をフックで受け取った時刻を設定するクラス
+ *
+ * Keyboardが入力を処理する間だけ設定し、その間にSinkへ送るイベントに引き継がせる。
+ * 設定するのも読むのもKeyboardのスレッドだけなので、アトミック変数にはしない。
+ */
+class ScopedCaptureTime final {
+public:
+  explicit ScopedCaptureTime(Clock::time_point tp) noexcept : prev_tp_(current_tp_) {
+    current_tp_ = tp;
+  }
+
+  ~ScopedCaptureTime() noexcept {
+    current_tp_ = prev_tp_;
+  }
+
+  ScopedCaptureTime(const ScopedCaptureTime&) = delete;
+  ScopedCaptureTime& operator=(const ScopedCaptureTime&) = delete;
+
+  /**
+   * @brief 処理中の入力をフックで受け取った時刻を取得する
+   *
+   * @return 設定された時刻。入力を処理していなければClock::time_point{}
+   */
+  static Clock::time_point current() noexcept {
+    return current_tp_;
+  }
+
+private:
+  static inline Clock::time_point current_tp_{};  ///< 処理中の入力をフックで受け取った時刻
+  Clock::time_point prev_tp_;                     ///< 設定する前の時刻
+};
+}  // namespace tmk_desktop
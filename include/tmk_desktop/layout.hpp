@@ -0,0 +1,123 @@
+/**
+ * @file layout.hpp
+ * @brief キーの配置とアクションをまとめて定義するための道具
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * キーマップでは、物理キーボードのキーと各レイヤーでのアクションを1つのKeyBindingとして並べる。
+ * Layoutはそれらからkey_to_keypos_table、tapping_key_table、レイヤーごとのアクションの表をコンパイル時に作る。
+ * キーは並べた順に仮想キーボードのキーに割り当てられる。
+ *
+ * 定義に誤りがあると、layout_error名前空間の関数を呼び出したことによるコンパイルエラーになる。
+ * エラーの内容は関数名で分かる。
+ */
+#pragma once
+
+#include <array>
+#include <initializer_list>
+#include <cstddef>
+#include <cstdint>
+#include "settings.hpp"
+
+extern "C" {
+#include <common/keyboard.h>
+#include <common/action_code.h>
+}  // extern "C"
+
+namespace tmk_desktop {
+/**
+ * @brief キーマップの誤りを報告する関数たち
+ *
+ * constexprではないので、定数式の評価中に呼び出されるとコンパイルエラーになる。定義はない。
+ */
+namespace layout_error {
+void wrong_number_of_layer_actions();  ///< レイヤー数とアクションの数が合わない
+void key_out_of_range();               ///< キーの値がKEY_COUNT以上か、キーを表さない0である
+void duplicate_key();                  ///< 同じキーが2回以上定義された
+void too_many_keys();                  ///< キーの数が仮想キーボードの大きさを超えた
+}  // namespace layout_error
+
+/**
+ * @brief 1つのキーの定義
+ *
+ * @tparam LayerCount レイヤー数
+ */
+template <size_t LayerCount>
+struct KeyBinding {
+  /**
+   * @param key 物理キーボードのキー
+   * @param actions レイヤー0から順に並べたアクション。レイヤー数と同じだけ必要
+   * @param tapping 押すと同時に離すと解釈するかどうか
+   */
+  consteval KeyBinding(Key key, std::initializer_list<action_t> actions, bool tapping = false) : key(key), tapping(tapping) {
+    if (actions.size() != LayerCount) layout_error::wrong_number_of_layer_actions();
+    for (size_t i = 0; auto action : actions) {
+      this->actions[i++] = action;
+    }
+  }
+
+  Key key{};                                 ///< 物理キーボードのキー
+  std::array<action_t, LayerCount> actions;  ///< レイヤーごとのアクション
+  bool tapping = false;                      ///< 押すと同時に離すと解釈するかどうか
+};
+
+/**
+ * @brief キーの定義から作った表
+ *
+ * @tparam LayerCount レイヤー数
+ * @tparam Rows 仮想キーボードの行数
+ * @tparam Cols 仮想キーボードの列数
+ */
+template <size_t LayerCount, size_t Rows = MATRIX_ROWS, size_t Cols = MATRIX_COLS>
+class Layout {
+public:
+  using Binding = KeyBinding<LayerCount>;
+  using ActionMap = std::array<std::array<action_t, Cols>, Rows>;
+
+  /**
+   * @param bindings キーの定義。並べた順に仮想キーボードのキーを割り当てる
+   */
+  consteval Layout(std::initializer_list<Binding> bindings) {
+    if (bindings.size() > Rows * Cols) layout_error::too_many_keys();
+
+    for (auto& keypos : key_to_keypos_table) {
+      keypos = keypos_t{0xff, 0xff};
+    }
+    for (auto& actionmap : actionmaps) {
+      for (auto& row : actionmap) {
+        for (auto& action : row) {
+          action = ACTION_NO;
+        }
+      }
+    }
+
+    for (size_t i = 0; const auto& binding : bindings) {
+      if (binding.key >= KEY_COUNT || binding.key == Key{}) layout_error::key_out_of_range();
+      if (key_to_keypos_table[binding.key].row != 0xff) layout_error::duplicate_key();
+
+      const auto row = static_cast<uint8_t>(i / Cols);
+      const auto col = static_cast<uint8_t>(i % Cols);
+      key_to_keypos_table[binding.key] = keypos_t{.col = col, .row = row};
+      tapping_key_table[binding.key] = binding.tapping;
+      for (size_t layer = 0; layer < LayerCount; ++layer) {
+        actionmaps[layer][row][col] = binding.actions[layer];
+      }
+      i++;
+    }
+  }
+
+  /**
+   * @brief レイヤーとキーの位置からアクションを取得する
+   *
+   * action_for_key()からそのまま呼び出せる。範囲外ならACTION_NOを返す。
+   */
+  constexpr action_t action(uint8_t layer, keypos_t pos) const noexcept {
+    if (layer >= LayerCount || pos.row >= Rows || pos.col >= Cols) return ACTION_NO;
+    return actionmaps[layer][pos.row][pos.col];
+  }
+
+  KeyToKeyposTable key_to_keypos_table{};          ///< キーからkeypos_tへの変換表
+  TappingKeyTable tapping_key_table{};             ///< 押すと同時に離すと解釈するかどうかのフラグ列
+  std::array<ActionMap, LayerCount> actionmaps{};  ///< レイヤーごとのアクションの表
+};
+}  // namespace tmk_desktop
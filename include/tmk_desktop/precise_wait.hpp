@@ -0,0 +1,204 @@
+/**
+ * @file precise_wait.hpp
+ * @brief 期限までの精密な待機
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include "clock.hpp"
+#include "counter.hpp"
+#include "wait_policy.hpp"
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <time.h>
+#endif
+
+#if defined(_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+namespace tmk_desktop {
+/**
+ * @brief 精密な待機の統計
+ */
+struct PreciseWaitStats {
+  static constexpr size_t BUCKET_COUNT = 16;  ///< 超過時間の分布の区間の数
+
+  uint64_t wait_count;        ///< 待機した回数
+  uint64_t sleep_count;       ///< スレッドを眠らせた回数
+  uint64_t max_overshoot_ns;  ///< 期限を超過した時間の最大値 [ns]
+
+  /**
+   * @brief 期限を超過した時間の分布
+   *
+   * [0]は1マイクロ秒未満、[i]は2^(i-1)以上2^iマイクロ秒未満の回数を表す。最後の区間はそれ以上をすべて含む。
+   */
+  std::array<uint64_t, BUCKET_COUNT> overshoot_histogram;
+};
+
+/**
+ * @brief 呼び出したスレッドのタイマースラックを最小にする
+ *
+ * Linuxは眠ったスレッドを起こす時刻をタイマースラック (既定では50マイクロ秒) の範囲で遅らせ、他のタイマーとまとめる。
+ * これを最小にすると、期限付きで眠ったスレッドが期限の直後に起きるようになる。Linux以外では何もしない。
+ *
+ * @retval true 設定に成功した
+ * @retval false 設定できなかった
+ */
+inline bool reduce_timer_slack() noexcept {
+#ifdef __linux__
+  // 0は既定値に戻す意味になるので、1ナノ秒を指定する
+  return ::prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) == 0;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief 期限までスレッドを眠らせる
+ *
+ * LinuxではCLOCK_MONOTONICの絶対時刻で眠り、割り込まれても期限まで眠り直す。
+ * steady_clockはCLOCK_MONOTONICを読むので、Clockの時刻をそのまま渡せる。
+ * Windowsでは、使えれば高分解能の待機可能タイマー (Windows 10 1803以降) で眠る。
+ */
+inline void sleep_until(Clock::time_point deadline) noexcept {
+#ifdef __linux__
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+  const timespec ts{
+      .tv_sec = static_cast<time_t>(ns / 1'000'000'000),
+      .tv_nsec = static_cast<long>(ns % 1'000'000'000),
+  };
+  while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+  }
+#elif defined(_WIN32)
+  /**
+   * @brief スレッドごとの待機可能タイマー
+   */
+  struct WaitableTimer {
+    HANDLE handle = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+    ~WaitableTimer() noexcept {
+      if (handle) CloseHandle(handle);
+    }
+  };
+  thread_local const WaitableTimer timer;
+
+  const auto remaining = std::chrono::duration_cast<std::chrono::duration<LONGLONG, std::ratio<1, 10'000'000>>>(deadline - Clock::now());
+  if (remaining.count() <= 0) return;
+  if (timer.handle) {
+    // 負の値は相対時間を表す
+    LARGE_INTEGER due_time;
+    due_time.QuadPart = -remaining.count();
+    if (SetWaitableTimer(timer.handle, &due_time, 0, nullptr, nullptr, FALSE)) {
+      WaitForSingleObject(timer.handle, INFINITE);
+      return;
+    }
+  }
+  std::this_thread::sleep_until(deadline);
+#else
+  std::this_thread::sleep_until(deadline);
+#endif
+}
+
+/**
+ * @brief 期限まで精密に待機するクラス
+ *
+ * 期限のSPIN_TAILだけ前まで眠り、残りはスピンして待つ。眠りすぎる分をスピンで吸収するので、期限の超過は数マイクロ秒に収まる。
+ * 待機するスレッドでは初回にreduce_timer_slack()を呼び出し、眠りすぎる時間そのものも減らす。
+ * wait_until()は単一のスレッドのみが、stats()はどのスレッドからでも呼び出せる。
+ */
+class PreciseWaiter final {
+public:
+  /**
+   * @brief 眠らずにスピンして待つ時間
+   *
+   * Linuxはタイマースラックを減らせば数十マイクロ秒以内に起きる。Windowsは高分解能のタイマーでも0.5ミリ秒ほど遅れるので長めに取る。
+   */
+#ifdef _WIN32
+  static constexpr auto SPIN_TAIL = std::chrono::milliseconds(1);
+#else
+  static constexpr auto SPIN_TAIL = std::chrono::microseconds(100);
+#endif
+
+  /**
+   * @brief 期限まで待機する
+   *
+   * @param deadline 期限
+   */
+  void wait_until(Clock::time_point deadline) noexcept {
+    thread_local const bool slack_reduced = reduce_timer_slack();
+    static_cast<void>(slack_reduced);
+
+    increment(wait_count_);
+    if (Clock::now() < deadline - SPIN_TAIL) {
+      increment(sleep_count_);
+      sleep_until(deadline - SPIN_TAIL);
+    }
+    auto now = Clock::now();
+    while (now < deadline) {
+      cpu_relax();
+      now = Clock::now();
+    }
+    record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline).count()));
+  }
+
+  /**
+   * @brief 指定の時間だけ待機する
+   *
+   * @param duration 待機する時間
+   */
+  template <typename Rep, typename Period>
+  void wait_for(std::chrono::duration<Rep, Period> duration) noexcept {
+    wait_until(Clock::now() + std::chrono::duration_cast<Clock::duration>(duration));
+  }
+
+  /**
+   * @brief 統計を取得する
+   */
+  PreciseWaitStats stats() const noexcept {
+    PreciseWaitStats stats{
+        .wait_count = wait_count_.load(std::memory_order_relaxed),
+        .sleep_count = sleep_count_.load(std::memory_order_relaxed),
+        .max_overshoot_ns = max_overshoot_ns_.load(std::memory_order_relaxed),
+        .overshoot_histogram = {},
+    };
+    for (size_t i = 0; i < PreciseWaitStats::BUCKET_COUNT; ++i) {
+      stats.overshoot_histogram[i] = overshoot_histogram_[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+private:
+  /**
+   * @brief 期限を超過した時間を記録する
+   */
+  void record(uint64_t overshoot_ns) noexcept {
+    const auto bucket = std::min<size_t>(std::bit_width(overshoot_ns / 1'000), PreciseWaitStats::BUCKET_COUNT - 1);
+    increment(overshoot_histogram_[bucket]);
+    if (overshoot_ns > max_overshoot_ns_.load(std::memory_order_relaxed)) {
+      max_overshoot_ns_.store(overshoot_ns, std::memory_order_relaxed);
+    }
+  }
+
+  std::atomic<uint64_t> wait_count_{0};                                                      ///< 待機した回数
+  std::atomic<uint64_t> sleep_count_{0};                                                     ///< 眠らせた回数
+  std::atomic<uint64_t> max_overshoot_ns_{0};                                                ///< 超過時間の最大値 [ns]
+  std::array<std::atomic<uint64_t>, PreciseWaitStats::BUCKET_COUNT> overshoot_histogram_{};  ///< 超過時間の分布
+};
+
+/**
+ * @brief TMKの待機関数 (wait_ms()とwait_us()) の統計を取得する
+ */
+PreciseWaitStats get_precise_wait_stats() noexcept;
+}  // namespace tmk_desktop
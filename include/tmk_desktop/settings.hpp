@@ -0,0 +1,15 @@
+/**
+ * @file settings.hpp
+ * @brief 設定を注入するためのインターフェイス
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#if defined(TMK_DESKTOP_HEADLESS)
+#include "headless/settings.hpp"
+#elif defined(TMK_DESKTOP_EVDEV)
+#include "evdev/settings.hpp"
+#elif defined(_WIN32)
+#include "win32/settings.hpp"
+#endif
@@ -7,9 +7,12 @@
 #pragma once
 
 #include <exception>
-#include <variant>
+#include <type_traits>
+#include <cstddef>
 #include <cstdint>
 #include "event.hpp"
+#include "latency.hpp"
+#include "stage.hpp"
 
 extern "C" {
 #include <common/report.h>
@@ -19,12 +22,7 @@ namespace tmk_desktop {
 /**
  * @brief Sinkの状態
  */
-enum class SinkStatus {
-  RESET,     ///< リセット済み
-  RUNNING,   ///< 動作中
-  STOPPING,  ///< 停止しようとしている
-  STOPPED,   ///< 停止した
-};
+using SinkStatus = StageStatus;
 
 enum class HidUsagePage : uint16_t {
   GENERIC_DESKTOP_CONTROL = 0x01,
@@ -39,15 +37,95 @@ struct HidUsage {
 /**
  * @brief シグナルの値
  */
-enum class SinkSignal {
+enum class SinkSignal : uint8_t {
   KEY_REPEAT,      ///< キーリピート
   KEY_REPEAT_END,  ///< キーリピートが途切れた
 };
 
+/**
+ * @brief SinkEventに格納されるイベントの種類
+ */
+enum class SinkEventType : uint8_t {
+  NONE,             ///< 何もしない
+  KEYBOARD_REPORT,  ///< report_keyboard_t
+  MOUSE_REPORT,     ///< report_mouse_t
+  HID_USAGE,        ///< HidUsage
+  NATIVE,           ///< NativeSinkEvent
+  SIGNAL,           ///< SinkSignal
+};
+
+/**
+ * @brief SinkEventTypeの個数
+ */
+static constexpr size_t SINK_EVENT_TYPE_COUNT = static_cast<size_t>(SinkEventType::SIGNAL) + 1;
+
 /**
  * @brief Sinkに渡されるイベントを格納するクラス
+ *
+ * キューにそのまま積めるように、中身を直に持つ固定長でトリビアルにコピーできる型にしてある。
  */
-using SinkEvent = std::variant<report_keyboard_t, report_mouse_t, HidUsage, NativeSinkEvent, SinkSignal>;
+class SinkEvent final {
+public:
+  constexpr SinkEvent() noexcept : type_(SinkEventType::NONE), signal_() {}
+
+  SinkEvent(const report_keyboard_t& report) noexcept : type_(SinkEventType::KEYBOARD_REPORT), keyboard_report_(report) {}
+
+  SinkEvent(const report_mouse_t& report) noexcept : type_(SinkEventType::MOUSE_REPORT), mouse_report_(report) {}
+
+  constexpr SinkEvent(const HidUsage& usage) noexcept : type_(SinkEventType::HID_USAGE), usage_(usage) {}
+
+  constexpr SinkEvent(const NativeSinkEvent& event) noexcept : type_(SinkEventType::NATIVE), native_(event) {}
+
+  constexpr SinkEvent(SinkSignal signal) noexcept : type_(SinkEventType::SIGNAL), signal_(signal) {}
+
+  /**
+   * @brief 格納しているイベントの種類を取得する
+   */
+  constexpr SinkEventType type() const noexcept {
+    return type_;
+  }
+
+  /**
+   * @brief 格納しているイベントを取得する
+   *
+   * type()が対応する種類を返すときだけ呼び出せる。
+   */
+  const report_keyboard_t& keyboard_report() const noexcept {
+    return keyboard_report_;
+  }
+
+  /// @copydoc keyboard_report()
+  const report_mouse_t& mouse_report() const noexcept {
+    return mouse_report_;
+  }
+
+  /// @copydoc keyboard_report()
+  constexpr const HidUsage& usage() const noexcept {
+    return usage_;
+  }
+
+  /// @copydoc keyboard_report()
+  constexpr const NativeSinkEvent& native() const noexcept {
+    return native_;
+  }
+
+  /// @copydoc keyboard_report()
+  constexpr SinkSignal signal() const noexcept {
+    return signal_;
+  }
+
+private:
+  SinkEventType type_;  ///< 格納しているイベントの種類
+  union {
+    report_keyboard_t keyboard_report_;
+    report_mouse_t mouse_report_;
+    HidUsage usage_;
+    NativeSinkEvent native_;
+    SinkSignal signal_;
+  };
+};
+static_assert(std::is_trivially_copyable_v<SinkEvent>);
+static_assert(sizeof(SinkEvent) <= 48);
 
 /**
  * @brief Sinkを始動させる
@@ -71,11 +149,13 @@ bool stop_sink();
 /**
  * @brief Sinkにイベントを送る
  *
+ * Keyboardスレッドからのみ呼び出すこと。
+ * キューが満杯のときはSinkが空けるのを待つが、Sinkが動いていなければイベントを捨てる。
+ * TMK_DESKTOP_FUSED_PIPELINEを定義したときは、キューを介さずにこの場で処理する。
+ *
  * @param event イベント
- * @exception bad_alloc メモリ確保に失敗
- * @exception system_error mutexのロックに失敗
  */
-void send_to_sink(const SinkEvent& event);
+void send_to_sink(const SinkEvent& event) noexcept;
 
 /**
  * @brief Sinkの状態を取得する
@@ -84,6 +164,71 @@ void send_to_sink(const SinkEvent& event);
  */
 SinkStatus get_sink_status() noexcept;
 
+/**
+ * @brief Sinkのスレッドがイベントを待つ方針を設定する
+ *
+ * 既定ではすぐにスレッドを眠らせる。
+ * 遅延を減らしたいときは、CPU時間と引き換えにスピンさせることができる。
+ * TMK_DESKTOP_FUSED_PIPELINEを定義したときは、Sinkがスレッドを持たないので効果がない。
+ *
+ * @param policy 待機の方針
+ * @retval true 設定に成功
+ * @retval false Sinkが動作中のため設定できない
+ */
+bool set_sink_wait_policy(const WaitPolicy& policy) noexcept;
+
+/**
+ * @brief Sinkの統計を取得する
+ *
+ * 処理したイベント数、イベントキュー、待機の統計をまとめて返す。
+ *
+ * @return 現在の統計
+ */
+StageStats get_sink_stats() noexcept;
+
+#ifdef TMK_DESKTOP_COALESCE_REPORTS
+/**
+ * @brief キーボードレポートをまとめた結果の統計
+ *
+ * received_countとsent_countの差が、まとめたことで送らずに済んだレポートの数になる。
+ */
+struct ReportCoalescingStats {
+  uint64_t received_count = 0;  ///< send_to_sink()で受け取ったレポートの数
+  uint64_t sent_count = 0;      ///< Sinkに渡したレポートの数
+};
+
+/**
+ * @brief キーボードレポートをまとめた結果の統計を取得する
+ *
+ * TMK_DESKTOP_COALESCE_REPORTSを定義したときのみ使える。
+ *
+ * @return 現在の統計
+ */
+ReportCoalescingStats get_report_coalescing_stats() noexcept;
+#endif
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+/**
+ * @brief Sinkを通る間の遅延の統計
+ *
+ * end_to_endは、時間経過による処理で生じたイベントを含まない。
+ */
+struct SinkLatencyStats {
+  LatencySnapshot queue;       ///< キューに積んでから、取り出すまで
+  LatencySnapshot submit;      ///< キューから取り出してから、OSへの送信を終えるまで
+  LatencySnapshot end_to_end;  ///< 元になった入力をフックで受け取ってから、OSへの送信を終えるまで
+};
+
+/**
+ * @brief Sinkを通る間の遅延の統計を取得する
+ *
+ * TMK_DESKTOP_LATENCY_HISTOGRAMSを定義したときのみ使える。どのスレッドからでも呼び出せる。
+ *
+ * @return 現在の統計
+ */
+SinkLatencyStats get_sink_latency_stats() noexcept;
+#endif
+
 /**
  * @brief Sinkが異常停止したときに呼ばれる関数
  *
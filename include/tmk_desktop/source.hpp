@@ -7,17 +7,13 @@
 #pragma once
 
 #include <exception>
+#include "stage.hpp"
 
 namespace tmk_desktop {
 /**
  * @brief Sourceの状態
  */
-enum class SourceStatus {
-  RESET,     ///< リセット済み
-  RUNNING,   ///< 動作中
-  STOPPING,  ///< 停止しようとしている
-  STOPPED,   ///< 停止した
-};
+using SourceStatus = StageStatus;
 
 /**
  * @brief Sourceを始動させる
@@ -0,0 +1,170 @@
+/**
+ * @file spsc_queue.hpp
+ * @brief 単一生産者単一消費者のキュー
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include "counter.hpp"
+
+namespace tmk_desktop {
+/**
+ * @brief キャッシュラインの大きさ
+ *
+ * std::hardware_destructive_interference_sizeはABIを跨ぐと値が変わり得るので、固定値を使う。
+ */
+inline constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * @brief 単一生産者単一消費者の固定長リングバッファ
+ *
+ * push()は生産者スレッドのみが、取り出しに関わる操作は消費者スレッドのみが呼び出せる。統計はどのスレッドからでも取得できる。
+ * push()はwait-freeであり、メモリ確保も例外送出も行わない。
+ *
+ * @tparam T 要素の型
+ * @tparam N 容量 (2のべき乗)
+ */
+template <typename T, size_t N>
+class SpscQueue final {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+  static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
+public:
+  using value_type = T;
+
+  /**
+   * @brief 要素の型だけを差し替えたキュー
+   */
+  template <typename U>
+  using rebind = SpscQueue<U, N>;
+
+  /**
+   * @brief 容量
+   */
+  static constexpr size_t CAPACITY = N;
+
+  /**
+   * @brief 要素を追加する
+   *
+   * @param value 追加する値
+   * @retval true 追加に成功
+   * @retval false キューが満杯
+   */
+  bool push(const T& value) noexcept {
+    const size_t tail = producer_.tail.load(std::memory_order_relaxed);
+    if (tail - producer_.head_cache >= N) {
+      // 消費者の進み具合を確認するのは満杯に見えたときだけにする
+      producer_.head_cache = consumer_.head.load(std::memory_order_acquire);
+      if (tail - producer_.head_cache >= N) {
+        increment(producer_.overflow_count);
+        return false;
+      }
+    }
+    buffer_[tail & MASK] = value;
+    producer_.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief キューが空かどうかを調べる
+   */
+  bool empty() const noexcept {
+    return consumer_.head.load(std::memory_order_relaxed) == producer_.tail.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief 要素を1つ取り出す
+   *
+   * @param value 取り出した値の格納先
+   * @retval true 取り出しに成功
+   * @retval false キューが空
+   */
+  bool pop(T& value) noexcept {
+    const size_t head = consumer_.head.load(std::memory_order_relaxed);
+    const size_t tail = producer_.tail.load(std::memory_order_acquire);
+    if (head == tail) return false;
+    update_high_water_mark(tail - head);
+    value = buffer_[head & MASK];
+    consumer_.head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief 溜まっている要素をまとめて取り出す
+   *
+   * 呼び出し時点で溜まっていた要素を順に処理し、最後にまとめて領域を解放する。
+   *
+   * @param f 要素を引数とする関数オブジェクト
+   * @return 処理した要素の数
+   */
+  template <typename F>
+  size_t drain(F f) {
+    const size_t head = consumer_.head.load(std::memory_order_relaxed);
+    const size_t tail = producer_.tail.load(std::memory_order_acquire);
+    if (head == tail) return 0;
+    update_high_water_mark(tail - head);
+    for (size_t i = head; i != tail; ++i) {
+      f(static_cast<const T&>(buffer_[i & MASK]));
+    }
+    consumer_.head.store(tail, std::memory_order_release);
+    return tail - head;
+  }
+
+  /**
+   * @brief 溜まっている要素を捨てる
+   */
+  void clear() noexcept {
+    consumer_.head.store(producer_.tail.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  /**
+   * @brief 取り出し時に観測した要素数の最大値を取得する
+   */
+  size_t high_water_mark() const noexcept {
+    return consumer_.high_water_mark.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 満杯のために追加できなかった要素の数を取得する
+   */
+  uint64_t overflow_count() const noexcept {
+    return producer_.overflow_count.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t MASK = N - 1;
+
+  void update_high_water_mark(size_t depth) noexcept {
+    if (depth > consumer_.high_water_mark.load(std::memory_order_relaxed)) {
+      consumer_.high_water_mark.store(depth, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief 生産者が書き込む変数たち
+   */
+  struct alignas(CACHE_LINE_SIZE) Producer {
+    std::atomic<size_t> tail{0};              ///< 次に書き込む位置
+    size_t head_cache = 0;                    ///< 最後に観測した読み出し位置
+    std::atomic<uint64_t> overflow_count{0};  ///< 溢れた要素の数
+  };
+
+  /**
+   * @brief 消費者が書き込む変数たち
+   */
+  struct alignas(CACHE_LINE_SIZE) Consumer {
+    std::atomic<size_t> head{0};             ///< 次に読み出す位置
+    std::atomic<size_t> high_water_mark{0};  ///< 観測した要素数の最大値
+  };
+
+  Producer producer_{};                                 ///< 生産者側の状態
+  Consumer consumer_{};                                 ///< 消費者側の状態
+  alignas(CACHE_LINE_SIZE) std::array<T, N> buffer_{};  ///< 要素を格納する配列
+};
+}  // namespace tmk_desktop
@@ -0,0 +1,431 @@
+/**
+ * @file stage.hpp
+ * @brief パイプラインのステージ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "clock.hpp"
+#include "counter.hpp"
+#include "latency.hpp"
+#include "spsc_queue.hpp"
+#include "wait_policy.hpp"
+
+namespace tmk_desktop {
+/**
+ * @brief ステージの状態
+ */
+enum class StageStatus {
+  RESET,     ///< リセット済み
+  RUNNING,   ///< 動作中
+  STOPPING,  ///< 停止しようとしている
+  STOPPED,   ///< 停止した
+};
+
+/**
+ * @brief イベントキューの統計
+ */
+struct QueueStats {
+  size_t capacity;          ///< キューの容量
+  size_t high_water_mark;   ///< キューに溜まったイベント数の最大値
+  uint64_t overflow_count;  ///< キューが溢れて受け付けられなかったイベント数
+};
+
+/**
+ * @brief ステージの処理の統計
+ */
+struct StageCounters {
+  uint64_t processed_count;  ///< 処理したイベント数
+  uint64_t batch_count;      ///< イベントをまとめて処理した回数
+};
+
+/**
+ * @brief ステージの統計
+ */
+struct StageStats {
+  StageStatus status;      ///< 状態
+  StageCounters counters;  ///< 処理の統計
+  QueueStats queue;        ///< イベントキューの統計
+  WaitStats wait;          ///< 待機の統計
+};
+
+/**
+ * @brief ステージのスレッドを管理するクラス
+ *
+ * 始動、停止、状態の取得を担う。スレッドの中身は呼び出し側が与える。
+ * start()とstop()は同じスレッドから呼び出すこと。
+ */
+class StageThread final {
+public:
+  /**
+   * @brief スレッドを始動させる
+   *
+   * @param body スレッドで実行する関数。stop_requested()がtrueになったらリターンすること
+   * @param on_error bodyが例外を投げたときに呼ばれる関数
+   * @retval true 始動に成功
+   * @retval false すでに始動している
+   * @exception system_error スレッドの生成に失敗
+   */
+  template <typename Body, typename OnError>
+  bool start(Body body, OnError on_error) {
+    if (thread_.joinable() || is_running()) return false;
+
+    // 状態を初期化する
+    control_.stop_requested.store(false, std::memory_order_release);
+
+    thread_ = std::thread([this, body = std::move(body), on_error = std::move(on_error)]() mutable {
+      const struct ScopedRunning {
+        Control& control;
+        explicit ScopedRunning(Control& control) : control(control) {
+          control.running.store(true, std::memory_order_release);
+        }
+        ~ScopedRunning() {
+          control.running.store(false, std::memory_order_release);
+        }
+      } _running{control_};
+
+      try {
+        body();
+      } catch (std::exception& e) {
+        on_error(e);
+      }
+    });
+
+    return true;
+  }
+
+  /**
+   * @brief スレッドを停止させる
+   *
+   * @param wake 停止要求を出した後に、待機しているスレッドを起こす関数
+   * @retval true 停止に成功
+   * @retval false すでに停止しているか、停止しようとしている
+   * @exception system_error スレッドのjoinに失敗
+   */
+  template <typename Wake>
+  bool stop(Wake wake) {
+    // すでにスレッドが停止しているかを確認する
+    if (!thread_.joinable()) return false;
+
+    // すでにスレッドが実行終了しているかを確認する
+    if (!is_running()) return false;
+
+    // スレッドに停止要求を出す
+    control_.stop_requested.store(true, std::memory_order_release);
+    wake();
+
+    // スレッドが停止するのを待つ
+    thread_.join();
+
+    return true;
+  }
+
+  /**
+   * @brief スレッドを使わずに動作中とする
+   *
+   * 呼び出し元のスレッドで処理を行うときに使う。
+   *
+   * @retval true 成功
+   * @retval false すでに始動している
+   */
+  bool start_inline() noexcept {
+    if (thread_.joinable() || is_running()) return false;
+    control_.stop_requested.store(false, std::memory_order_release);
+    control_.running.store(true, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief start_inline()で始動させたものを停止させる
+   *
+   * @retval true 成功
+   * @retval false すでに停止している
+   */
+  bool stop_inline() noexcept {
+    if (thread_.joinable() || !is_running()) return false;
+    control_.running.store(false, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief 停止要求が出ているかを調べる
+   */
+  bool stop_requested() const noexcept {
+    return control_.stop_requested.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief 動作中かどうかを調べる
+   */
+  bool is_running() const noexcept {
+    return control_.running.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief 状態を取得する
+   */
+  StageStatus status() const noexcept {
+    if (is_running()) {
+      if (stop_requested()) return StageStatus::STOPPING;
+      return StageStatus::RUNNING;
+    } else {
+      if (thread_.joinable()) return StageStatus::STOPPED;
+      return StageStatus::RESET;
+    }
+  }
+
+private:
+  /**
+   * @brief 制御用の変数たち
+   *
+   * 他のステージの変数やキューと同じキャッシュラインに載らないようにする。
+   */
+  struct alignas(CACHE_LINE_SIZE) Control {
+    std::atomic<bool> running{false};         ///< スレッドが動作中かどうか
+    std::atomic<bool> stop_requested{false};  ///< スレッドに対する停止要求
+  };
+
+  Control control_{};   ///< 制御用の変数
+  std::thread thread_;  ///< スレッド
+};
+
+/**
+ * @brief キューからイベントを受け取って処理するステージ
+ *
+ * Handlerには以下のメンバ関数を定義する。いずれもステージのスレッドから呼ばれる。
+ *
+ * - void init(): 始動時の初期化
+ * - void deinit(): 停止時の後片付け
+ * - void process(const Event& event): イベントの処理
+ * - void process(const Event& event, const LatencyStamp& stamp): TMK_DESKTOP_LATENCY_HISTOGRAMSを定義したときのイベントの処理。stampはキューに積んだ時刻など
+ * - Clock::time_point poll(): 時間経過による処理。次に呼ぶべき時刻を返し、なければClock::time_point::max()を返す
+ * - void on_error(std::exception& e) noexcept: 異常停止の通知
+ *
+ * @tparam Handler イベントを処理するクラス
+ * @tparam Queue 単一生産者単一消費者のキュー (SpscQueueと同じインターフェイスを持つこと)
+ */
+template <typename Handler, typename Queue>
+class Stage final {
+public:
+  using Event = typename Queue::value_type;
+
+  /**
+   * @brief スレッドを始動させる
+   *
+   * @retval true 始動に成功
+   * @retval false すでに始動している
+   * @exception system_error スレッドの生成に失敗
+   */
+  bool start() {
+    return thread_.start(
+        [this] {
+          handler_.init();
+          const struct ScopedDeinit {
+            Handler& handler;
+            ~ScopedDeinit() {
+              handler.deinit();
+            }
+          } _deinit{handler_};
+
+          while (!thread_.stop_requested()) {
+            // 溜まっているイベントと期限を迎えた処理をまとめて行う
+            const auto deadline = run_once();
+            if (!queue_.empty()) continue;
+
+            // 次のイベントか期限を待つ
+            waiter_.wait_until([this] { return !queue_.empty() || thread_.stop_requested(); }, deadline);
+          }
+        },
+        [this](std::exception& e) { handler_.on_error(e); });
+  }
+
+  /**
+   * @brief スレッドを停止させる
+   *
+   * @retval true 停止に成功
+   * @retval false すでに停止しているか、停止しようとしている
+   * @exception system_error スレッドのjoinに失敗
+   */
+  bool stop() {
+    return thread_.stop([this] { waiter_.notify(); });
+  }
+
+  /**
+   * @brief スレッドを持たずに始動させる
+   *
+   * 呼び出し元のスレッドで初期化し、以降はrun_inline()やprocess_inline()で処理を進める。
+   *
+   * @retval true 始動に成功
+   * @retval false すでに始動している
+   */
+  bool start_inline() {
+    if (thread_.is_running()) return false;
+    queue_.clear();
+    handler_.init();
+    return thread_.start_inline();
+  }
+
+  /**
+   * @brief start_inline()で始動させたものを停止させる
+   *
+   * @retval true 停止に成功
+   * @retval false すでに停止している
+   */
+  bool stop_inline() {
+    if (!thread_.stop_inline()) return false;
+    handler_.deinit();
+    return true;
+  }
+
+  /**
+   * @brief 溜まっているイベントと期限を迎えた処理を呼び出し元のスレッドで行う
+   *
+   * 例外が投げられたときは、停止させてからHandler::on_error()を呼び出す。
+   *
+   * @return 次に呼び出すべき時刻。期限がなければClock::time_point::max()
+   */
+  Clock::time_point run_inline() {
+    if (!thread_.is_running()) return Clock::time_point::max();
+    try {
+      return run_once();
+    } catch (std::exception& e) {
+      stop_inline();
+      handler_.on_error(e);
+    }
+    return Clock::time_point::max();
+  }
+
+  /**
+   * @brief キューを介さずにイベントを呼び出し元のスレッドで処理する
+   *
+   * 動作中でなければイベントを捨てる。
+   *
+   * @param event イベント
+   * @param captured 元になった入力をフックで受け取った時刻。TMK_DESKTOP_LATENCY_HISTOGRAMSを定義したときのみ使う
+   */
+  void process_inline(const Event& event, [[maybe_unused]] Clock::time_point captured = {}) {
+    if (!thread_.is_running()) return;
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+    handler_.process(event, LatencyStamp{.captured = captured, .enqueued = Clock::now()});
+#else
+    handler_.process(event);
+#endif
+    increment(counters_.processed_count);
+    increment(counters_.batch_count);
+  }
+
+  /**
+   * @brief イベントをキューに積み、スレッドが眠っていれば起こす
+   *
+   * 単一のスレッドから呼び出すこと。
+   *
+   * @param event イベント
+   * @param captured 元になった入力をフックで受け取った時刻。TMK_DESKTOP_LATENCY_HISTOGRAMSを定義したときのみ使う
+   * @retval true 成功
+   * @retval false キューが満杯
+   */
+  bool push(const Event& event, [[maybe_unused]] Clock::time_point captured = {}) noexcept {
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+    if (!queue_.push(Entry{.event = event, .stamp = {.captured = captured, .enqueued = Clock::now()}})) return false;
+#else
+    if (!queue_.push(event)) return false;
+#endif
+    waiter_.notify();
+    return true;
+  }
+
+  /**
+   * @brief 待機の方針を設定する
+   *
+   * @retval true 成功
+   * @retval false 動作中のため設定できない
+   */
+  bool set_wait_policy(const WaitPolicy& policy) noexcept {
+    if (thread_.is_running()) return false;
+    waiter_.set_policy(policy);
+    return true;
+  }
+
+  /**
+   * @brief 動作中かどうかを調べる
+   */
+  bool is_running() const noexcept {
+    return thread_.is_running();
+  }
+
+  /**
+   * @brief 状態を取得する
+   */
+  StageStatus status() const noexcept {
+    return thread_.status();
+  }
+
+  /**
+   * @brief 統計を取得する
+   */
+  StageStats stats() const noexcept {
+    return {
+        .status = thread_.status(),
+        .counters =
+            {
+                .processed_count = counters_.processed_count.load(std::memory_order_relaxed),
+                .batch_count = counters_.batch_count.load(std::memory_order_relaxed),
+            },
+        .queue =
+            {
+                .capacity = Queue::CAPACITY,
+                .high_water_mark = queue_.high_water_mark(),
+                .overflow_count = queue_.overflow_count(),
+            },
+        .wait = waiter_.stats(),
+    };
+  }
+
+private:
+  /**
+   * @brief キューに積む要素の型
+   *
+   * TMK_DESKTOP_LATENCY_HISTOGRAMSを定義したときは、遅延を測るための時刻を添える。
+   */
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+  using Entry = Stamped<Event>;
+#else
+  using Entry = Event;
+#endif
+  using EntryQueue = typename Queue::template rebind<Entry>;
+
+  Clock::time_point run_once() {
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+    const size_t count = queue_.drain([this](const Entry& entry) { handler_.process(entry.event, entry.stamp); });
+#else
+    const size_t count = queue_.drain([this](const Entry& entry) { handler_.process(entry); });
+#endif
+    if (count > 0) {
+      increment(counters_.processed_count, count);
+      increment(counters_.batch_count);
+    }
+    return handler_.poll();
+  }
+
+  /**
+   * @brief 処理の統計
+   */
+  struct alignas(CACHE_LINE_SIZE) Counters {
+    std::atomic<uint64_t> processed_count{0};  ///< 処理したイベント数
+    std::atomic<uint64_t> batch_count{0};      ///< イベントをまとめて処理した回数
+  };
+
+  StageThread thread_;   ///< スレッド
+  EntryQueue queue_;     ///< イベントキュー
+  Waiter waiter_;        ///< イベントを待つためのクラス
+  Counters counters_{};  ///< 処理の統計
+  Handler handler_{};    ///< イベントを処理するクラス
+};
+}  // namespace tmk_desktop
@@ -0,0 +1,315 @@
+/**
+ * @file timer_wheel.hpp
+ * @brief 階層タイマーホイール
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "clock.hpp"
+
+namespace tmk_desktop {
+/**
+ * @brief タイマーを識別する値
+ *
+ * 発火したり取り消したりしたタイマーの値は再利用されないので、古い値で別のタイマーを取り消すことはない。
+ */
+using TimerId = uint64_t;
+
+/**
+ * @brief タイマーがないことを示す値
+ */
+static constexpr TimerId NO_TIMER = 0;
+
+/**
+ * @brief 期限を迎えたときに呼ばれる関数の型
+ *
+ * @param context 予約したときに渡した値
+ */
+using TimerCallback = void (*)(void* context);
+
+/**
+ * @brief 期限付きの処理を予約する階層タイマーホイール
+ *
+ * 時刻をTICK_DURATION単位の刻みに区切り、SLOT_COUNT個のスロットを持つ輪をLEVEL_COUNT段重ねる。
+ * 段nの1スロットはSLOT_COUNT^n刻みを受け持ち、上の段のスロットは受け持つ区間の始めに下の段へ振り分け直される。
+ * 予約と取り消しはスロットの双方向リストへの挿入と削除だけなので、予約数によらずO(1)で済む。
+ * 最上段でも収まらない遠い期限は、最上段の最も遠いスロットに置いて振り分けのたびに置き直す。
+ *
+ * タイマーはノードの配列から割り当て、発火や取り消しで空いたノードを再利用する。
+ * 配列は同時に予約されたタイマーの最大数まで伸び、それ以降はメモリを確保しない。reserve()で前もって伸ばしておける。
+ *
+ * 単一のスレッドから使うこと。
+ */
+class TimerWheel final {
+public:
+  static constexpr auto TICK_DURATION = std::chrono::milliseconds(1);  ///< 刻みの長さ
+  static constexpr size_t SLOT_BITS = 6;                               ///< 1段のスロット数のビット数
+  static constexpr size_t SLOT_COUNT = size_t{1} << SLOT_BITS;         ///< 1段のスロット数
+  static constexpr size_t LEVEL_COUNT = 4;                             ///< 段数
+
+  /**
+   * @param origin 刻みを数える始点
+   */
+  explicit TimerWheel(Clock::time_point origin = Clock::now()) noexcept : origin_(origin) {
+    heads_.fill(NIL);
+  }
+
+  /**
+   * @brief 指定の数のタイマーを、メモリを確保せずに予約できるようにする
+   */
+  void reserve(size_t count) {
+    nodes_.reserve(count);
+  }
+
+  /**
+   * @brief 期限付きの処理を予約する
+   *
+   * 期限は刻みに切り上げるので、期限より早く呼ばれることはない。過去の期限は次の刻みで呼ばれる。
+   *
+   * @param deadline 期限
+   * @param callback 期限を迎えたときに呼ぶ関数
+   * @param context callbackに渡す値
+   * @return 予約したタイマー
+   * @exception bad_alloc ノードの配列を伸ばせない
+   */
+  TimerId schedule(Clock::time_point deadline, TimerCallback callback, void* context) {
+    const uint32_t index = allocate();
+    Node& node = nodes_[index];
+    node.expiry = std::max(to_tick_ceil(deadline), tick_ + 1);
+    node.callback = callback;
+    node.context = context;
+    link(index);
+    return to_id(index, node.generation);
+  }
+
+  /**
+   * @brief 予約を取り消す
+   *
+   * @param id 取り消すタイマー
+   * @retval true 取り消した
+   * @retval false すでに発火したか取り消したか、存在しない
+   */
+  bool cancel(TimerId id) noexcept {
+    const auto index = static_cast<uint32_t>(id) - 1;
+    if (id == NO_TIMER || index >= nodes_.size()) return false;
+    Node& node = nodes_[index];
+    if (node.list == FREE || node.generation != static_cast<uint32_t>(id >> 32)) return false;
+    unlink(index);
+    release(index);
+    return true;
+  }
+
+  /**
+   * @brief すべての予約を取り消す
+   */
+  void clear() noexcept {
+    for (uint32_t i = 0; i < nodes_.size(); ++i) {
+      if (nodes_[i].list != FREE) {
+        unlink(i);
+        release(i);
+      }
+    }
+  }
+
+  /**
+   * @brief 期限を迎えた処理を呼ぶ
+   *
+   * 処理の中で予約や取り消しを行ってもよいが、run()を呼んではならない。
+   *
+   * @param now 現在時刻
+   * @return 呼んだ処理の数
+   */
+  size_t run(Clock::time_point now) {
+    const uint64_t now_tick = to_tick_floor(now);
+    size_t count = 0;
+    while (tick_ < now_tick) {
+      // 何も起こらない刻みは飛ばす
+      const uint64_t next_tick = (size_ == 0) ? now_tick : std::min(next_event_tick(), now_tick);
+      tick_ = next_tick;
+      cascade();
+      count += expire();
+    }
+    return count;
+  }
+
+  /**
+   * @brief 次にrun()を呼ぶべき時刻を取得する
+   *
+   * 上の段のスロットを振り分け直す時刻も含むので、実際に処理を呼ぶ時刻より早いことがある。
+   *
+   * @return 次にrun()を呼ぶべき時刻。予約がなければClock::time_point::max()
+   */
+  Clock::time_point next_deadline() const noexcept {
+    if (size_ == 0) return Clock::time_point::max();
+    return origin_ + next_event_tick() * TICK_DURATION;
+  }
+
+  /**
+   * @brief 予約しているタイマーの数を取得する
+   */
+  size_t size() const noexcept {
+    return size_;
+  }
+
+private:
+  static constexpr uint32_t NIL = UINT32_MAX;                                            ///< ノードがないことを示す値
+  static constexpr uint16_t FREE = UINT16_MAX;                                           ///< ノードが空いていることを示す値
+  static constexpr uint64_t SLOT_MASK = SLOT_COUNT - 1;                                  ///< スロットの番号を取り出すマスク
+  static constexpr uint64_t MAX_DELTA = (uint64_t{1} << (SLOT_BITS * LEVEL_COUNT)) - 1;  ///< 置ける最も遠い期限までの刻み数
+
+  /**
+   * @brief タイマーのノード
+   */
+  struct Node {
+    uint64_t expiry = 0;               ///< 期限の刻み
+    TimerCallback callback = nullptr;  ///< 期限を迎えたときに呼ぶ関数
+    void* context = nullptr;           ///< callbackに渡す値
+    uint32_t prev = NIL;               ///< リストの前のノード
+    uint32_t next = NIL;               ///< リストの次のノード。空いていれば空きリストの次のノード
+    uint32_t generation = 1;           ///< 再利用された回数。古いTimerIdを見分ける
+    uint16_t list = FREE;              ///< 属するリストの番号 (段 * SLOT_COUNT + スロット)
+  };
+
+  static TimerId to_id(uint32_t index, uint32_t generation) noexcept {
+    return (TimerId{generation} << 32) | (TimerId{index} + 1);
+  }
+
+  uint64_t to_tick_floor(Clock::time_point tp) const noexcept {
+    if (tp <= origin_) return 0;
+    return static_cast<uint64_t>((tp - origin_) / TICK_DURATION);
+  }
+
+  uint64_t to_tick_ceil(Clock::time_point tp) const noexcept {
+    if (tp <= origin_) return 0;
+    if (tp == Clock::time_point::max()) return UINT64_MAX;
+    const auto elapsed = tp - origin_;
+    const auto ticks = static_cast<uint64_t>(elapsed / TICK_DURATION);
+    return (elapsed % TICK_DURATION == Clock::duration::zero()) ? ticks : ticks + 1;
+  }
+
+  uint32_t allocate() {
+    if (free_ == NIL) {
+      nodes_.emplace_back();
+      return static_cast<uint32_t>(nodes_.size() - 1);
+    }
+    const uint32_t index = free_;
+    free_ = nodes_[index].next;
+    return index;
+  }
+
+  void release(uint32_t index) noexcept {
+    Node& node = nodes_[index];
+    node.list = FREE;
+    node.generation++;
+    node.next = free_;
+    free_ = index;
+  }
+
+  /**
+   * @brief 期限に応じたスロットにノードを入れる
+   */
+  void link(uint32_t index) noexcept {
+    Node& node = nodes_[index];
+    const uint64_t delta = node.expiry > tick_ ? std::min(node.expiry - tick_, MAX_DELTA) : 0;
+    const uint64_t expiry = tick_ + delta;
+    const size_t level = delta == 0 ? 0 : static_cast<size_t>(std::bit_width(delta) - 1) / SLOT_BITS;
+    const size_t slot = static_cast<size_t>((expiry >> (level * SLOT_BITS)) & SLOT_MASK);
+    const auto list = static_cast<uint16_t>(level * SLOT_COUNT + slot);
+
+    node.list = list;
+    node.prev = NIL;
+    node.next = heads_[list];
+    if (node.next != NIL) nodes_[node.next].prev = index;
+    heads_[list] = index;
+    masks_[level] |= uint64_t{1} << slot;
+    size_++;
+  }
+
+  /**
+   * @brief ノードをスロットから外す
+   */
+  void unlink(uint32_t index) noexcept {
+    Node& node = nodes_[index];
+    if (node.prev != NIL) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      heads_[node.list] = node.next;
+      if (node.next == NIL) masks_[node.list / SLOT_COUNT] &= ~(uint64_t{1} << (node.list % SLOT_COUNT));
+    }
+    if (node.next != NIL) nodes_[node.next].prev = node.prev;
+    size_--;
+  }
+
+  /**
+   * @brief 現在の刻みより後で、処理を呼ぶか振り分け直す最初の刻みを求める
+   *
+   * 予約が1つ以上あること。
+   */
+  uint64_t next_event_tick() const noexcept {
+    uint64_t result = UINT64_MAX;
+    for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+      if (masks_[level] == 0) continue;
+      // 段levelのスロットは、受け持つ区間の始まりに処理される
+      const size_t shift = level * SLOT_BITS;
+      const uint64_t base = (tick_ >> shift) + 1;
+      const uint64_t rotated = std::rotr(masks_[level], static_cast<int>(base & SLOT_MASK));
+      result = std::min(result, (base + std::countr_zero(rotated)) << shift);
+    }
+    return result;
+  }
+
+  /**
+   * @brief 区間の始まりを迎えた上の段のスロットを、下の段へ振り分け直す
+   */
+  void cascade() noexcept {
+    for (size_t level = LEVEL_COUNT - 1; level > 0; --level) {
+      const size_t shift = level * SLOT_BITS;
+      if ((tick_ & ((uint64_t{1} << shift) - 1)) != 0) continue;
+      const auto list = static_cast<uint16_t>(level * SLOT_COUNT + ((tick_ >> shift) & SLOT_MASK));
+      for (uint32_t index = heads_[list]; index != NIL;) {
+        const uint32_t next = nodes_[index].next;
+        unlink(index);
+        link(index);
+        index = next;
+      }
+    }
+  }
+
+  /**
+   * @brief 現在の刻みのスロットにある処理を呼ぶ
+   *
+   * @return 呼んだ処理の数
+   */
+  size_t expire() {
+    const auto list = static_cast<uint16_t>(tick_ & SLOT_MASK);
+    size_t count = 0;
+    // 処理の中で同じスロットのタイマーが取り消されてもよいよう、1つずつ取り出す
+    while (heads_[list] != NIL) {
+      const uint32_t index = heads_[list];
+      const auto callback = nodes_[index].callback;
+      const auto context = nodes_[index].context;
+      unlink(index);
+      release(index);
+      callback(context);
+      count++;
+    }
+    return count;
+  }
+
+  Clock::time_point origin_;                              ///< 刻みを数える始点
+  uint64_t tick_ = 0;                                     ///< 処理を終えた刻み
+  size_t size_ = 0;                                       ///< 予約しているタイマーの数
+  uint32_t free_ = NIL;                                   ///< 空きリストの先頭
+  std::vector<Node> nodes_;                               ///< ノードの配列
+  std::array<uint32_t, LEVEL_COUNT * SLOT_COUNT> heads_;  ///< 各スロットのリストの先頭
+  std::array<uint64_t, LEVEL_COUNT> masks_{};             ///< 各段でノードのあるスロットのビットマスク
+};
+}  // namespace tmk_desktop
@@ -0,0 +1,206 @@
+/**
+ * @file wait_policy.hpp
+ * @brief スレッドの待機方法
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include "clock.hpp"
+#include "counter.hpp"
+#include "spsc_queue.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace tmk_desktop {
+/**
+ * @brief 待機の方法
+ */
+enum class WaitMode : uint8_t {
+  PARK,            ///< すぐにスレッドを眠らせる
+  SPIN_THEN_PARK,  ///< しばらくスピンしてから眠らせる
+  BUSY_POLL,       ///< 眠らせずにスピンし続ける
+};
+
+/**
+ * @brief 待機の方針
+ */
+struct WaitPolicy {
+  WaitMode mode = WaitMode::PARK;           ///< 待機の方法
+  std::chrono::nanoseconds spin_budget{0};  ///< SPIN_THEN_PARKでスピンする時間
+};
+
+/**
+ * @brief 待機の統計
+ */
+struct WaitStats {
+  uint64_t wait_count;      ///< 待機した回数
+  uint64_t spin_hit_count;  ///< スピンしている間に待機が終わった回数
+  uint64_t park_count;      ///< スレッドを眠らせた回数
+  uint64_t spin_ns;         ///< スピンに費やした時間の合計 [ns]
+};
+
+/**
+ * @brief スピンしていることをCPUに伝える
+ */
+inline void cpu_relax() noexcept {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief 方針に従って待機し、起こされるクラス
+ *
+ * wait()とwait_until()は待機する単一のスレッドのみが、notify()はどのスレッドからでも呼び出せる。
+ * 眠っている相手がいるときだけnotify()がMutexを取るので、スピンしている相手を起こすのは安価である。
+ */
+class alignas(CACHE_LINE_SIZE) Waiter final {
+public:
+  /**
+   * @brief 待機の方針を設定する
+   *
+   * 待機しているスレッドがいないときに呼び出すこと。
+   */
+  void set_policy(const WaitPolicy& policy) noexcept {
+    policy_ = policy;
+  }
+
+  /**
+   * @brief 待機の方針を取得する
+   */
+  const WaitPolicy& policy() const noexcept {
+    return policy_;
+  }
+
+  /**
+   * @brief 条件を満たすまで待機する
+   *
+   * @param ready 待機を終える条件。notify()の前に満たされるようにすること
+   */
+  template <typename Ready>
+  void wait(Ready ready) {
+    wait_until(ready, Clock::time_point::max());
+  }
+
+  /**
+   * @brief 条件を満たすか期限を迎えるまで待機する
+   *
+   * @param ready 待機を終える条件。notify()の前に満たされるようにすること
+   * @param deadline 期限
+   */
+  template <typename Ready>
+  void wait_until(Ready ready, Clock::time_point deadline) {
+    increment(stats_.wait_count);
+
+    if (policy_.mode != WaitMode::PARK) {
+      const auto begin = Clock::now();
+      const auto spin_end = (policy_.mode == WaitMode::BUSY_POLL) ? deadline : std::min(deadline, saturated_add(begin, policy_.spin_budget));
+      const bool done = spin_until(ready, spin_end);
+      const auto end = Clock::now();
+      increment(stats_.spin_ns, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+      if (done) {
+        increment(stats_.spin_hit_count);
+        return;
+      }
+      if (policy_.mode == WaitMode::BUSY_POLL || end >= deadline) return;
+    }
+
+    park_until(ready, deadline);
+  }
+
+  /**
+   * @brief 待機しているスレッドを起こす
+   *
+   * 待機を終える条件を満たしてから呼び出すこと。
+   */
+  void notify() noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed)) {
+      std::lock_guard lock{mtx_};
+      cv_.notify_one();
+    }
+  }
+
+  /**
+   * @brief 統計を取得する
+   */
+  WaitStats stats() const noexcept {
+    return {
+        .wait_count = stats_.wait_count.load(std::memory_order_relaxed),
+        .spin_hit_count = stats_.spin_hit_count.load(std::memory_order_relaxed),
+        .park_count = stats_.park_count.load(std::memory_order_relaxed),
+        .spin_ns = stats_.spin_ns.load(std::memory_order_relaxed),
+    };
+  }
+
+private:
+  static constexpr uint32_t CLOCK_CHECK_INTERVAL = 32;  ///< 時刻を確かめる間隔 (スピン回数)
+
+  static Clock::time_point saturated_add(Clock::time_point tp, std::chrono::nanoseconds d) noexcept {
+    const auto max = Clock::time_point::max();
+    const auto duration = std::chrono::duration_cast<Clock::duration>(d);
+    return (max - tp < duration) ? max : tp + duration;
+  }
+
+  template <typename Ready>
+  static bool spin_until(Ready& ready, Clock::time_point end) {
+    // 論理コアが1つしかなければ、スピンしても相手が進まないので譲る
+    static const bool single_core = std::thread::hardware_concurrency() == 1;
+    for (uint32_t i = 1;; ++i) {
+      if (ready()) return true;
+      if (i % CLOCK_CHECK_INTERVAL == 0 && Clock::now() >= end) return false;
+      if (single_core) {
+        std::this_thread::yield();
+      } else {
+        cpu_relax();
+      }
+    }
+  }
+
+  template <typename Ready>
+  void park_until(Ready& ready, Clock::time_point deadline) {
+    increment(stats_.park_count);
+
+    // 待機することを先に公開してから条件を確かめ直し、通知の取りこぼしを防ぐ
+    parked_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      std::unique_lock lock{mtx_};
+      if (deadline == Clock::time_point::max()) {
+        cv_.wait(lock, ready);
+      } else {
+        cv_.wait_until(lock, deadline, ready);
+      }
+    }
+    parked_.store(false, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 統計の値
+   */
+  struct Stats {
+    std::atomic<uint64_t> wait_count{0};
+    std::atomic<uint64_t> spin_hit_count{0};
+    std::atomic<uint64_t> park_count{0};
+    std::atomic<uint64_t> spin_ns{0};
+  };
+
+  WaitPolicy policy_{};              ///< 待機の方針
+  std::atomic<bool> parked_{false};  ///< スレッドが眠っているかどうか
+  std::mutex mtx_;                   ///< 眠るためのMutex
+  std::condition_variable cv_;       ///< 眠るためのCV
+  Stats stats_{};                    ///< 統計
+};
+}  // namespace tmk_desktop
@@ -6,8 +6,10 @@
  */
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <Windows.h>
+#include "../clock.hpp"
 
 namespace tmk_desktop::inline win32 {
 /**
@@ -27,7 +29,8 @@ class KeyEvent final {
 public:
   KeyEvent() = default;
 
-  KeyEvent(const KBDLLHOOKSTRUCT& info) noexcept : vk_(info.vkCode), sc_(info.scanCode), flags_(info.flags) {}
+  KeyEvent(const KBDLLHOOKSTRUCT& info) noexcept
+      : timestamp_(to_timestamp(info.time)), vk_(info.vkCode), sc_(info.scanCode), flags_(info.flags) {}
 
   Key key() const noexcept {
     // HACK: 8ビットより大きなスキャンコードが現れないことを前提としている
@@ -38,7 +41,30 @@ public:
     return !(flags_ & LLKHF_UP);
   }
 
+  /**
+   * @brief キーを操作した時刻を取得する
+   */
+  Clock::time_point timestamp() const noexcept {
+    return timestamp_;
+  }
+
 private:
+  /**
+   * @brief GetTickCount()基準のイベント時刻をエンジンの時計に写す
+   *
+   * フックが呼ばれた時刻から、イベントが発生してからの経過時間を差し引く。
+   * DWORD同士の差を取るので、49.7日ごとの桁あふれにも対応できる。
+   * 経過時間が不自然に長いとき (未来の時刻を含む) は、フックが呼ばれた時刻を使う。
+   */
+  static Clock::time_point to_timestamp(DWORD time) noexcept {
+    static constexpr DWORD MAX_AGE = 1000;
+    const auto now = Clock::now();
+    const DWORD age = GetTickCount() - time;
+    if (age > MAX_AGE) return now;
+    return now - std::chrono::milliseconds(age);
+  }
+
+  Clock::time_point timestamp_{};  ///< キーを操作した時刻
   [[maybe_unused]] WORD vk_ = 0;
   WORD sc_ = 0;
   DWORD flags_ = 0;
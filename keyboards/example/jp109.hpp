@@ -13,7 +13,7 @@ extern "C" {
 #include <common/action_code.h>
 }  // extern "C"
 
-#ifdef _WIN32
+#if defined(_WIN32) || defined(TMK_DESKTOP_EVDEV) || defined(TMK_DESKTOP_HEADLESS)
 
 /* clang-format off */
 /**
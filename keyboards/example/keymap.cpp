@@ -5,6 +5,7 @@
  * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
  */
 #include <array>
+#include <tmk_desktop/layout.hpp>
 #include <tmk_desktop/sink.hpp>
 #include "jp109.hpp"
 #include "utility.hpp"
@@ -31,6 +32,9 @@ enum Layer : uint8_t {
   L_RTHUMB,            // 右親指
 };
 
+// レイヤー数
+constexpr size_t LAYER_COUNT = L_RTHUMB + 1;
+
 // レイヤー番号のビットマスク
 constexpr uint32_t L_MASK_THUMBS = (1 << L_LTHUMB) | (1 << L_RTHUMB);
 
@@ -85,169 +89,171 @@ constexpr action_t AC_LAYER_ON_OFF_LSHIFT_QWERTY_JP = ACTION_FUNCTION(FN_LAYER_O
 constexpr action_t AC_LAYER_ON_OFF_RSHIFT_QWERTY_JP = ACTION_FUNCTION(FN_LAYER_ON_OFF_RSHIFT_JP);
 constexpr action_t AC_SHIFT_CAPS_LOCK = ACTION_MODS_KEY(MOD_LSFT, ::KC_CAPSLOCK);
 
-extern "C" {
-action_t action_for_key(uint8_t layer, keypos_t pos) {
-  /* clang-format off */
-  static constexpr std::array COLEMAK_P_ACTIONMAP{
-    AC_GRAVE, AC_1, AC_2, AC_3, AC_4, AC_5, AC_6, AC_7, AC_8, AC_9, AC_0, AC_LBRACKET, AC_RBRACKET, AC_YEN,
-    AC_Q, AC_W, AC_F, AC_P, AC_G, AC_J, AC_L, AC_U, AC_Y, AC_SCOLON, AC_QUOTE, AC_EQUAL,
-    AC_A, AC_R, AC_S, AC_T, AC_D, AC_H, AC_N, AC_E, AC_I, AC_O, AC_UNDERSCORE, AC_ENTER,
-    AC_Z, AC_X, AC_C, AC_V, AC_B, AC_K, AC_M, AC_COMMA, AC_DOT, AC_SLASH, AC_LAYER_OFFSET_RSHIFT,
-    // AC_LTHUMB_MUHENKAN, AC_RTHUMB_HENKAN
-    AC_LAYER_TAP_LTHUMB_BSPACE, AC_LAYER_TAP_RTHUMB_ENTER, AC_DELETE,
-    AC_LAYER_OFFSET_LCTRL, AC_LAYER_OFFSET_LSHIFT, AC_LAYER_OFFSET_LALT, AC_LAYER_OFFSET_LGUI,
-    AC_LAYER_OFFSET_RCTRL, AC_LAYER_OFFSET_RSHIFT, AC_LAYER_OFFSET_RALT, AC_LAYER_OFFSET_RGUI,
-  };
-  static constexpr std::array SHIFTED_COLEMAK_P_ACTIONMAP{
-    AC_TILDE, AC_EXCLAIM, AC_AT, AC_HASH, AC_DOLLAR, AC_PERCENT, AC_CIRCUMFLEX, AC_AMPERSAND, AC_ASTERISK, AC_LPAREN, AC_RPAREN, AC_LBRACE, AC_RBRACE, AC_PIPE,
-    AC_SHIFT_Q, AC_SHIFT_W, AC_SHIFT_F, AC_SHIFT_P, AC_SHIFT_G, AC_SHIFT_J, AC_SHIFT_L, AC_SHIFT_U, AC_SHIFT_Y, AC_COLON, AC_DQUOTE, AC_PLUS,
-    AC_SHIFT_A, AC_SHIFT_R, AC_SHIFT_S, AC_SHIFT_T, AC_SHIFT_D, AC_SHIFT_H, AC_SHIFT_N, AC_SHIFT_E, AC_SHIFT_I, AC_SHIFT_O, AC_EQUAL, AC_SHIFT_ENTER,
-    AC_SHIFT_Z, AC_SHIFT_X, AC_SHIFT_C, AC_SHIFT_V, AC_SHIFT_B, AC_SHIFT_K, AC_SHIFT_M, AC_LT, AC_GT, AC_QUESTION, AC_LAYER_OFFSET_RSHIFT,
-    // AC_SHIFT_MUHENKAN, AC_SHIFT_HENKAN,
-    AC_SHIFT_BSPACE, AC_SHIFT_ENTER, AC_SHIFT_DELETE,
-    AC_LAYER_OFFSET_LCTRL, AC_LAYER_OFFSET_LSHIFT, AC_LAYER_OFFSET_LALT, AC_LAYER_OFFSET_LGUI,
-    AC_LAYER_OFFSET_RCTRL, AC_LAYER_OFFSET_RSHIFT, AC_LAYER_OFFSET_RALT, AC_LAYER_OFFSET_RGUI,
-  };
-  static constexpr std::array QWERTY_ACTIONMAP{
-    AC_GRAVE, AC_1, AC_2, AC_3, AC_4, AC_5, AC_6, AC_7, AC_8, AC_9, AC_0, AC_MINUS, AC_EQUAL, AC_YEN,
-    AC_Q, AC_W, AC_E, AC_R, AC_T, AC_Y, AC_U, AC_I, AC_O, AC_P, AC_LBRACKET, AC_RBRACKET,
-    AC_A, AC_S, AC_D, AC_F, AC_G, AC_H, AC_J, AC_K, AC_L, AC_SCOLON, AC_QUOTE, AC_ENTER,
-    AC_Z, AC_X, AC_C, AC_V, AC_B, AC_N, AC_M, AC_COMMA, AC_DOT, AC_SLASH, AC_LAYER_OFFSET_RSHIFT,
-    // AC_LTHUMB_MUHENKAN, AC_RTHUMB_HENKAN,
-    AC_LAYER_TAP_LTHUMB_BSPACE, AC_LAYER_TAP_RTHUMB_ENTER, AC_DELETE,
-    AC_LAYER_OFFSET_LCTRL, AC_LAYER_OFFSET_LSHIFT, AC_LAYER_OFFSET_LALT, AC_LAYER_OFFSET_LGUI,
-    AC_LAYER_OFFSET_RCTRL, AC_LAYER_OFFSET_RSHIFT, AC_LAYER_OFFSET_RALT, AC_LAYER_OFFSET_RGUI,
-  };
-  static constexpr std::array SHIFTED_QWERTY_ACTIONMAP{
-    AC_TILDE, AC_EXCLAIM, AC_AT, AC_HASH, AC_DOLLAR, AC_PERCENT, AC_CIRCUMFLEX, AC_AMPERSAND, AC_ASTERISK, AC_LPAREN, AC_RPAREN, AC_UNDERSCORE, AC_PLUS, AC_PIPE,
-    AC_SHIFT_Q, AC_SHIFT_W, AC_SHIFT_E, AC_SHIFT_R, AC_SHIFT_T, AC_SHIFT_Y, AC_SHIFT_U, AC_SHIFT_I, AC_SHIFT_O, AC_SHIFT_P, AC_LBRACE, AC_RBRACE,
-    AC_SHIFT_A, AC_SHIFT_S, AC_SHIFT_D, AC_SHIFT_F, AC_SHIFT_G, AC_SHIFT_H, AC_SHIFT_J, AC_SHIFT_K, AC_SHIFT_L, AC_COLON, AC_DQUOTE, AC_SHIFT_ENTER,
-    AC_SHIFT_Z, AC_SHIFT_X, AC_SHIFT_C, AC_SHIFT_V, AC_SHIFT_B, AC_SHIFT_N, AC_SHIFT_M, AC_LT, AC_GT, AC_QUESTION, AC_LAYER_OFFSET_RSHIFT,
-    // AC_SHIFT_MUHENKAN, AC_SHIFT_HENKAN,
-    AC_SHIFT_BSPACE, AC_SHIFT_ENTER, AC_SHIFT_DELETE,
-    AC_LAYER_OFFSET_LCTRL, AC_LAYER_OFFSET_LSHIFT, AC_LAYER_OFFSET_LALT, AC_LAYER_OFFSET_LGUI,
-    AC_LAYER_OFFSET_RCTRL, AC_LAYER_OFFSET_RSHIFT, AC_LAYER_OFFSET_RALT, AC_LAYER_OFFSET_RGUI,
-  };
-  static constexpr std::array QWERTY_JP_ACTIONMAP{
-    AC_GRAVE, AC_1, AC_2, AC_3, AC_4, AC_5, AC_6, AC_7, AC_8, AC_9, AC_0, AC_MINUS, AC_EQUAL, AC_YEN,
-    AC_Q, AC_W, AC_E, AC_R, AC_T, AC_Y, AC_U, AC_I, AC_O, AC_P, AC_LBRACKET, AC_RBRACKET,
-    AC_A, AC_S, AC_D, AC_F, AC_G, AC_H, AC_J, AC_K, AC_L, AC_SCOLON, AC_QUOTE, AC_ENTER,
-    AC_Z, AC_X, AC_C, AC_V, AC_B, AC_N, AC_M, AC_COMMA, AC_DOT, AC_SLASH, AC_BSLASH,
-    // AC_LTHUMB_MUHENKAN, AC_RTHUMB_HENKAN,
-    AC_LAYER_TAP_LTHUMB_BSPACE, AC_LAYER_TAP_RTHUMB_ENTER, AC_DELETE,
-    AC_LCTRL, AC_LAYER_ON_OFF_LSHIFT_QWERTY_JP, AC_LALT, AC_LGUI,
-    AC_RCTRL, AC_LAYER_ON_OFF_RSHIFT_QWERTY_JP, AC_RALT, AC_RGUI,
-  };
-  static constexpr std::array SHIFTED_QWERTY_JP_ACTIONMAP{
-    AC_TILDE, AC_EXCLAIM, AC_AT, AC_HASH, AC_DOLLAR, AC_PERCENT, AC_CIRCUMFLEX, AC_AMPERSAND, AC_ASTERISK, AC_LPAREN, AC_RPAREN, AC_UNDERSCORE, AC_PLUS, AC_PIPE,
-    AC_SHIFT_Q, AC_SHIFT_W, AC_SHIFT_E, AC_SHIFT_R, AC_SHIFT_T, AC_SHIFT_Y, AC_SHIFT_U, AC_SHIFT_I, AC_SHIFT_O, AC_SHIFT_P, AC_LBRACE, AC_RBRACE,
-    AC_SHIFT_A, AC_SHIFT_S, AC_SHIFT_D, AC_SHIFT_F, AC_SHIFT_G, AC_SHIFT_H, AC_SHIFT_J, AC_SHIFT_K, AC_SHIFT_L, AC_COLON, AC_DQUOTE, AC_SHIFT_ENTER,
-    AC_SHIFT_Z, AC_SHIFT_X, AC_SHIFT_C, AC_SHIFT_V, AC_SHIFT_B, AC_SHIFT_N, AC_SHIFT_M, AC_LT, AC_GT, AC_QUESTION, AC_UNDERSCORE,
-    // AC_SHIFT_MUHENKAN, AC_SHIFT_HENKAN,
-    AC_SHIFT_BSPACE, AC_SHIFT_ENTER, AC_SHIFT_DELETE,
-    AC_LCTRL, AC_LAYER_ON_OFF_LSHIFT_QWERTY_JP, AC_LALT, AC_LGUI,
-    AC_RCTRL, AC_LAYER_ON_OFF_RSHIFT_QWERTY_JP, AC_RALT, AC_RGUI,
-  };
-  static constexpr std::array LTHUMB_ACTIONMAP{  // WIP
-    AC_HANKAKU_ZENKAKU, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO,
-    AC_NO, AC_MINUS, AC_PLUS, AC_NO, AC_NO, AC_NO, AC_NO, AC_PIPE, AC_TILDE, AC_NO, AC_GRAVE, AC_NO,
-    AC_LBRACKET, AC_ASTERISK, AC_LBRACE, AC_LPAREN, AC_HASH, AC_DOLLAR, AC_RPAREN, AC_RBRACE, AC_AMPERSAND, AC_RBRACKET, AC_NO, AC_NO,
-    AC_NO, AC_PERCENT, AC_EXCLAIM, AC_BSLASH, AC_NO, AC_NO, AC_AT, AC_CIRCUMFLEX, AC_RIGHT_ARROW, AC_BLOCK_COMMENT_BEGIN, AC_NO,
-    // AC_LTHUMB_MUHENKAN, AC_RTHUMB_HENKAN,
-    AC_LAYER_TAP_LTHUMB_BSPACE, AC_LAYER_MOVE_HENKAN, AC_SHIFT_CAPS_LOCK,
-    AC_LCTRL, AC_LSHIFT, AC_LALT, AC_LGUI,
-    AC_RCTRL, AC_RSHIFT, AC_RALT, AC_RGUI,
-  };
-  static constexpr std::array RTHUMB_ACTIONMAP{  // WIP
-    AC_HANKAKU_ZENKAKU, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO, AC_NO,
-    AC_NO, AC_MINUS, AC_PLUS, AC_NO, AC_NO, AC_NO, AC_NO, AC_PIPE, AC_TILDE, AC_NO, AC_GRAVE, AC_NO,
-    AC_LBRACKET, AC_ASTERISK, AC_LBRACE, AC_LPAREN, AC_HASH, AC_DOLLAR, AC_RPAREN, AC_RBRACE, AC_AMPERSAND, AC_RBRACKET, AC_NO, AC_NO,
-    AC_NO, AC_PERCENT, AC_EXCLAIM, AC_BSLASH, AC_NO, AC_NO, AC_AT, AC_CIRCUMFLEX, AC_RIGHT_ARROW, AC_BLOCK_COMMENT_BEGIN, AC_NO,
-    // AC_LTHUMB_MUHENKAN, AC_RTHUMB_HENKAN,
-    AC_LAYER_MOVE_MUHENKAN, AC_LAYER_TAP_RTHUMB_ENTER, AC_KATAKANA_HIRAGANA,
-    AC_LCTRL, AC_LSHIFT, AC_LALT, AC_LGUI,
-    AC_RCTRL, AC_RSHIFT, AC_RALT, AC_RGUI,
-  };
-  static constexpr std::array OTHERS_ACTIONMAP{
-    AC_ESCAPE, AC_F1, AC_F2, AC_F3, AC_F4, AC_F5, AC_F6, AC_F7, AC_F8, AC_F9, AC_F10, AC_F11, AC_F12,
-    AC_BSPACE, AC_TAB, AC_CAPSLOCK, AC_ENTER, AC_SPACE, AC_APPLICATION,
-
-    AC_PSCREEN, AC_SCROLLLOCK, AC_PAUSE,
-    AC_INSERT, AC_HOME, AC_PGUP,
-    AC_DELETE, AC_END, AC_PGDOWN,
-
-    AC_UP,
-    AC_LEFT, AC_DOWN, AC_RIGHT,
-
-    AC_NUMLOCK, AC_KP_SLASH, AC_KP_ASTERISK, AC_KP_MINUS,
-    AC_KP_7, AC_KP_8, AC_KP_9,
-    AC_KP_4, AC_KP_5, AC_KP_6, AC_KP_PLUS,
-    AC_KP_1, AC_KP_2, AC_KP_3,
-    AC_KP_0, AC_KP_DOT, AC_KP_ENTER,
-
-    AC_AUDIO_MUTE, AC_AUDIO_VOL_DOWN, AC_AUDIO_VOL_UP, AC_MICROPHONE_MUTE, AC_MEDIA_PREV_TRACK, AC_MEDIA_PLAY_PAUSE, AC_MEDIA_NEXT_TRACK,
-  };
-  /* clang-format on */
-
-  static constexpr size_t MAIN_ACTIONMAP_SIZE = COLEMAK_P_ACTIONMAP.size();
-  static constexpr size_t OTHERS_ACTIONMAP_SIZE = OTHERS_ACTIONMAP.size();
-  static constexpr size_t MAIN_ACTIONMAP_END = MAIN_ACTIONMAP_SIZE;
-  static constexpr size_t OTHERS_ACTIONMAP_END = MAIN_ACTIONMAP_END + OTHERS_ACTIONMAP_SIZE;
-
-  const size_t index = pos.row * MATRIX_COLS + pos.col;
-  if (index < MAIN_ACTIONMAP_END) {
-    switch (layer) {
-      case L_COLEMAK_P:
-        return COLEMAK_P_ACTIONMAP[index];
-      case L_LSHIFT_COLEMAK_P:
-        return SHIFTED_COLEMAK_P_ACTIONMAP[index];
-      case L_RSHIFT_COLEMAK_P:
-        return set_right_mods(SHIFTED_COLEMAK_P_ACTIONMAP[index]);
-      case L_QWERTY:
-        return QWERTY_ACTIONMAP[index];
-      case L_LSHIFT_QWERTY:
-        return SHIFTED_QWERTY_ACTIONMAP[index];
-      case L_RSHIFT_QWERTY:
-        return set_right_mods(SHIFTED_QWERTY_ACTIONMAP[index]);
-      case L_QWERTY_JP:
-        return QWERTY_JP_ACTIONMAP[index];
-      case L_LSHIFT_QWERTY_JP:
-        return SHIFTED_QWERTY_JP_ACTIONMAP[index];
-      case L_RSHIFT_QWERTY_JP:
-        return set_right_mods(SHIFTED_QWERTY_JP_ACTIONMAP[index]);
-      case L_LTHUMB:
-        return LTHUMB_ACTIONMAP[index];
-      case L_RTHUMB:
-        return RTHUMB_ACTIONMAP[index];
-      default:
-        return ACTION_NO;
-    }
-  } else if (index < OTHERS_ACTIONMAP_END) {
-    // シフトをそのまま適用するキーを個別に扱う
-    const size_t i = index - MAIN_ACTIONMAP_END;
-    switch (layer) {
-      case L_COLEMAK_P:
-      case L_QWERTY:
-      case L_QWERTY_JP:
-      case L_LTHUMB:
-      case L_RTHUMB:
-        return OTHERS_ACTIONMAP[i];
+/**
+ * @brief 主要キーの定義を作る
+ *
+ * 右シフト付きのレイヤーは、左シフト付きのレイヤーのアクションを右修飾キーに置き換えて作る。
+ */
+consteval KeyBinding<LAYER_COUNT> main_key(Key key, action_t colemak_p, action_t shifted_colemak_p, action_t qwerty, action_t shifted_qwerty,
+                                           action_t qwerty_jp, action_t shifted_qwerty_jp, action_t lthumb, action_t rthumb,
+                                           bool tapping = false) {
+  return {key,
+          {
+              colemak_p, shifted_colemak_p, set_right_mods(shifted_colemak_p),
+              qwerty, shifted_qwerty, set_right_mods(shifted_qwerty),
+              qwerty_jp, shifted_qwerty_jp, set_right_mods(shifted_qwerty_jp),
+              lthumb, rthumb,
+          },
+          tapping};
+}
 
-      case L_LSHIFT_COLEMAK_P:
-      case L_LSHIFT_QWERTY:
-      case L_LSHIFT_QWERTY_JP:
-        return add_mods(OTHERS_ACTIONMAP[i], MOD_LSFT);
+/**
+ * @brief シフトをそのまま適用するキーの定義を作る
+ */
+consteval KeyBinding<LAYER_COUNT> other_key(Key key, action_t action, bool tapping = false) {
+  const auto lshifted = add_mods(action, MOD_LSFT);
+  const auto rshifted = add_mods(action, MOD_RSFT);
+  return {key,
+          {
+              action, lshifted, rshifted,
+              action, lshifted, rshifted,
+              action, lshifted, rshifted,
+              action, action,
+          },
+          tapping};
+}
 
-      case L_RSHIFT_COLEMAK_P:
-      case L_RSHIFT_QWERTY:
-      case L_RSHIFT_QWERTY_JP:
-        return add_mods(OTHERS_ACTIONMAP[i], MOD_RSFT);
+/**
+ * @brief キーの配置とレイヤーごとのアクション
+ *
+ * 並べた順に仮想キーボードのキーが割り当てられる。
+ */
+constexpr Layout<LAYER_COUNT> LAYOUT{
+    /* clang-format off */
+    //       キー                 Colemak                     +Shift                  QWERTY                      +Shift                  QWERTY (JP)                       +Shift                            左親指                      右親指
+    main_key(K_HANKAKU_ZENKAKU,   AC_GRAVE,                   AC_TILDE,               AC_GRAVE,                   AC_TILDE,               AC_GRAVE,                         AC_TILDE,                         AC_HANKAKU_ZENKAKU,         AC_HANKAKU_ZENKAKU, true),
+    main_key(K_1,                 AC_1,                       AC_EXCLAIM,             AC_1,                       AC_EXCLAIM,             AC_1,                             AC_EXCLAIM,                       AC_NO,                      AC_NO),
+    main_key(K_2,                 AC_2,                       AC_AT,                  AC_2,                       AC_AT,                  AC_2,                             AC_AT,                            AC_NO,                      AC_NO),
+    main_key(K_3,                 AC_3,                       AC_HASH,                AC_3,                       AC_HASH,                AC_3,                             AC_HASH,                          AC_NO,                      AC_NO),
+    main_key(K_4,                 AC_4,                       AC_DOLLAR,              AC_4,                       AC_DOLLAR,              AC_4,                             AC_DOLLAR,                        AC_NO,                      AC_NO),
+    main_key(K_5,                 AC_5,                       AC_PERCENT,             AC_5,                       AC_PERCENT,             AC_5,                             AC_PERCENT,                       AC_NO,                      AC_NO),
+    main_key(K_6,                 AC_6,                       AC_CIRCUMFLEX,          AC_6,                       AC_CIRCUMFLEX,          AC_6,                             AC_CIRCUMFLEX,                    AC_NO,                      AC_NO),
+    main_key(K_7,                 AC_7,                       AC_AMPERSAND,           AC_7,                       AC_AMPERSAND,           AC_7,                             AC_AMPERSAND,                     AC_NO,                      AC_NO),
+    main_key(K_8,                 AC_8,                       AC_ASTERISK,            AC_8,                       AC_ASTERISK,            AC_8,                             AC_ASTERISK,                      AC_NO,                      AC_NO),
+    main_key(K_9,                 AC_9,                       AC_LPAREN,              AC_9,                       AC_LPAREN,              AC_9,                             AC_LPAREN,                        AC_NO,                      AC_NO),
+    main_key(K_0,                 AC_0,                       AC_RPAREN,              AC_0,                       AC_RPAREN,              AC_0,                             AC_RPAREN,                        AC_NO,                      AC_NO),
+    main_key(K_MINUS,             AC_LBRACKET,                AC_LBRACE,              AC_MINUS,                   AC_UNDERSCORE,          AC_MINUS,                         AC_UNDERSCORE,                    AC_NO,                      AC_NO),
+    main_key(K_CIRCUMFLEX,        AC_RBRACKET,                AC_RBRACE,              AC_EQUAL,                   AC_PLUS,                AC_EQUAL,                         AC_PLUS,                          AC_NO,                      AC_NO),
+    main_key(K_YEN,               AC_YEN,                     AC_PIPE,                AC_YEN,                     AC_PIPE,                AC_YEN,                           AC_PIPE,                          AC_NO,                      AC_NO),
+    main_key(K_Q,                 AC_Q,                       AC_SHIFT_Q,             AC_Q,                       AC_SHIFT_Q,             AC_Q,                             AC_SHIFT_Q,                       AC_NO,                      AC_NO),
+    main_key(K_W,                 AC_W,                       AC_SHIFT_W,             AC_W,                       AC_SHIFT_W,             AC_W,                             AC_SHIFT_W,                       AC_MINUS,                   AC_MINUS),
+    main_key(K_E,                 AC_F,                       AC_SHIFT_F,             AC_E,                       AC_SHIFT_E,             AC_E,                             AC_SHIFT_E,                       AC_PLUS,                    AC_PLUS),
+    main_key(K_R,                 AC_P,                       AC_SHIFT_P,             AC_R,                       AC_SHIFT_R,             AC_R,                             AC_SHIFT_R,                       AC_NO,                      AC_NO),
+    main_key(K_T,                 AC_G,                       AC_SHIFT_G,             AC_T,                       AC_SHIFT_T,             AC_T,                             AC_SHIFT_T,                       AC_NO,                      AC_NO),
+    main_key(K_Y,                 AC_J,                       AC_SHIFT_J,             AC_Y,                       AC_SHIFT_Y,             AC_Y,                             AC_SHIFT_Y,                       AC_NO,                      AC_NO),
+    main_key(K_U,                 AC_L,                       AC_SHIFT_L,             AC_U,                       AC_SHIFT_U,             AC_U,                             AC_SHIFT_U,                       AC_NO,                      AC_NO),
+    main_key(K_I,                 AC_U,                       AC_SHIFT_U,             AC_I,                       AC_SHIFT_I,             AC_I,                             AC_SHIFT_I,                       AC_PIPE,                    AC_PIPE),
+    main_key(K_O,                 AC_Y,                       AC_SHIFT_Y,             AC_O,                       AC_SHIFT_O,             AC_O,                             AC_SHIFT_O,                       AC_TILDE,                   AC_TILDE),
+    main_key(K_P,                 AC_SCOLON,                  AC_COLON,               AC_P,                       AC_SHIFT_P,             AC_P,                             AC_SHIFT_P,                       AC_NO,                      AC_NO),
+    main_key(K_AT,                AC_QUOTE,                   AC_DQUOTE,              AC_LBRACKET,                AC_LBRACE,              AC_LBRACKET,                      AC_LBRACE,                        AC_GRAVE,                   AC_GRAVE),
+    main_key(K_LBRACKET,          AC_EQUAL,                   AC_PLUS,                AC_RBRACKET,                AC_RBRACE,              AC_RBRACKET,                      AC_RBRACE,                        AC_NO,                      AC_NO),
+    main_key(K_A,                 AC_A,                       AC_SHIFT_A,             AC_A,                       AC_SHIFT_A,             AC_A,                             AC_SHIFT_A,                       AC_LBRACKET,                AC_LBRACKET),
+    main_key(K_S,                 AC_R,                       AC_SHIFT_R,             AC_S,                       AC_SHIFT_S,             AC_S,                             AC_SHIFT_S,                       AC_ASTERISK,                AC_ASTERISK),
+    main_key(K_D,                 AC_S,                       AC_SHIFT_S,             AC_D,                       AC_SHIFT_D,             AC_D,                             AC_SHIFT_D,                       AC_LBRACE,                  AC_LBRACE),
+    main_key(K_F,                 AC_T,                       AC_SHIFT_T,             AC_F,                       AC_SHIFT_F,             AC_F,                             AC_SHIFT_F,                       AC_LPAREN,                  AC_LPAREN),
+    main_key(K_G,                 AC_D,                       AC_SHIFT_D,             AC_G,                       AC_SHIFT_G,             AC_G,                             AC_SHIFT_G,                       AC_HASH,                    AC_HASH),
+    main_key(K_H,                 AC_H,                       AC_SHIFT_H,             AC_H,                       AC_SHIFT_H,             AC_H,                             AC_SHIFT_H,                       AC_DOLLAR,                  AC_DOLLAR),
+    main_key(K_J,                 AC_N,                       AC_SHIFT_N,             AC_J,                       AC_SHIFT_J,             AC_J,                             AC_SHIFT_J,                       AC_RPAREN,                  AC_RPAREN),
+    main_key(K_K,                 AC_E,                       AC_SHIFT_E,             AC_K,                       AC_SHIFT_K,             AC_K,                             AC_SHIFT_K,                       AC_RBRACE,                  AC_RBRACE),
+    main_key(K_L,                 AC_I,                       AC_SHIFT_I,             AC_L,                       AC_SHIFT_L,             AC_L,                             AC_SHIFT_L,                       AC_AMPERSAND,               AC_AMPERSAND),
+    main_key(K_SCOLON,            AC_O,                       AC_SHIFT_O,             AC_SCOLON,                  AC_COLON,               AC_SCOLON,                        AC_COLON,                         AC_RBRACKET,                AC_RBRACKET),
+    main_key(K_COLON,             AC_UNDERSCORE,              AC_EQUAL,               AC_QUOTE,                   AC_DQUOTE,              AC_QUOTE,                         AC_DQUOTE,                        AC_NO,                      AC_NO),
+    main_key(K_RBRACKET,          AC_ENTER,                   AC_SHIFT_ENTER,         AC_ENTER,                   AC_SHIFT_ENTER,         AC_ENTER,                         AC_SHIFT_ENTER,                   AC_NO,                      AC_NO),
+    main_key(K_Z,                 AC_Z,                       AC_SHIFT_Z,             AC_Z,                       AC_SHIFT_Z,             AC_Z,                             AC_SHIFT_Z,                       AC_NO,                      AC_NO),
+    main_key(K_X,                 AC_X,                       AC_SHIFT_X,             AC_X,                       AC_SHIFT_X,             AC_X,                             AC_SHIFT_X,                       AC_PERCENT,                 AC_PERCENT),
+    main_key(K_C,                 AC_C,                       AC_SHIFT_C,             AC_C,                       AC_SHIFT_C,             AC_C,                             AC_SHIFT_C,                       AC_EXCLAIM,                 AC_EXCLAIM),
+    main_key(K_V,                 AC_V,                       AC_SHIFT_V,             AC_V,                       AC_SHIFT_V,             AC_V,                             AC_SHIFT_V,                       AC_BSLASH,                  AC_BSLASH),
+    main_key(K_B,                 AC_B,                       AC_SHIFT_B,             AC_B,                       AC_SHIFT_B,             AC_B,                             AC_SHIFT_B,                       AC_NO,                      AC_NO),
+    main_key(K_N,                 AC_K,                       AC_SHIFT_K,             AC_N,                       AC_SHIFT_N,             AC_N,                             AC_SHIFT_N,                       AC_NO,                      AC_NO),
+    main_key(K_M,                 AC_M,                       AC_SHIFT_M,             AC_M,                       AC_SHIFT_M,             AC_M,                             AC_SHIFT_M,                       AC_AT,                      AC_AT),
+    main_key(K_COMMA,             AC_COMMA,                   AC_LT,                  AC_COMMA,                   AC_LT,                  AC_COMMA,                         AC_LT,                            AC_CIRCUMFLEX,              AC_CIRCUMFLEX),
+    main_key(K_DOT,               AC_DOT,                     AC_GT,                  AC_DOT,                     AC_GT,                  AC_DOT,                           AC_GT,                            AC_RIGHT_ARROW,             AC_RIGHT_ARROW),
+    main_key(K_SLASH,             AC_SLASH,                   AC_QUESTION,            AC_SLASH,                   AC_QUESTION,            AC_SLASH,                         AC_QUESTION,                      AC_BLOCK_COMMENT_BEGIN,     AC_BLOCK_COMMENT_BEGIN),
+    main_key(K_BSLASH,            AC_LAYER_OFFSET_RSHIFT,     AC_LAYER_OFFSET_RSHIFT, AC_LAYER_OFFSET_RSHIFT,     AC_LAYER_OFFSET_RSHIFT, AC_BSLASH,                        AC_UNDERSCORE,                    AC_NO,                      AC_NO),
+    main_key(K_MUHENKAN,          AC_LAYER_TAP_LTHUMB_BSPACE, AC_SHIFT_BSPACE,        AC_LAYER_TAP_LTHUMB_BSPACE, AC_SHIFT_BSPACE,        AC_LAYER_TAP_LTHUMB_BSPACE,       AC_SHIFT_BSPACE,                  AC_LAYER_TAP_LTHUMB_BSPACE, AC_LAYER_MOVE_MUHENKAN),
+    main_key(K_HENKAN,            AC_LAYER_TAP_RTHUMB_ENTER,  AC_SHIFT_ENTER,         AC_LAYER_TAP_RTHUMB_ENTER,  AC_SHIFT_ENTER,         AC_LAYER_TAP_RTHUMB_ENTER,        AC_SHIFT_ENTER,                   AC_LAYER_MOVE_HENKAN,       AC_LAYER_TAP_RTHUMB_ENTER),
+    main_key(K_KATAKANA_HIRAGANA, AC_DELETE,                  AC_SHIFT_DELETE,        AC_DELETE,                  AC_SHIFT_DELETE,        AC_DELETE,                        AC_SHIFT_DELETE,                  AC_SHIFT_CAPS_LOCK,         AC_KATAKANA_HIRAGANA, true),
+    main_key(K_LCTRL,             AC_LAYER_OFFSET_LCTRL,      AC_LAYER_OFFSET_LCTRL,  AC_LAYER_OFFSET_LCTRL,      AC_LAYER_OFFSET_LCTRL,  AC_LCTRL,                         AC_LCTRL,                         AC_LCTRL,                   AC_LCTRL),
+    main_key(K_LSHIFT,            AC_LAYER_OFFSET_LSHIFT,     AC_LAYER_OFFSET_LSHIFT, AC_LAYER_OFFSET_LSHIFT,     AC_LAYER_OFFSET_LSHIFT, AC_LAYER_ON_OFF_LSHIFT_QWERTY_JP, AC_LAYER_ON_OFF_LSHIFT_QWERTY_JP, AC_LSHIFT,                  AC_LSHIFT),
+    main_key(K_LALT,              AC_LAYER_OFFSET_LALT,       AC_LAYER_OFFSET_LALT,   AC_LAYER_OFFSET_LALT,       AC_LAYER_OFFSET_LALT,   AC_LALT,                          AC_LALT,                          AC_LALT,                    AC_LALT),
+    main_key(K_LGUI,              AC_LAYER_OFFSET_LGUI,       AC_LAYER_OFFSET_LGUI,   AC_LAYER_OFFSET_LGUI,       AC_LAYER_OFFSET_LGUI,   AC_LGUI,                          AC_LGUI,                          AC_LGUI,                    AC_LGUI),
+    main_key(K_RCTRL,             AC_LAYER_OFFSET_RCTRL,      AC_LAYER_OFFSET_RCTRL,  AC_LAYER_OFFSET_RCTRL,      AC_LAYER_OFFSET_RCTRL,  AC_RCTRL,                         AC_RCTRL,                         AC_RCTRL,                   AC_RCTRL),
+    main_key(K_RSHIFT,            AC_LAYER_OFFSET_RSHIFT,     AC_LAYER_OFFSET_RSHIFT, AC_LAYER_OFFSET_RSHIFT,     AC_LAYER_OFFSET_RSHIFT, AC_LAYER_ON_OFF_RSHIFT_QWERTY_JP, AC_LAYER_ON_OFF_RSHIFT_QWERTY_JP, AC_RSHIFT,                  AC_RSHIFT),
+    main_key(K_RALT,              AC_LAYER_OFFSET_RALT,       AC_LAYER_OFFSET_RALT,   AC_LAYER_OFFSET_RALT,       AC_LAYER_OFFSET_RALT,   AC_RALT,                          AC_RALT,                          AC_RALT,                    AC_RALT),
+    main_key(K_RGUI,              AC_LAYER_OFFSET_RGUI,       AC_LAYER_OFFSET_RGUI,   AC_LAYER_OFFSET_RGUI,       AC_LAYER_OFFSET_RGUI,   AC_RGUI,                          AC_RGUI,                          AC_RGUI,                    AC_RGUI),
+    // 以下は物理キーボードにあるがどのレイヤーでも同じ役割のキー
+    other_key(K_ESCAPE,           AC_ESCAPE),
+    other_key(K_F1,               AC_F1),
+    other_key(K_F2,               AC_F2),
+    other_key(K_F3,               AC_F3),
+    other_key(K_F4,               AC_F4),
+    other_key(K_F5,               AC_F5),
+    other_key(K_F6,               AC_F6),
+    other_key(K_F7,               AC_F7),
+    other_key(K_F8,               AC_F8),
+    other_key(K_F9,               AC_F9),
+    other_key(K_F10,              AC_F10),
+    other_key(K_F11,              AC_F11),
+    other_key(K_F12,              AC_F12),
+    other_key(K_BSPACE,           AC_BSPACE),
+    other_key(K_TAB,              AC_TAB),
+    other_key(K_CAPSLOCK,         AC_CAPSLOCK, true),
+    other_key(K_ENTER,            AC_ENTER),
+    other_key(K_SPACE,            AC_SPACE),
+    other_key(K_APPLICATION,      AC_APPLICATION),
+    other_key(K_PSCREEN,          AC_PSCREEN),
+    other_key(K_SCROLLLOCK,       AC_SCROLLLOCK),
+    other_key(K_PAUSE,            AC_PAUSE),
+    other_key(K_INSERT,           AC_INSERT),
+    other_key(K_HOME,             AC_HOME),
+    other_key(K_PGUP,             AC_PGUP),
+    other_key(K_DELETE,           AC_DELETE),
+    other_key(K_END,              AC_END),
+    other_key(K_PGDOWN,           AC_PGDOWN),
+    other_key(K_UP,               AC_UP),
+    other_key(K_LEFT,             AC_LEFT),
+    other_key(K_DOWN,             AC_DOWN),
+    other_key(K_RIGHT,            AC_RIGHT),
+    other_key(K_NUMLOCK,          AC_NUMLOCK),
+    other_key(K_KP_SLASH,         AC_KP_SLASH),
+    other_key(K_KP_ASTERISK,      AC_KP_ASTERISK),
+    other_key(K_KP_MINUS,         AC_KP_MINUS),
+    other_key(K_KP_7,             AC_KP_7),
+    other_key(K_KP_8,             AC_KP_8),
+    other_key(K_KP_9,             AC_KP_9),
+    other_key(K_KP_4,             AC_KP_4),
+    other_key(K_KP_5,             AC_KP_5),
+    other_key(K_KP_6,             AC_KP_6),
+    other_key(K_KP_PLUS,          AC_KP_PLUS),
+    other_key(K_KP_1,             AC_KP_1),
+    other_key(K_KP_2,             AC_KP_2),
+    other_key(K_KP_3,             AC_KP_3),
+    other_key(K_KP_0,             AC_KP_0),
+    other_key(K_KP_DOT,           AC_KP_DOT),
+    other_key(K_KP_ENTER,         AC_KP_ENTER),
+    other_key(K_AUDIO_MUTE,       AC_AUDIO_MUTE),
+    other_key(K_AUDIO_VOL_DOWN,   AC_AUDIO_VOL_DOWN),
+    other_key(K_AUDIO_VOL_UP,     AC_AUDIO_VOL_UP),
+    other_key(Key{0x102},         AC_MICROPHONE_MUTE),
+    other_key(K_MEDIA_PREV_TRACK, AC_MEDIA_PREV_TRACK),
+    other_key(K_MEDIA_PLAY_PAUSE, AC_MEDIA_PLAY_PAUSE),
+    other_key(K_MEDIA_NEXT_TRACK, AC_MEDIA_NEXT_TRACK),
+    /* clang-format on */
+};
 
-      default:
-        return ACTION_NO;
-    }
-  }
-  return ACTION_NO;
+extern "C" {
+action_t action_for_key(uint8_t layer, keypos_t pos) {
+  return LAYOUT.action(layer, pos);
 }
 
 const macro_t* action_get_macro(keyrecord_t* record, uint8_t id, [[maybe_unused]] uint8_t opt) {
@@ -328,61 +334,23 @@ void action_function(keyrecord_t* record, uint8_t id, uint8_t opt) {
   }
 }
 }  // extern "C"
-}  // namespace tmk_desktop
-
-#ifdef _WIN32
-#include <tmk_desktop/win32/settings.hpp>
 
-namespace tmk_desktop::inline win32 {
-using namespace jp109;
-
-const KeyToKeyposTable key_to_keypos_table = [] {
-  /* clang-format off */
-  const std::array KEYS{
-    K_HANKAKU_ZENKAKU, K_1, K_2, K_3, K_4, K_5, K_6, K_7, K_8, K_9, K_0, K_MINUS, K_CIRCUMFLEX, K_YEN,
-    K_Q, K_W, K_E, K_R, K_T, K_Y, K_U, K_I, K_O, K_P, K_AT, K_LBRACKET,
-    K_A, K_S, K_D, K_F, K_G, K_H, K_J, K_K, K_L, K_SCOLON, K_COLON, K_RBRACKET,
-    K_Z, K_X, K_C, K_V, K_B, K_N, K_M, K_COMMA, K_DOT, K_SLASH, K_BSLASH,
-    K_MUHENKAN, K_HENKAN, K_KATAKANA_HIRAGANA,
-    K_LCTRL, K_LSHIFT, K_LALT, K_LGUI,
-    K_RCTRL, K_RSHIFT, K_RALT, K_RGUI,
-
-    K_ESCAPE, K_F1, K_F2, K_F3, K_F4, K_F5, K_F6, K_F7, K_F8, K_F9, K_F10, K_F11, K_F12,
-    K_BSPACE, K_TAB, K_CAPSLOCK, K_ENTER, K_SPACE, K_APPLICATION,
-    K_PSCREEN, K_SCROLLLOCK, K_PAUSE,
-    K_INSERT, K_HOME, K_PGUP,
-    K_DELETE, K_END, K_PGDOWN,
-    K_UP,
-    K_LEFT, K_DOWN, K_RIGHT,
-    K_NUMLOCK, K_KP_SLASH, K_KP_ASTERISK, K_KP_MINUS,
-    K_KP_7, K_KP_8, K_KP_9,
-    K_KP_4, K_KP_5, K_KP_6, K_KP_PLUS,
-    K_KP_1, K_KP_2, K_KP_3,
-    K_KP_0, K_KP_DOT, K_KP_ENTER,
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+bool init_keymap_plugin() noexcept {
+  // 引き継いだレイヤーの状態がこのキーマップのレイヤー数に収まらなければ、差し替えを取りやめる
+  return (layer_state >> LAYER_COUNT) == 0 && (default_layer_state >> LAYER_COUNT) == 0;
+}
 
-    // Key{0x102}は自環境でのマイクミュートキーのコード
-    K_AUDIO_MUTE, K_AUDIO_VOL_DOWN, K_AUDIO_VOL_UP, Key{0x102}, K_MEDIA_PREV_TRACK, K_MEDIA_PLAY_PAUSE, K_MEDIA_NEXT_TRACK,
-  };
-  /* clang-format on */
+void deinit_keymap_plugin() noexcept {}
+#endif
+}  // namespace tmk_desktop
 
-  KeyToKeyposTable t{};
-  std::fill(t.begin(), t.end(), keypos_t{0xff, 0xff});
-  for (size_t i = 0; auto key : KEYS) {
-    t[key] = keypos_t{static_cast<uint8_t>(i % MATRIX_COLS), static_cast<uint8_t>(i / MATRIX_COLS)};
-    i++;
-  }
-  return t;
-}();
+#if defined(_WIN32) || defined(TMK_DESKTOP_EVDEV) || defined(TMK_DESKTOP_HEADLESS)
+#include <tmk_desktop/settings.hpp>
 
-const TappingKeyTable tapping_key_table = [] {
-  const std::array KEYS{K_HANKAKU_ZENKAKU, K_CAPSLOCK, K_KATAKANA_HIRAGANA};
-  TappingKeyTable t{};
-  for (auto key : KEYS) {
-    t[key] = true;
-  }
-  return t;
-}();
+// 変換表はプラットフォームごとの名前空間にあるので、修飾名で定義する
+const tmk_desktop::KeyToKeyposTable tmk_desktop::key_to_keypos_table = tmk_desktop::LAYOUT.key_to_keypos_table;
+const tmk_desktop::TappingKeyTable tmk_desktop::tapping_key_table = tmk_desktop::LAYOUT.tapping_key_table;
 
-// const KeycodeToScancodeTable keycode_to_scancode_table{};
-}  // namespace tmk_desktop::inline win32
+// const tmk_desktop::KeycodeToScancodeTable tmk_desktop::keycode_to_scancode_table{};
 #endif
@@ -84,9 +84,11 @@ inline void layer_translate(uint8_t keycode, bool pressed, size_t offset) noexce
 
 /**
  * @brief アクションに修飾キーを追加する
+ *
+ * 定数式で使えるように、共用体のメンバーはcodeだけを読み書きする。
  */
-inline action_t add_mods(action_t action, uint16_t mods) noexcept {
-  switch (action.kind.id) {
+constexpr action_t add_mods(action_t action, uint16_t mods) noexcept {
+  switch (action.code >> 12) {
     case ACT_LMODS:
     case ACT_RMODS:
       action.code |= mods & 0x1f00;
@@ -97,11 +99,13 @@ inline action_t add_mods(action_t action, uint16_t mods) noexcept {
 
 /**
  * @brief アクションが右修飾キーを使うようにする
+ *
+ * 定数式で使えるように、共用体のメンバーはcodeだけを読み書きする。
  */
-inline action_t set_right_mods(action_t action) noexcept {
-  switch (action.kind.id) {
+constexpr action_t set_right_mods(action_t action) noexcept {
+  switch (action.code >> 12) {
     case ACT_LMODS:
-      action.key.kind = ACT_RMODS;
+      action.code = static_cast<uint16_t>((action.code & 0x0fff) | (ACT_RMODS << 12));
       break;
   }
   return action;
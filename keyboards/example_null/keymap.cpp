@@ -11,27 +11,24 @@ extern "C" {
 extern const action_t actionmaps[/* layers */][MATRIX_ROWS][MATRIX_COLS] = {};
 }  // extern "C"
 
-// Win32アプリケーションに必要なもの
-#ifdef _WIN32
-#include <tmk_desktop/win32/settings.hpp>
-
-namespace tmk_desktop::inline win32 {
+// 各プラットフォームに必要なもの
+#if defined(_WIN32) || defined(TMK_DESKTOP_EVDEV) || defined(TMK_DESKTOP_HEADLESS)
+#include <tmk_desktop/settings.hpp>
 
 /**
  * @brief キーからkeypos_tへの変換表
  */
-const KeyToKeyposTable key_to_keypos_table{};
+const tmk_desktop::KeyToKeyposTable tmk_desktop::key_to_keypos_table{};
 
 /**
  * @brief 押すと同時に離すキーを示すフラグ列
  */
-const TappingKeyTable tapping_key_table{};
+const tmk_desktop::TappingKeyTable tmk_desktop::tapping_key_table{};
 
 /**
- * @brief キーコードからスキャンコードへの変換表
+ * @brief キーコードからスキャンコードへの変換表 (Win32のみ)
  *
  * デフォルト値が用意されるが、独自の対応表が欲しければここで定義する。
  */
-// const KeycodeToScancodeTable keycode_to_scancode_table{};
-}  // namespace tmk_desktop::inline win32
+// const tmk_desktop::KeycodeToScancodeTable tmk_desktop::keycode_to_scancode_table{};
 #endif
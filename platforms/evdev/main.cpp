@@ -0,0 +1,160 @@
+/**
+ * @file main.cpp
+ * @brief Linux (evdev) アプリケーション
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * キーボードを奪い、SIGINTかSIGTERMを受けるまで仮想キーボードに出力し続ける。
+ * SIGUSR1を受けると、フライトレコーダーの記録を$XDG_STATE_HOME/tmk_desktop/tmk_desktop.flightに書き出す。
+ * ステージが異常停止したときも書き出す。書き出した先か失敗したことは標準エラー出力に知らせる。
+ * /dev/input/event*と/dev/uinputを読み書きできる権限が必要になる。
+ */
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <signal.h>
+#include <tmk_desktop/flight_recorder.hpp>
+#include <tmk_desktop/source.hpp>
+#include <tmk_desktop/keyboard.hpp>
+#include <tmk_desktop/sink.hpp>
+
+namespace tmk_desktop {
+namespace {
+const char* const FLIGHT_RECORD_FILE_NAME = "tmk_desktop.flight";  ///< フライトレコーダーの記録を書き出すファイルの名前
+
+pthread_t main_thread_{};                   ///< メインスレッド
+std::string flight_record_path_;            ///< フライトレコーダーの記録を書き出すファイル
+std::exception_ptr source_ep_ = nullptr;    ///< Sourceスレッドで投げられた例外
+std::exception_ptr keyboard_ep_ = nullptr;  ///< Keyboardスレッドで投げられた例外
+std::exception_ptr sink_ep_ = nullptr;      ///< Sinkスレッドで投げられた例外
+
+/**
+ * @brief スコープ終わりに関数を呼び出すクラス
+ */
+template <typename Dtor>
+class Scoped {
+public:
+  Scoped(Dtor dtor) : dtor_(std::move(dtor)) {}
+  ~Scoped() {
+    dtor_();
+  }
+
+private:
+  Dtor dtor_;
+};
+
+/**
+ * @brief フライトレコーダーの記録を書き出すファイルのパスを決める
+ *
+ * 作業ディレクトリは起動のしかたによって変わるので、$XDG_STATE_HOME/tmk_desktop (既定は~/.local/state/tmk_desktop) に置く。
+ * どちらも決まらなければ、実行ファイルと同じディレクトリに置く。ディレクトリがなければ作る。
+ */
+std::string get_flight_record_path() {
+  std::filesystem::path dir;
+  std::error_code ec;
+  if (const char* state_home = std::getenv("XDG_STATE_HOME"); state_home && state_home[0] == '/') {
+    dir = std::filesystem::path{state_home} / "tmk_desktop";
+  } else if (const char* home = std::getenv("HOME"); home && home[0] == '/') {
+    dir = std::filesystem::path{home} / ".local/state/tmk_desktop";
+  } else {
+    dir = std::filesystem::read_symlink("/proc/self/exe", ec).parent_path();
+  }
+  std::filesystem::create_directories(dir, ec);
+  return (dir / FLIGHT_RECORD_FILE_NAME).string();
+}
+
+/**
+ * @brief フライトレコーダーの記録を書き出し、結果を標準エラー出力に知らせる
+ */
+void save_flight_record(FlightRecordReason reason, const char* message = nullptr) noexcept {
+  const char* path = flight_record_path_.c_str();
+  if (dump_flight_recorder(path, reason, message)) {
+    std::fprintf(stderr, "tmk_desktop: saved flight record to %s\n", path);
+  } else {
+    std::fprintf(stderr, "tmk_desktop: failed to save flight record to %s: %s\n", path, std::strerror(errno));
+  }
+}
+
+/**
+ * @brief メインスレッドに終了を知らせる
+ */
+void quit() noexcept {
+  pthread_kill(main_thread_, SIGTERM);
+}
+}  // namespace
+
+void on_source_error(std::exception& e) noexcept {
+  save_flight_record(FlightRecordReason::SOURCE_ERROR, e.what());
+  source_ep_ = std::current_exception();
+  quit();
+}
+
+void on_keyboard_error(std::exception& e) noexcept {
+  save_flight_record(FlightRecordReason::KEYBOARD_ERROR, e.what());
+  keyboard_ep_ = std::current_exception();
+  quit();
+}
+
+void on_sink_error(std::exception& e) noexcept {
+  save_flight_record(FlightRecordReason::SINK_ERROR, e.what());
+  sink_ep_ = std::current_exception();
+  quit();
+}
+}  // namespace tmk_desktop
+
+/**
+ * @brief メイン関数
+ */
+int main() {
+  using namespace tmk_desktop;
+
+  // 終了のシグナルはsigwaitで受け取るので、各スレッドに継承される前に塞いでおく
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  main_thread_ = pthread_self();
+
+  try {
+    // ステージが異常停止したときに書き出せるよう、先に決めておく
+    flight_record_path_ = get_flight_record_path();
+
+    {
+      // Sink
+      start_sink();
+      const Scoped sink_dtor{[] { stop_sink(); }};
+
+      // Keyboard
+      start_keyboard();
+      const Scoped keyboard_dtor{[] { stop_keyboard(); }};
+
+      // Source
+      start_source();
+      const Scoped source_dtor{[] { stop_source(); }};
+
+      // SIGUSR1は記録を書き出して待ち続け、それ以外で終了する
+      int signal = 0;
+      while (sigwait(&signals, &signal) == 0 && signal == SIGUSR1) {
+        save_flight_record(FlightRecordReason::REQUESTED);
+      }
+    }
+
+    if (source_ep_) std::rethrow_exception(source_ep_);
+    if (keyboard_ep_) std::rethrow_exception(keyboard_ep_);
+    if (sink_ep_) std::rethrow_exception(sink_ep_);
+  } catch (std::exception& e) {
+    std::fprintf(stderr, "tmk_desktop: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
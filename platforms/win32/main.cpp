@@ -4,10 +4,14 @@
  * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
  * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
  */
+#include <array>
+#include <string>
 #include <thread>
 #include <utility>
 #include <cstdio>
+#include <cwchar>
 #include <Windows.h>
+#include <tmk_desktop/flight_recorder.hpp>
 #include <tmk_desktop/source.hpp>
 #include <tmk_desktop/keyboard.hpp>
 #include <tmk_desktop/sink.hpp>
@@ -21,13 +25,21 @@ const WCHAR* const CLASS_NAME = L"TMK Desktop WNDCLASS";  // ウィンドウク
 const WCHAR* const WINDOW_NAME = L"TMK Desktop WINDOW";   // ウィンドウ名
 constexpr UINT WM_APP_NOTIFY_ICON = WM_APP + 1;           // 通知アイコンのメッセージID
 
+const WCHAR* const FLIGHT_RECORD_DIR_NAME = L"TMK Desktop";                    // フライトレコーダーの記録を置く、%LOCALAPPDATA%以下のディレクトリの名前
+const WCHAR* const FLIGHT_RECORD_FILE_NAME = L"tmk_desktop.flight";            // フライトレコーダーの記録を書き出すファイルの名前
+const WCHAR* const FLIGHT_RECORD_SAVED = L"Saved flight record to";            // フライトレコーダーの記録を書き出せたことを表す文
+const WCHAR* const FLIGHT_RECORD_FAILED = L"Failed to save flight record to";  // フライトレコーダーの記録を書き出せなかったことを表す文
+
 HMENU context_menu_ = NULL;  // コンテキストメニュー
 
-DWORD main_thread_id_ = 0;                  ///< メインスレッドID
-std::exception_ptr main_ep_ = nullptr;      ///< メインスレッドで投げられた例外
-std::exception_ptr source_ep_ = nullptr;    ///< Sourceスレッドで投げられた例外
-std::exception_ptr keyboard_ep_ = nullptr;  ///< Keyboardスレッドで投げられた例外
-std::exception_ptr sink_ep_ = nullptr;      ///< Sinkスレッドで投げられた例外
+DWORD main_thread_id_ = 0;                     ///< メインスレッドID
+std::wstring flight_record_path_;              ///< フライトレコーダーの記録を書き出すファイル
+std::string flight_record_path_utf8_;          ///< flight_record_path_をUTF-8で表したもの
+const WCHAR* flight_record_status_ = nullptr;  ///< 異常停止したときに記録を書き出せたかどうかを表す文。書き出していなければnullptr
+std::exception_ptr main_ep_ = nullptr;         ///< メインスレッドで投げられた例外
+std::exception_ptr source_ep_ = nullptr;       ///< Sourceスレッドで投げられた例外
+std::exception_ptr keyboard_ep_ = nullptr;     ///< Keyboardスレッドで投げられた例外
+std::exception_ptr sink_ep_ = nullptr;         ///< Sinkスレッドで投げられた例外
 
 /**
  * @brief スコープ終わりに関数を呼び出すクラス
@@ -44,6 +56,50 @@ private:
   Dtor dtor_;
 };
 
+/**
+ * @brief フライトレコーダーの記録を書き出すファイルのパスを決める
+ *
+ * 作業ディレクトリは起動のしかたによって変わるので、%LOCALAPPDATA%\TMK Desktopに置く。
+ * %LOCALAPPDATA%がなければ、実行ファイルと同じディレクトリに置く。ディレクトリがなければ作る。
+ */
+std::wstring get_flight_record_path() {
+  std::wstring dir(MAX_PATH, L'\0');
+  DWORD size = GetEnvironmentVariableW(L"LOCALAPPDATA", dir.data(), MAX_PATH);
+  if (size > 0 && size < MAX_PATH) {
+    dir.resize(size);
+    dir += L'\\';
+    dir += FLIGHT_RECORD_DIR_NAME;
+    CreateDirectoryW(dir.c_str(), NULL);  // 既にあれば失敗するが、そのまま使う
+  } else {
+    size = GetModuleFileNameW(NULL, dir.data(), MAX_PATH);
+    dir.resize(size);
+    const auto separator = dir.find_last_of(L'\\');
+    dir.resize(separator == std::wstring::npos ? 0 : separator);
+  }
+  return dir.empty() ? std::wstring{FLIGHT_RECORD_FILE_NAME} : dir + L'\\' + FLIGHT_RECORD_FILE_NAME;
+}
+
+/**
+ * @brief ワイド文字列をUTF-8に変換する
+ */
+std::string to_utf8(const std::wstring& wstr) {
+  const int size = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, nullptr, 0, nullptr, nullptr);
+  if (size <= 1) return {};
+  std::string str(size - 1, '\0');
+  WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, str.data(), size, nullptr, nullptr);
+  return str;
+}
+
+/**
+ * @brief フライトレコーダーの記録を書き出す
+ *
+ * @return FLIGHT_RECORD_SAVEDかFLIGHT_RECORD_FAILED
+ */
+const WCHAR* save_flight_record(FlightRecordReason reason, const char* message = nullptr) noexcept {
+  const bool saved = dump_flight_recorder(flight_record_path_utf8_.c_str(), reason, message);
+  return saved ? FLIGHT_RECORD_SAVED : FLIGHT_RECORD_FAILED;
+}
+
 /**
  * @brief ウィンドウプロシージャ
  */
@@ -87,6 +143,14 @@ LRESULT CALLBACK window_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
           }
           break;
         }
+        // フライトレコーダーの記録を書き出す
+        case ID_DUMP_FLIGHT_RECORDER: {
+          const WCHAR* status = save_flight_record(FlightRecordReason::REQUESTED);
+          std::array<WCHAR, 1024> text;
+          std::swprintf(text.data(), text.size(), L"%ls\n%ls", status, flight_record_path_.c_str());
+          MessageBox(hwnd, text.data(), TITLE, MB_OK | (status == FLIGHT_RECORD_SAVED ? MB_ICONINFORMATION : MB_ICONERROR));
+          break;
+        }
       }
       return 0;
     }
@@ -108,17 +172,20 @@ LRESULT CALLBACK window_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 }
 }  // namespace
 
-void on_source_error(std::exception&) noexcept {
+void on_source_error(std::exception& e) noexcept {
+  flight_record_status_ = save_flight_record(FlightRecordReason::SOURCE_ERROR, e.what());
   source_ep_ = std::current_exception();
   if (main_thread_id_ > 0) PostThreadMessage(main_thread_id_, WM_QUIT, 0, 0);
 }
 
-void on_keyboard_error(std::exception&) noexcept {
+void on_keyboard_error(std::exception& e) noexcept {
+  flight_record_status_ = save_flight_record(FlightRecordReason::KEYBOARD_ERROR, e.what());
   keyboard_ep_ = std::current_exception();
   if (main_thread_id_ > 0) PostThreadMessage(main_thread_id_, WM_QUIT, 0, 0);
 }
 
-void on_sink_error(std::exception&) noexcept {
+void on_sink_error(std::exception& e) noexcept {
+  flight_record_status_ = save_flight_record(FlightRecordReason::SINK_ERROR, e.what());
   sink_ep_ = std::current_exception();
   if (main_thread_id_ > 0) PostThreadMessage(main_thread_id_, WM_QUIT, 0, 0);
 }
@@ -132,6 +199,10 @@ extern "C" int APIENTRY wWinMain(HINSTANCE instance, HINSTANCE, LPWSTR, int) {
 
   main_thread_id_ = GetCurrentThreadId();
 
+  // ステージが異常停止したときに書き出せるよう、先に決めておく
+  flight_record_path_ = get_flight_record_path();
+  flight_record_path_utf8_ = to_utf8(flight_record_path_);
+
   // エラーハンドリング
   const Scoped error_handling{[] {
     try {
@@ -140,7 +211,14 @@ extern "C" int APIENTRY wWinMain(HINSTANCE instance, HINSTANCE, LPWSTR, int) {
       if (keyboard_ep_) std::rethrow_exception(keyboard_ep_);
       if (sink_ep_) std::rethrow_exception(sink_ep_);
     } catch (std::exception& e) {
-      // TODO: 異常停止を安全にユーザーへ知らせる方法を考える
+      // ウィンドウなどを片付けた後のメインスレッドなので、ここでユーザーに知らせる
+      std::array<WCHAR, 1024> text;
+      if (flight_record_status_) {
+        std::swprintf(text.data(), text.size(), L"%hs\n\n%ls\n%ls", e.what(), flight_record_status_, flight_record_path_.c_str());
+      } else {
+        std::swprintf(text.data(), text.size(), L"%hs", e.what());
+      }
+      MessageBox(NULL, text.data(), TITLE, MB_OK | MB_ICONERROR);
       throw;
     }
   }};
@@ -2,3 +2,4 @@
 #define ID_EXIT 40001
 #define ID_ENABLE_DISABLE 40002
 #define ID_RELEASE_ALL_KEYS 40003
+#define ID_DUMP_FLIGHT_RECORDER 40004
@@ -0,0 +1,133 @@
+/**
+ * @file action_cache.cpp
+ * @brief レイヤーの状態ごとに解決したアクションのキャッシュ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#include "action_cache.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <tmk_desktop/bitset.hpp>
+#include <tmk_desktop/counter.hpp>
+#include <tmk_desktop/keyboard.hpp>
+
+namespace tmk_desktop {
+namespace {
+static constexpr size_t KEYPOS_COUNT = MATRIX_ROWS * MATRIX_COLS;  ///< キーの位置の数
+static constexpr size_t SLOT_COUNT = 8;                            ///< キャッシュするレイヤーの状態の数
+
+/**
+ * @brief 1つのレイヤーの状態について解決したアクション
+ */
+struct Slot {
+  uint32_t layer_state = 0;                    ///< レイヤーの状態
+  uint32_t default_layer_state = 0;            ///< 既定レイヤーの状態
+  uint64_t last_used = 0;                      ///< 最後に使った順番
+  bool used = false;                           ///< 使われているかどうか
+  Bitset<KEYPOS_COUNT, uint64_t> filled;       ///< 解決済みのキー
+  std::array<action_t, KEYPOS_COUNT> actions;  ///< 解決したアクション
+};
+
+/**
+ * @brief 解決したアクションのキャッシュ
+ *
+ * 溢れたときは最も長く使われていないレイヤーの状態を捨てる。
+ */
+class ActionCache final {
+public:
+  action_t get(keypos_t key) {
+    if (key.row >= MATRIX_ROWS || key.col >= MATRIX_COLS) return layer_switch_get_action(key);
+
+    Slot& slot = find_slot();
+    const size_t index = key.row * MATRIX_COLS + key.col;
+    if (slot.filled[index]) {
+      increment(hit_count_);
+      return slot.actions[index];
+    }
+
+    increment(miss_count_);
+    const auto action = layer_switch_get_action(key);
+    slot.actions[index] = action;
+    slot.filled.set(index);
+    return action;
+  }
+
+  void clear() noexcept {
+    for (auto& slot : slots_) slot.used = false;
+  }
+
+  ActionCacheStats stats() const noexcept {
+    return ActionCacheStats{
+        .hit_count = hit_count_.load(std::memory_order_relaxed),
+        .miss_count = miss_count_.load(std::memory_order_relaxed),
+        .eviction_count = eviction_count_.load(std::memory_order_relaxed),
+    };
+  }
+
+private:
+  /**
+   * @brief 現在のレイヤーの状態に対応するスロットを探す
+   *
+   * 見つからなければ、空いているか最も長く使われていないスロットを割り当てる。
+   */
+  Slot& find_slot() noexcept {
+#ifndef NO_ACTION_LAYER
+    const uint32_t current_layer_state = layer_state;
+    const uint32_t current_default_layer_state = default_layer_state;
+#else
+    const uint32_t current_layer_state = 0;
+    const uint32_t current_default_layer_state = 0;
+#endif
+    use_count_++;
+
+    // 直前と同じレイヤーの状態であることが多いので、先に調べる
+    Slot* slot = &slots_[recent_];
+    if (!(slot->used && slot->layer_state == current_layer_state && slot->default_layer_state == current_default_layer_state)) {
+      slot = nullptr;
+      Slot* victim = &slots_[0];
+      for (auto& s : slots_) {
+        if (s.used && s.layer_state == current_layer_state && s.default_layer_state == current_default_layer_state) {
+          slot = &s;
+          break;
+        }
+        if (!s.used || (victim->used && s.last_used < victim->last_used)) victim = &s;
+      }
+      if (!slot) {
+        if (victim->used) increment(eviction_count_);
+        slot = victim;
+        slot->layer_state = current_layer_state;
+        slot->default_layer_state = current_default_layer_state;
+        slot->used = true;
+        slot->filled.clear();
+      }
+      recent_ = static_cast<size_t>(slot - slots_.data());
+    }
+    slot->last_used = use_count_;
+    return *slot;
+  }
+
+  std::array<Slot, SLOT_COUNT> slots_{};     ///< スロット
+  size_t recent_ = 0;                        ///< 直前に使ったスロットの添字
+  uint64_t use_count_ = 0;                   ///< スロットを使った回数
+  std::atomic<uint64_t> hit_count_{0};       ///< キャッシュから返した回数
+  std::atomic<uint64_t> miss_count_{0};      ///< 解決し直した回数
+  std::atomic<uint64_t> eviction_count_{0};  ///< スロットを捨てた回数
+} cache_;
+}  // namespace
+
+void clear_action_cache() noexcept {
+  cache_.clear();
+}
+
+ActionCacheStats get_action_cache_stats() noexcept {
+  return cache_.stats();
+}
+}  // namespace tmk_desktop
+
+extern "C" {
+action_t cached_layer_switch_get_action(keypos_t key) {
+  return tmk_desktop::cache_.get(key);
+}
+}  // extern "C"
@@ -0,0 +1,50 @@
+/**
+ * @file action_cache.hpp
+ * @brief レイヤーの状態ごとに解決したアクションのキャッシュ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * TMK_DESKTOP_ACTION_CACHEを定義すると、TMKのaction.cがlayer_switch_get_action()の代わりに呼び出す
+ * recorded_layer_switch_get_action()は、cached_layer_switch_get_action()を介してアクションを解決する。
+ * キャッシュは(layer_state, default_layer_state)の組ごとにキー数分のアクションを持ち、参照されたキーから埋めていく。
+ * レイヤーの状態を値で比べるので、layer_state自体を書き換えるような変更でも古いアクションを返すことはない。
+ * ただし、action_for_key()はレイヤーとキーの位置だけで結果が決まること。
+ */
+#pragma once
+
+extern "C" {
+#include <common/keyboard.h>
+#include <common/action.h>
+#include <common/action_layer.h>
+}  // extern "C"
+
+extern "C" {
+/**
+ * @brief キャッシュを経由してlayer_switch_get_action()を呼び出す
+ *
+ * Keyboardスレッドからのみ呼び出すこと。
+ */
+action_t cached_layer_switch_get_action(keypos_t key);
+}  // extern "C"
+
+namespace tmk_desktop {
+/**
+ * @brief 現在のレイヤーにおけるキーのアクションを取得する
+ *
+ * TMK_DESKTOP_ACTION_CACHEを定義したときはキャッシュを経由する。
+ */
+inline action_t resolve_action(keypos_t key) {
+#ifdef TMK_DESKTOP_ACTION_CACHE
+  return cached_layer_switch_get_action(key);
+#else
+  return layer_switch_get_action(key);
+#endif
+}
+
+/**
+ * @brief キャッシュを空にする
+ *
+ * action_for_key()の結果が変わるときに呼び出すこと。Keyboardスレッドからのみ呼び出すこと。
+ */
+void clear_action_cache() noexcept;
+}  // namespace tmk_desktop
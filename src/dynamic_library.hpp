@@ -0,0 +1,97 @@
+/**
+ * @file dynamic_library.hpp
+ * @brief 実行中に読み込んだ共有ライブラリ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <system_error>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace tmk_desktop {
+/**
+ * @brief 実行中に読み込んだ共有ライブラリを所有するクラス
+ *
+ * 破棄すると共有ライブラリを手放すので、その中の関数やデータを参照し終えてから破棄すること。
+ */
+class DynamicLibrary final {
+public:
+  DynamicLibrary() = default;
+
+  /**
+   * @param path 共有ライブラリのパス
+   * @exception runtime_error 読み込めない。WindowsではGetLastError()の値を持つsystem_errorを投げる
+   */
+  explicit DynamicLibrary(const char* path) {
+#ifdef _WIN32
+    const int path_size = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+    std::wstring wpath(path_size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath.data(), path_size);
+
+    handle_ = LoadLibraryW(wpath.c_str());
+    if (!handle_) throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "LoadLibraryW");
+#else
+    // 未解決のシンボルは読み込んだ時点で解決し、足りなければ差し替える前に失敗させる
+    handle_ = ::dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle_) throw std::runtime_error(std::string{"dlopen: "} + ::dlerror());
+#endif
+  }
+
+  DynamicLibrary(DynamicLibrary&& other) noexcept {
+    *this = std::move(other);
+  }
+
+  DynamicLibrary& operator=(DynamicLibrary&& other) noexcept {
+    if (this != &other) {
+      close();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~DynamicLibrary() noexcept {
+    close();
+  }
+
+  /**
+   * @brief 公開された関数を探す
+   *
+   * @tparam F 関数ポインタの型
+   * @param name 関数の名前
+   * @return 関数ポインタ。見つからなければnullptr
+   */
+  template <typename F>
+  F find(const char* name) const noexcept {
+#ifdef _WIN32
+    return reinterpret_cast<F>(GetProcAddress(handle_, name));
+#else
+    return reinterpret_cast<F>(::dlsym(handle_, name));
+#endif
+  }
+
+private:
+  void close() noexcept {
+    if (!handle_) return;
+#ifdef _WIN32
+    FreeLibrary(handle_);
+#else
+    ::dlclose(handle_);
+#endif
+    handle_ = nullptr;
+  }
+
+#ifdef _WIN32
+  HMODULE handle_ = nullptr;  ///< 読み込んだモジュール
+#else
+  void* handle_ = nullptr;  ///< dlopen()のハンドル
+#endif
+};
+}  // namespace tmk_desktop
@@ -0,0 +1,45 @@
+/**
+ * @file device.hpp
+ * @brief 仮想キーボードの識別情報
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <linux/input.h>
+#include <sys/ioctl.h>
+
+namespace tmk_desktop::inline evdev {
+/**
+ * @brief 仮想キーボードの名前
+ */
+inline constexpr const char* VIRTUAL_DEVICE_NAME = "TMK Desktop Virtual Keyboard";
+
+/**
+ * @brief 仮想キーボードのID
+ */
+inline constexpr input_id VIRTUAL_DEVICE_ID{
+    .bustype = BUS_VIRTUAL,
+    .vendor = 0x746d,   // "tm"
+    .product = 0x6b64,  // "kd"
+    .version = 1,
+};
+
+/**
+ * @brief 自身が作った仮想キーボードかどうかを調べる
+ *
+ * 仮想キーボードを奪うと、出力したイベントが入力に戻ってきてしまう。
+ */
+inline bool is_virtual_device(int fd) noexcept {
+  input_id id{};
+  if (ioctl(fd, EVIOCGID, &id) < 0) return false;
+  if (id.bustype != VIRTUAL_DEVICE_ID.bustype || id.vendor != VIRTUAL_DEVICE_ID.vendor || id.product != VIRTUAL_DEVICE_ID.product) {
+    return false;
+  }
+  std::array<char, 64> name{};
+  if (ioctl(fd, EVIOCGNAME(name.size() - 1), name.data()) < 0) return false;
+  return std::strcmp(name.data(), VIRTUAL_DEVICE_NAME) == 0;
+}
+}  // namespace tmk_desktop::inline evdev
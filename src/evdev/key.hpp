@@ -0,0 +1,89 @@
+/**
+ * @file key.hpp
+ * @brief evdevのキーコードとキーの変換
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <utility>
+#include <cstdint>
+#include <linux/input.h>
+#include <tmk_desktop/evdev/event.hpp>
+
+namespace tmk_desktop::inline evdev {
+/**
+ * @brief evdevのキーコードからキーへの変換表
+ *
+ * Win32のフックで得られる値に合わせるため、NumLockと右Shiftを拡張キー、PauseをNumLockの値として扱う。
+ */
+inline constexpr std::array<Key, KEY_CNT> evdev_code_to_key_table = [] {
+  std::array<Key, KEY_CNT> t{};
+
+  // ESCAPEからF12までは、Set1のスキャンコードと一致する
+  for (uint16_t code = KEY_ESC; code <= KEY_F12; ++code) {
+    t[code] = code;
+  }
+
+  /* clang-format off */
+  constexpr std::pair<uint16_t, Key> KEYS[]{
+    {KEY_RIGHTSHIFT, 0x136}, {KEY_NUMLOCK, 0x145}, {KEY_PAUSE, 0x45}, {KEY_ZENKAKUHANKAKU, 0x29},
+    {KEY_RO, 0x73}, {KEY_KATAKANAHIRAGANA, 0x70}, {KEY_HENKAN, 0x79}, {KEY_MUHENKAN, 0x7b}, {KEY_YEN, 0x7d},
+    {KEY_KPJPCOMMA, 0x5c}, {KEY_KPEQUAL, 0x59}, {KEY_KPCOMMA, 0x7e},
+    {KEY_F13, 0x64}, {KEY_F14, 0x65}, {KEY_F15, 0x66}, {KEY_F16, 0x67}, {KEY_F17, 0x68}, {KEY_F18, 0x69},
+    {KEY_F19, 0x6a}, {KEY_F20, 0x6b}, {KEY_F21, 0x6c}, {KEY_F22, 0x6d}, {KEY_F23, 0x6e}, {KEY_F24, 0x76},
+    {KEY_KPENTER, 0x11c}, {KEY_RIGHTCTRL, 0x11d}, {KEY_KPSLASH, 0x135}, {KEY_SYSRQ, 0x137}, {KEY_RIGHTALT, 0x138},
+    {KEY_HOME, 0x147}, {KEY_UP, 0x148}, {KEY_PAGEUP, 0x149}, {KEY_LEFT, 0x14b}, {KEY_RIGHT, 0x14d},
+    {KEY_END, 0x14f}, {KEY_DOWN, 0x150}, {KEY_PAGEDOWN, 0x151}, {KEY_INSERT, 0x152}, {KEY_DELETE, 0x153},
+    {KEY_LEFTMETA, 0x15b}, {KEY_RIGHTMETA, 0x15c}, {KEY_COMPOSE, 0x15d},
+    {KEY_POWER, 0x15e}, {KEY_SLEEP, 0x15f}, {KEY_WAKEUP, 0x163},
+    {KEY_MUTE, 0x120}, {KEY_VOLUMEDOWN, 0x12e}, {KEY_VOLUMEUP, 0x130},
+    {KEY_PREVIOUSSONG, 0x110}, {KEY_NEXTSONG, 0x119}, {KEY_PLAYPAUSE, 0x122}, {KEY_STOPCD, 0x124},
+    {KEY_CALC, 0x121}, {KEY_HOMEPAGE, 0x132}, {KEY_SEARCH, 0x165}, {KEY_BOOKMARKS, 0x166}, {KEY_REFRESH, 0x167},
+    {KEY_STOP, 0x168}, {KEY_FORWARD, 0x169}, {KEY_BACK, 0x16a}, {KEY_COMPUTER, 0x16b}, {KEY_MAIL, 0x16c}, {KEY_MEDIA, 0x16d},
+  };
+  /* clang-format on */
+  for (auto [code, key] : KEYS) {
+    t[code] = key;
+  }
+  return t;
+}();
+
+/**
+ * @brief evdevのキーコードをキーに変換する
+ */
+constexpr Key evdev_code_to_key(uint16_t code) noexcept {
+  return (code < KEY_CNT) ? evdev_code_to_key_table[code] : NO_KEY;
+}
+
+/**
+ * @brief カーネルが記録したイベント時刻をエンジンの時計に写す
+ *
+ * デバイスの時計はEVIOCSCLOCKIDでCLOCK_MONOTONICに揃えてあるので、そのまま使える。
+ * 未来の時刻や不自然に古い時刻 (時計を揃えられなかったときなど) は、現在時刻を使う。
+ *
+ * @param event イベント
+ * @param now 現在時刻
+ */
+inline Clock::time_point to_timestamp(const input_event& event, Clock::time_point now) noexcept {
+  static constexpr auto MAX_AGE = std::chrono::seconds(1);
+  const auto timestamp = Clock::time_point{std::chrono::duration_cast<Clock::duration>(
+      std::chrono::seconds(event.input_event_sec) + std::chrono::microseconds(event.input_event_usec))};
+  if (timestamp > now || now - timestamp > MAX_AGE) return now;
+  return timestamp;
+}
+
+/**
+ * @brief EV_KEYのイベントをKeyEventに変換する
+ *
+ * 値が2 (オートリピート) のときも押したものとして扱う。
+ *
+ * @param event イベント
+ * @param now 現在時刻
+ */
+inline KeyEvent to_key_event(const input_event& event, Clock::time_point now) noexcept {
+  return KeyEvent{evdev_code_to_key(event.code), event.value != 0, to_timestamp(event, now)};
+}
+}  // namespace tmk_desktop::inline evdev
@@ -0,0 +1,187 @@
+/**
+ * @file keycode.cpp
+ * @brief evdevのキーコード
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+
+#include <tmk_desktop/evdev/settings.hpp>
+#include <linux/input-event-codes.h>
+
+extern "C" {
+#include <common/keycode.h>
+}  // extern "C"
+
+/* clang-format off */
+/**
+ * @brief キーコードに対応するevdevのキーコード一覧
+ *
+ * win32/scancode.cppの一覧と同じキーを扱う。
+ */
+#define TMK_DESKTOP_EVDEV_KEYCODES(m) \
+    m(ESCAPE, KEY_ESC) \
+    m(1, KEY_1) \
+    m(2, KEY_2) \
+    m(3, KEY_3) \
+    m(4, KEY_4) \
+    m(5, KEY_5) \
+    m(6, KEY_6) \
+    m(7, KEY_7) \
+    m(8, KEY_8) \
+    m(9, KEY_9) \
+    m(0, KEY_0) \
+    m(MINUS, KEY_MINUS) \
+    m(EQUAL, KEY_EQUAL) \
+    m(BSPACE, KEY_BACKSPACE) \
+    m(TAB, KEY_TAB) \
+    m(Q, KEY_Q) \
+    m(W, KEY_W) \
+    m(E, KEY_E) \
+    m(R, KEY_R) \
+    m(T, KEY_T) \
+    m(Y, KEY_Y) \
+    m(U, KEY_U) \
+    m(I, KEY_I) \
+    m(O, KEY_O) \
+    m(P, KEY_P) \
+    m(LBRACKET, KEY_LEFTBRACE) \
+    m(RBRACKET, KEY_RIGHTBRACE) \
+    m(ENTER, KEY_ENTER) \
+    m(LCTRL, KEY_LEFTCTRL) \
+    m(A, KEY_A) \
+    m(S, KEY_S) \
+    m(D, KEY_D) \
+    m(F, KEY_F) \
+    m(G, KEY_G) \
+    m(H, KEY_H) \
+    m(J, KEY_J) \
+    m(K, KEY_K) \
+    m(L, KEY_L) \
+    m(SCOLON, KEY_SEMICOLON) \
+    m(QUOTE, KEY_APOSTROPHE) \
+    m(GRAVE, KEY_GRAVE) \
+    m(LSHIFT, KEY_LEFTSHIFT) \
+    m(BSLASH, KEY_BACKSLASH) \
+    m(Z, KEY_Z) \
+    m(X, KEY_X) \
+    m(C, KEY_C) \
+    m(V, KEY_V) \
+    m(B, KEY_B) \
+    m(N, KEY_N) \
+    m(M, KEY_M) \
+    m(COMMA, KEY_COMMA) \
+    m(DOT, KEY_DOT) \
+    m(SLASH, KEY_SLASH) \
+    m(RSHIFT, KEY_RIGHTSHIFT) \
+    m(KP_ASTERISK, KEY_KPASTERISK) \
+    m(LALT, KEY_LEFTALT) \
+    m(SPACE, KEY_SPACE) \
+    m(CAPSLOCK, KEY_CAPSLOCK) \
+    m(F1, KEY_F1) \
+    m(F2, KEY_F2) \
+    m(F3, KEY_F3) \
+    m(F4, KEY_F4) \
+    m(F5, KEY_F5) \
+    m(F6, KEY_F6) \
+    m(F7, KEY_F7) \
+    m(F8, KEY_F8) \
+    m(F9, KEY_F9) \
+    m(F10, KEY_F10) \
+    m(NUMLOCK, KEY_NUMLOCK) \
+    m(SCROLLLOCK, KEY_SCROLLLOCK) \
+    m(KP_7, KEY_KP7) \
+    m(KP_8, KEY_KP8) \
+    m(KP_9, KEY_KP9) \
+    m(KP_MINUS, KEY_KPMINUS) \
+    m(KP_4, KEY_KP4) \
+    m(KP_5, KEY_KP5) \
+    m(KP_6, KEY_KP6) \
+    m(KP_PLUS, KEY_KPPLUS) \
+    m(KP_1, KEY_KP1) \
+    m(KP_2, KEY_KP2) \
+    m(KP_3, KEY_KP3) \
+    m(KP_0, KEY_KP0) \
+    m(KP_DOT, KEY_KPDOT) \
+    m(NONUS_BSLASH, KEY_102ND) \
+    m(F11, KEY_F11) \
+    m(F12, KEY_F12) \
+    m(KP_EQUAL, KEY_KPEQUAL) \
+    m(INT6, KEY_KPJPCOMMA) \
+    m(F13, KEY_F13) \
+    m(F14, KEY_F14) \
+    m(F15, KEY_F15) \
+    m(F16, KEY_F16) \
+    m(F17, KEY_F17) \
+    m(F18, KEY_F18) \
+    m(F19, KEY_F19) \
+    m(F20, KEY_F20) \
+    m(F21, KEY_F21) \
+    m(F22, KEY_F22) \
+    m(F23, KEY_F23) \
+    m(INT2, KEY_KATAKANAHIRAGANA) \
+    m(INT1, KEY_RO) \
+    m(F24, KEY_F24) \
+    m(LANG5, KEY_ZENKAKUHANKAKU) \
+    m(LANG4, KEY_HIRAGANA) \
+    m(LANG3, KEY_KATAKANA) \
+    m(INT4, KEY_HENKAN) \
+    m(INT5, KEY_MUHENKAN) \
+    m(INT3, KEY_YEN) \
+    m(KP_COMMA, KEY_KPCOMMA) \
+    m(LANG2, KEY_HANJA) \
+    m(LANG1, KEY_HANGEUL) \
+    m(MEDIA_PREV_TRACK, KEY_PREVIOUSSONG) \
+    m(MEDIA_NEXT_TRACK, KEY_NEXTSONG) \
+    m(KP_ENTER, KEY_KPENTER) \
+    m(RCTRL, KEY_RIGHTCTRL) \
+    m(AUDIO_MUTE, KEY_MUTE) \
+    m(CALCULATOR, KEY_CALC) \
+    m(MEDIA_PLAY_PAUSE, KEY_PLAYPAUSE) \
+    m(MEDIA_STOP, KEY_STOPCD) \
+    m(AUDIO_VOL_DOWN, KEY_VOLUMEDOWN) \
+    m(AUDIO_VOL_UP, KEY_VOLUMEUP) \
+    m(WWW_HOME, KEY_HOMEPAGE) \
+    m(KP_SLASH, KEY_KPSLASH) \
+    m(PSCREEN, KEY_SYSRQ) \
+    m(RALT, KEY_RIGHTALT) \
+    m(HOME, KEY_HOME) \
+    m(UP, KEY_UP) \
+    m(PGUP, KEY_PAGEUP) \
+    m(LEFT, KEY_LEFT) \
+    m(RIGHT, KEY_RIGHT) \
+    m(END, KEY_END) \
+    m(DOWN, KEY_DOWN) \
+    m(PGDOWN, KEY_PAGEDOWN) \
+    m(INSERT, KEY_INSERT) \
+    m(DELETE, KEY_DELETE) \
+    m(LGUI, KEY_LEFTMETA) \
+    m(RGUI, KEY_RIGHTMETA) \
+    m(APPLICATION, KEY_COMPOSE) \
+    m(SYSTEM_POWER, KEY_POWER) \
+    m(SYSTEM_SLEEP, KEY_SLEEP) \
+    m(SYSTEM_WAKE, KEY_WAKEUP) \
+    m(WWW_SEARCH, KEY_SEARCH) \
+    m(WWW_FAVORITES, KEY_BOOKMARKS) \
+    m(WWW_REFRESH, KEY_REFRESH) \
+    m(WWW_STOP, KEY_STOP) \
+    m(WWW_FORWARD, KEY_FORWARD) \
+    m(WWW_BACK, KEY_BACK) \
+    m(MY_COMPUTER, KEY_COMPUTER) \
+    m(MAIL, KEY_MAIL) \
+    m(MEDIA_SELECT, KEY_MEDIA) \
+    m(PAUSE, KEY_PAUSE) \
+    m(MEDIA_EJECT, KEY_EJECTCD)
+/* clang-format on */
+
+namespace tmk_desktop::inline evdev {
+#ifndef TMK_DESKTOP_NOIMPL_KEYCODE_TO_EVDEV_TABLE
+// コンパイル時に作り、他の静的変数の初期化順序に左右されないようにする
+constinit const KeycodeToEvdevTable keycode_to_evdev_table = []() {
+  KeycodeToEvdevTable t{};
+#define M(name, value) t[KC_##name] = value;
+  TMK_DESKTOP_EVDEV_KEYCODES(M)
+#undef M
+  return t;
+}();
+#endif
+}  // namespace tmk_desktop::inline evdev
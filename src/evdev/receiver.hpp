@@ -0,0 +1,486 @@
+/**
+ * @file receiver.hpp
+ * @brief Linux (evdev) の入力イベントを受け取るやつ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <span>
+#include <system_error>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <tmk_desktop/bitset.hpp>
+#include <tmk_desktop/clock.hpp>
+#include <tmk_desktop/keyboard.hpp>
+#include "device.hpp"
+#include "key.hpp"
+
+namespace tmk_desktop::inline evdev {
+/**
+ * @brief /dev/input以下のキーボードを奪って入力イベントを受け取るクラス
+ *
+ * すべてのデバイスをepollで待ち受け、read()でinput_eventをまとめて読み出す。
+ * 読み出しの経路ではイベントごとのシステムコールやメモリ確保を行わない。
+ * デバイスの抜き差しはinotifyで検知する。
+ * 期限はCLOCK_MONOTONICの絶対時刻で設定したtimerfdで待つので、ミリ秒に丸めずに期限の直後に起きられる。
+ *
+ * add_device()にパイプなどのファイルディスクリプタを渡せば、記録したinput_eventの列を流し込んで試験できる。
+ */
+class EventReceiver final {
+public:
+  static constexpr const char* DEVICE_DIR = "/dev/input";  ///< デバイスを探すディレクトリ
+  static constexpr size_t MAX_DEVICE_COUNT = 16;           ///< 同時に扱えるデバイスの数
+  static constexpr size_t BATCH_SIZE = 64;                 ///< 1回のread()で読み出すイベントの数
+
+  EventReceiver() = default;
+  EventReceiver(const EventReceiver&) = delete;
+  EventReceiver& operator=(const EventReceiver&) = delete;
+
+  ~EventReceiver() {
+    disable();
+  }
+
+  /**
+   * @brief 有効化
+   *
+   * DEVICE_DIRにあるキーボードを奪う。
+   *
+   * @param discover DEVICE_DIRからデバイスを探すかどうか。falseならadd_device()で渡したものだけを扱う
+   * @throw std::system_error epollなどを作れなかった
+   */
+  void enable(bool discover = true) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) fail("epoll_create1");
+    notify_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd_ < 0 || !watch(notify_fd_, NOTIFY_ID)) fail("eventfd");
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0 || !watch(timer_fd_, TIMER_ID)) fail("timerfd_create");
+    timer_armed_ = false;
+    if (!discover) return;
+
+    // inotifyを使えなくても、今あるデバイスは扱える
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ >= 0) {
+      if (inotify_add_watch(inotify_fd_, DEVICE_DIR, IN_CREATE | IN_ATTRIB) < 0 || !watch(inotify_fd_, INOTIFY_ID)) {
+        close(inotify_fd_);
+        inotify_fd_ = -1;
+      }
+    }
+
+    if (DIR* dir = opendir(DEVICE_DIR)) {
+      while (const dirent* entry = readdir(dir)) {
+        open_device(entry->d_name);
+      }
+      closedir(dir);
+    }
+  }
+
+  /**
+   * @brief 無効化
+   *
+   * 奪ったデバイスを手放す。
+   */
+  void disable() noexcept {
+    for (auto& device : devices_) {
+      close_device(device);
+    }
+    for (int* fd : {&inotify_fd_, &timer_fd_, &notify_fd_, &epoll_fd_}) {
+      if (*fd >= 0) close(*fd);
+      *fd = -1;
+    }
+    key_begin_ = 0;
+    key_end_ = 0;
+  }
+
+  /**
+   * @brief デバイスを追加する
+   *
+   * デバイスを奪う処理などは行わず、読み出せるものとしてそのまま扱う。
+   *
+   * @param fd 読み出し可能なファイルディスクリプタ。所有権を受け取る
+   * @retval true 追加に成功
+   * @retval false 追加できなかった (fdは閉じられる)
+   */
+  bool add_device(int fd) noexcept {
+    return add_device(fd, 0, true);
+  }
+
+  /**
+   * @brief イベントを受け取って処理する
+   *
+   * イベントを受け取るか、notify()を受けるとリターンされる。
+   */
+  void poll() noexcept {
+    poll(Clock::time_point::max());
+  }
+
+  /**
+   * @brief 期限までイベントを受け取って処理する
+   *
+   * イベントを受け取るか、期限を迎えるか、notify()を受けるとリターンされる。
+   *
+   * @param deadline 期限。Clock::time_point::max()なら期限なし
+   */
+  void poll(Clock::time_point deadline) noexcept {
+    // Keyboardに送れていないイベントがあれば、それを送り終えるまで次を読まない
+    if (!forward()) return;
+
+    // 期限はミリ秒に丸めずにtimerfdで待つ。期限を過ぎていれば待たない
+    int timeout = -1;
+    if (deadline != Clock::time_point::max()) {
+      if (!set_timer(deadline)) timeout = 0;
+    } else if (timer_armed_) {
+      reset_timer();
+    }
+    const int count = epoll_wait(epoll_fd_, ready_.data(), static_cast<int>(ready_.size()), timeout);
+    for (int i = 0; i < count; ++i) {
+      const auto& ready = ready_[i];
+      switch (ready.data.u32) {
+        case NOTIFY_ID: {
+          uint64_t value;
+          [[maybe_unused]] const auto _ = read(notify_fd_, &value, sizeof(value));
+          break;
+        }
+        case INOTIFY_ID:
+          process_inotify();
+          break;
+        case TIMER_ID: {
+          uint64_t value;
+          [[maybe_unused]] const auto _ = read(timer_fd_, &value, sizeof(value));
+          timer_armed_ = false;
+          break;
+        }
+        default:
+          process_device(devices_[ready.data.u32]);
+          break;
+      }
+
+      // 送り切れなければ、残りのデバイスはepollが再び知らせてくれる
+      if (!forward()) return;
+    }
+  }
+
+  /**
+   * @brief pollを抜けるよう通知する
+   */
+  void notify() noexcept {
+    if (notify_fd_ >= 0) {
+      const uint64_t value = 1;
+      [[maybe_unused]] const auto _ = write(notify_fd_, &value, sizeof(value));
+    }
+  }
+
+private:
+  static constexpr uint32_t NOTIFY_ID = MAX_DEVICE_COUNT;       ///< notify()用のeventfdを示すepollのデータ
+  static constexpr uint32_t INOTIFY_ID = MAX_DEVICE_COUNT + 1;  ///< inotifyを示すepollのデータ
+  static constexpr uint32_t TIMER_ID = MAX_DEVICE_COUNT + 2;    ///< 期限を待つtimerfdを示すepollのデータ
+
+  using KeyState = Bitset<KEY_CNT, uint64_t>;
+
+  /**
+   * @brief 奪ったデバイス
+   */
+  struct Device {
+    int fd = -1;                                           ///< ファイルディスクリプタ
+    dev_t rdev = 0;                                        ///< デバイス番号 (試験用のものは0)
+    bool grabbed = false;                                  ///< 奪ったかどうか
+    bool dropping = false;                                 ///< SYN_DROPPEDから次のSYN_REPORTまでの間かどうか
+    KeyState pressed{};                                    ///< 押しているキー
+    size_t partial_size = 0;                               ///< 読み残したバイト数
+    std::array<std::byte, sizeof(input_event)> partial{};  ///< 読み残したバイト列
+  };
+
+  /**
+   * @brief 作りかけのものを片付けて例外を投げる
+   */
+  [[noreturn]] void fail(const char* what) {
+    const int error = errno;
+    disable();
+    throw std::system_error(error, std::generic_category(), what);
+  }
+
+  /**
+   * @brief キーボードらしいデバイスかどうかを調べる
+   */
+  static bool is_keyboard(int fd) noexcept {
+    std::array<uint64_t, KeyState::VALUE_COUNT> bits{};
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits.data()) < 0) return false;
+    const KeyState keys{std::span<const uint64_t, KeyState::VALUE_COUNT>(bits)};
+    return keys[KEY_A] && keys[KEY_Z] && keys[KEY_SPACE] && keys[KEY_ENTER];
+  }
+
+  /**
+   * @brief デバイスで押されているキーを取得する
+   *
+   * @retval true 取得に成功
+   * @retval false 取得できなかった (試験用のデバイスなど)
+   */
+  static bool get_key_state(int fd, KeyState& state) noexcept {
+    std::array<uint64_t, KeyState::VALUE_COUNT> bits{};
+    if (ioctl(fd, EVIOCGKEY(sizeof(bits)), bits.data()) < 0) return false;
+    state = KeyState{std::span<const uint64_t, KeyState::VALUE_COUNT>(bits)};
+    return true;
+  }
+
+  /**
+   * @brief ファイルディスクリプタをepollに登録する
+   */
+  bool watch(int fd, uint32_t id) noexcept {
+    epoll_event event{.events = EPOLLIN, .data = {.u32 = id}};
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0;
+  }
+
+  /**
+   * @brief 期限に起きるようtimerfdを設定する
+   *
+   * @retval true 設定した
+   * @retval false 期限を過ぎているか、設定できなかった (待たずに戻る)
+   */
+  bool set_timer(Clock::time_point deadline) noexcept {
+    // steady_clockはCLOCK_MONOTONICを読むので、Clockの時刻をそのまま渡せる
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    if (deadline <= Clock::now() || ns <= 0) return false;
+    const itimerspec spec{
+        .it_interval = {},
+        .it_value = {.tv_sec = static_cast<time_t>(ns / 1'000'000'000), .tv_nsec = static_cast<long>(ns % 1'000'000'000)},
+    };
+    timer_armed_ = timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == 0;
+    return timer_armed_;
+  }
+
+  /**
+   * @brief timerfdの設定を解除する
+   *
+   * 期限より前に起きた後で期限なしで待つとき、古い期限で起きないようにする。
+   */
+  void reset_timer() noexcept {
+    // 設定し直すと満了の回数も0に戻るので、読み出さなくてもepollは知らせない
+    const itimerspec spec{};
+    timerfd_settime(timer_fd_, 0, &spec, nullptr);
+    timer_armed_ = false;
+  }
+
+  /**
+   * @brief DEVICE_DIR以下のデバイスを開いて奪う
+   *
+   * @param name ファイル名。event*以外は無視する
+   */
+  void open_device(const char* name) noexcept {
+    if (std::strncmp(name, "event", 5) != 0) return;
+
+    char path[64];
+    if (std::snprintf(path, sizeof(path), "%s/%s", DEVICE_DIR, name) >= static_cast<int>(sizeof(path))) return;
+
+    // inotifyの通知は重複し得るので、開いているデバイスは開き直さない
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISCHR(st.st_mode)) return;
+    for (const auto& device : devices_) {
+      if (device.fd >= 0 && device.rdev == st.st_rdev) return;
+    }
+
+    const int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return;
+    if (!is_keyboard(fd) || is_virtual_device(fd)) {
+      close(fd);
+      return;
+    }
+
+    // KeyEventの時刻をエンジンの時計と揃える
+    const int clock_id = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock_id);
+
+    add_device(fd, st.st_rdev, false);
+  }
+
+  /**
+   * @brief デバイスを登録する
+   *
+   * @param grabbed 奪わずに使えるかどうか。falseなら、すべてのキーが離されてから奪う
+   */
+  bool add_device(int fd, dev_t rdev, bool grabbed) noexcept {
+    for (uint32_t i = 0; i < devices_.size(); ++i) {
+      auto& device = devices_[i];
+      if (device.fd >= 0) continue;
+
+      const int flags = fcntl(fd, F_GETFL);
+      if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 || !watch(fd, i)) break;
+      device = Device{.fd = fd, .rdev = rdev, .grabbed = grabbed};
+      try_grab(device);
+      return true;
+    }
+    close(fd);
+    return false;
+  }
+
+  /**
+   * @brief デバイスを奪う
+   *
+   * 押されたままのキーがあるうちに奪うと、そのキーを離したことがOSに伝わらないので、すべて離されるまで待つ。
+   */
+  static void try_grab(Device& device) noexcept {
+    if (device.grabbed) return;
+    KeyState state;
+    if (!get_key_state(device.fd, state)) return;
+    if (state.any()) return;
+    device.grabbed = ioctl(device.fd, EVIOCGRAB, 1) == 0;
+  }
+
+  /**
+   * @brief デバイスを手放す
+   */
+  static void close_device(Device& device) noexcept {
+    if (device.fd < 0) return;
+    if (device.grabbed && device.rdev != 0) ioctl(device.fd, EVIOCGRAB, 0);
+    close(device.fd);  // epollからも外れる
+    device = Device{};
+  }
+
+  /**
+   * @brief 抜かれたデバイスを手放す
+   *
+   * 押されたままのキーを離したことにする。
+   */
+  void remove_device(Device& device) noexcept {
+    const auto now = Clock::now();
+    device.pressed.scan([&](auto pos) { push_key(KeyEvent{evdev_code_to_key(static_cast<uint16_t>(pos.index())), false, now}); });
+    close_device(device);
+  }
+
+  /**
+   * @brief inotifyの通知を処理する
+   *
+   * 作られたデバイスや、権限が変わって開けるようになったデバイスを開く。
+   */
+  void process_inotify() noexcept {
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+      const ssize_t size = read(inotify_fd_, buffer, sizeof(buffer));
+      if (size <= 0) return;
+      for (ssize_t offset = 0; offset < size;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        if (event->len > 0) open_device(event->name);
+        offset += sizeof(inotify_event) + event->len;
+      }
+    }
+  }
+
+  /**
+   * @brief デバイスから読み出したイベントを処理する
+   */
+  void process_device(Device& device) noexcept {
+    if (device.fd < 0) return;
+
+    // 前回の読み残しに続けて読み出す
+    auto* bytes = reinterpret_cast<std::byte*>(events_.data());
+    std::memcpy(bytes, device.partial.data(), device.partial_size);
+    const ssize_t size = read(device.fd, bytes + device.partial_size, sizeof(events_) - device.partial_size);
+    if (size < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (size <= 0) {
+      // 抜かれたか、試験用のパイプが閉じられた
+      remove_device(device);
+      return;
+    }
+
+    const size_t total = device.partial_size + static_cast<size_t>(size);
+    const size_t count = total / sizeof(input_event);
+    device.partial_size = total % sizeof(input_event);
+    std::memcpy(device.partial.data(), bytes + count * sizeof(input_event), device.partial_size);
+
+    decode(device, std::span(events_.data(), count));
+    try_grab(device);
+  }
+
+  /**
+   * @brief input_eventの列をKeyEventに変換する
+   */
+  void decode(Device& device, std::span<const input_event> events) noexcept {
+    const auto now = Clock::now();
+    for (const auto& event : events) {
+      if (event.type == EV_SYN) {
+        if (event.code == SYN_DROPPED) {
+          device.dropping = true;
+        } else if (event.code == SYN_REPORT && device.dropping) {
+          device.dropping = false;
+          resync(device, now);
+        }
+        continue;
+      }
+
+      // 奪う前のイベントはOSにも届いているので扱わない
+      if (device.dropping || !device.grabbed || event.type != EV_KEY || event.code >= KEY_CNT) continue;
+      device.pressed.set(event.code, event.value != 0);
+      push_key(to_key_event(event, now));
+    }
+  }
+
+  /**
+   * @brief イベントを取りこぼした後で、キーの状態を同期させる
+   */
+  void resync(Device& device, Clock::time_point now) noexcept {
+    KeyState state;
+    // 状態を取得できないデバイス (試験用のパイプなど) では、押されたままのキーが残らないよう、すべて離されたものとする
+    if (!get_key_state(device.fd, state)) state = KeyState{};
+    const auto [pressed, released] = diff(device.pressed, state);
+    released.scan([&](auto pos) {
+      push_key(KeyEvent{evdev_code_to_key(static_cast<uint16_t>(pos.index())), false, now});
+    });
+    pressed.scan([&](auto pos) {
+      push_key(KeyEvent{evdev_code_to_key(static_cast<uint16_t>(pos.index())), true, now});
+    });
+    device.pressed = state;
+  }
+
+  /**
+   * @brief Keyboardに送るイベントを積む
+   */
+  void push_key(const KeyEvent& event) noexcept {
+    if (event.key() == NO_KEY || key_end_ >= keys_.size()) return;
+    keys_[key_end_++] = event;
+  }
+
+  /**
+   * @brief 積んだイベントをKeyboardに送る
+   *
+   * @retval true すべて送った
+   * @retval false Keyboardのキューが満杯で送り切れなかった
+   */
+  bool forward() noexcept {
+    for (; key_begin_ < key_end_; ++key_begin_) {
+      if (send_to_keyboard(keys_[key_begin_])) continue;
+      if (get_keyboard_status() == KeyboardStatus::RUNNING) return false;  // 空くのを待つ
+      // 受け取り手がいないので捨てる
+    }
+    key_begin_ = 0;
+    key_end_ = 0;
+    return true;
+  }
+
+  int epoll_fd_ = -1;                                      ///< epoll
+  int notify_fd_ = -1;                                     ///< notify()で書き込むeventfd
+  int inotify_fd_ = -1;                                    ///< DEVICE_DIRを監視するinotify
+  int timer_fd_ = -1;                                      ///< 期限を待つtimerfd
+  bool timer_armed_ = false;                               ///< timerfdに期限を設定しているかどうか
+  std::array<Device, MAX_DEVICE_COUNT> devices_{};         ///< デバイス
+  std::array<epoll_event, MAX_DEVICE_COUNT + 3> ready_{};  ///< epoll_wait()の結果
+  std::array<input_event, BATCH_SIZE> events_{};           ///< read()の読み出し先
+  std::array<KeyEvent, BATCH_SIZE + KEY_CNT> keys_{};      ///< Keyboardに送るイベント
+  size_t key_begin_ = 0;                                   ///< 次に送るイベントの位置
+  size_t key_end_ = 0;                                     ///< 積んだイベントの終わり
+};
+}  // namespace tmk_desktop::inline evdev
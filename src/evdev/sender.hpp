@@ -0,0 +1,195 @@
+/**
+ * @file sender.hpp
+ * @brief Linux (uinput) の入力イベントを送信するやつ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <system_error>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <tmk_desktop/evdev/settings.hpp>
+#include "../key_batch.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include <common/keycode.h>
+}  // extern "C"
+
+namespace tmk_desktop::inline evdev {
+inline uint16_t keycode_to_evdev(uint8_t keycode) noexcept {
+  return keycode_to_evdev_table[keycode];
+}
+
+/**
+ * @brief /dev/uinputで作った仮想キーボードにイベントを書き込むクラス
+ *
+ * send_*()は、生じたイベントをSYN_REPORTで締めくくって1回のwrite()で書き込む。
+ * これにより、1つのレポートで変化したキーがまとめて1つのフレームとして届く。
+ */
+class EventSender final {
+public:
+  static constexpr const char* DEVICE_PATH = "/dev/uinput";      ///< uinputのデバイスファイル
+  static constexpr size_t BUFFER_SIZE = KeyBatch::CAPACITY + 1;  ///< 1回に書き込めるイベントの数 (キー操作の列とSYN_REPORT)
+
+  EventSender() = default;
+  EventSender(const EventSender&) = delete;
+  EventSender& operator=(const EventSender&) = delete;
+
+  ~EventSender() {
+    disable();
+  }
+
+  /**
+   * @brief 有効化
+   *
+   * 仮想キーボードを作る。
+   *
+   * @throw std::system_error 仮想キーボードを作れなかった
+   */
+  void enable() {
+    const int fd = open(DEVICE_PATH, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), DEVICE_PATH);
+
+    bool ok = ioctl(fd, UI_SET_EVBIT, EV_SYN) == 0 && ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0;
+    for (auto code : keycode_to_evdev_table) {
+      if (ok && code != 0) ok = ioctl(fd, UI_SET_KEYBIT, code) == 0;
+    }
+    uinput_setup setup{.id = VIRTUAL_DEVICE_ID, .name = {}, .ff_effects_max = 0};
+    std::strncpy(setup.name, VIRTUAL_DEVICE_NAME, UINPUT_MAX_NAME_SIZE - 1);
+    ok = ok && ioctl(fd, UI_DEV_SETUP, &setup) == 0 && ioctl(fd, UI_DEV_CREATE) == 0;
+    if (!ok) {
+      const int error = errno;
+      close(fd);
+      throw std::system_error(error, std::generic_category(), "uinput");
+    }
+
+    fd_ = fd;
+    owns_device_ = true;
+  }
+
+  /**
+   * @brief 書き込み先を指定して有効化する
+   *
+   * 仮想キーボードを作らず、イベントをそのまま書き込む。パイプなどに書き込ませて試験するためのもの。
+   *
+   * @param fd 書き込み可能なファイルディスクリプタ。所有権を受け取る
+   */
+  void enable(int fd) noexcept {
+    fd_ = fd;
+    owns_device_ = false;
+  }
+
+  /**
+   * @brief 無効化
+   *
+   * 仮想キーボードを取り除く。
+   */
+  void disable() noexcept {
+    if (fd_ < 0) return;
+    count_ = 0;
+    if (owns_device_) ioctl(fd_, UI_DEV_DESTROY);
+    close(fd_);
+    fd_ = -1;
+    latest_press_code_ = 0;
+  }
+
+  /**
+   * @brief キー操作の列を送信する
+   *
+   * SYN_REPORTで締めくくって1回のwrite()で書き込むので、1つのフレームとして届く。
+   */
+  void send_keys(const KeyBatch& batch) noexcept {
+    for (const auto& action : batch.actions()) {
+      const auto code = keycode_to_evdev(action.keycode);
+      push_key(code, action.pressed ? 1 : 0);
+      if (action.pressed) {
+        latest_press_code_ = code;
+      } else if (code == latest_press_code_) {
+        latest_press_code_ = 0;
+      }
+    }
+    submit();
+  }
+
+  /**
+   * @brief 押してすぐ離すイベントを送信する
+   *
+   * 同じフレームで押して離すと無視されかねないので、間にSYN_REPORTを挟む。
+   */
+  void send_key_tap(uint8_t keycode) noexcept {
+    const auto code = keycode_to_evdev(keycode);
+    if (code != 0) {
+      push(EV_KEY, code, 1);
+      push(EV_SYN, SYN_REPORT, 0);
+      push(EV_KEY, code, 0);
+      submit();
+    }
+    latest_press_code_ = 0;
+  }
+
+  /**
+   * @brief イベントをそのまま送信する
+   */
+  void send_native_event(const NativeSinkEvent& event) noexcept {
+    push(event.type, event.code, event.value);
+    submit();
+    latest_press_code_ = 0;
+  }
+
+  /**
+   * @brief キーリピートを表すイベントを送信する
+   */
+  void send_key_repeat() noexcept {
+    if (latest_press_code_ == 0) return;
+    push(EV_KEY, latest_press_code_, 2);
+    submit();
+  }
+
+  /**
+   * @brief キーリピート情報をクリアする
+   */
+  void clear_key_repeat() noexcept {
+    latest_press_code_ = 0;
+  }
+
+private:
+  /**
+   * @brief 溜めたイベントをSYN_REPORTで締めくくって書き込む
+   */
+  void submit() noexcept {
+    if (count_ == 0) return;
+    buffer_[count_++] = input_event{.time = {}, .type = EV_SYN, .code = SYN_REPORT, .value = 0};
+    if (fd_ >= 0) {
+      // uinputはイベント単位でしか受け付けないので、書き込みが途中で切れることはない
+      while (write(fd_, buffer_.data(), count_ * sizeof(input_event)) < 0 && errno == EINTR) {}
+    }
+    count_ = 0;
+  }
+
+  void push_key(uint16_t code, int32_t value) noexcept {
+    if (code != 0) push(EV_KEY, code, value);
+  }
+
+  void push(uint16_t type, uint16_t code, int32_t value) noexcept {
+    // SYN_REPORTを書き足せる余地を残しておく
+    if (count_ + 1 >= buffer_.size()) submit();
+    buffer_[count_++] = input_event{.time = {}, .type = type, .code = code, .value = value};
+  }
+
+  int fd_ = -1;                                    ///< 書き込み先
+  bool owns_device_ = false;                       ///< 仮想キーボードを作ったかどうか
+  uint16_t latest_press_code_ = 0;                 ///< 最後に押したキー
+  size_t count_ = 0;                               ///< 溜めたイベントの数
+  std::array<input_event, BUFFER_SIZE> buffer_{};  ///< 書き込むイベント
+};
+}  // namespace tmk_desktop::inline evdev
@@ -0,0 +1,147 @@
+/**
+ * @file flight_recorder.cpp
+ * @brief 直近のパイプラインのイベントを記録するフライトレコーダー
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#include "flight_recorder.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <tmk_desktop/flight_recorder.hpp>
+#include "action_cache.hpp"
+
+extern "C" {
+#include <common/action_layer.h>
+#include <common/action_util.h>
+}  // extern "C"
+
+namespace tmk_desktop {
+namespace {
+FlightRecorder recorder_;            ///< フライトレコーダー
+Clock::time_point current_tp_{};     ///< 記録に付ける時刻
+FlightRecord last_action_record_{};  ///< 直前に記録したアクション
+
+/**
+ * @brief エンジンの時計の時刻をナノ秒単位の値に変換する
+ */
+inline int64_t to_ns(Clock::time_point tp) noexcept {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+}
+
+/**
+ * @brief 現在の時刻とTMKの状態を埋めた記録を作る
+ */
+inline FlightRecord make_record(FlightRecordType type, uint16_t code) noexcept {
+  FlightRecord record{};
+  record.time_ns = to_ns(current_tp_);
+#ifndef NO_ACTION_LAYER
+  record.layer_state = layer_state;
+  record.default_layer_state = default_layer_state;
+#endif
+  record.type = type;
+  record.mods = get_mods();
+  record.weak_mods = get_weak_mods();
+  record.code = code;
+  return record;
+}
+
+/**
+ * @brief 値のバイト列を、記録の中身に収まるだけ複製する
+ */
+template <typename T>
+inline void copy_bytes(FlightRecord& record, const T& value) noexcept {
+  std::memcpy(record.data.data(), &value, std::min(sizeof(T), record.data.size()));
+}
+}  // namespace
+
+void record_key_event(const KeyEvent& event) noexcept {
+  current_tp_ = event.timestamp();
+  auto record = make_record(FlightRecordType::KEY_EVENT, event.key());
+  record.data[0] = event.is_pressed() ? 1 : 0;
+  recorder_.record(record);
+}
+
+void record_sink_event(const SinkEvent& event) noexcept {
+  auto record = make_record(FlightRecordType::SINK_EVENT, static_cast<uint16_t>(event.type()));
+  switch (event.type()) {
+    case SinkEventType::KEYBOARD_REPORT:
+      copy_bytes(record, event.keyboard_report());
+      break;
+    case SinkEventType::MOUSE_REPORT:
+      copy_bytes(record, event.mouse_report());
+      break;
+    case SinkEventType::HID_USAGE:
+      copy_bytes(record, event.usage());
+      break;
+    case SinkEventType::NATIVE:
+#if !defined(TMK_DESKTOP_HEADLESS) && !defined(TMK_DESKTOP_EVDEV) && defined(_WIN32)
+      // INPUTの先頭は種類と詰め物なので、キーボード入力のスキャンコードとフラグを記録する
+      copy_bytes(record, std::array<DWORD, 2>{event.native().ki.wScan, event.native().ki.dwFlags});
+#else
+      copy_bytes(record, event.native());
+#endif
+      break;
+    case SinkEventType::SIGNAL:
+      record.data[0] = static_cast<uint8_t>(event.signal());
+      break;
+    case SinkEventType::NONE:
+      break;
+  }
+  recorder_.record(record);
+}
+
+void set_flight_record_time(Clock::time_point tp) noexcept {
+  current_tp_ = tp;
+}
+
+bool dump_flight_recorder(const char* path, FlightRecordReason reason, const char* message) noexcept {
+  std::array<FlightRecord, FlightRecorder::CAPACITY> records;
+  const size_t count = recorder_.read(records);
+
+  FlightRecordFileHeader header{
+      .magic = FLIGHT_RECORD_FILE_MAGIC,
+      .version = FLIGHT_RECORD_FILE_VERSION,
+      .record_size = sizeof(FlightRecord),
+      .reason = reason,
+      .record_count = static_cast<uint32_t>(count),
+      .total_count = recorder_.total_count(),
+      .dumped_ns = to_ns(Clock::now()),
+      .message = {},
+  };
+  if (message) std::strncpy(header.message.data(), message, header.message.size() - 1);
+
+#ifdef _WIN32
+  // パスはUTF-8なので、ワイド文字に変換して開く
+  std::array<wchar_t, 1024> wpath;
+  if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath.data(), static_cast<int>(wpath.size())) == 0) return false;
+  std::FILE* file = _wfopen(wpath.data(), L"wb");
+#else
+  std::FILE* file = std::fopen(path, "wb");
+#endif
+  if (!file) return false;
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok && count > 0) ok = std::fwrite(records.data(), sizeof(FlightRecord), count, file) == count;
+  return std::fclose(file) == 0 && ok;
+}
+}  // namespace tmk_desktop
+
+extern "C" {
+action_t recorded_layer_switch_get_action(keypos_t key) {
+  using namespace tmk_desktop;
+  const action_t action = resolve_action(key);
+
+  // TMKは1つの入力に対して同じキーのアクションを何度か解決するので、続けて同じ記録は省く
+  auto record = make_record(FlightRecordType::ACTION, action.code);
+  record.data[0] = key.col;
+  record.data[1] = key.row;
+  if (std::memcmp(&record, &last_action_record_, sizeof(FlightRecord)) == 0) return action;
+  last_action_record_ = record;
+  recorder_.record(record);
+  return action;
+}
+}  // extern "C"
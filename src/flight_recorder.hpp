@@ -0,0 +1,51 @@
+/**
+ * @file flight_recorder.hpp
+ * @brief フライトレコーダーへの記録の内部インターフェイス
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * TMKのaction.cは、layer_switch_get_action()の代わりにrecorded_layer_switch_get_action()を呼び出すようにビルドされる。
+ * 記録はすべてKeyboardのスレッドで行うので、フライトレコーダーの書き込み側は1つのスレッドに限られる。
+ */
+#pragma once
+
+#include <tmk_desktop/clock.hpp>
+#include <tmk_desktop/event.hpp>
+#include <tmk_desktop/sink.hpp>
+
+extern "C" {
+#include <common/keyboard.h>
+#include <common/action.h>
+}  // extern "C"
+
+extern "C" {
+/**
+ * @brief アクションを解決し、フライトレコーダーに記録する
+ *
+ * TMK_DESKTOP_ACTION_CACHEを定義したときはキャッシュを経由して解決する。Keyboardのスレッドからのみ呼び出すこと。
+ */
+action_t recorded_layer_switch_get_action(keypos_t key);
+}  // extern "C"
+
+namespace tmk_desktop {
+/**
+ * @brief Keyboardが受け取った入力を記録する
+ *
+ * 以降の記録には、入力の時刻を付ける。Keyboardのスレッドからのみ呼び出すこと。
+ */
+void record_key_event(const KeyEvent& event) noexcept;
+
+/**
+ * @brief Sinkに渡すイベントを記録する
+ *
+ * Keyboardのスレッドからのみ呼び出すこと。
+ */
+void record_sink_event(const SinkEvent& event) noexcept;
+
+/**
+ * @brief 以降の記録に付ける時刻を設定する
+ *
+ * 時間経過による処理を行う前に呼び出す。Keyboardのスレッドからのみ呼び出すこと。
+ */
+void set_flight_record_time(Clock::time_point tp) noexcept;
+}  // namespace tmk_desktop
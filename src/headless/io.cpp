@@ -0,0 +1,59 @@
+/**
+ * @file io.cpp
+ * @brief ヘッドレス環境の入出力
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#include "io.hpp"
+
+namespace tmk_desktop::inline headless {
+namespace {
+InputQueue input_queue_;    ///< 入力イベントのキュー
+Waiter input_waiter_;       ///< 入力イベントを待つためのWaiter
+OutputQueue output_queue_;  ///< 出力イベントのキュー
+
+/**
+ * @brief キューの統計を取得する
+ */
+template <typename Queue>
+QueueStats get_queue_stats(const Queue& queue) noexcept {
+  return {
+      .capacity = Queue::CAPACITY,
+      .high_water_mark = queue.high_water_mark(),
+      .overflow_count = queue.overflow_count(),
+  };
+}
+}  // namespace
+
+InputQueue& get_input_queue() noexcept {
+  return input_queue_;
+}
+
+Waiter& get_input_waiter() noexcept {
+  return input_waiter_;
+}
+
+OutputQueue& get_output_queue() noexcept {
+  return output_queue_;
+}
+
+bool send_to_source(const KeyEvent& event) noexcept {
+  if (!input_queue_.push(event)) return false;
+  input_waiter_.notify();
+  return true;
+}
+
+size_t receive_from_sink(std::span<OutputEvent> events) noexcept {
+  size_t count = 0;
+  while (count < events.size() && output_queue_.pop(events[count])) count++;
+  return count;
+}
+
+QueueStats get_input_queue_stats() noexcept {
+  return get_queue_stats(input_queue_);
+}
+
+QueueStats get_output_queue_stats() noexcept {
+  return get_queue_stats(output_queue_);
+}
+}  // namespace tmk_desktop::inline headless
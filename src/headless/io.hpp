@@ -0,0 +1,35 @@
+/**
+ * @file io.hpp
+ * @brief ヘッドレス環境の入出力を受け持つバッファ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <tmk_desktop/headless/io.hpp>
+#include <tmk_desktop/spsc_queue.hpp>
+#include <tmk_desktop/wait_policy.hpp>
+
+namespace tmk_desktop::inline headless {
+using InputQueue = SpscQueue<KeyEvent, 1024>;      ///< 入力イベントのキュー
+using OutputQueue = SpscQueue<OutputEvent, 4096>;  ///< 出力イベントのキュー
+
+/**
+ * @brief 入力イベントのキューを取得する
+ *
+ * 生産者はsend_to_source()の呼び出し元、消費者はSourceのスレッドである。
+ */
+InputQueue& get_input_queue() noexcept;
+
+/**
+ * @brief 入力イベントを待つためのWaiterを取得する
+ */
+Waiter& get_input_waiter() noexcept;
+
+/**
+ * @brief 出力イベントのキューを取得する
+ *
+ * 生産者はSinkのスレッド、消費者はreceive_from_sink()の呼び出し元である。
+ */
+OutputQueue& get_output_queue() noexcept;
+}  // namespace tmk_desktop::inline headless
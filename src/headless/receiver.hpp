@@ -0,0 +1,109 @@
+/**
+ * @file receiver.hpp
+ * @brief ヘッドレス環境の入力イベントを受け取るやつ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <tmk_desktop/clock.hpp>
+#include <tmk_desktop/keyboard.hpp>
+#include "io.hpp"
+
+namespace tmk_desktop::inline headless {
+class EventReceiver final {
+public:
+  /**
+   * @brief Keyboardに送り損ねたイベントを送り直す間隔
+   */
+  static constexpr auto RETRY_INTERVAL = std::chrono::milliseconds(1);
+
+  /**
+   * @brief 有効化
+   *
+   * 無効な間に送られた入力イベントは捨てる。
+   */
+  void enable() noexcept {
+    get_input_queue().clear();
+    has_pending_ = false;
+  }
+
+  /**
+   * @brief 無効化
+   */
+  void disable() noexcept {}
+
+  /**
+   * @brief イベントを受け取って処理する
+   *
+   * イベントを受け取るか、notify()を受けるとリターンされる。
+   * Keyboardに送り損ねたイベントがあれば、送り直すためにRETRY_INTERVALごとにリターンされる。
+   */
+  void poll() noexcept {
+    poll(Clock::time_point::max());
+  }
+
+  /**
+   * @brief 期限までイベントを受け取って処理する
+   *
+   * イベントを受け取るか、期限を迎えるか、notify()を受けるとリターンされる。
+   * Keyboardに送り損ねたイベントがあれば、送り直すためにRETRY_INTERVALごとにリターンされる。
+   * 単一スレッド構成では、送り損ねたらすぐにリターンされる。
+   *
+   * @param deadline 期限。Clock::time_point::max()なら期限なし
+   */
+  void poll(Clock::time_point deadline) noexcept {
+    auto& queue = get_input_queue();
+    if (has_pending_) {
+      has_pending_ = false;
+      if (!forward(pending_)) {
+#ifndef TMK_DESKTOP_FUSED_PIPELINE
+        // Keyboardのキューが空いたことは知らされないので、スピンせずに間隔を空けて送り直す
+        // 単一スレッド構成では、リターンした後にこのスレッドがキューを空けるので待たない
+        get_input_waiter().wait_until([&] { return notified_.load(std::memory_order_acquire); }, std::min(deadline, Clock::now() + RETRY_INTERVAL));
+        notified_.store(false, std::memory_order_relaxed);
+#endif
+        return;
+      }
+    } else {
+      get_input_waiter().wait_until([&] { return !queue.empty() || notified_.load(std::memory_order_acquire); }, deadline);
+      notified_.store(false, std::memory_order_relaxed);
+    }
+
+    KeyEvent event;
+    while (queue.pop(event) && forward(event)) {}
+  }
+
+  /**
+   * @brief pollを抜けるよう通知する
+   */
+  void notify() noexcept {
+    notified_.store(true, std::memory_order_release);
+    get_input_waiter().notify();
+  }
+
+private:
+  /**
+   * @brief Keyboardにイベントを送る
+   *
+   * Keyboardのキューが満杯なら、イベントを失わないように次のpoll()まで持ち越す。
+   *
+   * @retval true 送ったか、受け取り手がいないので捨てた
+   * @retval false 送れずに持ち越した
+   */
+  bool forward(const KeyEvent& event) noexcept {
+    if (send_to_keyboard(event)) return true;
+    if (get_keyboard_status() != KeyboardStatus::RUNNING) return true;  // 受け取り手がいないので捨てる
+    pending_ = event;
+    has_pending_ = true;
+    return false;
+  }
+
+  KeyEvent pending_{};                 ///< Keyboardに送れなかったイベント
+  bool has_pending_ = false;           ///< 送れなかったイベントがあるかどうか
+  std::atomic<bool> notified_{false};  ///< notify()を受けたかどうか
+};
+}  // namespace tmk_desktop::inline headless
@@ -0,0 +1,97 @@
+/**
+ * @file sender.hpp
+ * @brief ヘッドレス環境の出力イベントを記録するやつ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 他のプラットフォームでOSに1回で渡すイベントには、同じbatch_idを付けて記録する。
+ * これにより、Sinkがイベントを何回に分けて送信したかを数えられる。
+ */
+#pragma once
+
+#include <tmk_desktop/clock.hpp>
+#include <tmk_desktop/headless/settings.hpp>
+#include "../key_batch.hpp"
+#include "io.hpp"
+
+extern "C" {
+#include <common/keycode.h>
+}  // extern "C"
+
+namespace tmk_desktop::inline headless {
+class EventSender final {
+public:
+  void enable() noexcept {}
+
+  void disable() noexcept {}
+
+  /**
+   * @brief キー操作の列を記録する
+   */
+  void send_keys(const KeyBatch& batch) noexcept {
+    batch_id_++;
+    for (const auto& action : batch.actions()) {
+      if (action.pressed) {
+        record(OutputType::KEY_PRESS, action.keycode);
+        latest_press_keycode_ = action.keycode;
+      } else {
+        record(OutputType::KEY_RELEASE, action.keycode);
+        if (action.keycode == latest_press_keycode_) latest_press_keycode_ = KC_NO;
+      }
+    }
+  }
+
+  /**
+   * @brief 押してすぐ離すイベントを記録する
+   */
+  void send_key_tap(uint8_t keycode) noexcept {
+    batch_id_++;
+    record(OutputType::KEY_TAP, keycode);
+    latest_press_keycode_ = KC_NO;
+  }
+
+  /**
+   * @brief イベントをそのまま記録する
+   */
+  void send_native_event(const NativeSinkEvent& event) noexcept {
+    batch_id_++;
+    record(OutputType::NATIVE, KC_NO, event);
+    latest_press_keycode_ = KC_NO;
+  }
+
+  /**
+   * @brief キーリピートを表すイベントを記録する
+   */
+  void send_key_repeat() noexcept {
+    if (latest_press_keycode_ == KC_NO) return;
+    batch_id_++;
+    record(OutputType::KEY_REPEAT, latest_press_keycode_);
+  }
+
+  /**
+   * @brief キーリピート情報をクリアする
+   */
+  void clear_key_repeat() noexcept {
+    latest_press_keycode_ = KC_NO;
+  }
+
+private:
+  /**
+   * @brief 出力イベントをバッファに積む
+   *
+   * バッファが満杯なら捨てる。捨てた数はget_output_queue_stats()で分かる。
+   */
+  void record(OutputType type, uint8_t keycode, const NativeSinkEvent& native = {}) noexcept {
+    get_output_queue().push(OutputEvent{
+        .timestamp = Clock::now(),
+        .batch_id = batch_id_,
+        .type = type,
+        .keycode = keycode,
+        .native = native,
+    });
+  }
+
+  uint8_t latest_press_keycode_ = KC_NO;  ///< 最後に押したキー
+  uint32_t batch_id_ = 0;                 ///< 最後に送信した回の通し番号
+};
+}  // namespace tmk_desktop::inline headless
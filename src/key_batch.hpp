@@ -0,0 +1,68 @@
+/**
+ * @file key_batch.hpp
+ * @brief まとめて送信するキー操作の列
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+namespace tmk_desktop {
+/**
+ * @brief キー操作
+ */
+struct KeyAction {
+  uint8_t keycode = 0;   ///< キーコード
+  bool pressed = false;  ///< 押すならtrue、離すならfalse
+};
+
+/**
+ * @brief 1つのレポートで生じたキー操作を順番通りに並べたもの
+ *
+ * EventSenderは、これを1回のシステムコールでOSに渡す。
+ * 他の入力が途中に割り込まないので、修飾キーと組み合わせたキー入力が崩れない。
+ */
+class KeyBatch final {
+public:
+  /**
+   * @brief 容量
+   *
+   * 1つのレポートでは、非修飾キー256個と修飾キー8個がそれぞれ高々1回ずつ変化する。
+   */
+  static constexpr size_t CAPACITY = 256 + 8;
+
+  /**
+   * @brief キー操作を追加する
+   */
+  constexpr void push(uint8_t keycode, bool pressed) noexcept {
+    if (size_ < CAPACITY) actions_[size_++] = KeyAction{keycode, pressed};
+  }
+
+  /**
+   * @brief キー操作を取り除く
+   */
+  constexpr void clear() noexcept {
+    size_ = 0;
+  }
+
+  constexpr bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  constexpr size_t size() const noexcept {
+    return size_;
+  }
+
+  constexpr std::span<const KeyAction> actions() const noexcept {
+    return {actions_.data(), size_};
+  }
+
+private:
+  std::array<KeyAction, CAPACITY> actions_{};  ///< キー操作
+  size_t size_ = 0;                            ///< キー操作の数
+};
+}  // namespace tmk_desktop
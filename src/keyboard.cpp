@@ -5,14 +5,26 @@
  * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
  */
 #include <tmk_desktop/keyboard.hpp>
-#include <atomic>
-#include <deque>
-#include <mutex>
-#include <condition_variable>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
 #include <exception>
-#include <thread>
 #include <tmk_desktop/bitset.hpp>
+#include <tmk_desktop/latency.hpp>
+#include <tmk_desktop/precise_wait.hpp>
+#include <tmk_desktop/settings.hpp>
 #include <tmk_desktop/sink.hpp>
+#include <tmk_desktop/spsc_queue.hpp>
+#include <tmk_desktop/stage.hpp>
+#include <tmk_desktop/timer_wheel.hpp>
+#include "action_cache.hpp"
+#include "flight_recorder.hpp"
+#include "keymap_scope.hpp"
+#include "macro.hpp"
+#include "passthrough.hpp"
+#include "pipeline.hpp"
+#include "timer.hpp"
 
 extern "C" {
 #include <common/keyboard.h>
@@ -20,27 +32,59 @@ extern "C" {
 #include <common/matrix.h>
 #include <common/host.h>
 #include <common/report.h>
-}  // extern "C"
-
-#ifdef _WIN32
-#include <tmk_desktop/win32/settings.hpp>
+#include <common/action_tapping.h>
+#include <common/hook.h>
+#include <common/timer.h>
+#ifdef MOUSEKEY_ENABLE
+#include <common/mousekey.h>
 #endif
+}  // extern "C"
 
 namespace tmk_desktop {
 namespace {
-std::thread thread_{};                     ///< スレッド
-std::atomic<bool> running_{false};         ///< スレッドが動作中かどうか
-std::atomic<bool> stop_requested_{false};  ///< スレッドに対する停止要求
+using Matrix = Bitset<MATRIX_ROWS * MATRIX_COLS, matrix_row_t>;
+static constexpr Key NO_REPEAT = Key{KEY_COUNT};     ///< キーリピートしていないことを示す値
+static constexpr size_t KEYMAP_TIMER_RESERVE = 256;  ///< キーマップのタイマーのために前もって確保しておく数
 
-std::deque<KeyEvent> event_queue_;        ///< イベントキュー
-std::mutex event_queue_mtx_;              ///< イベントキューのためのMutex
-std::condition_variable event_queue_cv_;  ///< イベントキューのためのCV
+/**
+ * @brief キーの変化からタップ判定が確実に時間切れになるまでの時間
+ *
+ * TMKのタイマーはミリ秒単位で切り捨てられるので、1ミリ秒の余裕を持たせる。
+ */
+static constexpr auto TAPPING_TIMEOUT = std::chrono::milliseconds(TAPPING_TERM + 1);
 
-using Matrix = Bitset<MATRIX_ROWS * MATRIX_COLS, matrix_row_t>;
-static constexpr Key NO_REPEAT = Key{KEY_COUNT};  ///< キーリピートしていないことを示す値
+Matrix matrix_;                      ///< キーボードの状態
+Key repeat_key_ = NO_REPEAT;         ///< リピートしているキー
+TimerWheel engine_timers_;           ///< エンジンが予約したタイマー
+TimerWheel keymap_timers_;           ///< キーマップが予約したタイマー
+TimerId tapping_timer_ = NO_TIMER;   ///< タップ判定を時間切れにするタイマー
+TimerId mousekey_timer_ = NO_TIMER;  ///< マウスキーを次に動かすタイマー
+#ifdef TMK_DESKTOP_PASSTHROUGH
+Passthrough passthrough_;  ///< TMKを介さずにキーを送信するための近道
+#endif
+#if defined(TMK_DESKTOP_KEYMAP_FILE) || defined(TMK_DESKTOP_KEYMAP_PLUGIN)
+std::array<keypos_t, KEY_COUNT> pressed_keyposes_;  ///< 押したキーの位置。押していなければ{0xff, 0xff}
+#endif
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+/**
+ * @brief Keyboardを通る間の遅延の分布
+ *
+ * 記録するのはKeyboardのスレッドだけである。
+ */
+struct KeyboardLatency {
+  LatencyHistogram capture;   ///< 入力をフックで受け取ってから、キューに積むまで
+  LatencyHistogram queue;     ///< キューに積んでから、取り出すまで
+  LatencyHistogram dispatch;  ///< キューから取り出してから、TMKの処理に入るまで
+  LatencyHistogram task;      ///< 入力によるTMKの処理に入ってから、出るまで
+  LatencyHistogram tick;      ///< 時間経過によるTMKの処理に入ってから、出るまで
+};
 
-Matrix matrix_;               ///< キーボードの状態
-Key repeat_key_ = NO_REPEAT;  ///< リピートしているキー
+KeyboardLatency latency_;          ///< 遅延の分布
+Clock::time_point dequeued_tp_{};  ///< 処理中の入力をキューから取り出した時刻。TMKの処理に入ったらClock::time_point{}に戻す
+bool task_measuring_ = false;      ///< TMKの処理にかかる時間を測っている最中かどうか
+#endif
+
+void move_mousekey(void* context);
 
 // Sinkにイベントを送信するホストドライバ関数たち
 uint8_t keyboard_leds() noexcept {
@@ -50,7 +94,15 @@ void send_keyboard(report_keyboard_t* report_ptr) noexcept {
   if (report_ptr) send_to_sink(*report_ptr);
 }
 void send_mouse(report_mouse_t* report_ptr) noexcept {
-  if (report_ptr) send_to_sink(*report_ptr);
+  if (report_ptr) {
+    send_to_sink(*report_ptr);
+#ifdef MOUSEKEY_ENABLE
+    // 動いている間は、加速やリピートのためにマウスキーを定期的に処理させる
+    const bool moving = report_ptr->x != 0 || report_ptr->y != 0 || report_ptr->v != 0 || report_ptr->h != 0;
+    engine_timers_.cancel(mousekey_timer_);
+    mousekey_timer_ = moving ? engine_timers_.schedule(Clock::now() + std::chrono::milliseconds(MOUSEKEY_INTERVAL), move_mousekey, nullptr) : NO_TIMER;
+#endif
+  }
 }
 void send_system(uint16_t val) noexcept {
   send_to_sink(HidUsage{HidUsagePage::GENERIC_DESKTOP_CONTROL, val});
@@ -60,135 +112,481 @@ void send_consumer(uint16_t val) noexcept {
 }
 
 // 変換表にアクセスする関数
+// キーマップファイルかキーマッププラグインを読み込んでいれば、キーマップライブラリの変換表の代わりにそれを参照する
 inline keypos_t key_to_keypos(Key key) noexcept {
+#ifdef TMK_DESKTOP_KEYMAP_FILE
+  if (const auto* keymap = get_loaded_keymap_file()) return keymap->keypos(key);
+#endif
   if (key >= KEY_COUNT) return {0xff, 0xff};
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+  if (const auto* plugin = get_loaded_keymap_plugin()) return plugin->key_to_keypos_table[key];
+#endif
   return key_to_keypos_table[key];
 }
 inline bool is_tapping_key(Key key) noexcept {
+#ifdef TMK_DESKTOP_KEYMAP_FILE
+  if (const auto* keymap = get_loaded_keymap_file()) return keymap->is_tapping_key(key);
+#endif
   if (key >= KEY_COUNT) return false;
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+  if (const auto* plugin = get_loaded_keymap_plugin()) return plugin->tapping_key_table[key];
+#endif
   return tapping_key_table[key];
 }
-}  // namespace
 
-bool start_keyboard() {
-  if (thread_.joinable()) return false;
+/**
+ * @brief キーイベントが操作するキーの位置を取得する
+ *
+ * キーマップが実行中に切り替わり得るときは、押したときの位置を覚えておいて離すときにも使う。
+ * これにより、押している間にキーマップが切り替わっても、押したキーを離せる。
+ */
+inline keypos_t find_keypos(Key key, bool pressed) noexcept {
+#if defined(TMK_DESKTOP_KEYMAP_FILE) || defined(TMK_DESKTOP_KEYMAP_PLUGIN)
+  if (key >= KEY_COUNT) return {0xff, 0xff};
+  if (pressed) {
+    // リピートでは押したときの位置を保つ
+    if (pressed_keyposes_[key].row == 0xff) pressed_keyposes_[key] = key_to_keypos(key);
+    return pressed_keyposes_[key];
+  }
+  const auto keypos = pressed_keyposes_[key].row != 0xff ? pressed_keyposes_[key] : key_to_keypos(key);
+  pressed_keyposes_[key] = {0xff, 0xff};
+  return keypos;
+#else
+  return key_to_keypos(key);
+#endif
+}
 
-  // 状態を初期化する
-  stop_requested_.store(false, std::memory_order_release);
+#ifndef TMK_DESKTOP_NOIMPL_MATRIX
+using RowBitset = Bitset<MATRIX_ROWS, uint64_t>;
 
-  thread_ = std::thread([] {
-    const struct ScopedRunning {
-      ScopedRunning() {
-        running_.store(true, std::memory_order_release);
-      }
-      ~ScopedRunning() {
-        running_.store(false, std::memory_order_release);
-      }
-    } _running{};
-
-    try {
-      const struct ScopedInit {
-        ScopedInit() {
-          static host_driver_t driver{
-              keyboard_leds, send_keyboard, send_mouse, send_system, send_consumer,
-          };
-          host_set_driver(&driver);
-          keyboard_init();
-        }
-        ~ScopedInit() {
-          clear_keyboard();
-          host_set_driver(nullptr);
-        }
-      } _init{};
-
-      while (!stop_requested_.load(std::memory_order_acquire)) {
-        KeyEvent event;
-        {
-          std::unique_lock lock{event_queue_mtx_};
-          if (event_queue_.empty()) {
-            event_queue_cv_.wait(lock, [] { return !event_queue_.empty() || stop_requested_.load(std::memory_order_acquire); });
-            if (stop_requested_.load(std::memory_order_acquire)) break;
-            if (event_queue_.empty()) continue;
-          }
-          event = event_queue_.front();
-          event_queue_.pop_front();
-        }
-
-        const auto key = event.key();
-        const auto keypos = key_to_keypos(key);
-        if (keypos.row < MATRIX_ROWS && keypos.col < MATRIX_COLS) {
-          const auto pos = Matrix::Position{keypos.row, keypos.col};
-          if (event.is_pressed()) {
-            if (key == repeat_key_) {
-              send_to_sink(SinkSignal::KEY_REPEAT);
-            } else {
-              send_to_sink(SinkSignal::KEY_REPEAT_END);
-              repeat_key_ = key;
-              matrix_.set(pos);
-              keyboard_task();
-
-              // 指定のキーはすぐに離す処理を行う
-              if (is_tapping_key(key)) {
-                send_to_sink(SinkSignal::KEY_REPEAT_END);
-                repeat_key_ = NO_REPEAT;
-                matrix_.reset(pos);
-                keyboard_task();
-              }
-            }
-          } else {
-            if (key == repeat_key_) {
-              send_to_sink(SinkSignal::KEY_REPEAT_END);
-              repeat_key_ = NO_REPEAT;
-            }
-            matrix_.reset(pos);
-            keyboard_task();
-          }
-        }
-
-        // CPUを明け渡す
-        std::this_thread::yield();
-      }
-    } catch (std::exception& e) {
-      on_keyboard_error(e);
+Matrix delivered_matrix_;  ///< TMKに伝えたキーボードの状態
+RowBitset changed_rows_;   ///< matrix_とdelivered_matrix_が食い違っている行
+
+/**
+ * @brief マトリクスの変化をすべてTMKに伝え終えたかどうかを調べる
+ */
+inline bool is_matrix_delivered() noexcept {
+  return changed_rows_.none();
+}
+
+/**
+ * @brief キーの変化をTMKに伝える
+ *
+ * keyboard_task()のうち、変化したキーを見つけたあとの処理にあたる。
+ */
+void deliver_key_event(uint8_t row, uint8_t col, bool pressed) {
+  const keyevent_t event{
+      .key = keypos_t{.col = col, .row = row},
+      .pressed = pressed,
+      .time = static_cast<uint16_t>(timer_read() | 1),
+  };
+  action_exec(event);
+  hook_matrix_change(event);
+  delivered_matrix_.set(Matrix::Position{row, col}, pressed);
+}
+
+/**
+ * @brief keyboard_task()の後半の処理を行う
+ */
+void finish_keyboard_task() {
+  hook_keyboard_loop();
+#ifdef MOUSEKEY_ENABLE
+  mousekey_task();
+#endif
+}
+
+/**
+ * @brief keyboard_task()の代わりにTMKに処理させる
+ *
+ * keyboard_task()と同様に1回につき変化したキーを高々1つ処理し、なければ時間経過を処理させる。
+ * ただし、全行を走査せずに、食い違っている行だけを調べる。
+ */
+void keyboard_scan_task() {
+  // イテレータは列挙中の値を複製して持つので、列挙しながら行の印を消してよい
+  for (const auto pos : changed_rows_) {
+    const auto row = static_cast<uint8_t>(pos.index());
+    const auto changes = matrix_.value(row) ^ delivered_matrix_.value(row);
+    if (changes == 0) {
+      changed_rows_.reset(row);
+      continue;
     }
-  });
 
-  return true;
+    const auto col = static_cast<uint8_t>(std::countr_zero(changes));
+    deliver_key_event(row, col, (matrix_.value(row) >> col) & 1);
+    if ((changes & (changes - 1)) == 0) changed_rows_.reset(row);
+    finish_keyboard_task();
+    return;
+  }
+
+  action_exec(keyevent_t{
+      .key = keypos_t{.col = 255, .row = 255},
+      .pressed = false,
+      .time = static_cast<uint16_t>(timer_read() | 1),
+  });
+  finish_keyboard_task();
 }
+#endif
 
-bool stop_keyboard() {
-  // すでにスレッドが停止しているかを確認する
-  if (!thread_.joinable()) return false;
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+/**
+ * @brief TMKの処理に入ってから出るまでを記録するクラス
+ *
+ * 入れ子にしたときは、最も外側のものだけが記録する。
+ * キューから入力を取り出した後の最初の1回では、取り出してから入るまでも記録する。
+ */
+class ScopedTaskLatency final {
+public:
+  /**
+   * @param histogram 入ってから出るまでを記録するヒストグラム
+   */
+  explicit ScopedTaskLatency(LatencyHistogram& histogram) noexcept : histogram_(task_measuring_ ? nullptr : &histogram) {
+    if (!histogram_) return;
+    task_measuring_ = true;
+    entered_tp_ = Clock::now();
+    if (dequeued_tp_ != Clock::time_point{}) {
+      latency_.dispatch.record(dequeued_tp_, entered_tp_);
+      dequeued_tp_ = Clock::time_point{};
+    }
+  }
 
-  // すでにスレッドが実行終了しているかを確認する
-  if (!running_.load(std::memory_order_acquire)) return false;
+  ~ScopedTaskLatency() noexcept {
+    if (!histogram_) return;
+    histogram_->record(entered_tp_, Clock::now());
+    task_measuring_ = false;
+  }
 
-  // スレッドに停止要求を出す
-  stop_requested_.store(true, std::memory_order_release);
-  event_queue_cv_.notify_one();
+  ScopedTaskLatency(const ScopedTaskLatency&) = delete;
+  ScopedTaskLatency& operator=(const ScopedTaskLatency&) = delete;
 
-  // スレッドが停止するのを待つ
-  thread_.join();
+private:
+  LatencyHistogram* histogram_;   ///< 記録するヒストグラム。外側で測っていればnullptr
+  Clock::time_point entered_tp_;  ///< TMKの処理に入った時刻
+};
+#endif
 
-  return true;
+/**
+ * @brief TMKに処理させる
+ *
+ * TMK_DESKTOP_COALESCE_REPORTSを定義したときは、処理中に送られたキーボードレポートをまとめてから送信する。
+ * 処理中にTMKが読むタイマーの時刻は、処理を始めたときの時刻に固定する。
+ */
+inline void run_keyboard_task() {
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+  // レポートをまとめて送る処理も含めるよう、最初に作って最後に壊す。入力の処理中なら、そちらで測る
+  const ScopedTaskLatency _task_latency{latency_.tick};
+#endif
+  const ScopedTimerSnapshot _timer_snapshot;
+  SinkTransaction transaction;
+#ifndef TMK_DESKTOP_NOIMPL_MATRIX
+  keyboard_scan_task();
+#else
+  keyboard_task();
+#endif
 }
 
-void send_to_keyboard(const KeyEvent& event) {
-  {
-    std::lock_guard lock{event_queue_mtx_};
-    event_queue_.emplace_back(event);
+/**
+ * @brief タップ判定を時間切れにする
+ */
+void expire_tapping(void*) {
+  tapping_timer_ = NO_TIMER;
+
+  // 時間切れで確定したキーに続いて待機バッファ内のタップキーが判定対象になることがあり、
+  // それらも同じ時点で時間切れになっているので、バッファが捌けるまで処理させる
+  for (size_t i = 0; i <= WAITING_BUFFER_SIZE; ++i) {
+    run_keyboard_task();
   }
-  event_queue_cv_.notify_one();
 }
 
-KeyboardStatus get_keyboard_status() noexcept {
-  if (running_.load(std::memory_order_acquire)) {
-    if (stop_requested_.load(std::memory_order_acquire)) return KeyboardStatus::STOPPING;
-    return KeyboardStatus::RUNNING;
+/**
+ * @brief マウスキーを動かす
+ *
+ * マウスキーが動いていれば、送信時に次のタイマーが予約される。
+ */
+void move_mousekey(void*) {
+  mousekey_timer_ = NO_TIMER;
+  run_keyboard_task();
+}
+
+/**
+ * @brief キーの状態を更新してTMKに処理させる
+ *
+ * マトリクスを自前で持つときは、変化したキーが分かっているので走査せずにTMKに伝える。
+ *
+ * @param pos キーの位置
+ * @param pressed 押したかどうか
+ * @param timestamp キーを操作した時刻
+ */
+void update_matrix(const Matrix::Position& pos, bool pressed, Clock::time_point timestamp) {
+  matrix_.set(pos, pressed);
+#ifndef TMK_DESKTOP_NOIMPL_MATRIX
+  if (is_matrix_delivered()) {
+    SinkTransaction transaction;
+    deliver_key_event(static_cast<uint8_t>(pos.row()), static_cast<uint8_t>(pos.col()), pressed);
+    finish_keyboard_task();
   } else {
-    if (thread_.joinable()) return KeyboardStatus::STOPPED;
-    return KeyboardStatus::RESET;
+    // 伝えていない変化が残っていれば、順序を保つために走査ですべて処理させる
+    changed_rows_.set(pos.row());
+    while (!is_matrix_delivered()) run_keyboard_task();
   }
+#else
+  run_keyboard_task();
+#endif
+
+#ifndef NO_ACTION_TAPPING
+  // タップ判定中のキーは次の入力があるまで判定されないので、時間切れになる頃に改めて処理させる
+  engine_timers_.cancel(tapping_timer_);
+  tapping_timer_ = engine_timers_.schedule(timestamp + TAPPING_TIMEOUT, expire_tapping, nullptr);
+#endif
+}
+
+/**
+ * @brief キーの変化を処理する
+ *
+ * TMK_DESKTOP_PASSTHROUGHを定義したときは、単なるキーコードのキーをTMKを介さずに送信する。
+ *
+ * @param keypos キーの位置
+ * @param pressed 押したかどうか
+ * @param timestamp キーを操作した時刻
+ */
+void update_key(keypos_t keypos, bool pressed, Clock::time_point timestamp) {
+#ifdef TMK_DESKTOP_PASSTHROUGH
+  if (passthrough_.process(keypos, pressed)) return;
+#endif
+  update_matrix(Matrix::Position{keypos.row, keypos.col}, pressed, timestamp);
+}
+
+/**
+ * @brief 入力イベントを処理する
+ *
+ * @param event 入力イベント
+ */
+void process_event(const KeyEvent& event) {
+  const auto key = event.key();
+  const auto keypos = find_keypos(key, event.is_pressed());
+  if (keypos.row >= MATRIX_ROWS || keypos.col >= MATRIX_COLS) return;
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+  // 走査を省く近道やTMKを介さない送信も含めるよう、keyboard_task()ではなくここで測る
+  const ScopedTaskLatency _task_latency{latency_.task};
+#endif
+
+  // TMKのタイマーには処理した時刻ではなくキーを操作した時刻を返させる
+  const auto timestamp = event.timestamp();
+  const ScopedEventTime _event_time{timestamp};
+
+  if (event.is_pressed()) {
+    if (key == repeat_key_) {
+      send_to_sink(SinkSignal::KEY_REPEAT);
+    } else {
+      send_to_sink(SinkSignal::KEY_REPEAT_END);
+      repeat_key_ = key;
+      update_key(keypos, true, timestamp);
+
+      // 指定のキーはすぐに離す処理を行う
+      if (is_tapping_key(key)) {
+        send_to_sink(SinkSignal::KEY_REPEAT_END);
+        repeat_key_ = NO_REPEAT;
+        update_key(find_keypos(key, false), false, timestamp);
+      }
+    }
+  } else {
+    if (key == repeat_key_) {
+      send_to_sink(SinkSignal::KEY_REPEAT_END);
+      repeat_key_ = NO_REPEAT;
+    }
+    update_key(keypos, false, timestamp);
+  }
+}
+
+/**
+ * @brief 期限を迎えた時間経過による処理を行う
+ *
+ * @param now 現在時刻
+ * @return 次の期限。期限がなければClock::time_point::max()
+ */
+Clock::time_point process_deadlines(Clock::time_point now) {
+  engine_timers_.run(now);
+  keymap_timers_.run(now);
+
+  // 実行中のマクロを進める
+  const auto macro_deadline = run_macro_steps(now);
+
+  return std::min({engine_timers_.next_deadline(), keymap_timers_.next_deadline(), macro_deadline});
+}
+
+/**
+ * @brief TMKを初期化する
+ */
+void init_tmk() {
+  static host_driver_t driver{
+      keyboard_leds, send_keyboard, send_mouse, send_system, send_consumer,
+  };
+  host_set_driver(&driver);
+  keymap_timers_.reserve(KEYMAP_TIMER_RESERVE);
+#ifdef TMK_DESKTOP_ACTION_CACHE
+  clear_action_cache();
+#endif
+#if defined(TMK_DESKTOP_KEYMAP_FILE) || defined(TMK_DESKTOP_KEYMAP_PLUGIN)
+  pressed_keyposes_.fill(keypos_t{0xff, 0xff});
+#endif
+  keyboard_init();
+#ifdef TMK_DESKTOP_PASSTHROUGH
+  passthrough_.reset();
+#endif
+}
+
+/**
+ * @brief キーマップが切り替わっていれば、古いキーマップから作ったキャッシュと、古いキーマップが予約したタイマーを捨てる
+ *
+ * 押しているキーやレイヤーの状態は引き継ぐ。
+ *
+ * @param scope キーマップの参照区間
+ */
+void refresh_keymap(const KeymapScope& scope) noexcept {
+  if (!scope.is_changed()) return;
+  // 古いキーマップの関数を呼ばないよう、キーマップが予約したタイマーを取り消す
+  keymap_timers_.clear();
+#ifdef TMK_DESKTOP_ACTION_CACHE
+  clear_action_cache();
+#endif
+#ifdef TMK_DESKTOP_PASSTHROUGH
+  passthrough_.invalidate();
+#endif
+}
+
+/**
+ * @brief TMKの状態を片付ける
+ */
+void deinit_tmk() {
+  engine_timers_.clear();
+  keymap_timers_.clear();
+  tapping_timer_ = NO_TIMER;
+  mousekey_timer_ = NO_TIMER;
+  clear_macros();
+  clear_keyboard();
+  host_set_driver(nullptr);
+}
+
+/**
+ * @brief Keyboardのステージでイベントを処理するクラス
+ */
+struct KeyboardHandler {
+  void init() {
+#ifndef TMK_DESKTOP_FUSED_PIPELINE
+    // マクロのステップなどの期限で起きるとき、遅れないようにする
+    // 融合モードではSourceのスレッドが期限を待つので、そちらで設定する
+    reduce_timer_slack();
+#endif
+
+    const KeymapScope keymap_scope;
+    init_tmk();
+  }
+
+  void deinit() {
+    deinit_tmk();
+  }
+
+  void process(const KeyEvent& event) {
+    record_key_event(event);
+    const KeymapScope keymap_scope;
+    refresh_keymap(keymap_scope);
+    process_event(event);
+  }
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+  void process(const KeyEvent& event, const LatencyStamp& stamp) {
+    const auto dequeued_tp = Clock::now();
+    latency_.capture.record(stamp.captured, stamp.enqueued);
+    latency_.queue.record(stamp.enqueued, dequeued_tp);
+
+    // 入力を受け取った時刻をSinkに引き継ぐ
+    const ScopedCaptureTime _capture_time{stamp.captured};
+    dequeued_tp_ = dequeued_tp;
+    process(event);
+    // 割り当てのないキーはTMKの処理に入らない
+    dequeued_tp_ = Clock::time_point{};
+  }
+#endif
+
+  Clock::time_point poll() {
+    const KeymapScope keymap_scope;
+    refresh_keymap(keymap_scope);
+    const auto now = Clock::now();
+    set_flight_record_time(now);
+    return process_deadlines(now);
+  }
+
+  void on_error(std::exception& e) noexcept {
+    on_keyboard_error(e);
+  }
+};
+
+Stage<KeyboardHandler, SpscQueue<KeyEvent, 256>> stage_;  ///< ステージ
+}  // namespace
+
+#ifdef TMK_DESKTOP_FUSED_PIPELINE
+bool start_keyboard() {
+  return stage_.start_inline();
+}
+
+bool stop_keyboard() {
+  return stage_.stop_inline();
+}
+
+Clock::time_point run_keyboard() {
+  return stage_.run_inline();
+}
+
+bool send_to_keyboard(const KeyEvent& event) noexcept {
+  // 処理するのは呼び出し元のスレッドなので、積んだ後に眠っている相手はいない
+  // 動いていなければ、キー入力を失わないように受け付けない
+  if (!stage_.is_running()) return false;
+  return stage_.push(event, event.timestamp());
+}
+#else
+bool start_keyboard() {
+  return stage_.start();
+}
+
+bool stop_keyboard() {
+  return stage_.stop();
+}
+
+bool send_to_keyboard(const KeyEvent& event) noexcept {
+  return stage_.push(event, event.timestamp());
+}
+#endif
+
+bool set_keyboard_wait_policy(const WaitPolicy& policy) noexcept {
+  return stage_.set_wait_policy(policy);
+}
+
+StageStats get_keyboard_stats() noexcept {
+  return stage_.stats();
+}
+
+TimerId schedule_keyboard_timer(Clock::time_point deadline, TimerCallback callback, void* context) {
+  return keymap_timers_.schedule(deadline, callback, context);
+}
+
+bool cancel_keyboard_timer(TimerId id) noexcept {
+  return keymap_timers_.cancel(id);
+}
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+KeyboardLatencyStats get_keyboard_latency_stats() noexcept {
+  return KeyboardLatencyStats{
+      .capture = latency_.capture.snapshot(),
+      .queue = latency_.queue.snapshot(),
+      .dispatch = latency_.dispatch.snapshot(),
+      .task = latency_.task.snapshot(),
+      .tick = latency_.tick.snapshot(),
+  };
+}
+#endif
+
+KeyboardStatus get_keyboard_status() noexcept {
+  return stage_.status();
 }
 
 extern "C" {
@@ -196,6 +594,8 @@ extern "C" {
 #ifndef TMK_DESKTOP_NOIMPL_MATRIX
 void matrix_init() {
   matrix_.clear();
+  delivered_matrix_.clear();
+  changed_rows_.clear();
 }
 
 uint8_t matrix_scan() {
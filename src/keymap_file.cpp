@@ -0,0 +1,202 @@
+/**
+ * @file keymap_file.cpp
+ * @brief キーマップファイルの読み込みと切り替え
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#include "keymap_scope.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <tmk_desktop/clock.hpp>
+#include <tmk_desktop/counter.hpp>
+#include "mapped_file.hpp"
+
+namespace tmk_desktop {
+namespace {
+/**
+ * @brief 読み込んだキーマップファイル
+ */
+struct LoadedKeymap {
+  MappedFile file;      ///< マップしたファイル
+  KeymapFileView view;  ///< ファイルの内容
+  uint64_t generation;  ///< 読み込んだ順番 (1から始まる)
+};
+
+/**
+ * @brief ファイルが変わったかどうかを判断するための値
+ */
+struct FileStamp {
+  std::filesystem::file_time_type last_write_time;  ///< 更新時刻
+  uintmax_t size;                                   ///< 大きさ
+
+  bool operator==(const FileStamp&) const = default;
+};
+
+std::atomic<LoadedKeymap*> published_{nullptr};  ///< 公開しているキーマップ
+const LoadedKeymap* active_ = nullptr;           ///< Keyboardスレッドが参照しているキーマップ
+uint64_t active_generation_ = 0;                 ///< Keyboardスレッドが最後に参照したキーマップの順番。なければ0
+
+std::mutex writer_mutex_;       ///< 切り替える側を1つに絞るためのミューテックス
+uint64_t last_generation_ = 0;  ///< 最後に読み込んだキーマップの順番
+
+std::atomic<uint64_t> load_count_{0};         ///< 読み込んで切り替えた回数
+std::atomic<uint64_t> rejected_count_{0};     ///< 誤りがあって読み込まなかった回数
+std::atomic<uint64_t> last_load_time_ns_{0};  ///< 最後の読み込みにかかった時間
+
+std::mutex watcher_mutex_;  ///< 監視用のスレッドを操作するためのミューテックス
+std::jthread watcher_;      ///< 監視用のスレッド
+
+/**
+ * @brief キーマップを公開し、古いキーマップを解放する
+ *
+ * writer_mutex_をロックした状態で呼び出すこと。
+ */
+void publish(std::unique_ptr<LoadedKeymap> next) noexcept {
+  std::unique_ptr<LoadedKeymap> prev{published_.exchange(next.release(), std::memory_order_seq_cst)};
+
+  // 公開より前に参照区間に入っていれば古いキーマップを参照し得るので、その区間が明けるまで待つ
+  // 公開より後に入った区間は新しいキーマップしか参照しない
+  synchronize_keymap_scope();
+}
+
+/**
+ * @brief ファイルの更新時刻と大きさを取得する
+ *
+ * @return 取得できなければnullopt
+ */
+std::optional<FileStamp> get_file_stamp(const std::filesystem::path& path) noexcept {
+  std::error_code ec;
+  const auto last_write_time = std::filesystem::last_write_time(path, ec);
+  if (ec) return std::nullopt;
+  const auto size = std::filesystem::file_size(path, ec);
+  if (ec) return std::nullopt;
+  return FileStamp{last_write_time, size};
+}
+
+/**
+ * @brief ファイルが変わるたびに読み込み直す
+ */
+void watch(const std::string& path, std::chrono::milliseconds interval, std::stop_token stop) {
+  std::mutex mutex;
+  std::condition_variable_any cv;
+  std::optional<FileStamp> loaded_stamp;
+  while (!stop.stop_requested()) {
+    // 書き込み途中のファイルを読んで失敗しても、書き終えれば更新時刻か大きさが変わるので読み込み直せる
+    if (const auto stamp = get_file_stamp(path); stamp && stamp != loaded_stamp) {
+      loaded_stamp = stamp;
+      try {
+        load_keymap_file(path.c_str());
+      } catch (std::exception&) {
+        // 統計に数えてあるので、それまでのキーマップを使い続ける
+      }
+    }
+
+    std::unique_lock lock{mutex};
+    cv.wait_for(lock, stop, interval, [] { return false; });
+  }
+}
+}  // namespace
+
+bool enter_keymap_file() noexcept {
+  active_ = published_.load(std::memory_order_seq_cst);
+  const uint64_t generation = active_ ? active_->generation : 0;
+  if (generation == active_generation_) return false;
+  active_generation_ = generation;
+  return true;
+}
+
+void leave_keymap_file() noexcept {
+  active_ = nullptr;
+}
+
+const KeymapFileView* get_loaded_keymap_file() noexcept {
+  return active_ ? &active_->view : nullptr;
+}
+
+void load_keymap_file(const char* path) {
+  std::lock_guard lock{writer_mutex_};
+  const auto begin = Clock::now();
+
+  auto next = std::make_unique<LoadedKeymap>();
+  try {
+    next->file = MappedFile{path};
+  } catch (std::exception&) {
+    increment(rejected_count_);
+    throw;
+  }
+  if (const char* error = KeymapFileView::validate(next->file.bytes())) {
+    increment(rejected_count_);
+    throw std::runtime_error(std::string{"invalid keymap file: "} + error);
+  }
+  next->view = KeymapFileView{next->file.bytes()};
+  next->generation = ++last_generation_;
+  publish(std::move(next));
+
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin);
+  last_load_time_ns_.store(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+  increment(load_count_);
+}
+
+void unload_keymap_file() noexcept {
+  std::lock_guard lock{writer_mutex_};
+  publish(nullptr);
+}
+
+bool watch_keymap_file(const char* path, uint32_t interval_ms) {
+  std::lock_guard lock{watcher_mutex_};
+  if (watcher_.joinable()) return false;
+  watcher_ = std::jthread{[path = std::string{path}, interval = std::chrono::milliseconds(interval_ms)](std::stop_token stop) {
+    watch(path, interval, stop);
+  }};
+  return true;
+}
+
+bool unwatch_keymap_file() {
+  std::lock_guard lock{watcher_mutex_};
+  if (!watcher_.joinable()) return false;
+  watcher_.request_stop();
+  watcher_.join();
+  return true;
+}
+
+KeymapFileStats get_keymap_file_stats() noexcept {
+  return KeymapFileStats{
+      .load_count = load_count_.load(std::memory_order_relaxed),
+      .rejected_count = rejected_count_.load(std::memory_order_relaxed),
+      .last_load_time_ns = last_load_time_ns_.load(std::memory_order_relaxed),
+  };
+}
+}  // namespace tmk_desktop
+
+extern "C" {
+action_t keymap_file_action_for_key(uint8_t layer, keypos_t key) {
+  if (const auto* keymap = tmk_desktop::get_loaded_keymap_file()) return keymap->action(layer, key);
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+  return keymap_plugin_action_for_key(layer, key);
+#else
+  return action_for_key(layer, key);
+#endif
+}
+
+const macro_t* keymap_file_action_get_macro(keyrecord_t* record, uint8_t id, uint8_t opt) {
+  if (const auto* keymap = tmk_desktop::get_loaded_keymap_file()) {
+    // TMKは押したときと離したときの両方で呼び出すので、押したときだけ返して1回だけ再生させる
+    return (record && record->event.pressed) ? keymap->macro(id) : MACRO_NONE;
+  }
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+  return keymap_plugin_action_get_macro(record, id, opt);
+#else
+  return action_get_macro(record, id, opt);
+#endif
+}
+}  // extern "C"
@@ -0,0 +1,156 @@
+/**
+ * @file keymap_plugin.cpp
+ * @brief キーマッププラグインの読み込みと差し替え
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#include <tmk_desktop/keymap_plugin.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+#include <tmk_desktop/clock.hpp>
+#include <tmk_desktop/counter.hpp>
+#include <tmk_desktop/settings.hpp>
+#include "dynamic_library.hpp"
+#include "keymap_scope.hpp"
+
+namespace tmk_desktop {
+namespace {
+/**
+ * @brief 読み込んだキーマッププラグイン
+ */
+struct LoadedPlugin {
+  DynamicLibrary library;                         ///< 読み込んだ共有ライブラリ
+  const tmk_desktop_keymap_plugin_t* descriptor;  ///< プラグインの記述子
+};
+
+// 以下の2つはKeyboardスレッドを止めている間にのみ書き換える
+std::unique_ptr<LoadedPlugin> current_;  ///< 使っているプラグイン
+uint64_t generation_ = 0;                ///< プラグインを差し替えた回数
+
+uint64_t active_generation_ = 0;  ///< Keyboardスレッドが最後に参照したプラグインの世代
+
+std::mutex controller_mutex_;  ///< 差し替える側を1つに絞るためのミューテックス
+
+std::atomic<uint64_t> load_count_{0};         ///< 読み込んで差し替えた回数
+std::atomic<uint64_t> rollback_count_{0};     ///< 初期化に失敗して差し替えを取りやめた回数
+std::atomic<uint64_t> last_swap_time_ns_{0};  ///< 最後の差し替えでKeyboardスレッドを止めた時間
+std::atomic<uint64_t> max_swap_time_ns_{0};   ///< 差し替えでKeyboardスレッドを止めた時間の最大値
+
+/**
+ * @brief 記述子がエンジンと合うかを確かめる
+ *
+ * @return 合わなければその理由。合えばnullptr
+ */
+const char* validate(const tmk_desktop_keymap_plugin_t* plugin) noexcept {
+  if (!plugin) return "no descriptor";
+  if (plugin->abi_version != TMK_DESKTOP_KEYMAP_PLUGIN_ABI_VERSION) return "ABI version mismatch";
+  if (plugin->size < sizeof(tmk_desktop_keymap_plugin_t)) return "descriptor too small";
+  if (plugin->matrix_rows != MATRIX_ROWS || plugin->matrix_cols != MATRIX_COLS) return "matrix size mismatch";
+  if (plugin->key_count != KEY_COUNT) return "key count mismatch";
+  if (!plugin->key_to_keypos_table || !plugin->tapping_key_table) return "missing tables";
+  if (!plugin->action_for_key) return "missing action_for_key";
+  return nullptr;
+}
+
+/**
+ * @brief Keyboardスレッドを止めてプラグインを差し替える
+ *
+ * controller_mutex_をロックした状態で呼び出すこと。
+ * 手放すプラグインは、Keyboardスレッドを動かしてから破棄すればよい。
+ *
+ * @param plugin 新しいプラグイン。nullptrならキーマップライブラリに戻す。差し替えたときは古いプラグインが入る
+ * @retval true 差し替えた
+ * @retval false 新しいプラグインの初期化に失敗したので、差し替えなかった
+ */
+bool swap_plugin(std::unique_ptr<LoadedPlugin>& plugin) noexcept {
+  const auto begin = Clock::now();
+  close_keymap_scope();
+
+  // 古いプラグインを片付ける前に新しいプラグインを初期化し、失敗すれば古いプラグインを使い続ける
+  const bool initialized = !plugin || !plugin->descriptor->init || plugin->descriptor->init() == 0;
+  if (initialized) {
+    std::swap(current_, plugin);
+    generation_++;
+    if (plugin && plugin->descriptor->deinit) plugin->descriptor->deinit();
+  }
+
+  open_keymap_scope();
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin);
+  const auto elapsed_ns = static_cast<uint64_t>(elapsed.count());
+  last_swap_time_ns_.store(elapsed_ns, std::memory_order_relaxed);
+  max_swap_time_ns_.store(std::max(max_swap_time_ns_.load(std::memory_order_relaxed), elapsed_ns), std::memory_order_relaxed);
+  return initialized;
+}
+}  // namespace
+
+bool enter_keymap_plugin() noexcept {
+  if (generation_ == active_generation_) return false;
+  active_generation_ = generation_;
+  return true;
+}
+
+const tmk_desktop_keymap_plugin_t* get_loaded_keymap_plugin() noexcept {
+  return current_ ? current_->descriptor : nullptr;
+}
+
+void load_keymap_plugin(const char* path) {
+  std::lock_guard lock{controller_mutex_};
+
+  // 読み込みと照合はKeyboardスレッドを止めずに行う
+  auto next = std::make_unique<LoadedPlugin>();
+  next->library = DynamicLibrary{path};
+  const auto entry = next->library.find<tmk_desktop_keymap_plugin_entry_t>(TMK_DESKTOP_KEYMAP_PLUGIN_ENTRY_NAME);
+  if (!entry) throw std::runtime_error("invalid keymap plugin: missing " TMK_DESKTOP_KEYMAP_PLUGIN_ENTRY_NAME);
+  next->descriptor = entry();
+  if (const char* error = validate(next->descriptor)) throw std::runtime_error(std::string{"invalid keymap plugin: "} + error);
+
+  if (!swap_plugin(next)) {
+    increment(rollback_count_);
+    throw std::runtime_error("keymap plugin failed to initialize");
+  }
+  increment(load_count_);
+}
+
+void unload_keymap_plugin() noexcept {
+  std::lock_guard lock{controller_mutex_};
+  std::unique_ptr<LoadedPlugin> plugin;
+  swap_plugin(plugin);
+}
+
+KeymapPluginStats get_keymap_plugin_stats() noexcept {
+  return KeymapPluginStats{
+      .load_count = load_count_.load(std::memory_order_relaxed),
+      .rollback_count = rollback_count_.load(std::memory_order_relaxed),
+      .last_swap_time_ns = last_swap_time_ns_.load(std::memory_order_relaxed),
+      .max_swap_time_ns = max_swap_time_ns_.load(std::memory_order_relaxed),
+  };
+}
+}  // namespace tmk_desktop
+
+extern "C" {
+action_t keymap_plugin_action_for_key(uint8_t layer, keypos_t key) {
+  if (const auto* plugin = tmk_desktop::get_loaded_keymap_plugin()) return plugin->action_for_key(layer, key);
+  return action_for_key(layer, key);
+}
+
+const macro_t* keymap_plugin_action_get_macro(keyrecord_t* record, uint8_t id, uint8_t opt) {
+  if (const auto* plugin = tmk_desktop::get_loaded_keymap_plugin()) {
+    return plugin->action_get_macro ? plugin->action_get_macro(record, id, opt) : MACRO_NONE;
+  }
+  return action_get_macro(record, id, opt);
+}
+
+void keymap_plugin_action_function(keyrecord_t* record, uint8_t id, uint8_t opt) {
+  if (const auto* plugin = tmk_desktop::get_loaded_keymap_plugin()) {
+    if (plugin->action_function) plugin->action_function(record, id, opt);
+    return;
+  }
+  action_function(record, id, opt);
+}
+}  // extern "C"
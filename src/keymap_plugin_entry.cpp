@@ -0,0 +1,42 @@
+/**
+ * @file keymap_plugin_entry.cpp
+ * @brief キーマップをキーマッププラグインとして公開する
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * キーマップのソースファイルと一緒にプラグインにビルドする。エンジンには含めない。
+ * キーマップが定義するaction_for_key()などの関数と変換表から記述子を作る。
+ */
+#include <tmk_desktop/keymap_plugin.h>
+#include <tmk_desktop/settings.hpp>
+
+namespace tmk_desktop {
+namespace {
+int init_plugin() {
+  return init_keymap_plugin() ? 0 : -1;
+}
+
+void deinit_plugin() {
+  deinit_keymap_plugin();
+}
+
+const tmk_desktop_keymap_plugin_t plugin_{
+    .abi_version = TMK_DESKTOP_KEYMAP_PLUGIN_ABI_VERSION,
+    .size = sizeof(tmk_desktop_keymap_plugin_t),
+    .matrix_rows = MATRIX_ROWS,
+    .matrix_cols = MATRIX_COLS,
+    .key_count = KEY_COUNT,
+    .key_to_keypos_table = key_to_keypos_table.data(),
+    .tapping_key_table = tapping_key_table.data(),
+    .init = init_plugin,
+    .deinit = deinit_plugin,
+    .action_for_key = action_for_key,
+    .action_get_macro = action_get_macro,
+    .action_function = action_function,
+};
+}  // namespace
+}  // namespace tmk_desktop
+
+extern "C" TMK_DESKTOP_KEYMAP_PLUGIN_EXPORT const tmk_desktop_keymap_plugin_t* tmk_desktop_get_keymap_plugin(void) {
+  return &tmk_desktop::plugin_;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file keymap_scope.cpp
+ * @brief キーマップの参照区間
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#include "keymap_scope.hpp"
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+namespace tmk_desktop {
+namespace {
+std::atomic<uint64_t> reader_epoch_{0};  ///< Keyboardスレッドが参照区間に出入りした回数。奇数なら参照中
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+std::atomic<bool> closed_{false};  ///< 参照区間に入るのを止めているかどうか
+#endif
+
+/**
+ * @brief 参照区間にいれば、その区間が明けるのを待つ
+ *
+ * 呼び出す前に、参照区間に入ったスレッドに見せたい変更をseq_cstで書き込んでおくこと。
+ */
+void wait_for_reader() noexcept {
+  const auto epoch = reader_epoch_.load(std::memory_order_seq_cst);
+  if (epoch & 1) {
+    while (reader_epoch_.load(std::memory_order_acquire) == epoch) std::this_thread::yield();
+  }
+}
+}  // namespace
+
+bool enter_keymap_scope() noexcept {
+  reader_epoch_.fetch_add(1, std::memory_order_seq_cst);
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+  // 参照区間に入った後で止められていると分かれば、区間から引き返して開くのを待つ
+  // 止める側はclosed_を書いてからreader_epoch_を読むので、どちらかが必ず相手の書き込みを見る
+  while (closed_.load(std::memory_order_seq_cst)) {
+    reader_epoch_.fetch_add(1, std::memory_order_release);
+    closed_.wait(true, std::memory_order_acquire);
+    reader_epoch_.fetch_add(1, std::memory_order_seq_cst);
+  }
+#endif
+
+  bool changed = false;
+#ifdef TMK_DESKTOP_KEYMAP_FILE
+  changed |= enter_keymap_file();
+#endif
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+  changed |= enter_keymap_plugin();
+#endif
+  return changed;
+}
+
+void leave_keymap_scope() noexcept {
+#ifdef TMK_DESKTOP_KEYMAP_FILE
+  leave_keymap_file();
+#endif
+  reader_epoch_.fetch_add(1, std::memory_order_release);
+}
+
+void synchronize_keymap_scope() noexcept {
+  wait_for_reader();
+}
+
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+void close_keymap_scope() noexcept {
+  closed_.store(true, std::memory_order_seq_cst);
+  wait_for_reader();
+}
+
+void open_keymap_scope() noexcept {
+  closed_.store(false, std::memory_order_release);
+  closed_.notify_all();
+}
+#endif
+}  // namespace tmk_desktop
@@ -0,0 +1,191 @@
+/**
+ * @file keymap_scope.hpp
+ * @brief 実行中に切り替わるキーマップを参照するための内部インターフェイス
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * TMK_DESKTOP_KEYMAP_FILEを定義すると、TMKのaction_layer.cとaction.cはaction_for_key()とaction_get_macro()の代わりに
+ * keymap_file_action_for_key()とkeymap_file_action_get_macro()を呼び出すようにビルドされる。
+ * これらはキーマップファイルを読み込んでいればその内容を、なければキーマッププラグインかキーマップライブラリの関数の結果を返す。
+ *
+ * TMK_DESKTOP_KEYMAP_PLUGINを定義すると、同様にkeymap_plugin_action_for_key()などを呼び出すようにビルドされる。
+ * これらはキーマッププラグインを読み込んでいればその関数を、なければキーマップライブラリの関数を呼び出す。
+ *
+ * Keyboardスレッドは処理の間だけKeymapScopeで参照区間を示す。
+ * キーマップファイルの切り替えはRCUのように行う。
+ * 参照区間の間は切り替え前のキーマップでも解放されず、切り替える側は参照区間が明けるのを待って古いキーマップを解放する。
+ * Keyboardスレッドが待たされることはない。
+ * キーマッププラグインの差し替えは、参照区間に入るのを止めてから行う。
+ * プラグインのコードは参照区間の中でしか呼ばれないので、Keyboardスレッドを参照区間の外で待たせれば安全に差し替えられる。
+ * 参照区間はkeyboard_task()などの1回の処理を囲むので、TMKの状態が処理の途中で差し替わることもない。
+ */
+#pragma once
+
+#include <tmk_desktop/keymap_file.hpp>
+#include <tmk_desktop/keymap_plugin.h>
+
+extern "C" {
+#include <common/keyboard.h>
+#include <common/action.h>
+#include <common/action_macro.h>
+}  // extern "C"
+
+#ifdef TMK_DESKTOP_KEYMAP_FILE
+extern "C" {
+/**
+ * @brief 読み込んだキーマップファイルがあればそれを参照してaction_for_key()を呼び出す
+ *
+ * KeymapScopeの中でのみ呼び出すこと。
+ */
+action_t keymap_file_action_for_key(uint8_t layer, keypos_t key);
+
+/**
+ * @brief 読み込んだキーマップファイルがあればそれを参照してaction_get_macro()を呼び出す
+ *
+ * KeymapScopeの中でのみ呼び出すこと。
+ */
+const macro_t* keymap_file_action_get_macro(keyrecord_t* record, uint8_t id, uint8_t opt);
+}  // extern "C"
+#endif
+
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+extern "C" {
+/**
+ * @brief 読み込んだキーマッププラグインがあればそのaction_for_key()を呼び出す
+ *
+ * KeymapScopeの中でのみ呼び出すこと。
+ */
+action_t keymap_plugin_action_for_key(uint8_t layer, keypos_t key);
+
+/**
+ * @brief 読み込んだキーマッププラグインがあればそのaction_get_macro()を呼び出す
+ *
+ * KeymapScopeの中でのみ呼び出すこと。
+ */
+const macro_t* keymap_plugin_action_get_macro(keyrecord_t* record, uint8_t id, uint8_t opt);
+
+/**
+ * @brief 読み込んだキーマッププラグインがあればそのaction_function()を呼び出す
+ *
+ * KeymapScopeの中でのみ呼び出すこと。
+ */
+void keymap_plugin_action_function(keyrecord_t* record, uint8_t id, uint8_t opt);
+}  // extern "C"
+#endif
+
+namespace tmk_desktop {
+#if defined(TMK_DESKTOP_KEYMAP_FILE) || defined(TMK_DESKTOP_KEYMAP_PLUGIN)
+/**
+ * @brief Keyboardスレッドがキーマップの参照区間に入る
+ *
+ * キーマッププラグインを差し替えている間は、差し替え終わるまで待つ。
+ *
+ * @return 前の参照区間からキーマップが切り替わったかどうか
+ */
+bool enter_keymap_scope() noexcept;
+
+/**
+ * @brief Keyboardスレッドがキーマップの参照区間から出る
+ */
+void leave_keymap_scope() noexcept;
+
+/**
+ * @brief 呼び出した時点で参照区間にあれば、その区間が明けるのを待つ
+ *
+ * Keyboardスレッド以外から呼び出すこと。
+ */
+void synchronize_keymap_scope() noexcept;
+#endif
+
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+/**
+ * @brief 参照区間に入るのを止め、参照区間の外でKeyboardスレッドを待たせる
+ *
+ * 戻った時点で参照区間にいるスレッドはない。open_keymap_scope()を呼び出すまで、参照区間に入ろうとするスレッドは待つ。
+ * Keyboardスレッド以外から呼び出すこと。
+ */
+void close_keymap_scope() noexcept;
+
+/**
+ * @brief 参照区間に入るのを再び許す
+ */
+void open_keymap_scope() noexcept;
+#endif
+
+#ifdef TMK_DESKTOP_KEYMAP_FILE
+/**
+ * @brief 参照区間に入るときに、読み込んだキーマップファイルを取得する
+ *
+ * @return 前の参照区間からキーマップファイルが切り替わったかどうか
+ */
+bool enter_keymap_file() noexcept;
+
+/**
+ * @brief 参照区間から出るときに、読み込んだキーマップファイルを手放す
+ */
+void leave_keymap_file() noexcept;
+
+/**
+ * @brief 読み込んだキーマップファイルを取得する
+ *
+ * KeymapScopeの中でのみ呼び出すこと。
+ *
+ * @return 読み込んだキーマップファイル。なければnullptr
+ */
+const KeymapFileView* get_loaded_keymap_file() noexcept;
+#endif
+
+#ifdef TMK_DESKTOP_KEYMAP_PLUGIN
+/**
+ * @brief 参照区間に入るときに、キーマッププラグインが差し替わったかを調べる
+ *
+ * @return 前の参照区間からキーマッププラグインが差し替わったかどうか
+ */
+bool enter_keymap_plugin() noexcept;
+
+/**
+ * @brief 読み込んだキーマッププラグインを取得する
+ *
+ * KeymapScopeの中でのみ呼び出すこと。
+ *
+ * @return 読み込んだキーマッププラグインの記述子。なければnullptr
+ */
+const tmk_desktop_keymap_plugin_t* get_loaded_keymap_plugin() noexcept;
+#endif
+
+/**
+ * @brief スコープをキーマップの参照区間にするクラス
+ *
+ * Keyboardスレッドでキーマップを参照する処理を囲む。入れ子にしないこと。
+ * TMK_DESKTOP_KEYMAP_FILEとTMK_DESKTOP_KEYMAP_PLUGINのどちらも定義しなければ何もしない。
+ */
+class KeymapScope final {
+public:
+  KeymapScope() noexcept {
+#if defined(TMK_DESKTOP_KEYMAP_FILE) || defined(TMK_DESKTOP_KEYMAP_PLUGIN)
+    changed_ = enter_keymap_scope();
+#endif
+  }
+
+  KeymapScope(const KeymapScope&) = delete;
+  KeymapScope& operator=(const KeymapScope&) = delete;
+
+  ~KeymapScope() {
+#if defined(TMK_DESKTOP_KEYMAP_FILE) || defined(TMK_DESKTOP_KEYMAP_PLUGIN)
+    leave_keymap_scope();
+#endif
+  }
+
+  /**
+   * @brief 前の参照区間からキーマップが切り替わったかどうかを調べる
+   *
+   * 切り替わっていれば、古いキーマップから作ったキャッシュを捨てること。
+   */
+  bool is_changed() const noexcept {
+    return changed_;
+  }
+
+private:
+  bool changed_ = false;  ///< 前の参照区間からキーマップが切り替わったかどうか
+};
+}  // namespace tmk_desktop
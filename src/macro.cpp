@@ -0,0 +1,233 @@
+/**
+ * @file macro.cpp
+ * @brief マクロの実行
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * action_macro.cの代わりに、マクロをステップ列に変換してKeyboardのループで少しずつ実行する。
+ * WAITやINTERVALはスレッドを眠らせずに次のステップの予定時刻として扱うので、
+ * マクロの実行中でも後続のキー入力が待たされない。
+ */
+#include "macro.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <common/action.h>
+#include <common/action_macro.h>
+#include <common/action_util.h>
+#include <common/keycode.h>
+}  // extern "C"
+
+namespace tmk_desktop {
+namespace {
+/**
+ * @brief ステップの種類
+ */
+enum class StepType : uint8_t {
+  BEGIN,        ///< マクロの開始
+  KEY_DOWN,     ///< キーを押す
+  KEY_UP,       ///< キーを離す
+  WAIT,         ///< 待つ
+  INTERVAL,     ///< ステップ間の待ち時間を設定する
+  MOD_STORE,    ///< 修飾キーの状態を保存する
+  MOD_RESTORE,  ///< 修飾キーの状態を復元する
+  MOD_CLEAR,    ///< 修飾キーを解除する
+};
+
+/**
+ * @brief マクロの1ステップ
+ */
+struct Step {
+  StepType type;  ///< 種類
+  uint8_t arg;    ///< 引数
+};
+
+static constexpr size_t STEP_CAPACITY = 1024;  ///< 実行待ちにできるステップ数 (2のべき乗)
+static constexpr size_t STEP_MASK = STEP_CAPACITY - 1;
+static constexpr Clock::time_point NO_DEADLINE = Clock::time_point::max();  ///< 予定がないことを示す値
+
+std::array<Step, STEP_CAPACITY> steps_{};  ///< 実行待ちのステップ
+size_t head_ = 0;                          ///< 次に実行するステップの位置
+size_t tail_ = 0;                          ///< 次にステップを追加する位置
+Clock::time_point next_tp_ = NO_DEADLINE;  ///< 次のステップを実行する時刻
+uint8_t interval_ = 0;                     ///< 実行中のマクロのステップ間の待ち時間 [ms]
+uint8_t mod_storage_ = 0;                  ///< 実行中のマクロが保存した修飾キー
+
+/**
+ * @brief マクロをステップ列に変換したときの長さを数える
+ *
+ * @param macro_p マクロ
+ * @return ステップ数 (BEGINを含む)
+ */
+size_t count_steps(const macro_t* macro_p) noexcept {
+  size_t count = 1;
+  for (;;) {
+    const macro_t macro = *macro_p++;
+    switch (macro) {
+      case KEY_DOWN:
+      case KEY_UP:
+      case WAIT:
+      case INTERVAL:
+        macro_p++;
+        [[fallthrough]];
+      case MOD_STORE:
+      case MOD_RESTORE:
+      case MOD_CLEAR:
+        count++;
+        break;
+      default:
+        if ((0x04 <= macro && macro <= 0x73) || (0x84 <= macro && macro <= 0xF3)) {
+          count++;
+          break;
+        }
+        return count;
+    }
+  }
+}
+
+/**
+ * @brief ステップを実行待ちにする
+ */
+inline void push_step(StepType type, uint8_t arg = 0) noexcept {
+  steps_[tail_++ & STEP_MASK] = Step{type, arg};
+}
+
+/**
+ * @brief マクロをステップ列に変換して実行待ちにする
+ *
+ * @param macro_p マクロ
+ */
+void push_steps(const macro_t* macro_p) noexcept {
+  push_step(StepType::BEGIN);
+  for (;;) {
+    const macro_t macro = *macro_p++;
+    switch (macro) {
+      case KEY_DOWN:
+        push_step(StepType::KEY_DOWN, *macro_p++);
+        break;
+      case KEY_UP:
+        push_step(StepType::KEY_UP, *macro_p++);
+        break;
+      case WAIT:
+        push_step(StepType::WAIT, *macro_p++);
+        break;
+      case INTERVAL:
+        push_step(StepType::INTERVAL, *macro_p++);
+        break;
+      case MOD_STORE:
+        push_step(StepType::MOD_STORE);
+        break;
+      case MOD_RESTORE:
+        push_step(StepType::MOD_RESTORE);
+        break;
+      case MOD_CLEAR:
+        push_step(StepType::MOD_CLEAR);
+        break;
+      default:
+        if (0x04 <= macro && macro <= 0x73) {
+          push_step(StepType::KEY_DOWN, macro);
+          break;
+        }
+        if (0x84 <= macro && macro <= 0xF3) {
+          push_step(StepType::KEY_UP, macro & 0x7F);
+          break;
+        }
+        return;
+    }
+  }
+}
+
+/**
+ * @brief ステップを実行する
+ *
+ * 挙動はaction_macro.cのaction_macro_play()に合わせている。
+ *
+ * @param step ステップ
+ * @return 次のステップまでの待ち時間 [ms]
+ */
+uint32_t execute_step(const Step& step) {
+  switch (step.type) {
+    case StepType::BEGIN:
+      interval_ = 0;
+      mod_storage_ = 0;
+      return 0;
+    case StepType::KEY_DOWN:
+      if (IS_MOD(step.arg)) {
+        add_weak_mods(MOD_BIT(step.arg));
+        send_keyboard_report();
+      } else {
+        register_code(step.arg);
+      }
+      break;
+    case StepType::KEY_UP:
+      if (IS_MOD(step.arg)) {
+        del_weak_mods(MOD_BIT(step.arg));
+        send_keyboard_report();
+      } else {
+        unregister_code(step.arg);
+      }
+      break;
+    case StepType::WAIT:
+      return uint32_t{step.arg} + interval_;
+    case StepType::INTERVAL:
+      interval_ = step.arg;
+      break;
+    case StepType::MOD_STORE:
+      mod_storage_ = get_mods();
+      break;
+    case StepType::MOD_RESTORE:
+      set_mods(mod_storage_);
+      send_keyboard_report();
+      break;
+    case StepType::MOD_CLEAR:
+      clear_mods();
+      send_keyboard_report();
+      break;
+  }
+  return interval_;
+}
+}  // namespace
+
+Clock::time_point run_macro_steps(Clock::time_point now) {
+  while (head_ != tail_ && next_tp_ <= now) {
+    const Step step = steps_[head_++ & STEP_MASK];
+    const auto delay = std::chrono::milliseconds(execute_step(step));
+    if (delay.count() == 0) continue;
+
+    // 予定時刻を積み上げて、眠りの粒度による遅れが溜まらないようにする
+    // ただし、待ち時間より大きく遅れたときは、ステップ間の間隔を保つために予定を組み直す
+    next_tp_ += delay;
+    if (next_tp_ <= now) next_tp_ = now + delay;
+  }
+  if (head_ == tail_) next_tp_ = NO_DEADLINE;
+  return next_tp_;
+}
+
+void clear_macros() noexcept {
+  head_ = tail_;
+  next_tp_ = NO_DEADLINE;
+}
+}  // namespace tmk_desktop
+
+extern "C" {
+void action_macro_play(const macro_t* macro_p) {
+  using namespace tmk_desktop;
+
+  if (!macro_p) return;
+
+  // 実行待ちのステップが溢れるときは、マクロを途中で打ち切らないように丸ごと捨てる
+  const size_t count = count_steps(macro_p);
+  if (tail_ - head_ + count > STEP_CAPACITY) return;
+
+  // 前のマクロが残っていれば、その後に続けて実行する
+  const auto now = Clock::now();
+  if (head_ == tail_) next_tp_ = now;
+  push_steps(macro_p);
+
+  // 待たずに実行できるステップはこの場で実行する
+  run_macro_steps(now);
+}
+}  // extern "C"
@@ -0,0 +1,26 @@
+/**
+ * @file macro.hpp
+ * @brief マクロの実行
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <tmk_desktop/clock.hpp>
+
+namespace tmk_desktop {
+/**
+ * @brief 予定時刻を迎えたマクロのステップを実行する
+ *
+ * Keyboardのスレッドから呼び出すこと。
+ *
+ * @param now 現在時刻
+ * @return 次のステップを実行する時刻。実行待ちのステップがなければClock::time_point::max()
+ */
+Clock::time_point run_macro_steps(Clock::time_point now);
+
+/**
+ * @brief 実行待ちのマクロをすべて破棄する
+ */
+void clear_macros() noexcept;
+}  // namespace tmk_desktop
@@ -0,0 +1,139 @@
+/**
+ * @file mapped_file.hpp
+ * @brief 読み取り専用でメモリにマップしたファイル
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <span>
+#include <system_error>
+#include <utility>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <memory>
+#include <string>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tmk_desktop {
+/**
+ * @brief 読み取り専用でメモリにマップしたファイルを所有するクラス
+ *
+ * マップした後はファイルを閉じても内容を参照できる。
+ * Windowsでは、マップしている間はファイルを置き換えられないので、代わりに内容をメモリに読み込む。
+ */
+class MappedFile final {
+public:
+  MappedFile() = default;
+
+  /**
+   * @param path ファイルのパス
+   * @exception system_error ファイルを開けないかマップできない
+   */
+  explicit MappedFile(const char* path) {
+#ifdef _WIN32
+    const int path_size = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+    std::wstring wpath(path_size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath.data(), path_size);
+
+    const HANDLE file = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw_last_error("CreateFileW");
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart > 0x7fffffff) {
+      CloseHandle(file);
+      throw_last_error("GetFileSizeEx");
+    }
+
+    // マップしたファイルは置き換えられなくなるので、読み込んだ内容を持つ
+    auto buffer = std::make_unique<std::byte[]>(static_cast<size_t>(size.QuadPart));
+    DWORD read_size = 0;
+    const BOOL ok = ReadFile(file, buffer.get(), static_cast<DWORD>(size.QuadPart), &read_size, nullptr);
+    CloseHandle(file);
+    if (!ok) throw_last_error("ReadFile");
+    buffer_ = std::move(buffer);
+    data_ = buffer_.get();
+    size_ = read_size;
+#else
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw_errno("open");
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw_errno("fstat");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+      ::close(fd);
+      return;
+    }
+
+    void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) throw_errno("mmap");
+    data_ = data;
+#endif
+  }
+
+  MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+  }
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+      unmap();
+#ifdef _WIN32
+      buffer_ = std::move(other.buffer_);
+#endif
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  ~MappedFile() noexcept {
+    unmap();
+  }
+
+  /**
+   * @brief ファイルの内容を取得する
+   */
+  std::span<const std::byte> bytes() const noexcept {
+    return {static_cast<const std::byte*>(data_), size_};
+  }
+
+private:
+#ifdef _WIN32
+  [[noreturn]] static void throw_last_error(const char* what) {
+    throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), what);
+  }
+#else
+  [[noreturn]] static void throw_errno(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+  }
+#endif
+
+  void unmap() noexcept {
+#ifdef _WIN32
+    buffer_.reset();
+#else
+    if (data_) ::munmap(data_, size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+#ifdef _WIN32
+  std::unique_ptr<std::byte[]> buffer_;  ///< 読み込んだ内容
+#endif
+  void* data_ = nullptr;  ///< マップした先頭のアドレス
+  size_t size_ = 0;       ///< ファイルの大きさ
+};
+}  // namespace tmk_desktop
@@ -0,0 +1,161 @@
+/**
+ * @file passthrough.hpp
+ * @brief TMKを介さずにキーを送信する近道
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "action_cache.hpp"
+
+extern "C" {
+#include <common/keyboard.h>
+#include <common/action.h>
+#include <common/action_layer.h>
+#include <common/action_util.h>
+#include <common/keycode.h>
+}  // extern "C"
+
+namespace tmk_desktop {
+/**
+ * @brief アクションが単なるキーコードであるキーを、TMKを介さずに処理するクラス
+ *
+ * 現在のレイヤーでアクションが修飾キーを伴わないキーコードになるキーを表にしておき、
+ * それらのキーはマトリクスの走査やアクションの解決を省いて、TMKのレポートに直接追加して送信する。
+ * レポートはTMKのものを更新するので、TMKが後で送るレポートとも食い違わない。
+ *
+ * 以下のときはTMKの状態が次のキーに影響し得るので、近道を使わない。
+ * - 単なるキーコードでも修飾キーでもないアクションのキー (タップ判定中のキーやレイヤー切り替えのキーなど) が押されている
+ * - そのようなキーを操作してから、TMKがまだ次のキーを処理していない (ワンショットモディファイアなどが残り得る)
+ * - 弱い修飾キーが残っている
+ *
+ * Keyboardスレッドからのみ操作すること。
+ */
+class Passthrough final {
+public:
+  /**
+   * @brief 状態を初期化し、表を作る
+   *
+   * TMKを初期化したあとに呼び出すこと。以降はレイヤーが変わるたびに表を作り直す。
+   */
+  void reset() noexcept {
+    complexes_ = {};
+    pressed_keycodes_ = {};
+    held_complex_count_ = 0;
+    dirty_ = false;
+    valid_ = false;
+    update_table();
+  }
+
+  /**
+   * @brief 表を作り直させる
+   *
+   * 押しているキーの状態は保つので、キーマップが切り替わっても離したキーは押したときのキーコードで離す。
+   */
+  void invalidate() noexcept {
+    valid_ = false;
+  }
+
+  /**
+   * @brief 可能であればキーの変化をTMKを介さずに処理する
+   *
+   * 処理できなかったときは、呼び出し元がTMKに処理させること。
+   *
+   * @param keypos キーの位置
+   * @param pressed 押したかどうか
+   * @retval true 処理した
+   * @retval false TMKに処理させる必要がある
+   */
+  bool process(keypos_t keypos, bool pressed) noexcept {
+    const size_t index = keypos.row * MATRIX_COLS + keypos.col;
+    if (!pressed) {
+      // 近道で押したキーは、押したときのキーコードを離す
+      if (const uint8_t keycode = pressed_keycodes_[index]; keycode != KC_NO) {
+        pressed_keycodes_[index] = KC_NO;
+        del_key(keycode);
+        send_keyboard_report();
+        return true;
+      }
+      if (complexes_[index]) {
+        complexes_[index] = false;
+        held_complex_count_--;
+        dirty_ = true;
+      }
+      return false;
+    }
+
+    update_table();
+    const uint8_t keycode = keycodes_[index];
+    if (keycode != KC_NO && held_complex_count_ == 0 && !dirty_ && get_weak_mods() == 0) {
+      pressed_keycodes_[index] = keycode;
+      add_key(keycode);
+      send_keyboard_report();
+      return true;
+    }
+
+    if (keycode == KC_NO && !is_trivial(resolve_action(keypos))) {
+      complexes_[index] = true;
+      held_complex_count_++;
+      dirty_ = true;
+    } else {
+      // TMKが単純なキーを処理すれば、前のアクションが残した状態は片付く
+      dirty_ = false;
+    }
+    return false;
+  }
+
+private:
+  static constexpr size_t KEYPOS_COUNT = MATRIX_ROWS * MATRIX_COLS;
+
+  /**
+   * @brief アクションが修飾キーを伴わないキーコードかどうかを調べる
+   */
+  static bool is_passthrough(action_t action) noexcept {
+    return (action.kind.id == ACT_LMODS || action.kind.id == ACT_RMODS) && action.key.mods == 0 && IS_KEY(action.key.code);
+  }
+
+  /**
+   * @brief アクションが次のキーに影響を残さないかどうかを調べる
+   *
+   * 修飾キーを伴わないキーコードと修飾キー、何もしないアクションが該当する。
+   */
+  static bool is_trivial(action_t action) noexcept {
+    if (action.kind.id != ACT_LMODS && action.kind.id != ACT_RMODS) return false;
+    if (action.key.mods != 0) return false;
+    const uint8_t code = action.key.code;
+    return code == KC_NO || code == KC_TRANSPARENT || IS_KEY(code) || IS_MOD(code);
+  }
+
+  /**
+   * @brief レイヤーが変わっていれば表を作り直す
+   */
+  void update_table() noexcept {
+#ifndef NO_ACTION_LAYER
+    const uint32_t layers = layer_state | default_layer_state;
+#else
+    const uint32_t layers = 0;
+#endif
+    if (valid_ && layers == layers_) return;
+    layers_ = layers;
+    valid_ = true;
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; ++row) {
+      for (uint8_t col = 0; col < MATRIX_COLS; ++col) {
+        const auto action = resolve_action(keypos_t{.col = col, .row = row});
+        keycodes_[row * MATRIX_COLS + col] = is_passthrough(action) ? action.key.code : uint8_t{KC_NO};
+      }
+    }
+  }
+
+  std::array<uint8_t, KEYPOS_COUNT> keycodes_{};          ///< 近道で送れるキーコード。送れなければKC_NO
+  std::array<bool, KEYPOS_COUNT> complexes_{};            ///< TMKが処理中の複雑なアクションのキーかどうか
+  std::array<uint8_t, KEYPOS_COUNT> pressed_keycodes_{};  ///< 近道で押したキーコード
+  size_t held_complex_count_ = 0;                         ///< 押されている複雑なアクションのキーの数
+  uint32_t layers_ = 0;                                   ///< 表を作ったときのレイヤーの状態
+  bool dirty_ = false;                                    ///< TMKの状態が次のキーに影響し得るかどうか
+  bool valid_ = false;                                    ///< 表が作られているかどうか
+};
+}  // namespace tmk_desktop
@@ -0,0 +1,71 @@
+/**
+ * @file pipeline.hpp
+ * @brief Source、Keyboard、Sinkをつなぐ内部インターフェイス
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * TMK_DESKTOP_FUSED_PIPELINEを定義すると、KeyboardとSinkはスレッドを持たなくなる。
+ * Sourceのスレッドが入力イベントを受け取るたびにrun_keyboard()を呼び出し、
+ * Keyboardが送ったSinkEventはsend_to_sink()の中でそのまま処理される。
+ * start_*()とstop_*()の使い方は変わらないが、Sink、Keyboard、Sourceの順に始動し、逆順に停止させること。
+ *
+ * TMK_DESKTOP_COALESCE_REPORTSを定義すると、Keyboardはkeyboard_task()をSinkのトランザクションで囲む。
+ * その間にsend_to_sink()で送られたキーボードレポートは、途中経過を省いてからSinkに渡される。
+ */
+#pragma once
+
+#include <tmk_desktop/clock.hpp>
+
+namespace tmk_desktop {
+#ifdef TMK_DESKTOP_FUSED_PIPELINE
+/**
+ * @brief Keyboardの処理を呼び出し元のスレッドで進める
+ *
+ * 溜まっている入力イベントと期限を迎えた処理をまとめて行う。Sourceのスレッドから呼び出すこと。
+ * 処理中に例外が投げられたときは、Keyboardを停止させてからon_keyboard_error()を呼び出す。
+ *
+ * @return 次に呼び出すべき時刻。期限がなければClock::time_point::max()
+ */
+Clock::time_point run_keyboard();
+#endif
+
+#ifdef TMK_DESKTOP_COALESCE_REPORTS
+/**
+ * @brief Sinkのトランザクションを始める
+ *
+ * 以降にsend_to_sink()で送られたキーボードレポートは、commit_sink_transaction()を呼ぶまで溜められる。
+ * Keyboardスレッドからのみ呼び出すこと。
+ */
+void begin_sink_transaction() noexcept;
+
+/**
+ * @brief Sinkのトランザクションを終え、溜めたレポートを送信する
+ *
+ * Keyboardスレッドからのみ呼び出すこと。
+ */
+void commit_sink_transaction() noexcept;
+#endif
+
+/**
+ * @brief スコープをSinkのトランザクションで囲むクラス
+ *
+ * TMK_DESKTOP_COALESCE_REPORTSを定義しなければ何もしない。
+ */
+class SinkTransaction final {
+public:
+  SinkTransaction() noexcept {
+#ifdef TMK_DESKTOP_COALESCE_REPORTS
+    begin_sink_transaction();
+#endif
+  }
+
+  SinkTransaction(const SinkTransaction&) = delete;
+  SinkTransaction& operator=(const SinkTransaction&) = delete;
+
+  ~SinkTransaction() {
+#ifdef TMK_DESKTOP_COALESCE_REPORTS
+    commit_sink_transaction();
+#endif
+  }
+};
+}  // namespace tmk_desktop
@@ -0,0 +1,145 @@
+/**
+ * @file report_coalescer.hpp
+ * @brief keyboard_task()の間に送られたキーボードレポートをまとめるやつ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <tmk_desktop/counter.hpp>
+#include "report_keyset.hpp"
+
+namespace tmk_desktop {
+/**
+ * @brief キーボードレポートをまとめるクラス
+ *
+ * トランザクションの間に届いたレポートは、前のレポートが押したキーがなければ後のレポートで上書きする。
+ * 非修飾キーを押したレポートは、そのときの修飾キー状態が意味を持つので、上書きせずに送信する。
+ * 押したキーを後のレポートで離すときや、離したキーを後のレポートで押し直すときも、その操作が消えないように送信する。
+ * これは修飾キーも同じで、修飾キーだけのタップや押し直しもOSに届く。
+ * これにより、修飾キーを足してから非修飾キーを押すような途中経過は捨てつつ、キーを押す順序とそのときの修飾キー状態は保たれる。
+ *
+ * 操作はKeyboardスレッドのみが行う。統計はどのスレッドからでも取得できる。
+ */
+class ReportCoalescer final {
+public:
+  /**
+   * @brief トランザクションを始める
+   */
+  void begin() noexcept {
+    open_ = true;
+  }
+
+  /**
+   * @brief トランザクションを終え、溜めていたレポートを送信する
+   *
+   * @param send レポートを送信する関数オブジェクト
+   */
+  template <typename Send>
+  void commit(Send send) noexcept {
+    flush(send);
+    open_ = false;
+  }
+
+  /**
+   * @brief トランザクション中かどうかを調べる
+   */
+  bool is_open() const noexcept {
+    return open_;
+  }
+
+  /**
+   * @brief レポートを受け取る
+   *
+   * トランザクション中でなければそのまま送信する。
+   *
+   * @param report レポート
+   * @param send レポートを送信する関数オブジェクト
+   */
+  template <typename Send>
+  void push(const report_keyboard_t& report, Send send) noexcept {
+    increment(received_count_);
+    const auto keyset = ReportKeyset::from(report);
+    if (!open_) {
+      emit(report, keyset, send);
+      return;
+    }
+
+    if (has_pending_ && must_emit_pending(keyset)) emit(pending_, pending_keyset_, send);
+    pending_ = report;
+    pending_keyset_ = keyset;
+    has_pending_ = true;
+  }
+
+  /**
+   * @brief 溜めていたレポートを送信する
+   *
+   * 他の種類のイベントを送る前に呼び出し、イベントの順序を保つ。
+   * 送信済みのキー状態と変わらなければ送信しない。
+   *
+   * @param send レポートを送信する関数オブジェクト
+   */
+  template <typename Send>
+  void flush(Send send) noexcept {
+    if (!has_pending_) return;
+    has_pending_ = false;
+    if (committed_.keys == pending_keyset_.keys && committed_.mods == pending_keyset_.mods) return;
+    emit(pending_, pending_keyset_, send);
+  }
+
+  /**
+   * @brief 受け取ったレポートの数を取得する
+   */
+  uint64_t received_count() const noexcept {
+    return received_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 送信したレポートの数を取得する
+   */
+  uint64_t sent_count() const noexcept {
+    return sent_count_.load(std::memory_order_relaxed);
+  }
+
+private:
+  /**
+   * @brief 溜めていたレポートを上書きせずに送信すべきかを調べる
+   *
+   * @param next 次のレポートのキー状態
+   */
+  bool must_emit_pending(const ReportKeyset& next) const noexcept {
+    const auto both = [](auto lhs, auto rhs) { return lhs & rhs; };
+
+    // 非修飾キーを押したなら、そのときの修飾キー状態と合わせて送る
+    if (reset_to_set(committed_.keys, pending_keyset_.keys).any()) return true;
+
+    // 押した修飾キーを次のレポートで離すなら、押したことを送る
+    const auto pressed_mods = reset_to_set(committed_.mods, pending_keyset_.mods);
+    if (binary_op(pressed_mods, set_to_reset(pending_keyset_.mods, next.mods), both).any()) return true;
+
+    // 離したキーを次のレポートで押し直すなら、離したことを送る
+    const auto released = set_to_reset(committed_.keys, pending_keyset_.keys);
+    if (binary_op(released, next.keys, both).any()) return true;
+    const auto released_mods = set_to_reset(committed_.mods, pending_keyset_.mods);
+    return binary_op(released_mods, next.mods, both).any();
+  }
+
+  template <typename Send>
+  void emit(const report_keyboard_t& report, const ReportKeyset& keyset, Send& send) noexcept {
+    send(report);
+    committed_ = keyset;
+    increment(sent_count_);
+  }
+
+  bool open_ = false;                        ///< トランザクション中かどうか
+  bool has_pending_ = false;                 ///< 溜めているレポートがあるかどうか
+  report_keyboard_t pending_{};              ///< 溜めているレポート
+  ReportKeyset pending_keyset_{};            ///< 溜めているレポートのキー状態
+  ReportKeyset committed_{};                 ///< 送信済みのキー状態
+  std::atomic<uint64_t> received_count_{0};  ///< 受け取ったレポートの数
+  std::atomic<uint64_t> sent_count_{0};      ///< 送信したレポートの数
+};
+}  // namespace tmk_desktop
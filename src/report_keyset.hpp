@@ -0,0 +1,76 @@
+/**
+ * @file report_keyset.hpp
+ * @brief キーボードレポートが表すキー状態
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <span>
+#include <cstdint>
+#include <tmk_desktop/bitset.hpp>
+#include "key_batch.hpp"
+
+extern "C" {
+#include <common/keycode.h>
+#include <common/report.h>
+}  // extern "C"
+
+namespace tmk_desktop {
+/**
+ * @brief キーボードレポートが表すキー状態
+ */
+struct ReportKeyset {
+  using Keyset = Bitset<256, uint8_t>;
+  using ModKeyset = Bitset<8, uint8_t>;
+
+  Keyset keys{};     ///< 非修飾キーの状態
+  ModKeyset mods{};  ///< 修飾キーの状態
+
+  /**
+   * @brief レポートからキー状態を取り出す
+   */
+  static ReportKeyset from(const report_keyboard_t& report) noexcept {
+    ReportKeyset keyset;
+#ifdef NKRO_ENABLE
+    keyset.keys = Keyset{report.nkro.bits};
+    keyset.mods = ModKeyset{report.nkro.mods};
+#else
+    for (auto key : std::span(report.keys)) {
+      if (key >= KC_LCTRL && key <= KC_RGUI) continue;
+      if (key != 0) keyset.keys.set(key);
+    }
+    keyset.mods = ModKeyset{report.mods};
+#endif
+    return keyset;
+  }
+};
+
+/**
+ * @brief キー状態の変化を、OSに送る順番でキー操作の列に並べる
+ *
+ * 非修飾キーを離す、修飾キーを離す、修飾キーを押す、非修飾キーを押す、の順に並べる。
+ *
+ * @param prev 前回のキー状態
+ * @param next 今回のキー状態
+ * @param batch 格納先。元の内容は捨てる
+ */
+inline void make_key_batch(const ReportKeyset& prev, const ReportKeyset& next, KeyBatch& batch) noexcept {
+  const auto [pressed_keyset, released_keyset] = diff(prev.keys, next.keys);          // 押した、離した
+  const auto [pressed_mod_keyset, released_mod_keyset] = diff(prev.mods, next.mods);  // 押した、離した
+
+  batch.clear();
+  released_keyset.scan([&](auto pos) {  // 非修飾キーを離す
+    batch.push(pos.index(), false);
+  });
+  released_mod_keyset.scan([&](auto pos) {  // 修飾キーを離す
+    batch.push(KC_LCTRL + pos.index(), false);
+  });
+  pressed_mod_keyset.scan([&](auto pos) {  // 修飾キーを押す
+    batch.push(KC_LCTRL + pos.index(), true);
+  });
+  pressed_keyset.scan([&](auto pos) {  // 非修飾キーを押す
+    batch.push(pos.index(), true);
+  });
+}
+}  // namespace tmk_desktop
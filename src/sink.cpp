@@ -5,78 +5,48 @@
  * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
  */
 #include <tmk_desktop/sink.hpp>
-#include <atomic>
-#include <deque>
-#include <mutex>
-#include <condition_variable>
+#include <array>
 #include <exception>
 #include <thread>
 #include <tmk_desktop/bitset.hpp>
+#include <tmk_desktop/latency.hpp>
+#include <tmk_desktop/spsc_queue.hpp>
+#include <tmk_desktop/stage.hpp>
+#include "flight_recorder.hpp"
+#include "key_batch.hpp"
+#include "pipeline.hpp"
+#include "report_coalescer.hpp"
+#include "report_keyset.hpp"
 
 extern "C" {
 #include <common/action.h>
 }  // extern "C"
 
-#ifdef _WIN32
+#if defined(TMK_DESKTOP_HEADLESS)
+#include "headless/sender.hpp"
+#elif defined(TMK_DESKTOP_EVDEV)
+#include "evdev/sender.hpp"
+#elif defined(_WIN32)
 #include "win32/sender.hpp"
 #endif
 
 namespace tmk_desktop {
 namespace {
-std::thread thread_{};                     ///< スレッド
-std::atomic<bool> running_{false};         ///< スレッドが動作中かどうか
-std::atomic<bool> stop_requested_{false};  ///< スレッドに対する停止要求
-
-std::deque<SinkEvent> event_queue_;       ///< イベントキュー
-std::mutex event_queue_mtx_;              ///< イベントキューのためのMutex
-std::condition_variable event_queue_cv_;  ///< イベントキューのためのCV
-EventSender sender_;                      ///< OSに入力イベントを送るためのクラス
+EventSender sender_;  ///< OSに入力イベントを送るためのクラス
 
 /**
  * @brief SinkEventのvisitor
  */
 class SinkEventVisitor final {
 public:
-  using Keyset = Bitset<256, uint8_t>;
-  using ModKeyset = Bitset<8, uint8_t>;
-
   void operator()(const report_keyboard_t& report) noexcept {
-    // 前回のキー状態を保存する
-    const auto prev_keyset = keyset_;          // 前回のキー状態
-    const auto prev_mod_keyset = mod_keyset_;  // 前回の修飾キー状態
-
-    // 今回のキー状態を記録する
-#ifdef NKRO_ENABLE
-    keyset_ = Keyset{report.nkro.bits};         // 今回のキー状態
-    mod_keyset_ = ModKeyset{report.nkro.mods};  // 今回の修飾キー状態
-#else
-    keyset_.clear();
-    for (auto key : std::span(report.keys)) {
-      if (key >= KC_LCTRL && key <= KC_RGUI) continue;
-      if (key != 0) keyset_.set(key);
-    }
-    mod_keyset_ = ModKeyset{report.mods};
-#endif
+    // 前回のキー状態を保存し、今回のキー状態を記録する
+    const auto prev = keyset_;
+    keyset_ = ReportKeyset::from(report);
 
-    // 今回の更新で変化するキーを抽出する
-    const auto pressed_keyset = reset_to_set(prev_keyset, keyset_);               // 押した
-    const auto released_keyset = set_to_reset(prev_keyset, keyset_);              // 離した
-    const auto pressed_mod_keyset = reset_to_set(prev_mod_keyset, mod_keyset_);   // 押した
-    const auto released_mod_keyset = set_to_reset(prev_mod_keyset, mod_keyset_);  // 離した
-
-    // キーイベントを送信する
-    released_keyset.scan([](auto pos) {  // 非修飾キーを離す
-      sender_.send_key_release(pos.index());
-    });
-    released_mod_keyset.scan([](auto pos) {  // 修飾キーを離す
-      sender_.send_key_release(KC_LCTRL + pos.index());
-    });
-    pressed_mod_keyset.scan([](auto pos) {  // 修飾キーを押す
-      sender_.send_key_press(KC_LCTRL + pos.index());
-    });
-    pressed_keyset.scan([](auto pos) {  // 非修飾キーを押す
-      sender_.send_key_press(pos.index());
-    });
+    // 今回の更新で変化するキー操作を順番通りに並べ、まとめて送信する
+    make_key_batch(prev, keyset_, batch_);
+    if (!batch_.empty()) sender_.send_keys(batch_);
   }
 
   void operator()(const report_mouse_t& report) noexcept {
@@ -160,96 +130,186 @@ public:
   }
 
 private:
-  Keyset keyset_{};         ///< 最新のキー状態
-  ModKeyset mod_keyset_{};  ///< 最新の修飾キー状態
+  ReportKeyset keyset_{};  ///< 最新のキー状態
+  KeyBatch batch_{};       ///< 送信するキー操作
 } visitor_;
-}  // namespace
 
-bool start_sink() {
-  if (thread_.joinable()) return false;
+/**
+ * @brief SinkEventを処理する関数の型
+ */
+using Dispatcher = void (*)(const SinkEvent&) noexcept;
 
-  // 状態を初期化する
-  stop_requested_.store(false, std::memory_order_release);
+/**
+ * @brief SinkEventTypeを添字とする処理関数の表
+ */
+constexpr std::array<Dispatcher, SINK_EVENT_TYPE_COUNT> dispatchers_{
+    [](const SinkEvent&) noexcept {},
+    [](const SinkEvent& event) noexcept { visitor_(event.keyboard_report()); },
+    [](const SinkEvent& event) noexcept { visitor_(event.mouse_report()); },
+    [](const SinkEvent& event) noexcept { visitor_(event.usage()); },
+    [](const SinkEvent& event) noexcept { visitor_(event.native()); },
+    [](const SinkEvent& event) noexcept { visitor_(event.signal()); },
+};
 
-  thread_ = std::thread([] {
-    const struct ScopedRunning {
-      ScopedRunning() {
-        running_.store(true, std::memory_order_release);
-      }
-      ~ScopedRunning() {
-        running_.store(false, std::memory_order_release);
-      }
-    } _running{};
-
-    try {
-      const struct ScopedInit {
-        ScopedInit() {
-          sender_.enable();
-        }
-        ~ScopedInit() {
-          sender_.disable();
-        }
-      } _init{};
-
-      while (!stop_requested_.load(std::memory_order_acquire)) {
-        SinkEvent event;
-        {
-          std::unique_lock lock{event_queue_mtx_};
-          if (event_queue_.empty()) {
-            event_queue_cv_.wait(lock, [] { return !event_queue_.empty() || stop_requested_.load(std::memory_order_acquire); });
-            if (stop_requested_.load(std::memory_order_acquire)) break;
-            if (event_queue_.empty()) continue;
-          }
-          event = event_queue_.front();
-          event_queue_.pop_front();
-        }
+/**
+ * @brief イベントの中身に応じて処理を行う
+ *
+ * @param event イベント
+ */
+inline void dispatch(const SinkEvent& event) noexcept {
+  dispatchers_[static_cast<size_t>(event.type())](event);
+}
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+/**
+ * @brief Sinkを通る間の遅延の分布
+ *
+ * 記録するのはSinkのスレッドだけである。
+ */
+struct SinkLatency {
+  LatencyHistogram queue;       ///< キューに積んでから、取り出すまで
+  LatencyHistogram submit;      ///< キューから取り出してから、OSへの送信を終えるまで
+  LatencyHistogram end_to_end;  ///< 元になった入力をフックで受け取ってから、OSへの送信を終えるまで
+};
 
-        // イベントの中身に応じて処理を行う
-        std::visit(visitor_, event);
+SinkLatency latency_;  ///< 遅延の分布
+#endif
 
-        // CPUを明け渡す
-        std::this_thread::yield();
-      }
-    } catch (std::exception& e) {
-      on_sink_error(e);
-    }
-  });
+/**
+ * @brief Sinkのステージでイベントを処理するクラス
+ */
+struct SinkHandler {
+  void init() {
+    sender_.enable();
+  }
 
-  return true;
+  void deinit() {
+    sender_.disable();
+  }
+
+  void process(const SinkEvent& event) noexcept {
+    dispatch(event);
+  }
+
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+  void process(const SinkEvent& event, const LatencyStamp& stamp) noexcept {
+    const auto dequeued_tp = Clock::now();
+    latency_.queue.record(stamp.enqueued, dequeued_tp);
+    dispatch(event);
+    const auto submitted_tp = Clock::now();
+    latency_.submit.record(dequeued_tp, submitted_tp);
+    if (stamp.captured != Clock::time_point{}) latency_.end_to_end.record(stamp.captured, submitted_tp);
+  }
+#endif
+
+  Clock::time_point poll() noexcept {
+    return Clock::time_point::max();
+  }
+
+  void on_error(std::exception& e) noexcept {
+    on_sink_error(e);
+  }
+};
+
+Stage<SinkHandler, SpscQueue<SinkEvent, 512>> stage_;  ///< ステージ
+}  // namespace
+
+#ifdef TMK_DESKTOP_FUSED_PIPELINE
+bool start_sink() {
+  return stage_.start_inline();
 }
 
 bool stop_sink() {
-  // すでにスレッドが停止しているかを確認する
-  if (!thread_.joinable()) return false;
+  return stage_.stop_inline();
+}
 
-  // すでにスレッドが実行終了しているかを確認する
-  if (!running_.load(std::memory_order_acquire)) return false;
+namespace {
+void submit_to_sink(const SinkEvent& event) noexcept {
+  record_sink_event(event);
+  // 呼び出し元のスレッドでそのまま処理する
+  stage_.process_inline(event, ScopedCaptureTime::current());
+}
+}  // namespace
+#else
+bool start_sink() {
+  return stage_.start();
+}
 
-  // スレッドに停止要求を出す
-  stop_requested_.store(true, std::memory_order_release);
-  event_queue_cv_.notify_one();
+bool stop_sink() {
+  return stage_.stop();
+}
 
-  // スレッドが停止するのを待つ
-  thread_.join();
+namespace {
+void submit_to_sink(const SinkEvent& event) noexcept {
+  record_sink_event(event);
+  // 満杯のときは、Sinkが動いている限り空くのを待つ
+  while (!stage_.push(event, ScopedCaptureTime::current())) {
+    if (!stage_.is_running()) return;
+    std::this_thread::yield();
+  }
+}
+}  // namespace
+#endif
+
+#ifdef TMK_DESKTOP_COALESCE_REPORTS
+namespace {
+ReportCoalescer coalescer_;  ///< keyboard_task()の間に送られたレポートをまとめるクラス
 
-  return true;
+void submit_report(const report_keyboard_t& report) noexcept {
+  submit_to_sink(report);
 }
+}  // namespace
 
-void send_to_sink(const SinkEvent& event) {
-  {
-    std::lock_guard lock{event_queue_mtx_};
-    event_queue_.push_back(event);
+void begin_sink_transaction() noexcept {
+  coalescer_.begin();
+}
+
+void commit_sink_transaction() noexcept {
+  coalescer_.commit(submit_report);
+}
+
+void send_to_sink(const SinkEvent& event) noexcept {
+  if (event.type() == SinkEventType::KEYBOARD_REPORT) {
+    coalescer_.push(event.keyboard_report(), submit_report);
+    return;
   }
-  event_queue_cv_.notify_one();
+
+  // 溜めていたレポートを先に送り、イベントの順序を保つ
+  coalescer_.flush(submit_report);
+  submit_to_sink(event);
+}
+
+ReportCoalescingStats get_report_coalescing_stats() noexcept {
+  return ReportCoalescingStats{
+      .received_count = coalescer_.received_count(),
+      .sent_count = coalescer_.sent_count(),
+  };
+}
+#else
+void send_to_sink(const SinkEvent& event) noexcept {
+  submit_to_sink(event);
+}
+#endif
+
+bool set_sink_wait_policy(const WaitPolicy& policy) noexcept {
+  return stage_.set_wait_policy(policy);
+}
+
+StageStats get_sink_stats() noexcept {
+  return stage_.stats();
 }
 
+#ifdef TMK_DESKTOP_LATENCY_HISTOGRAMS
+SinkLatencyStats get_sink_latency_stats() noexcept {
+  return SinkLatencyStats{
+      .queue = latency_.queue.snapshot(),
+      .submit = latency_.submit.snapshot(),
+      .end_to_end = latency_.end_to_end.snapshot(),
+  };
+}
+#endif
+
 SinkStatus get_sink_status() noexcept {
-  if (running_.load(std::memory_order_acquire)) {
-    if (stop_requested_.load(std::memory_order_acquire)) return SinkStatus::STOPPING;
-    return SinkStatus::RUNNING;
-  } else {
-    if (thread_.joinable()) return SinkStatus::STOPPED;
-    return SinkStatus::RESET;
-  }
+  return stage_.status();
 }
 }  // namespace tmk_desktop
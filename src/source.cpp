@@ -5,84 +5,63 @@
  * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
  */
 #include <tmk_desktop/source.hpp>
-#include <atomic>
 #include <exception>
 #include <thread>
+#include <tmk_desktop/precise_wait.hpp>
+#include <tmk_desktop/stage.hpp>
+#include "pipeline.hpp"
 
-#ifdef _WIN32
+#if defined(TMK_DESKTOP_HEADLESS)
+#include "headless/receiver.hpp"
+#elif defined(TMK_DESKTOP_EVDEV)
+#include "evdev/receiver.hpp"
+#elif defined(_WIN32)
 #include "win32/receiver.hpp"
 #endif
 
 namespace tmk_desktop {
 namespace {
-std::thread thread_;                       ///< スレッド
-std::atomic<bool> running_{false};         ///< スレッドが動作中かどうか
-std::atomic<bool> stop_requested_{false};  ///< スレッドに対する停止要求
-EventReceiver receiver_;                   ///< OSから入力イベントを受け取るためのクラス
+StageThread thread_;      ///< スレッド
+EventReceiver receiver_;  ///< OSから入力イベントを受け取るためのクラス
 }  // namespace
 
 bool start_source() {
-  if (thread_.joinable()) return false;
+  return thread_.start(
+      [] {
+        const struct ScopedInit {
+          ScopedInit() {
+            receiver_.enable();
+          }
+          ~ScopedInit() {
+            receiver_.disable();
+          }
+        } _init{};
 
-  // 状態を初期化する
-  stop_requested_.store(false, std::memory_order_release);
+#ifdef TMK_DESKTOP_FUSED_PIPELINE
+        // 期限はこのスレッドで待つので、マクロのステップなどの期限で起きるとき遅れないようにする
+        reduce_timer_slack();
 
-  thread_ = std::thread([] {
-    const struct ScopedRunning {
-      ScopedRunning() {
-        running_.store(true, std::memory_order_release);
-      }
-      ~ScopedRunning() {
-        running_.store(false, std::memory_order_release);
-      }
-    } _running{};
-
-    try {
-      const struct ScopedInit {
-        ScopedInit() {
-          receiver_.enable();
+        // 受け取ったイベントをこのスレッドでKeyboardに処理させ、次の期限まで次のイベントを待つ
+        auto deadline = Clock::time_point::max();
+        while (!thread_.stop_requested()) {
+          receiver_.poll(deadline);
+          deadline = run_keyboard();
         }
-        ~ScopedInit() {
-          receiver_.disable();
+#else
+        while (!thread_.stop_requested()) {
+          receiver_.poll();
+          std::this_thread::yield();
         }
-      } _init{};
-
-      while (!stop_requested_.load(std::memory_order_acquire)) {
-        receiver_.poll();
-        std::this_thread::yield();
-      }
-    } catch (std::exception& e) {
-      on_source_error(e);
-    }
-  });
-
-  return true;
+#endif
+      },
+      on_source_error);
 }
 
 bool stop_source() {
-  // すでにスレッドが停止しているかを確認する
-  if (!thread_.joinable()) return false;
-
-  // すでにスレッドが実行終了しているかを確認する
-  if (!running_.load(std::memory_order_acquire)) return false;
-
-  // スレッドに停止要求を出す
-  stop_requested_.store(true, std::memory_order_release);
-  receiver_.notify();
-
-  // スレッドが停止するのを待つ
-  thread_.join();
-
-  return true;
+  return thread_.stop([] { receiver_.notify(); });
 }
 
 SourceStatus get_source_status() noexcept {
-  if (running_.load(std::memory_order_acquire)) {
-    if (stop_requested_.load(std::memory_order_acquire)) return SourceStatus::STOPPING;
-    return SourceStatus::RUNNING;
-  } else {
-    if (thread_.joinable()) return SourceStatus::STOPPED;
-    return SourceStatus::RESET;
-  }
+  return thread_.status();
 }
 }  // namespace tmk_desktop
@@ -4,31 +4,78 @@
  * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
  * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
  */
+#include "timer.hpp"
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include "timer_clock.hpp"
 
 extern "C" {
 #include <common/timer.h>
 }  // extern "C"
 
+namespace tmk_desktop {
 namespace {
-using Clock = std::chrono::high_resolution_clock;
+static constexpr Clock::time_point NO_FIXED_TIME = Clock::time_point::min();  ///< 時刻を固定していないことを示す値
 
-Clock::time_point zero_tp_{};  // 始点となるtime_point
+TimerClock clock_;                            ///< 時計
+Clock::time_point zero_tp_{};                 ///< 始点となるtime_point
+Clock::time_point last_tp_{};                 ///< 最後に返した時刻
+Clock::time_point fixed_tp_ = NO_FIXED_TIME;  ///< 固定した時刻
+
+/**
+ * @brief タイマーの現在時刻を取得する
+ *
+ * イベントの時刻は実際の時刻より遅れているので、以前に返した時刻を下回らないようにする。
+ * 時刻が巻き戻ると、TMKは経過時間の桁あふれによってタップ判定を誤る。
+ */
+inline Clock::time_point now() noexcept {
+  const auto tp = (fixed_tp_ != NO_FIXED_TIME) ? fixed_tp_ : clock_.now();
+  last_tp_ = std::max(last_tp_, tp);
+  return last_tp_;
+}
+
+/**
+ * @brief 始点を現在時刻に戻す
+ */
+inline void reset() noexcept {
+  zero_tp_ = clock_.now();
+  last_tp_ = zero_tp_;
+}
 
 template <typename T>
 inline auto get_elapsed_time() noexcept {
-  return std::chrono::duration_cast<std::chrono::duration<T, std::milli>>(Clock::now() - zero_tp_);
+  return std::chrono::duration_cast<std::chrono::duration<T, std::milli>>(now() - zero_tp_);
 }
 }  // namespace
 
+ScopedEventTime::ScopedEventTime(Clock::time_point tp) noexcept : prev_tp_(fixed_tp_) {
+  fixed_tp_ = tp;
+}
+
+ScopedEventTime::~ScopedEventTime() noexcept {
+  fixed_tp_ = prev_tp_;
+}
+
+ScopedTimerSnapshot::ScopedTimerSnapshot() noexcept : prev_tp_(fixed_tp_) {
+  if (fixed_tp_ == NO_FIXED_TIME) fixed_tp_ = clock_.now();
+}
+
+ScopedTimerSnapshot::~ScopedTimerSnapshot() noexcept {
+  fixed_tp_ = prev_tp_;
+}
+}  // namespace tmk_desktop
+
 extern "C" {
+using tmk_desktop::get_elapsed_time;
+
 void timer_init() {
-  zero_tp_ = Clock::now();
+  tmk_desktop::clock_.calibrate();
+  tmk_desktop::reset();
 }
 
 void timer_clear() {
-  zero_tp_ = Clock::now();
+  tmk_desktop::reset();
 }
 
 uint16_t timer_read() {
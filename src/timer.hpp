@@ -0,0 +1,49 @@
+/**
+ * @file timer.hpp
+ * @brief タイマー関数の内部インターフェイス
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <tmk_desktop/clock.hpp>
+
+namespace tmk_desktop {
+/**
+ * @brief TMKのタイマー関数が返す時刻をイベントの時刻に固定する
+ *
+ * 生存している間、timer_read()などは現在時刻の代わりに指定した時刻を返す。
+ * キューで待たされた時間がタップ判定に影響しないよう、入力イベントを処理している間に使う。
+ * タイマーの呼び出し元と同じスレッドで使うこと。
+ */
+class ScopedEventTime final {
+public:
+  explicit ScopedEventTime(Clock::time_point tp) noexcept;
+  ~ScopedEventTime() noexcept;
+
+  ScopedEventTime(const ScopedEventTime&) = delete;
+  ScopedEventTime& operator=(const ScopedEventTime&) = delete;
+
+private:
+  Clock::time_point prev_tp_;  ///< 固定する前の時刻
+};
+
+/**
+ * @brief TMKのタイマー関数が返す時刻を、生成したときの時刻に固定する
+ *
+ * TMKはkeyboard_task()の1回の処理でタイマーを何度も読むので、時計を読むのを1回で済ませるために使う。
+ * すでにScopedEventTimeで時刻を固定していれば、その時刻を保つ。
+ * タイマーの呼び出し元と同じスレッドで使うこと。
+ */
+class ScopedTimerSnapshot final {
+public:
+  ScopedTimerSnapshot() noexcept;
+  ~ScopedTimerSnapshot() noexcept;
+
+  ScopedTimerSnapshot(const ScopedTimerSnapshot&) = delete;
+  ScopedTimerSnapshot& operator=(const ScopedTimerSnapshot&) = delete;
+
+private:
+  Clock::time_point prev_tp_;  ///< 固定する前の時刻
+};
+}  // namespace tmk_desktop
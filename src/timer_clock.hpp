@@ -0,0 +1,208 @@
+/**
+ * @file timer_clock.hpp
+ * @brief TMKのタイマーが読む時計
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * TMK_DESKTOP_TIMER_CLOCK_COARSEを定義すると、CLOCK_MONOTONIC_COARSEを読む。Linux以外ではsteady_clockを読む。
+ * TMK_DESKTOP_TIMER_CLOCK_TSCを定義すると、TSCを読んでsteady_clockの時刻に換算する。x86-64以外ではsteady_clockを読む。
+ * どの時計もClockと同じ始点の時刻を返すので、入力イベントの時刻と比べられる。
+ */
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <tmk_desktop/clock.hpp>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+namespace tmk_desktop {
+/**
+ * @brief steady_clockを読む時計
+ */
+class SteadyTimerClock final {
+public:
+  void calibrate() noexcept {}
+
+  Clock::time_point now() const noexcept {
+    return Clock::now();
+  }
+
+  const char* name() const noexcept {
+    return "steady_clock";
+  }
+};
+
+#ifdef __linux__
+/**
+ * @brief CLOCK_MONOTONIC_COARSEを読む時計
+ *
+ * vDSOが最後のティックで記録した時刻を返すだけなので速いが、分解能はカーネルのティック (1~10ミリ秒) に落ちる。
+ * steady_clockはCLOCK_MONOTONICを読むので、始点は同じである。
+ */
+class CoarseTimerClock final {
+public:
+  void calibrate() noexcept {}
+
+  Clock::time_point now() const noexcept {
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return Clock::time_point{std::chrono::duration_cast<Clock::duration>(std::chrono::seconds{ts.tv_sec} +
+                                                                         std::chrono::nanoseconds{ts.tv_nsec})};
+  }
+
+  const char* name() const noexcept {
+    return "CLOCK_MONOTONIC_COARSE";
+  }
+};
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+/**
+ * @brief TSCを読んでsteady_clockの時刻に換算する時計
+ *
+ * calibrate()でTSCの周波数を測り、以降はsteady_clockとの対応点からの差分を換算して返す。
+ * 周波数の誤差やsteady_clockの調整によるずれが溜まらないよう、1秒ごとに対応点を取り直し、周波数を測り直す。
+ * 取り直した瞬間に時刻がわずかに戻ることがあるので、単調性は呼び出し元で保つこと。
+ * CPUが不変TSCを持たなければ、steady_clockを読む。
+ *
+ * 状態を持つので、1つのスレッドから使うこと。
+ */
+class TscTimerClock final {
+public:
+  /**
+   * @brief CPUが不変TSCを持つかどうかを調べる
+   *
+   * 不変TSCは周波数の変化や省電力状態によらず一定の速さで進み、コア間で同期している。
+   */
+  static bool has_invariant_tsc() noexcept {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0x80000000);
+    if (static_cast<unsigned int>(info[0]) < 0x80000007) return false;
+    __cpuid(info, 0x80000007);
+    return info[3] & (1 << 8);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+    return edx & (1 << 8);
+#endif
+  }
+
+  /**
+   * @brief TSCの周波数を測る
+   *
+   * CALIBRATION_TIMEだけ待つ。
+   */
+  void calibrate() noexcept {
+    invariant_ = has_invariant_tsc();
+    if (!invariant_) return;
+
+    base_ = sample();
+    Sample last = base_;
+    while (last.tp - base_.tp < CALIBRATION_TIME) last = sample();
+    resync(last);
+  }
+
+  Clock::time_point now() noexcept {
+    if (!invariant_) return Clock::now();
+    const uint64_t tsc = __rdtsc();
+    const uint64_t ticks = tsc - anchor_.tsc;
+    if (ticks >= resync_ticks_) [[unlikely]] {
+      return resync(sample());
+    }
+    // ticksはRESYNC_INTERVAL分のティック数未満なので、mult_を掛けても64ビットに収まる
+    return anchor_.tp + std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds{(ticks * mult_) >> SHIFT});
+  }
+
+  const char* name() const noexcept {
+    return invariant_ ? "TSC" : "steady_clock (no invariant TSC)";
+  }
+
+  /**
+   * @brief 測ったTSCの周波数 [Hz] を取得する
+   */
+  double frequency() const noexcept {
+    return invariant_ ? std::ldexp(1e9, SHIFT) / static_cast<double>(mult_) : 0.0;
+  }
+
+private:
+  static constexpr auto CALIBRATION_TIME = std::chrono::milliseconds(2);  ///< 最初に周波数を測る時間
+  static constexpr auto RESYNC_INTERVAL = std::chrono::seconds(1);        ///< 対応点を取り直す間隔
+  static constexpr int SHIFT = 24;                                        ///< mult_の固定小数点の桁数
+
+  /**
+   * @brief TSCとsteady_clockの対応点
+   */
+  struct Sample {
+    uint64_t tsc = 0;
+    Clock::time_point tp{};
+  };
+
+  /**
+   * @brief 対応点を取る
+   *
+   * steady_clockを読む前後のTSCの差が最も小さかった組を使い、割り込みなどで空いた組を避ける。
+   */
+  static Sample sample() noexcept {
+    Sample best;
+    uint64_t best_span = UINT64_MAX;
+    for (int i = 0; i < 4; ++i) {
+      const uint64_t before = __rdtsc();
+      const auto tp = Clock::now();
+      const uint64_t after = __rdtsc();
+      if (after - before < best_span) {
+        best_span = after - before;
+        best = Sample{before + (after - before) / 2, tp};
+      }
+    }
+    return best;
+  }
+
+  /**
+   * @brief 対応点を取り直し、最初の対応点からの長い区間で周波数を測り直す
+   *
+   * @return 新しい対応点の時刻
+   */
+  Clock::time_point resync(const Sample& s) noexcept {
+    const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(s.tp - base_.tp).count());
+    const double ticks = static_cast<double>(s.tsc - base_.tsc);
+    if (ns > 0 && ticks > 0) {
+      mult_ = static_cast<uint64_t>(std::ldexp(ns / ticks, SHIFT));
+      resync_ticks_ = static_cast<uint64_t>(ticks / ns * std::chrono::duration<double, std::nano>(RESYNC_INTERVAL).count());
+    }
+    anchor_ = s;
+    return s.tp;
+  }
+
+  bool invariant_ = false;     ///< 不変TSCを持つかどうか
+  Sample base_;                ///< 最初の対応点
+  Sample anchor_;              ///< 換算の基準にする対応点
+  uint64_t mult_ = 0;          ///< 1ティックあたりのナノ秒数を2^SHIFT倍した値
+  uint64_t resync_ticks_ = 0;  ///< 対応点を取り直すまでのティック数
+};
+#endif
+
+/**
+ * @brief TMKのタイマーが読む時計
+ */
+#if defined(TMK_DESKTOP_TIMER_CLOCK_TSC) && (defined(_M_X64) || defined(__x86_64__))
+using TimerClock = TscTimerClock;
+#elif defined(TMK_DESKTOP_TIMER_CLOCK_COARSE) && defined(__linux__)
+using TimerClock = CoarseTimerClock;
+#else
+using TimerClock = SteadyTimerClock;
+#endif
+}  // namespace tmk_desktop
@@ -3,15 +3,29 @@
  * @brief 待機関数
  * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
  * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * sleep_for()は期限を過ぎてからスレッドを起こすので、タイマースラックやスケジューラーの都合で数十マイクロ秒から数ミリ秒遅れる。
+ * TMKの待機は短い待ち時間でキー入力の間隔を作るために使われるので、PreciseWaiterで期限の直後に戻る。
  */
-#include <thread>
+#include <chrono>
+#include <tmk_desktop/precise_wait.hpp>
+
+namespace tmk_desktop {
+namespace {
+PreciseWaiter waiter_;  ///< TMKの待機関数が使う待機
+}  // namespace
+
+PreciseWaitStats get_precise_wait_stats() noexcept {
+  return waiter_.stats();
+}
+}  // namespace tmk_desktop
 
 extern "C" {
 void wait_ms(uintptr_t ms) {
-  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  tmk_desktop::waiter_.wait_for(std::chrono::milliseconds(ms));
 }
 
 void wait_us(uintptr_t us) {
-  std::this_thread::sleep_for(std::chrono::microseconds(us));
+  tmk_desktop::waiter_.wait_for(std::chrono::microseconds(us));
 }
 }  // extern "C"
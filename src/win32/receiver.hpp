@@ -6,21 +6,35 @@
  */
 #pragma once
 
-#include <exception>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <Windows.h>
-#include <tmk_desktop/source.hpp>
+#include <tmk_desktop/bitset.hpp>
+#include <tmk_desktop/clock.hpp>
 #include <tmk_desktop/keyboard.hpp>
+#include <tmk_desktop/precise_wait.hpp>
 #include "injected.hpp"
 
 namespace tmk_desktop::inline win32 {
 class EventReceiver final {
 public:
+  /**
+   * @brief Keyboardに送り損ねた離す操作を送り直す間隔
+   */
+  static constexpr auto RETRY_INTERVAL = std::chrono::milliseconds(1);
+
   /**
    * @brief 有効化
    */
   void enable() noexcept {
+    engine_keys_.clear();
+    passed_keys_.clear();
+    pending_keys_.clear();
     thread_id_ = GetCurrentThreadId();
     hook_ = SetWindowsHookEx(WH_KEYBOARD_LL, hook_proc, GetModuleHandle(NULL), 0);
+    // 使えれば高分解能の待機可能タイマー (Windows 10 1803以降) で期限を待つ
+    timer_ = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
   }
 
   /**
@@ -32,18 +46,48 @@ public:
       thread_id_ = 0;
       hook_ = NULL;
     }
+    if (timer_) {
+      CloseHandle(timer_);
+      timer_ = NULL;
+    }
   }
 
   /**
    * @brief イベントを受け取って処理する
    *
    * notify()を受けたり異常停止したりしない限りリターンされない。
+   * Keyboardに送り損ねた離す操作があれば、送り直すためにRETRY_INTERVALごとにリターンされる。
    */
   void poll() noexcept {
+    if (pending_keys_.any()) {
+      poll(Clock::now() + RETRY_INTERVAL);
+      return;
+    }
     MSG msg;
     GetMessage(&msg, NULL, 0, 0);
   }
 
+  /**
+   * @brief 期限までイベントを受け取って処理する
+   *
+   * イベントを受け取るか、期限を迎えるか、notify()を受けるとリターンされる。
+   *
+   * @param deadline 期限。Clock::time_point::max()なら期限なし
+   */
+  void poll(Clock::time_point deadline) noexcept {
+    if (deadline == Clock::time_point::max()) {
+      poll();
+      return;
+    }
+
+    const auto now = Clock::now();
+    if (pending_keys_.any()) deadline = std::min(deadline, now + RETRY_INTERVAL);
+    if (deadline > now) wait(deadline - now);
+    MSG msg;
+    PeekMessage(&msg, NULL, 0, 0, PM_REMOVE);
+    send_pending();
+  }
+
   /**
    * @brief pollを抜けるよう通知する
    */
@@ -52,6 +96,90 @@ public:
   }
 
 private:
+  using KeySet = Bitset<KEY_COUNT, uint64_t>;
+
+  /**
+   * @brief 入力を受けるか、指定の時間が経つまで待つ
+   *
+   * 待機可能タイマーを使えれば、時間をミリ秒に丸めずに待つ。
+   */
+  void wait(Clock::duration duration) noexcept {
+    if (timer_) {
+      // 負の値は相対時間を表す
+      LARGE_INTEGER due_time;
+      due_time.QuadPart = -std::chrono::ceil<std::chrono::duration<LONGLONG, std::ratio<1, 10'000'000>>>(duration).count();
+      if (SetWaitableTimer(timer_, &due_time, 0, nullptr, nullptr, FALSE)) {
+        MsgWaitForMultipleObjectsEx(1, &timer_, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        return;
+      }
+    }
+    const auto timeout = std::chrono::ceil<std::chrono::milliseconds>(duration);
+    MsgWaitForMultipleObjectsEx(0, NULL, static_cast<DWORD>(timeout.count()), QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+  }
+
+  /**
+   * @brief キーイベントをエンジンとOSのどちらに流すかを決める
+   *
+   * キーを押したときの行き先を覚えておき、同じキーのオートリピートと離す操作を同じ行き先に流す。
+   * これにより、キューが溢れても、押す操作と離す操作が別々の行き先に届いてキーが押されたままになることを防ぐ。
+   *
+   * @retval true エンジンに流した (または捨てた)
+   * @retval false OSに素通りさせる
+   */
+  static bool route(const KBDLLHOOKSTRUCT& info) noexcept {
+    const KeyEvent event{info};
+    const auto key = event.key();
+
+    // 押したときに素通りさせたキーは、離すまで素通りさせ続ける
+    if (passed_keys_[key]) {
+      if (!event.is_pressed()) passed_keys_.reset(key);
+      return false;
+    }
+
+    // 先に離した操作を送り損ねていれば、順序を保つために先に送る
+    send_pending();
+
+    if (event.is_pressed()) {
+      // 離す操作を送り損ねたままのキーは、押す操作が先に届いてしまうのでエンジンに流さない
+      if (!pending_keys_[key] && send_to_keyboard(event)) {
+        engine_keys_.set(key);
+        return true;
+      }
+      // エンジンが押しているキーのオートリピートは、素通りさせるとOSだけが押すことになるので捨てる
+      if (engine_keys_[key]) return true;
+      // キューが溢れたときは、キー入力を失わないように素通りさせる
+      passed_keys_.set(key);
+      return false;
+    }
+
+    if (!engine_keys_[key]) {
+      // フックを設定する前に押していたキーは、押す操作がOSに届いているので、溢れたときはOSに流す
+      return send_to_keyboard(event);
+    }
+    engine_keys_.reset(key);
+    if (send_to_keyboard(event)) return true;
+    // エンジンが押しているキーの離す操作は、キューが空いてから送り直す
+    pending_events_[key] = event;
+    pending_keys_.set(key);
+    return true;
+  }
+
+  /**
+   * @brief 送り損ねた離す操作をKeyboardに送り直す
+   */
+  static void send_pending() noexcept {
+    if (pending_keys_.none()) return;
+    const auto keys = pending_keys_;
+    keys.scan([](auto pos) {
+      if (send_to_keyboard(pending_events_[pos.index()])) {
+        pending_keys_.reset(pos);
+      } else if (get_keyboard_status() != KeyboardStatus::RUNNING) {
+        // 受け取り手がいないので捨てる
+        pending_keys_.reset(pos);
+      }
+    });
+  }
+
   /**
    * @brief フックプロシージャ
    *
@@ -70,11 +198,11 @@ private:
         if (remove_injected(*info_ptr)) break;
 
         // キー入力を奪ってエンジンに横流しする
-        try {
-          send_to_keyboard(*info_ptr);
-        } catch (std::exception& e) {
-          on_source_error(e);
-        }
+        if (!route(*info_ptr)) break;
+#ifdef TMK_DESKTOP_FUSED_PIPELINE
+        // フックの外でイベントを処理させるため、poll()を抜けさせる
+        PostThreadMessage(GetCurrentThreadId(), WM_NULL, 0, 0);
+#endif
         return TRUE;
       }
     }
@@ -85,5 +213,12 @@ private:
 
   HHOOK hook_ = NULL;    ///< フックのハンドル
   DWORD thread_id_ = 0;  ///< スレッドID
+  HANDLE timer_ = NULL;  ///< 期限を待つ待機可能タイマー
+
+  // フックプロシージャとpoll()は同じスレッドで呼ばれるので、排他制御はしない
+  static inline KeySet engine_keys_{};                              ///< 押す操作をエンジンに流したキー
+  static inline KeySet passed_keys_{};                              ///< 押す操作をOSに素通りさせたキー
+  static inline KeySet pending_keys_{};                             ///< 離す操作をKeyboardに送り損ねたキー
+  static inline std::array<KeyEvent, KEY_COUNT> pending_events_{};  ///< 送り損ねた離す操作
 };
 }  // namespace tmk_desktop::inline win32
@@ -6,8 +6,10 @@
  */
 #pragma once
 
+#include <array>
 #include <Windows.h>
 #include <tmk_desktop/win32/settings.hpp>
+#include "../key_batch.hpp"
 #include "injected.hpp"
 
 namespace tmk_desktop::inline win32 {
@@ -55,6 +57,9 @@ struct Input final : INPUT {
   }
 };
 
+// SendInputに配列として渡すので、INPUTと同じ大きさでなければならない
+static_assert(sizeof(Input) == sizeof(INPUT));
+
 class EventSender final {
 public:
   void enable() noexcept {}
@@ -62,23 +67,24 @@ public:
   void disable() noexcept {}
 
   /**
-   * @brief 押すイベントを送信する
-   */
-  void send_key_press(uint8_t keycode) noexcept {
-    latest_press_keycode_ = keycode;
-    latest_press_input_ = Input(keycode, true);
-    latest_press_input_.send();
-  }
-
-  /**
-   * @brief 離すイベントを送信する
+   * @brief キー操作の列を送信する
+   *
+   * 1回のSendInputで送るので、他の入力が途中に割り込まない。
    */
-  void send_key_release(uint8_t keycode) noexcept {
-    Input(keycode, false).send();
-    if (keycode == latest_press_keycode_) {
-      latest_press_keycode_ = KC_NO;
-      latest_press_input_.clear();
+  void send_keys(const KeyBatch& batch) noexcept {
+    UINT count = 0;
+    for (const auto& action : batch.actions()) {
+      const Input input(action.keycode, action.pressed);
+      inputs_[count++] = input;
+      if (action.pressed) {
+        latest_press_keycode_ = action.keycode;
+        latest_press_input_ = input;
+      } else if (action.keycode == latest_press_keycode_) {
+        latest_press_keycode_ = KC_NO;
+        latest_press_input_.clear();
+      }
     }
+    if (count > 0) SendInput(count, inputs_.data(), sizeof(INPUT));
   }
 
   /**
@@ -115,7 +121,8 @@ public:
   }
 
 private:
-  uint8_t latest_press_keycode_ = KC_NO;  ///< 最後に押したキー
-  Input latest_press_input_{};            ///< 最後に押したキーイベント
+  uint8_t latest_press_keycode_ = KC_NO;            ///< 最後に押したキー
+  Input latest_press_input_{};                      ///< 最後に押したキーイベント
+  std::array<Input, KeyBatch::CAPACITY> inputs_{};  ///< SendInputに渡す配列
 };
 }  // namespace tmk_desktop::inline win32
@@ -0,0 +1,52 @@
+/**
+ * @file bench.hpp
+ * @brief ベンチマークのためのユーティリティ
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+namespace tmk_desktop::bench {
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief 最適化で計算が取り除かれないようにする
+ */
+template <typename T>
+inline void do_not_optimize(const T& value) noexcept {
+#if defined(__GNUC__)
+  asm volatile("" : : "g"(&value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+/**
+ * @brief 関数の実行時間を測る
+ *
+ * @param f 測定する関数
+ * @return 経過時間 (ナノ秒)
+ */
+template <typename F>
+inline double measure_ns(F&& f) {
+  const auto begin = Clock::now();
+  f();
+  const auto end = Clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+/**
+ * @brief 1回あたりの実行時間を表示する
+ *
+ * @param name 測定項目の名前
+ * @param count 実行回数
+ * @param ns 全体の経過時間 (ナノ秒)
+ */
+inline void report(const char* name, size_t count, double ns) {
+  std::printf("%-40s %12.2f ns/op %14.0f op/s\n", name, ns / count, count * 1e9 / ns);
+}
+}  // namespace tmk_desktop::bench
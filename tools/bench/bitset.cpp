@@ -0,0 +1,242 @@
+/**
+ * @file bitset.cpp
+ * @brief ビットセットのベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 1ビットずつずらして調べる列挙と1バイトずつの差分を基準に、Bitsetの列挙、集計、差分の各処理を測る。
+ * 差分はSinkが扱うキーボードレポートの256ビットと、evdevが扱うキー状態のKEY_CNTビットで測る。
+ */
+#include <array>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <tmk_desktop/bitset.hpp>
+#include "bench.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t SAMPLE_COUNT = 1'024;         ///< 入力として用意するビットセットの数
+static constexpr size_t ITERATION_COUNT = 4'000'000;  ///< 各処理を行う回数
+
+using Keyset = Bitset<256, uint8_t>;     ///< キーボードレポートのキー状態
+using KeyState = Bitset<768, uint64_t>;  ///< evdevのキー状態 (KEY_CNT)
+
+/**
+ * @brief 1ビットずつずらして1のビットを探す、以前の列挙
+ */
+template <typename Pred>
+void legacy_scan(const std::array<uint8_t, 32>& values, Pred pred) noexcept {
+  size_t index = 0;
+  for (auto value : values) {
+    const auto next_index = index + 8;
+    while (value != 0) {
+      if (value & 1) pred(index);
+      value >>= 1;
+      index++;
+    }
+    index = next_index;
+  }
+}
+
+/**
+ * @brief 1バイトずつ2回に分けて求める、以前の差分
+ */
+void legacy_diff(const std::array<uint8_t, 32>& prev, const std::array<uint8_t, 32>& next, std::array<uint8_t, 32>& set,
+                 std::array<uint8_t, 32>& reset) noexcept {
+  for (size_t i = 0; i < 32; ++i) set[i] = static_cast<uint8_t>(next[i] & ~prev[i]);
+  for (size_t i = 0; i < 32; ++i) reset[i] = static_cast<uint8_t>(prev[i] & ~next[i]);
+}
+
+/**
+ * @brief キーを押したり離したりした状態を模したビットセットを作る
+ *
+ * @param key_count 1にするビットの数
+ */
+template <typename BitsetT>
+std::vector<BitsetT> make_samples(size_t key_count) {
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<size_t> dist{0, BitsetT{}.size() - 1};
+  std::vector<BitsetT> samples(SAMPLE_COUNT);
+  for (auto& sample : samples) {
+    for (size_t i = 0; i < key_count; ++i) sample.set(dist(rng));
+  }
+  return samples;
+}
+
+/**
+ * @brief ビットセットを以前の格納方法に戻す
+ */
+std::array<uint8_t, 32> to_bytes(const Keyset& keyset) noexcept {
+  std::array<uint8_t, 32> bytes{};
+  for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = keyset.value(i);
+  return bytes;
+}
+
+/**
+ * @brief サンプルを順に処理する時間を測る
+ */
+template <typename F>
+void run(const char* name, F f) {
+  uint64_t hash = 0;
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < ITERATION_COUNT; ++i) hash = hash * 31 + f(i % SAMPLE_COUNT);
+  });
+  report(name, ITERATION_COUNT, ns);
+  do_not_optimize(hash);
+}
+
+/**
+ * @brief 列挙を測る
+ *
+ * @param key_count 1にするビットの数
+ */
+void run_scan(size_t key_count) {
+  const auto samples = make_samples<Keyset>(key_count);
+  std::vector<std::array<uint8_t, 32>> legacy_samples;
+  for (const auto& sample : samples) legacy_samples.push_back(to_bytes(sample));
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "scan, %zu keys (bit by bit)", key_count);
+  run(name, [&](size_t i) {
+    uint64_t sum = 0;
+    legacy_scan(legacy_samples[i], [&](size_t index) { sum += index; });
+    return sum;
+  });
+  std::snprintf(name, sizeof(name), "scan, %zu keys (countr_zero)", key_count);
+  run(name, [&](size_t i) {
+    uint64_t sum = 0;
+    samples[i].scan([&](auto pos) { sum += pos.index(); });
+    return sum;
+  });
+  std::snprintf(name, sizeof(name), "scan, %zu keys (iterator)", key_count);
+  run(name, [&](size_t i) {
+    uint64_t sum = 0;
+    for (const auto pos : samples[i]) sum += pos.index();
+    return sum;
+  });
+}
+
+/**
+ * @brief 集計を測る
+ */
+template <typename BitsetT>
+void run_queries(const char* size_name) {
+  const auto samples = make_samples<BitsetT>(2);
+  char name[64];
+  std::snprintf(name, sizeof(name), "popcount (%s)", size_name);
+  run(name, [&](size_t i) { return samples[i].popcount(); });
+  std::snprintf(name, sizeof(name), "any (%s)", size_name);
+  run(name, [&](size_t i) { return samples[i].any(); });
+  std::snprintf(name, sizeof(name), "find_first (%s)", size_name);
+  run(name, [&](size_t i) { return samples[i].find_first().index(); });
+}
+
+/**
+ * @brief 差分の各実装を測る
+ *
+ * @param legacy 以前の実装でも測るかどうか
+ */
+template <typename BitsetT>
+void run_diff(const char* size_name, bool legacy) {
+  const auto samples = make_samples<BitsetT>(6);
+  constexpr size_t count = BitsetT::WORD_COUNT;
+  std::array<uint64_t, count> set{};
+  std::array<uint64_t, count> reset{};
+  const auto kernel = [&](auto diff_words) {
+    return [&, diff_words](size_t i) {
+      const auto& prev = samples[i];
+      const auto& next = samples[(i + 1) % SAMPLE_COUNT];
+      diff_words(prev.words().data(), next.words().data(), set.data(), reset.data(), count);
+      do_not_optimize(set);
+      do_not_optimize(reset);
+      return set[0] ^ reset[count - 1];
+    };
+  };
+
+  char name[64];
+  if constexpr (std::is_same_v<BitsetT, Keyset>) {
+    if (legacy) {
+      std::vector<std::array<uint8_t, 32>> legacy_samples;
+      for (const auto& sample : samples) legacy_samples.push_back(to_bytes(sample));
+      std::array<uint8_t, 32> legacy_set{};
+      std::array<uint8_t, 32> legacy_reset{};
+      std::snprintf(name, sizeof(name), "diff (%s, bytes)", size_name);
+      run(name, [&](size_t i) {
+        legacy_diff(legacy_samples[i], legacy_samples[(i + 1) % SAMPLE_COUNT], legacy_set, legacy_reset);
+        do_not_optimize(legacy_set);
+        do_not_optimize(legacy_reset);
+        return uint64_t{legacy_set[0]} ^ legacy_reset[31];
+      });
+    }
+  }
+  std::snprintf(name, sizeof(name), "diff (%s, scalar)", size_name);
+  run(name, kernel([](auto... args) { bitset_simd::diff_scalar(args...); }));
+#if defined(_M_X64) || defined(__x86_64__)
+  std::snprintf(name, sizeof(name), "diff (%s, SSE2)", size_name);
+  run(name, kernel([](auto... args) { bitset_simd::diff_sse2(args...); }));
+  if (bitset_simd::is_avx2_supported()) {
+    std::snprintf(name, sizeof(name), "diff (%s, AVX2)", size_name);
+    run(name, kernel([](auto... args) { bitset_simd::diff_avx2(args...); }));
+  }
+#endif
+  std::snprintf(name, sizeof(name), "diff (%s, dispatched)", size_name);
+  run(name, kernel([](auto... args) { bitset_simd::diff(args...); }));
+
+  // 結果のビットセットを返す分も含めて測る
+  std::snprintf(name, sizeof(name), "diff (%s, Bitset)", size_name);
+  run(name, [&](size_t i) {
+    const auto [pressed, released] = diff(samples[i], samples[(i + 1) % SAMPLE_COUNT]);
+    do_not_optimize(pressed);
+    do_not_optimize(released);
+    return pressed.words()[0] ^ released.words()[count - 1];
+  });
+}
+
+/**
+ * @brief 各実装が同じ結果を返すことを確かめる
+ */
+bool verify() {
+  const auto samples = make_samples<Keyset>(6);
+  for (size_t i = 0; i < SAMPLE_COUNT; ++i) {
+    const auto& prev = samples[i];
+    const auto& next = samples[(i + 1) % SAMPLE_COUNT];
+    const auto [pressed, released] = diff(prev, next);
+    if (pressed != reset_to_set(prev, next) || released != set_to_reset(prev, next)) return false;
+
+    size_t legacy_count = 0;
+    bool same_order = true;
+    auto it = next.begin();
+    legacy_scan(to_bytes(next), [&](size_t index) {
+      legacy_count++;
+      same_order = same_order && it != next.end() && (*it++).index() == index;
+    });
+    if (!same_order || it != next.end() || legacy_count != next.popcount()) return false;
+    if (next.any() && next.find_first().index() != (*next.begin()).index()) return false;
+  }
+  return true;
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  if (!verify()) {
+    std::printf("MISMATCH between implementations\n");
+    return 1;
+  }
+#if defined(_M_X64) || defined(__x86_64__)
+  std::printf("AVX2: %s\n", bitset_simd::is_avx2_supported() ? "supported" : "not supported");
+#endif
+
+  run_scan(1);
+  run_scan(6);
+  run_queries<Keyset>("256 bits");
+  run_queries<KeyState>("768 bits");
+  run_diff<Keyset>("256 bits", true);
+  run_diff<KeyState>("768 bits", false);
+  return 0;
+}
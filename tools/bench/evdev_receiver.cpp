@@ -0,0 +1,216 @@
+/**
+ * @file evdev_receiver.cpp
+ * @brief Linux (evdev) のEventReceiverの読み出しを確かめるベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * キーボードの代わりにパイプをEventReceiver::add_device()に渡し、記録したinput_eventの列を流し込む。
+ * Keyboardの代わりに受け取ったKeyEventが、キーの変換、カーネルが記録した時刻、
+ * SYN_DROPPEDからの同期、パイプを閉じたときのキーの解放について期待通りであることを確かめる。
+ * また、1つのイベントを読み出して変換するのにかかる時間を測る。
+ */
+#include <array>
+#include <chrono>
+#include <initializer_list>
+#include <span>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <unistd.h>
+#include <tmk_desktop/keyboard.hpp>
+#include "bench.hpp"
+#include "evdev/receiver.hpp"
+
+namespace tmk_desktop {
+namespace {
+std::vector<KeyEvent> received_;  ///< Keyboardの代わりに受け取ったイベント
+}  // namespace
+
+// Keyboardを動かさずに、EventReceiverが送ったイベントを受け取る
+bool send_to_keyboard(const KeyEvent& event) noexcept {
+  received_.push_back(event);
+  return true;
+}
+
+KeyboardStatus get_keyboard_status() noexcept {
+  return KeyboardStatus::RUNNING;
+}
+}  // namespace tmk_desktop
+
+namespace tmk_desktop::bench {
+namespace {
+using EngineClock = tmk_desktop::Clock;
+
+static constexpr size_t REPLAY_COUNT = 100'000;                      ///< 時間を測るときに流し込む回数
+static constexpr auto POLL_TIMEOUT = std::chrono::milliseconds(100);  ///< イベントを待つ時間
+
+/**
+ * @brief 時刻付きのinput_eventを作る
+ */
+input_event make_event(uint16_t type, uint16_t code, int32_t value, EngineClock::time_point time = {}) noexcept {
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+  input_event event{};
+  event.input_event_sec = us / 1'000'000;
+  event.input_event_usec = us % 1'000'000;
+  event.type = type;
+  event.code = code;
+  event.value = value;
+  return event;
+}
+
+/**
+ * @brief バイト列を書き込む
+ */
+void write_bytes(int fd, const void* data, size_t size) {
+  [[maybe_unused]] const auto _ = write(fd, data, size);
+}
+
+void write_events(int fd, std::initializer_list<input_event> events) {
+  write_bytes(fd, events.begin(), events.size() * sizeof(input_event));
+}
+
+/**
+ * @brief 指定の数のイベントを受け取るか、時間切れになるまで読み出す
+ */
+void collect(EventReceiver& receiver, size_t count) {
+  const auto deadline = EngineClock::now() + POLL_TIMEOUT;
+  while (received_.size() < count && EngineClock::now() < deadline) receiver.poll(deadline);
+}
+
+/**
+ * @brief 受け取ったイベントが期待通りかを調べる
+ *
+ * @param name 確かめる項目の名前
+ * @param expected 期待するイベント。時刻がClock::time_point{}なら時刻は比べない
+ */
+bool expect(EventReceiver& receiver, const char* name, std::initializer_list<KeyEvent> expected) {
+  received_.clear();
+  collect(receiver, expected.size());
+  // 期待したより多く届いていないかも確かめる
+  receiver.poll(EngineClock::now() + std::chrono::milliseconds(10));
+
+  bool ok = received_.size() == expected.size();
+  for (size_t i = 0; ok && i < expected.size(); ++i) {
+    const auto& e = expected.begin()[i];
+    const auto& r = received_[i];
+    ok = r.key() == e.key() && r.is_pressed() == e.is_pressed() &&
+         (e.timestamp() == EngineClock::time_point{} || r.timestamp() == e.timestamp());
+  }
+  std::printf("%-32s %zu events, %s\n", name, received_.size(), ok ? "ok" : "MISMATCH");
+  return ok;
+}
+
+/**
+ * @brief 記録したinput_eventの列を流し込み、受け取ったKeyEventを確かめる
+ */
+bool verify() {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    std::perror("pipe2");
+    return false;
+  }
+  const int fd = fds[1];
+
+  EventReceiver receiver;
+  receiver.enable(false);
+  if (!receiver.add_device(fds[0])) {
+    close(fd);
+    return false;
+  }
+
+  // カーネルが記録した時刻はマイクロ秒単位なので、それに丸めた時刻を使う
+  const auto base = std::chrono::floor<std::chrono::microseconds>(EngineClock::now() - std::chrono::milliseconds(10));
+  const auto at = [&](int ms) { return EngineClock::time_point{base + std::chrono::milliseconds(ms)}; };
+  bool ok = true;
+
+  // キー以外のイベントは無視し、キーはWin32と同じ値に変換する
+  write_events(fd, {make_event(EV_MSC, MSC_SCAN, 0x04, at(0)), make_event(EV_KEY, KEY_A, 1, at(0)), make_event(EV_SYN, SYN_REPORT, 0, at(0))});
+  ok = expect(receiver, "press A", {KeyEvent{0x1e, true, at(0)}}) && ok;
+
+  // 拡張キーには0x100を足し、オートリピートは押したものとして扱う
+  write_events(fd, {make_event(EV_KEY, KEY_RIGHTCTRL, 1, at(1)), make_event(EV_KEY, KEY_UP, 1, at(2)), make_event(EV_KEY, KEY_UP, 2, at(3)),
+                    make_event(EV_SYN, SYN_REPORT, 0, at(3))});
+  ok = expect(receiver, "press RCtrl, Up and repeat",
+              {KeyEvent{0x11d, true, at(1)}, KeyEvent{0x148, true, at(2)}, KeyEvent{0x148, true, at(3)}}) &&
+       ok;
+
+  // 1つのイベントが2回に分けて届いても、つなげて読む
+  const auto henkan = make_event(EV_KEY, KEY_HENKAN, 1, at(4));
+  write_bytes(fd, &henkan, sizeof(henkan) / 2);
+  ok = expect(receiver, "first half of Henkan", {}) && ok;
+  write_bytes(fd, reinterpret_cast<const std::byte*>(&henkan) + sizeof(henkan) / 2, sizeof(henkan) - sizeof(henkan) / 2);
+  write_events(fd, {make_event(EV_SYN, SYN_REPORT, 0, at(4))});
+  ok = expect(receiver, "second half of Henkan", {KeyEvent{0x79, true, at(4)}}) && ok;
+
+  // 取りこぼした区間のイベントは捨て、押していたキーを同期させる
+  // パイプはキーの状態を返せないので、すべて離されたものとして扱われる
+  write_events(fd, {make_event(EV_SYN, SYN_DROPPED, 0, at(5)), make_event(EV_KEY, KEY_B, 1, at(5)), make_event(EV_KEY, KEY_A, 0, at(6)),
+                    make_event(EV_SYN, SYN_REPORT, 0, at(6))});
+  ok = expect(receiver, "resync after SYN_DROPPED",
+              {KeyEvent{0x1e, false, {}}, KeyEvent{0x79, false, {}}, KeyEvent{0x11d, false, {}}, KeyEvent{0x148, false, {}}}) &&
+       ok;
+
+  write_events(fd, {make_event(EV_KEY, KEY_C, 1, at(7)), make_event(EV_SYN, SYN_REPORT, 0, at(7))});
+  ok = expect(receiver, "press C after resync", {KeyEvent{0x2e, true, at(7)}}) && ok;
+
+  // パイプを閉じると、抜かれたデバイスと同じく押していたキーを離す
+  close(fd);
+  ok = expect(receiver, "release C on close", {KeyEvent{0x2e, false, {}}}) && ok;
+
+  receiver.disable();
+  return ok;
+}
+
+/**
+ * @brief 1つのイベントを読み出して変換するのにかかる時間を測る
+ *
+ * read()1回分のイベントを書き込んでは、すべて受け取るまで読み出すことを繰り返す。
+ */
+void run_replay() {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0) return;
+  EventReceiver receiver;
+  receiver.enable(false);
+  if (!receiver.add_device(fds[0])) return;
+
+  // 押して離すキーとSYN_REPORTの組を、1回のread()で読み出せるだけ並べる
+  static constexpr size_t KEYS_PER_BATCH = EventReceiver::BATCH_SIZE / 4;
+  std::array<input_event, KEYS_PER_BATCH * 4> batch;
+  const auto now = EngineClock::now();
+  for (size_t i = 0; i < KEYS_PER_BATCH; ++i) {
+    const auto code = static_cast<uint16_t>(KEY_1 + i % 10);
+    batch[i * 4 + 0] = make_event(EV_KEY, code, 1, now);
+    batch[i * 4 + 1] = make_event(EV_SYN, SYN_REPORT, 0, now);
+    batch[i * 4 + 2] = make_event(EV_KEY, code, 0, now);
+    batch[i * 4 + 3] = make_event(EV_SYN, SYN_REPORT, 0, now);
+  }
+
+  received_.reserve(KEYS_PER_BATCH * 2);
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < REPLAY_COUNT; ++i) {
+      received_.clear();
+      write_bytes(fds[1], batch.data(), sizeof(batch));
+      collect(receiver, KEYS_PER_BATCH * 2);
+    }
+  });
+  report("replay input_event", REPLAY_COUNT * batch.size(), ns);
+
+  close(fds[1]);
+  receiver.disable();
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop::bench;
+
+  if (!verify()) {
+    std::printf("MISMATCH between replayed input_events and KeyEvents\n");
+    return 1;
+  }
+  run_replay();
+  return 0;
+}
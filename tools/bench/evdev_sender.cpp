@@ -0,0 +1,179 @@
+/**
+ * @file evdev_sender.cpp
+ * @brief Linux (uinput) のEventSenderの書き込みを確かめるベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 仮想キーボードの代わりにパケットモードのパイプを書き込み先として渡し、SinkEventから書き込まれたinput_eventの列を読み戻す。
+ * パケットモードではwrite()1回分が1回のread()で読めるので、1つのレポートが1回のwrite()で書き込まれたことを確かめられる。
+ * 読み戻した列が、すべての離す操作、すべての押す操作、1つのSYN_REPORTの順に並び、
+ * キーコードがkeycode_to_evdev_tableで変換したものと一致することを確かめる。
+ * また、1つのレポートを送信するのにかかる時間を測る。
+ */
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <unistd.h>
+#include <tmk_desktop/sink.hpp>
+#include "bench.hpp"
+#include "evdev/sender.hpp"
+#include "report_keyset.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t SEND_COUNT = 1'000'000;  ///< 時間を測るときに送信するレポートの数
+
+/**
+ * @brief 修飾キーと非修飾キーからレポートを作る
+ */
+report_keyboard_t make_report(uint8_t mods, std::initializer_list<uint8_t> keys) noexcept {
+  report_keyboard_t report{};
+#ifdef NKRO_ENABLE
+  report.nkro.mods = mods;
+  for (const auto key : keys) report.nkro.bits[key / 8] |= static_cast<uint8_t>(1 << (key % 8));
+#else
+  report.mods = mods;
+  std::copy(keys.begin(), keys.end(), report.keys);
+#endif
+  return report;
+}
+
+/**
+ * @brief SinkのSinkEventVisitorと同じく、キーボードレポートの変化を送信する
+ */
+class ReportSender final {
+public:
+  explicit ReportSender(EventSender& sender) noexcept : sender_(sender) {}
+
+  void send(const SinkEvent& event) noexcept {
+    const auto prev = keyset_;
+    keyset_ = ReportKeyset::from(event.keyboard_report());
+    make_key_batch(prev, keyset_, batch_);
+    if (!batch_.empty()) sender_.send_keys(batch_);
+  }
+
+private:
+  EventSender& sender_;    ///< 送信に使うEventSender
+  ReportKeyset keyset_{};  ///< 最新のキー状態
+  KeyBatch batch_{};       ///< 送信するキー操作
+};
+
+/**
+ * @brief 1回のwrite()で書き込まれたイベントの列を読み出す
+ *
+ * @return 読み出したイベントの列。何も書き込まれていなければ空
+ */
+std::vector<input_event> read_frame(int fd) {
+  std::array<input_event, EventSender::BUFFER_SIZE> events;
+  const ssize_t size = read(fd, events.data(), sizeof(events));
+  if (size <= 0) return {};
+  return {events.begin(), events.begin() + size / static_cast<ssize_t>(sizeof(input_event))};
+}
+
+/**
+ * @brief 読み出した列が、離す操作、押す操作、SYN_REPORTの順に並び、期待したキーを含むかを調べる
+ *
+ * @param frame 読み出したイベントの列
+ * @param released 離したはずのキーコード
+ * @param pressed 押したはずのキーコード
+ */
+bool check_frame(const std::vector<input_event>& frame, std::initializer_list<uint8_t> released,
+                 std::initializer_list<uint8_t> pressed) {
+  if (frame.size() != released.size() + pressed.size() + 1) return false;
+  const auto matches = [&](size_t begin, std::initializer_list<uint8_t> keycodes, int32_t value) {
+    std::vector<uint16_t> expected, actual;
+    for (const auto keycode : keycodes) expected.push_back(keycode_to_evdev_table[keycode]);
+    for (size_t i = begin; i < begin + keycodes.size(); ++i) {
+      if (frame[i].type != EV_KEY || frame[i].value != value) return false;
+      actual.push_back(frame[i].code);
+    }
+    std::sort(expected.begin(), expected.end());
+    std::sort(actual.begin(), actual.end());
+    return expected == actual;
+  };
+  const auto& last = frame.back();
+  return matches(0, released, 0) && matches(released.size(), pressed, 1) && last.type == EV_SYN && last.code == SYN_REPORT;
+}
+
+/**
+ * @brief パイプに書き込ませて、書き込まれた列を確かめる
+ */
+bool verify() {
+  // 変換表が壊れていれば以降の比較は意味をなさないので、代表的なキーを確かめておく
+  bool ok = keycode_to_evdev_table[KC_A] == KEY_A && keycode_to_evdev_table[KC_LSHIFT] == KEY_LEFTSHIFT &&
+            keycode_to_evdev_table[KC_RCTRL] == KEY_RIGHTCTRL;
+
+  int fds[2];
+  if (pipe2(fds, O_DIRECT | O_CLOEXEC) < 0) {
+    std::perror("pipe2");
+    return false;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  EventSender sender;
+  sender.enable(fds[1]);
+  ReportSender reports{sender};
+  const auto expect = [&](const char* name, std::initializer_list<uint8_t> released, std::initializer_list<uint8_t> pressed) {
+    const auto frame = read_frame(fds[0]);
+    const bool frame_ok = check_frame(frame, released, pressed);
+    // 続けて読めるものがあれば、2回以上に分けて書き込まれている
+    const bool single_write = read_frame(fds[0]).empty();
+    std::printf("%-24s %zu events, %s\n", name, frame.size(), frame_ok && single_write ? "ok" : "MISMATCH");
+    ok = ok && frame_ok && single_write;
+  };
+
+  reports.send(SinkEvent{make_report(MOD_BIT(KC_LSHIFT), {KC_A, KC_B})});
+  expect("press shift+A+B", {}, {KC_LSHIFT, KC_A, KC_B});
+  reports.send(SinkEvent{make_report(MOD_BIT(KC_LCTRL), {KC_B, KC_C})});
+  expect("switch to ctrl+B+C", {KC_A, KC_LSHIFT}, {KC_LCTRL, KC_C});
+  reports.send(SinkEvent{make_report(0, {})});
+  expect("release all", {KC_B, KC_C, KC_LCTRL}, {});
+
+  // 変化のないレポートは何も書き込まない
+  reports.send(SinkEvent{make_report(0, {})});
+  if (!read_frame(fds[0]).empty()) ok = false;
+
+  sender.disable();
+  close(fds[0]);
+  return ok;
+}
+
+/**
+ * @brief 1つのレポートを送信するのにかかる時間を測る
+ *
+ * 読み出し側を持たずに済むよう、/dev/nullに書き込ませる。
+ */
+void run_send() {
+  const int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  EventSender sender;
+  sender.enable(fd);
+  ReportSender reports{sender};
+  const SinkEvent pressed{make_report(MOD_BIT(KC_LSHIFT), {KC_A})};
+  const SinkEvent released{make_report(0, {})};
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < SEND_COUNT / 2; ++i) {
+      reports.send(pressed);
+      reports.send(released);
+    }
+  });
+  report("send report", SEND_COUNT, ns);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop::bench;
+
+  if (!verify()) {
+    std::printf("MISMATCH between SinkEvents and the events EventSender wrote\n");
+    return 1;
+  }
+  run_send();
+  return 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file flight_recorder.cpp
+ * @brief フライトレコーダーのベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 1つの記録にかかる時間を、読み出すスレッドがないときとあるときで測る。
+ * また、記録しながら別のスレッドで読み出し、書きかけや上書きされた記録が混ざらず、古い順に隙間なく並ぶことを確かめる。
+ */
+#include <array>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <tmk_desktop/flight_recorder.hpp>
+#include "bench.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t RECORD_COUNT = 20'000'000;  ///< 記録する回数
+
+/**
+ * @brief 番号から記録を作る
+ *
+ * すべての欄を番号から決めるので、読み出した記録が1つの書き込みに由来するかどうかを確かめられる。
+ */
+FlightRecord make_record(uint64_t index) noexcept {
+  FlightRecord record{};
+  record.time_ns = static_cast<int64_t>(index);
+  record.layer_state = static_cast<uint32_t>(index * 3);
+  record.default_layer_state = static_cast<uint32_t>(index >> 32);
+  record.type = FlightRecordType::KEY_EVENT;
+  record.mods = static_cast<uint8_t>(index);
+  record.code = static_cast<uint16_t>(index * 7);
+  record.data[9] = static_cast<uint8_t>(index * 11);
+  return record;
+}
+
+/**
+ * @brief 記録がmake_record()で作ったものと一致するかを調べる
+ */
+bool is_consistent(const FlightRecord& record) noexcept {
+  const auto expected = make_record(static_cast<uint64_t>(record.time_ns));
+  return std::memcmp(&record, &expected, sizeof(FlightRecord)) == 0;
+}
+
+/**
+ * @brief 記録にかかる時間を測る
+ *
+ * @param with_reader 別のスレッドで読み出し続けるかどうか
+ * @return 読み出した結果が正しければtrue
+ */
+bool run_record(bool with_reader) {
+  static FlightRecorder recorder;
+  std::atomic<bool> done{false};
+  bool ok = true;
+  uint64_t read_count = 0;
+
+  std::thread reader;
+  if (with_reader) {
+    reader = std::thread{[&] {
+      static std::array<FlightRecord, FlightRecorder::CAPACITY> records;
+      while (!done.load(std::memory_order_acquire)) {
+        const size_t count = recorder.read(records);
+        for (size_t i = 0; i < count; ++i) {
+          if (!is_consistent(records[i])) ok = false;
+          if (i > 0 && records[i].time_ns != records[i - 1].time_ns + 1) ok = false;
+        }
+        read_count++;
+      }
+    }};
+  }
+
+  const uint64_t base = recorder.total_count();
+  const auto ns = measure_ns([&] {
+    for (uint64_t i = 0; i < RECORD_COUNT; ++i) recorder.record(make_record(base + i));
+  });
+  done.store(true, std::memory_order_release);
+  if (reader.joinable()) reader.join();
+
+  report(with_reader ? "record (with reader)" : "record", RECORD_COUNT, ns);
+  if (with_reader) std::printf("  %llu reads\n", static_cast<unsigned long long>(read_count));
+  return ok;
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop::bench;
+
+  bool ok = run_record(false);
+  ok = run_record(true) && ok;
+  if (!ok) {
+    std::printf("INCONSISTENT records read from FlightRecorder\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file keymap.cpp
+ * @brief ヘッドレス環境でキーマップを含むパイプライン全体の処理時間を測るベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * send_to_source()で入力したキーイベントが、TMKの処理を経てSinkで出力されるまでの時間を測る。
+ * 測るキーは引数で指定できる (既定はAキーの値)。出力を伴わないキーを指定すると遅延は測れない。
+ */
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <tmk_desktop/headless/io.hpp>
+#include <tmk_desktop/keyboard.hpp>
+#include <tmk_desktop/sink.hpp>
+#include <tmk_desktop/source.hpp>
+#include "bench.hpp"
+
+namespace tmk_desktop {
+void on_source_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "source: %s\n", e.what());
+}
+
+void on_keyboard_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "keyboard: %s\n", e.what());
+}
+
+void on_sink_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "sink: %s\n", e.what());
+}
+}  // namespace tmk_desktop
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t KEYSTROKE_COUNT = 10'000;                      ///< 遅延を測る打鍵数
+static constexpr size_t BURST_KEYSTROKE_COUNT = 100'000;               ///< スループットを測る打鍵数
+static constexpr auto OUTPUT_TIMEOUT = std::chrono::milliseconds(50);  ///< 出力を待つ時間
+
+std::array<OutputEvent, 256> outputs_;  ///< 出力イベントの受け取り先
+
+/**
+ * @brief 入力イベントを送る
+ */
+void send(Key key, bool pressed) {
+  const KeyEvent event{key, pressed};
+  while (!send_to_source(event)) std::this_thread::yield();
+}
+
+/**
+ * @brief 出力イベントを待つ
+ *
+ * @return 最初に受け取った出力の時刻。期限までに出力がなければClock::time_point::max()
+ */
+Clock::time_point wait_output() {
+  const auto deadline = Clock::now() + OUTPUT_TIMEOUT;
+  while (Clock::now() < deadline) {
+    if (const auto count = receive_from_sink(outputs_)) {
+      const auto first = outputs_[0].timestamp;
+      // 同じ入力から出た残りの出力も捨てる
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      while (receive_from_sink(outputs_) > 0) {}
+      return first;
+    }
+    std::this_thread::yield();
+  }
+  return Clock::time_point::max();
+}
+
+/**
+ * @brief 1打鍵ずつ入力から出力までの遅延を測る
+ */
+std::vector<double> run_latency(Key key) {
+  std::vector<double> latencies_ns;
+  latencies_ns.reserve(KEYSTROKE_COUNT * 2);
+  for (size_t i = 0; i < KEYSTROKE_COUNT; ++i) {
+    for (bool pressed : {true, false}) {
+      const auto begin = Clock::now();
+      send(key, pressed);
+      const auto end = wait_output();
+      if (end != Clock::time_point::max()) latencies_ns.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+    }
+  }
+  return latencies_ns;
+}
+
+/**
+ * @brief 入力を詰め込み、すべての出力が出るまでの時間を測る
+ *
+ * @return 受け取った出力イベントの数
+ */
+size_t run_burst(Key key, double& ns) {
+  size_t count = 0;
+  ns = measure_ns([&] {
+    for (size_t i = 0; i < BURST_KEYSTROKE_COUNT; ++i) {
+      send(key, true);
+      send(key, false);
+      count += receive_from_sink(outputs_);
+    }
+    // 出力が途絶えるまで受け取る
+    auto deadline = Clock::now() + OUTPUT_TIMEOUT;
+    while (Clock::now() < deadline) {
+      if (const auto n = receive_from_sink(outputs_)) {
+        count += n;
+        deadline = Clock::now() + OUTPUT_TIMEOUT;
+      }
+    }
+  });
+  ns -= std::chrono::duration<double, std::nano>(OUTPUT_TIMEOUT).count();
+  return count;
+}
+
+/**
+ * @brief 遅延の分布を表示する
+ */
+void print_latencies(const char* name, std::vector<double> latencies_ns) {
+  if (latencies_ns.empty()) {
+    std::printf("%-24s no output\n", name);
+    return;
+  }
+  std::sort(latencies_ns.begin(), latencies_ns.end());
+  const auto percentile = [&](double p) { return latencies_ns[static_cast<size_t>(p * (latencies_ns.size() - 1))]; };
+  std::printf("%-24s p50 %10.0f ns  p90 %10.0f ns  p99 %10.0f ns  max %10.0f ns\n", name, percentile(0.5), percentile(0.9),
+              percentile(0.99), latencies_ns.back());
+}
+
+/**
+ * @brief キューの統計を表示する
+ */
+void print_queue_stats(const char* name, const QueueStats& stats) {
+  std::printf("%-24s capacity %zu, high water mark %zu, overflow %llu\n", name, stats.capacity, stats.high_water_mark,
+              static_cast<unsigned long long>(stats.overflow_count));
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main(int argc, char** argv) {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  const Key key = (argc > 1) ? static_cast<Key>(std::strtoul(argv[1], nullptr, 0)) : Key{0x1e};
+
+  start_sink();
+  start_keyboard();
+  start_source();
+
+  std::printf("key 0x%x, %zu keystrokes\n", key, KEYSTROKE_COUNT);
+  print_latencies("source -> sink", run_latency(key));
+
+  double ns = 0;
+  const auto count = run_burst(key, ns);
+  std::printf("%zu keystrokes in burst, %zu outputs\n", BURST_KEYSTROKE_COUNT, count);
+  report("burst", BURST_KEYSTROKE_COUNT * 2, ns);
+
+  print_queue_stats("input", get_input_queue_stats());
+  print_queue_stats("output", get_output_queue_stats());
+
+  stop_source();
+  stop_keyboard();
+  stop_sink();
+  return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file keymap_file.cpp
+ * @brief キーマップファイルの読み込みと参照のベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 読み込み (マップ、検証、切り替え) にかかる時間を、Keyboardスレッドに見立てたスレッドが参照し続けている状態でも測る。
+ * また、キーマップライブラリの表とキーマップファイルからアクションを引く時間を比べ、ファイルを参照しても遅くならないことを確かめる。
+ * 加えて、マクロのキーを押して離したときに、ファイルのマクロが1回だけ再生されることを確かめる。
+ */
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <tmk_desktop/keymap_file.hpp>
+#include "bench.hpp"
+#include "keymap_builder.hpp"
+#include "keymap_scope.hpp"
+
+namespace tmk_desktop {
+void on_source_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "source: %s\n", e.what());
+}
+
+void on_keyboard_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "keyboard: %s\n", e.what());
+}
+
+void on_sink_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "sink: %s\n", e.what());
+}
+}  // namespace tmk_desktop
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t LAYER_COUNT = 4;           ///< キーマップファイルのレイヤー数
+static constexpr size_t RELOAD_COUNT = 1'000;      ///< 読み込みを測る回数
+static constexpr size_t LOOKUP_COUNT = 1'000'000;  ///< アクションを引く回数
+static constexpr uint8_t MACRO_LAYER = 2;          ///< マクロを割り当てたレイヤー
+
+/**
+ * @brief すべてのキーの位置を埋めたキーマップファイルを書き出す
+ */
+void write_keymap_file(const std::filesystem::path& path) {
+  KeymapFileBuilder builder{LAYER_COUNT};
+  const size_t key_count = std::min(KEY_COUNT - 1, size_t{MATRIX_ROWS * MATRIX_COLS});
+  for (size_t i = 0; i < key_count; ++i) {
+    const action_t actions[LAYER_COUNT] = {
+        ACTION_KEY(0x04 + i % 26),
+        ACTION_TRANSPARENT,
+        ACTION_MACRO(0),
+        ACTION_NO,
+    };
+    builder.add_key(static_cast<Key>(i + 1), actions);
+  }
+  const macro_t macro[] = {KEY_DOWN, 0x04, KEY_UP, 0x04};
+  builder.set_macro(0, macro);
+
+  const auto bytes = builder.build();
+  std::ofstream output{path, std::ios::binary | std::ios::trunc};
+  output.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+}
+
+/**
+ * @brief マクロのキーを押して離したときに、マクロが1回だけ再生されることを確かめる
+ *
+ * TMKのprocess_action()と同じく、押したときと離したときの両方でマクロを引き、得られたマクロを再生したものと数える。
+ */
+bool verify_macro() {
+  const KeymapScope scope;
+  const keypos_t keypos{.col = 0, .row = 0};
+  const auto action = keymap_file_action_for_key(MACRO_LAYER, keypos);
+  if (action.kind.id != ACT_MACRO) return false;
+
+  size_t play_count = 0;
+  for (bool pressed : {true, false}) {
+    keyrecord_t record{};
+    record.event = keyevent_t{.key = keypos, .pressed = pressed, .time = 0};
+    if (keymap_file_action_get_macro(&record, action.func.id, action.func.opt) != MACRO_NONE) ++play_count;
+  }
+  std::printf("macro key press/release: played %zu times, %s\n", play_count, play_count == 1 ? "ok" : "MISMATCH");
+  return play_count == 1;
+}
+
+/**
+ * @brief 読み込みにかかる時間を測る
+ *
+ * @return 1回ごとの時間 (ナノ秒)
+ */
+std::vector<double> run_reload(const char* path) {
+  std::vector<double> times_ns;
+  times_ns.reserve(RELOAD_COUNT);
+  for (size_t i = 0; i < RELOAD_COUNT; ++i) {
+    times_ns.push_back(measure_ns([&] { load_keymap_file(path); }));
+  }
+  return times_ns;
+}
+
+/**
+ * @brief 読み込みにかかる時間の分布を表示する
+ */
+void print_reload(const char* name, std::vector<double> times_ns) {
+  std::sort(times_ns.begin(), times_ns.end());
+  const auto percentile = [&](double p) { return times_ns[static_cast<size_t>(p * (times_ns.size() - 1))]; };
+  std::printf("%-40s p50 %10.0f ns  p99 %10.0f ns  max %10.0f ns\n", name, percentile(0.5), percentile(0.99), times_ns.back());
+}
+
+/**
+ * @brief 全キーの位置についてアクションを引く時間を測る
+ *
+ * @param lookup アクションを引く関数
+ */
+template <typename Lookup>
+void run_lookup(const char* name, Lookup lookup) {
+  uint32_t hash = 0;
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+      const auto index = i % (MATRIX_ROWS * MATRIX_COLS);
+      const keypos_t keypos{.col = static_cast<uint8_t>(index % MATRIX_COLS), .row = static_cast<uint8_t>(index / MATRIX_COLS)};
+      hash = hash * 31 + lookup(keypos).code;
+    }
+  });
+  report(name, LOOKUP_COUNT, ns);
+  do_not_optimize(hash);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  const auto path = std::filesystem::temp_directory_path() / "tmk_desktop_bench.tkm";
+  write_keymap_file(path);
+  std::printf("%s: %ju bytes\n", path.string().c_str(), std::filesystem::file_size(path));
+
+  print_reload("reload (idle)", run_reload(path.string().c_str()));
+
+  // Keyboardスレッドのように参照区間に出入りし続けるスレッドがいるときは、参照区間が明けるのを待つ分だけ長くなる
+  std::atomic<bool> stop = false;
+  std::thread reader{[&] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      const KeymapScope scope;
+      do_not_optimize(keymap_file_action_for_key(0, keypos_t{0, 0}));
+    }
+  }};
+  print_reload("reload (with reader)", run_reload(path.string().c_str()));
+  stop.store(true, std::memory_order_relaxed);
+  reader.join();
+
+  // Keyboardスレッドは1つのイベントの処理を1つの参照区間で囲むので、区間の出入りとアクションを引く時間は分けて測る
+  const auto scope_ns = measure_ns([] {
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+      const KeymapScope scope;
+    }
+  });
+  report("scope enter/leave", LOOKUP_COUNT, scope_ns);
+
+  unload_keymap_file();
+  {
+    const KeymapScope scope;
+    run_lookup("lookup (keymap library)", [](keypos_t keypos) { return keymap_file_action_for_key(0, keypos); });
+  }
+
+  load_keymap_file(path.string().c_str());
+  if (!verify_macro()) {
+    std::printf("MISMATCH between macro key presses and macro plays\n");
+    unload_keymap_file();
+    std::filesystem::remove(path);
+    return 1;
+  }
+  {
+    const KeymapScope scope;
+    run_lookup("lookup (keymap file)", [](keypos_t keypos) { return keymap_file_action_for_key(0, keypos); });
+  }
+
+  const auto stats = get_keymap_file_stats();
+  std::printf("%llu loads, %llu rejected\n", static_cast<unsigned long long>(stats.load_count),
+              static_cast<unsigned long long>(stats.rejected_count));
+
+  unload_keymap_file();
+  std::filesystem::remove(path);
+  return 0;
+}
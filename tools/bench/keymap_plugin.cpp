@@ -0,0 +1,149 @@
+/**
+ * @file keymap_plugin.cpp
+ * @brief キーマッププラグインの差し替えと呼び出しのベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 差し替えでKeyboardスレッドを止めている時間と、読み込みを含めた全体の時間を、Keyboardスレッドに見立てたスレッドが参照し続けている状態で測る。
+ * また、キーマップライブラリとプラグインからアクションを引く時間を比べ、関数ポインタを経由する分の重さを確かめる。
+ */
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <tmk_desktop/keymap_plugin.hpp>
+#include "bench.hpp"
+#include "keymap_scope.hpp"
+
+extern "C" {
+#include <common/action_layer.h>
+}  // extern "C"
+
+namespace tmk_desktop {
+void on_source_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "source: %s\n", e.what());
+}
+
+void on_keyboard_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "keyboard: %s\n", e.what());
+}
+
+void on_sink_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "sink: %s\n", e.what());
+}
+}  // namespace tmk_desktop
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t SWAP_COUNT = 1'000;        ///< 差し替えを測る回数
+static constexpr size_t LOOKUP_COUNT = 1'000'000;  ///< アクションを引く回数
+
+/**
+ * @brief 差し替えにかかった時間
+ */
+struct SwapTimes {
+  std::vector<double> total_ns;      ///< 読み込みを含めた全体の時間
+  std::vector<double> quiescent_ns;  ///< Keyboardスレッドを止めていた時間
+};
+
+/**
+ * @brief 2つのプラグインを交互に読み込み、差し替えにかかる時間を測る
+ *
+ * 同じファイルを読み込み直すと共有ライブラリが使い回されるので、別のファイルを交互に読み込む。
+ */
+SwapTimes run_swap(const char* path_a, const char* path_b) {
+  SwapTimes times;
+  times.total_ns.reserve(SWAP_COUNT);
+  times.quiescent_ns.reserve(SWAP_COUNT);
+  for (size_t i = 0; i < SWAP_COUNT; ++i) {
+    times.total_ns.push_back(measure_ns([&] { load_keymap_plugin(i & 1 ? path_b : path_a); }));
+    times.quiescent_ns.push_back(static_cast<double>(get_keymap_plugin_stats().last_swap_time_ns));
+  }
+  return times;
+}
+
+/**
+ * @brief 時間の分布を表示する
+ */
+void print_times(const char* name, std::vector<double> times_ns) {
+  std::sort(times_ns.begin(), times_ns.end());
+  const auto percentile = [&](double p) { return times_ns[static_cast<size_t>(p * (times_ns.size() - 1))]; };
+  std::printf("%-40s p50 %10.0f ns  p99 %10.0f ns  max %10.0f ns\n", name, percentile(0.5), percentile(0.99), times_ns.back());
+}
+
+/**
+ * @brief 差し替えにかかった時間を表示する
+ */
+void print_swap(const char* name, SwapTimes times) {
+  std::printf("%s\n", name);
+  print_times("  total (load, validate, swap)", std::move(times.total_ns));
+  print_times("  keyboard thread quiesced", std::move(times.quiescent_ns));
+}
+
+/**
+ * @brief 全キーの位置についてアクションを引く時間を測る
+ */
+void run_lookup(const char* name) {
+  const KeymapScope scope;
+  uint32_t hash = 0;
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+      const auto index = i % (MATRIX_ROWS * MATRIX_COLS);
+      const keypos_t keypos{.col = static_cast<uint8_t>(index % MATRIX_COLS), .row = static_cast<uint8_t>(index / MATRIX_COLS)};
+      hash = hash * 31 + keymap_plugin_action_for_key(0, keypos).code;
+    }
+  });
+  report(name, LOOKUP_COUNT, ns);
+  do_not_optimize(hash);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  // 同じ内容の別のファイルを用意する
+  const std::filesystem::path path_a = TMK_DESKTOP_BENCH_KEYMAP_PLUGIN;
+  auto path_b = std::filesystem::temp_directory_path() / "tmk_desktop_bench_plugin";
+  path_b += path_a.extension();
+  std::filesystem::copy_file(path_a, path_b, std::filesystem::copy_options::overwrite_existing);
+
+  print_swap("swap (idle)", run_swap(path_a.string().c_str(), path_b.string().c_str()));
+
+  // Keyboardスレッドのように参照区間に出入りし続けるスレッドがいるときは、参照区間が明けるのを待つ分だけ長くなる
+  std::atomic<bool> stop = false;
+  std::thread reader{[&] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      const KeymapScope scope;
+      do_not_optimize(keymap_plugin_action_for_key(0, keypos_t{0, 0}));
+    }
+  }};
+  print_swap("swap (with reader)", run_swap(path_a.string().c_str(), path_b.string().c_str()));
+  stop.store(true, std::memory_order_relaxed);
+  reader.join();
+
+  // 初期化に失敗させ、差し替えを取りやめる
+  layer_state = 1ul << 31;
+  try {
+    load_keymap_plugin(path_a.string().c_str());
+  } catch (std::exception& e) {
+    std::printf("rollback: %s (quiesced %llu ns)\n", e.what(),
+                static_cast<unsigned long long>(get_keymap_plugin_stats().last_swap_time_ns));
+  }
+  layer_state = 0;
+
+  run_lookup("lookup (keymap plugin)");
+  unload_keymap_plugin();
+  run_lookup("lookup (keymap library)");
+
+  const auto stats = get_keymap_plugin_stats();
+  std::printf("%llu loads, %llu rollbacks, max quiesced %llu ns\n", static_cast<unsigned long long>(stats.load_count),
+              static_cast<unsigned long long>(stats.rollback_count), static_cast<unsigned long long>(stats.max_swap_time_ns));
+
+  std::filesystem::remove(path_b);
+  return 0;
+}
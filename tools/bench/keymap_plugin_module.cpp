@@ -0,0 +1,36 @@
+/**
+ * @file keymap_plugin_module.cpp
+ * @brief ベンチマークで差し替えるキーマッププラグイン
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 全キーにキーコードを割り当てるだけのキーマップ。
+ * レイヤー16以上が有効なときは初期化に失敗するので、差し替えを取りやめるときの時間も測れる。
+ */
+#include <tmk_desktop/keymap_plugin.h>
+#include <tmk_desktop/settings.hpp>
+
+extern "C" {
+#include <common/action_layer.h>
+
+action_t action_for_key(uint8_t layer, keypos_t pos) {
+  return ACTION_KEY(0x04 + (pos.row * MATRIX_COLS + pos.col) % 26);
+}
+
+const macro_t* action_get_macro(keyrecord_t* record, uint8_t id, uint8_t opt) {
+  return MACRO_NONE;
+}
+
+void action_function(keyrecord_t* record, uint8_t id, uint8_t opt) {}
+}  // extern "C"
+
+namespace tmk_desktop {
+bool init_keymap_plugin() noexcept {
+  return (layer_state >> 16) == 0;
+}
+
+void deinit_keymap_plugin() noexcept {}
+}  // namespace tmk_desktop
+
+const tmk_desktop::KeyToKeyposTable tmk_desktop::key_to_keypos_table{};
+const tmk_desktop::TappingKeyTable tmk_desktop::tapping_key_table{};
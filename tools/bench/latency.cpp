@@ -0,0 +1,219 @@
+/**
+ * @file latency.cpp
+ * @brief 遅延の分布を記録するヒストグラムのベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * TMK_DESKTOP_LATENCY_HISTOGRAMSで1つのイベントに加わる処理、つまり時刻の読み取りとヒストグラムへの記録にかかる時間を測る。
+ * また、対数正規分布に従う値を記録し、要約した百分位数が並べ替えて求めた値と相対誤差1/SUB_BUCKET_COUNT以内で一致することを確かめる。
+ *
+ * ヘッドレス環境でTMK_DESKTOP_LATENCY_HISTOGRAMSを有効にしたときは、パイプライン全体を動かし、
+ * Keyboardが入力ごとにdispatchとtaskを1回ずつ記録することも確かめる。
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <tmk_desktop/latency.hpp>
+#include "bench.hpp"
+
+#if defined(TMK_DESKTOP_LATENCY_HISTOGRAMS) && defined(TMK_DESKTOP_HEADLESS)
+#define TMK_DESKTOP_BENCH_PIPELINE_LATENCY
+#include <array>
+#include <exception>
+#include <thread>
+#include <tmk_desktop/headless/io.hpp>
+#include <tmk_desktop/keyboard.hpp>
+#include <tmk_desktop/sink.hpp>
+#include <tmk_desktop/source.hpp>
+
+namespace tmk_desktop {
+void on_source_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "source: %s\n", e.what());
+}
+
+void on_keyboard_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "keyboard: %s\n", e.what());
+}
+
+void on_sink_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "sink: %s\n", e.what());
+}
+}  // namespace tmk_desktop
+#endif
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t RECORD_COUNT = 10'000'000;  ///< 記録する回数
+static constexpr size_t VERIFY_COUNT = 1'000'000;   ///< 確かめるときに記録する回数
+
+/**
+ * @brief 数マイクロ秒を中心とし、まれに数ミリ秒に及ぶ遅延を模した値を作る
+ */
+std::vector<uint64_t> make_values(size_t count) {
+  std::mt19937_64 rng{42};
+  std::lognormal_distribution<double> dist{std::log(5'000.0), 1.5};
+  std::vector<uint64_t> values(count);
+  for (auto& value : values) value = static_cast<uint64_t>(dist(rng));
+  return values;
+}
+
+/**
+ * @brief ヒストグラムに記録する時間を測る
+ */
+void run_record() {
+  const auto values = make_values(RECORD_COUNT);
+  static LatencyHistogram histogram;
+  const auto ns = measure_ns([&] {
+    for (const auto value : values) histogram.record(value);
+  });
+  report("record", RECORD_COUNT, ns);
+  do_not_optimize(histogram);
+}
+
+/**
+ * @brief 時刻を読んで間隔を記録する時間を測る
+ *
+ * ステージの境界で行う処理と同じく、直前に読んだ時刻との間隔を記録する。
+ */
+void run_record_now() {
+  static LatencyHistogram histogram;
+  const auto ns = measure_ns([&] {
+    auto prev_tp = tmk_desktop::Clock::now();
+    for (size_t i = 0; i < RECORD_COUNT; ++i) {
+      const auto tp = tmk_desktop::Clock::now();
+      histogram.record(prev_tp, tp);
+      prev_tp = tp;
+    }
+  });
+  report("Clock::now + record", RECORD_COUNT, ns);
+  do_not_optimize(histogram);
+}
+
+/**
+ * @brief 要約する時間を測る
+ */
+void run_snapshot() {
+  static LatencyHistogram histogram;
+  for (const auto value : make_values(VERIFY_COUNT)) histogram.record(value);
+  static constexpr size_t SNAPSHOT_COUNT = 10'000;
+  uint64_t hash = 0;
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < SNAPSHOT_COUNT; ++i) hash += histogram.snapshot().p99_ns;
+  });
+  report("snapshot", SNAPSHOT_COUNT, ns);
+  do_not_optimize(hash);
+}
+
+/**
+ * @brief 要約した百分位数を、並べ替えて求めた値と比べる
+ */
+bool verify() {
+  auto values = make_values(VERIFY_COUNT);
+  static LatencyHistogram histogram;
+  for (const auto value : values) histogram.record(value);
+  const auto snapshot = histogram.snapshot();
+  std::sort(values.begin(), values.end());
+
+  bool ok = snapshot.count == values.size() && snapshot.max_ns == values.back();
+  const auto check = [&](const char* name, uint64_t numerator, uint64_t denominator, uint64_t actual) {
+    const uint64_t rank = (values.size() * numerator + denominator - 1) / denominator;
+    const uint64_t expected = values[rank - 1];
+    const double error = static_cast<double>(actual) / expected - 1.0;
+    std::printf("%-6s exact %10llu ns, histogram %10llu ns (%+.2f%%)\n", name, static_cast<unsigned long long>(expected),
+                static_cast<unsigned long long>(actual), error * 100.0);
+    if (actual < expected || error > 1.0 / LatencyHistogram::SUB_BUCKET_COUNT) ok = false;
+  };
+  check("p50", 50, 100, snapshot.p50_ns);
+  check("p99", 99, 100, snapshot.p99_ns);
+  check("p99.9", 999, 1000, snapshot.p999_ns);
+
+  // 区間の境界が隙間なく並んでいることを確かめる
+  for (size_t i = 0; i + 1 < LatencyHistogram::BUCKET_COUNT; ++i) {
+    const auto lower = LatencyHistogram::lower_bound_of(i);
+    const auto upper = LatencyHistogram::upper_bound_of(i);
+    if (LatencyHistogram::bucket_of(lower) != i || LatencyHistogram::bucket_of(upper) != i || upper + 1 != LatencyHistogram::lower_bound_of(i + 1)) {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+#ifdef TMK_DESKTOP_BENCH_PIPELINE_LATENCY
+static constexpr size_t KEYSTROKE_COUNT = 10'000;                   ///< パイプラインに入力する打鍵数
+static constexpr Key PIPELINE_KEY = 0x1e;                           ///< 入力するキー (Aキーの値)
+static constexpr auto PIPELINE_TIMEOUT = std::chrono::seconds(10);  ///< Keyboardが処理し終えるのを待つ時間
+
+/**
+ * @brief 区間の統計を表示する
+ */
+void print_stats(const char* name, const LatencySnapshot& snapshot) {
+  std::printf("%-10s count %8llu  p50 %8llu ns  p99 %8llu ns  p99.9 %8llu ns  max %10llu ns\n", name,
+              static_cast<unsigned long long>(snapshot.count), static_cast<unsigned long long>(snapshot.p50_ns),
+              static_cast<unsigned long long>(snapshot.p99_ns), static_cast<unsigned long long>(snapshot.p999_ns),
+              static_cast<unsigned long long>(snapshot.max_ns));
+}
+
+/**
+ * @brief パイプラインに打鍵を入力し、Keyboardが入力ごとに1回ずつ記録することを確かめる
+ *
+ * 走査を省く近道やTMKを介さない送信を通った入力も、dispatchとtaskに数えられなければならない。
+ */
+bool verify_pipeline() {
+  static std::array<OutputEvent, 256> outputs;
+  const size_t event_count = KEYSTROKE_COUNT * 2;
+
+  start_sink();
+  start_keyboard();
+  start_source();
+  for (size_t i = 0; i < KEYSTROKE_COUNT; ++i) {
+    for (bool pressed : {true, false}) {
+      const KeyEvent event{PIPELINE_KEY, pressed};
+      while (!send_to_source(event)) std::this_thread::yield();
+      while (receive_from_sink(outputs) > 0) {}
+    }
+  }
+  const auto deadline = Clock::now() + PIPELINE_TIMEOUT;
+  while (get_keyboard_latency_stats().task.count < event_count && Clock::now() < deadline) {
+    while (receive_from_sink(outputs) > 0) {}
+    std::this_thread::yield();
+  }
+  stop_source();
+  stop_keyboard();
+  stop_sink();
+
+  const auto stats = get_keyboard_latency_stats();
+  std::printf("%zu key events\n", event_count);
+  print_stats("capture", stats.capture);
+  print_stats("queue", stats.queue);
+  print_stats("dispatch", stats.dispatch);
+  print_stats("task", stats.task);
+  print_stats("tick", stats.tick);
+  return stats.dispatch.count == event_count && stats.task.count == event_count;
+}
+#endif
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop::bench;
+
+  if (!verify()) {
+    std::printf("MISMATCH between LatencyHistogram and exact percentiles\n");
+    return 1;
+  }
+#ifdef TMK_DESKTOP_BENCH_PIPELINE_LATENCY
+  if (!verify_pipeline()) {
+    std::printf("MISMATCH between key events and Keyboard dispatch/task counts\n");
+    return 1;
+  }
+#endif
+
+  run_record();
+  run_record_now();
+  run_snapshot();
+  return 0;
+}
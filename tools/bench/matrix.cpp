@@ -0,0 +1,166 @@
+/**
+ * @file matrix.cpp
+ * @brief マトリクスの変化をTMKに伝える処理のベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * keyboard_task()のように全行を走査して変化を探す方法と、変化したキーを直接伝えて食い違う行だけを調べる方法を比べる。
+ * TMKのアクション処理は含めず、変化を見つけるまでの処理だけを測る。
+ */
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <tmk_desktop/bitset.hpp>
+#include "bench.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+using Row = uint32_t;
+
+static constexpr size_t KEYSTROKE_COUNT = 1'000'000;  ///< 打鍵数
+static constexpr size_t COLS = 32;                    ///< 列の数
+
+/**
+ * @brief TMKに伝えたイベントを数えるもの
+ */
+struct EventCounter {
+  size_t count = 0;
+  uint32_t hash = 0;
+
+  void operator()(size_t row, size_t col, bool pressed) noexcept {
+    hash = hash * 31 + static_cast<uint32_t>(row * COLS + col) * 2 + pressed;
+    count++;
+  }
+};
+
+/**
+ * @brief 全行を走査して変化を探す方法
+ *
+ * matrix_get_row()はTMKから関数として呼ばれるので、インライン化させない。
+ */
+template <size_t Rows>
+struct FullScan {
+  Bitset<Rows * COLS, Row> matrix;
+  Row prev[Rows]{};
+
+  [[gnu::noinline]] Row get_row(size_t row) const noexcept {
+    return matrix.value(row);
+  }
+
+  void update(size_t row, size_t col, bool pressed, EventCounter& counter) noexcept {
+    matrix.set({row, col}, pressed);
+    task(counter);
+  }
+
+  void tick(EventCounter& counter) noexcept {
+    task(counter);
+  }
+
+  void task(EventCounter& counter) noexcept {
+    for (size_t r = 0; r < Rows; ++r) {
+      const Row row = get_row(r);
+      const Row changes = row ^ prev[r];
+      if (changes == 0) continue;
+      const size_t c = std::countr_zero(changes);
+      counter(r, c, (row >> c) & 1);
+      prev[r] ^= Row{1} << c;
+      return;
+    }
+  }
+};
+
+/**
+ * @brief 変化を直接伝え、食い違う行だけを調べる方法
+ */
+template <size_t Rows>
+struct EventDriven {
+  Bitset<Rows * COLS, Row> matrix;
+  Bitset<Rows * COLS, Row> delivered;
+  Bitset<Rows, uint64_t> changed_rows;
+
+  bool is_delivered() const noexcept {
+    return changed_rows.none();
+  }
+
+  void update(size_t row, size_t col, bool pressed, EventCounter& counter) noexcept {
+    matrix.set({row, col}, pressed);
+    if (is_delivered()) {
+      counter(row, col, pressed);
+      delivered.set({row, col}, pressed);
+    } else {
+      changed_rows.set(row);
+      while (!is_delivered()) task(counter);
+    }
+  }
+
+  void tick(EventCounter& counter) noexcept {
+    task(counter);
+  }
+
+  void task(EventCounter& counter) noexcept {
+    for (const auto pos : changed_rows) {
+      const size_t r = pos.index();
+      const Row changes = matrix.value(r) ^ delivered.value(r);
+      if (changes == 0) {
+        changed_rows.reset(r);
+        continue;
+      }
+      const size_t c = std::countr_zero(changes);
+      counter(r, c, (matrix.value(r) >> c) & 1);
+      delivered.flip({r, c});
+      if ((changes & (changes - 1)) == 0) changed_rows.reset(r);
+      return;
+    }
+  }
+};
+
+/**
+ * @brief 1打鍵ごとに押す、時間経過、離すを処理させて測る
+ *
+ * 押すキーは最後の行に置き、全行走査にとって最も遠い位置にする。
+ */
+template <typename Matrix, size_t Rows>
+double run(EventCounter& counter) {
+  static Matrix matrix;
+  const size_t row = Rows - 1;
+  return measure_ns([&] {
+    for (size_t i = 0; i < KEYSTROKE_COUNT; ++i) {
+      const size_t col = i % COLS;
+      matrix.update(row, col, true, counter);
+      matrix.tick(counter);
+      matrix.update(row, col, false, counter);
+    }
+  });
+}
+
+template <size_t Rows>
+void run_all() {
+  char name[64];
+
+  EventCounter full_scan;
+  const auto full_scan_ns = run<FullScan<Rows>, Rows>(full_scan);
+  std::snprintf(name, sizeof(name), "full scan (%zu rows)", Rows);
+  report(name, KEYSTROKE_COUNT, full_scan_ns);
+
+  EventCounter event_driven;
+  const auto event_driven_ns = run<EventDriven<Rows>, Rows>(event_driven);
+  std::snprintf(name, sizeof(name), "event driven (%zu rows)", Rows);
+  report(name, KEYSTROKE_COUNT, event_driven_ns);
+
+  // 両者が同じイベント列を伝えたことを確かめる
+  if (full_scan.count != event_driven.count || full_scan.hash != event_driven.hash) {
+    std::printf("MISMATCH: %zu events vs %zu events\n", full_scan.count, event_driven.count);
+  }
+  do_not_optimize(event_driven.hash);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop::bench;
+
+  std::printf("%zu keystrokes (press, tick, release)\n", KEYSTROKE_COUNT);
+  run_all<1>();
+  run_all<255>();
+  return 0;
+}
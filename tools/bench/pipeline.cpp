@@ -0,0 +1,149 @@
+/**
+ * @file pipeline.cpp
+ * @brief ヘッドレス環境でパイプラインのエンドツーエンドの遅延を測るベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * send_to_source()で入力したキーイベントが、Source、Keyboard (TMK)、Sinkを経て出力されるまでの時間を測る。
+ * 実際のキー入力と同じく、イベントの間隔を空けて各スレッドが待機から起きる状況を再現する。
+ * 測るのはビルドした構成のパイプラインなので、3スレッド構成と単一スレッド構成を比べるには
+ * TMK_DESKTOP_FUSED_PIPELINEのオンとオフでそれぞれビルドして実行する。
+ * 3スレッド構成では、KeyboardとSinkの待機の方針を変えて測る。
+ */
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <tmk_desktop/headless/io.hpp>
+#include <tmk_desktop/keyboard.hpp>
+#include <tmk_desktop/sink.hpp>
+#include <tmk_desktop/source.hpp>
+#include <tmk_desktop/wait_policy.hpp>
+#include "bench.hpp"
+
+namespace tmk_desktop {
+void on_source_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "source: %s\n", e.what());
+}
+
+void on_keyboard_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "keyboard: %s\n", e.what());
+}
+
+void on_sink_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "sink: %s\n", e.what());
+}
+}  // namespace tmk_desktop
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t EVENT_COUNT = 20'000;                           ///< イベント数
+static constexpr auto EVENT_INTERVAL = std::chrono::microseconds(200);  ///< イベントの間隔
+static constexpr auto OUTPUT_TIMEOUT = std::chrono::milliseconds(50);   ///< 出力を待つ時間
+static constexpr Key KEY = 0x1e;                                        ///< 入力するキー (Aキー)
+
+std::array<OutputEvent, 256> outputs_;  ///< 出力イベントの受け取り先
+
+/**
+ * @brief 一定間隔で入力イベントを送り、それぞれが出力されるまでの時間を測る
+ *
+ * 出力を待つ間はスピンするが、パイプラインのスレッドとは別のスレッドなので、各ステージの待機には影響しない。
+ */
+std::vector<double> run_events() {
+  std::vector<double> latencies_ns;
+  latencies_ns.reserve(EVENT_COUNT);
+
+  auto next = Clock::now();
+  for (size_t i = 0; i < EVENT_COUNT; ++i) {
+    next += EVENT_INTERVAL;
+    std::this_thread::sleep_until(next);
+
+    const auto begin = Clock::now();
+    const KeyEvent event{KEY, i % 2 == 0, begin};
+    while (!send_to_source(event)) std::this_thread::yield();
+
+    const auto deadline = begin + OUTPUT_TIMEOUT;
+    size_t count = 0;
+    while (count == 0 && Clock::now() < deadline) count = receive_from_sink(outputs_);
+    if (count > 0) latencies_ns.push_back(std::chrono::duration<double, std::nano>(outputs_[0].timestamp - begin).count());
+    // 同じ入力から出た残りの出力も捨てる
+    while (receive_from_sink(outputs_) > 0) {}
+  }
+  return latencies_ns;
+}
+
+/**
+ * @brief パイプラインを始動させて遅延を測る
+ *
+ * @param policy KeyboardとSinkの待機の方針。単一スレッド構成では使われない
+ * @param stats Sinkの待機の統計の格納先
+ */
+std::vector<double> run_pipeline(const WaitPolicy& policy, WaitStats& stats) {
+  set_keyboard_wait_policy(policy);
+  set_sink_wait_policy(policy);
+  const auto stats_before = get_sink_stats().wait;
+
+  start_sink();
+  start_keyboard();
+  start_source();
+  auto latencies_ns = run_events();
+  stop_source();
+  stop_keyboard();
+  stop_sink();
+
+  const auto stats_after = get_sink_stats().wait;
+  stats = {
+      .wait_count = stats_after.wait_count - stats_before.wait_count,
+      .spin_hit_count = stats_after.spin_hit_count - stats_before.spin_hit_count,
+      .park_count = stats_after.park_count - stats_before.park_count,
+      .spin_ns = stats_after.spin_ns - stats_before.spin_ns,
+  };
+  return latencies_ns;
+}
+
+/**
+ * @brief 遅延の分布を表示する
+ */
+void print_latencies(const char* name, std::vector<double> latencies_ns) {
+  if (latencies_ns.empty()) {
+    std::printf("%-24s no output\n", name);
+    return;
+  }
+  std::sort(latencies_ns.begin(), latencies_ns.end());
+  const auto percentile = [&](double p) { return latencies_ns[static_cast<size_t>(p * (latencies_ns.size() - 1))]; };
+  std::printf("%-24s p50 %10.0f ns  p90 %10.0f ns  p99 %10.0f ns  max %10.0f ns  (%zu outputs)\n", name, percentile(0.5),
+              percentile(0.9), percentile(0.99), latencies_ns.back(), latencies_ns.size());
+}
+
+/**
+ * @brief 待機の統計を表示する
+ */
+void print_wait_stats(const WaitStats& stats) {
+  std::printf("%-24s %llu waits, %llu spin hits, %llu parks, %.1f ms spinning\n", "", static_cast<unsigned long long>(stats.wait_count),
+              static_cast<unsigned long long>(stats.spin_hit_count), static_cast<unsigned long long>(stats.park_count), stats.spin_ns / 1e6);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  std::printf("%zu events, %lld us interval\n", EVENT_COUNT, static_cast<long long>(EVENT_INTERVAL.count()));
+  WaitStats stats{};
+#ifdef TMK_DESKTOP_FUSED_PIPELINE
+  print_latencies("fused (1 thread)", run_pipeline({.mode = WaitMode::PARK}, stats));
+#else
+  print_latencies("threaded: park", run_pipeline({.mode = WaitMode::PARK}, stats));
+  print_wait_stats(stats);
+  print_latencies("threaded: spin 50us", run_pipeline({.mode = WaitMode::SPIN_THEN_PARK, .spin_budget = std::chrono::microseconds(50)}, stats));
+  print_wait_stats(stats);
+  print_latencies("threaded: spin 500us", run_pipeline({.mode = WaitMode::SPIN_THEN_PARK, .spin_budget = std::chrono::microseconds(500)}, stats));
+  print_wait_stats(stats);
+  print_latencies("threaded: busy poll", run_pipeline({.mode = WaitMode::BUSY_POLL}, stats));
+  print_wait_stats(stats);
+#endif
+  return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file precise_wait.cpp
+ * @brief 待機関数のベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 以前のwait_us()と同じsleep_for()と、PreciseWaiterで、期限を超過した時間の分布を比べる。
+ * タイマースラックはスレッドごとの設定なので、sleep_for()は既定のスラックのスレッドと、最小にしたスレッドの両方で測る。
+ */
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <tmk_desktop/precise_wait.hpp>
+#include "bench.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t WAIT_COUNT = 2'000;  ///< 待ち時間ごとの待機回数
+
+/**
+ * @brief 超過時間の分布を表示する
+ */
+void print_stats(const char* name, std::chrono::microseconds duration, const PreciseWaitStats& stats) {
+  std::printf("%s, %lld us: %llu waits, max overshoot %.2f us\n", name, static_cast<long long>(duration.count()),
+              static_cast<unsigned long long>(stats.wait_count), stats.max_overshoot_ns / 1e3);
+  for (size_t i = 0; i < PreciseWaitStats::BUCKET_COUNT; ++i) {
+    const auto count = stats.overshoot_histogram[i];
+    if (count == 0) continue;
+    const auto lower = (i == 0) ? 0ULL : (1ULL << (i - 1));
+    if (i + 1 == PreciseWaitStats::BUCKET_COUNT) {
+      std::printf("  >= %6llu us: %6llu\n", lower, static_cast<unsigned long long>(count));
+    } else {
+      std::printf("  %6llu-%6llu us: %6llu\n", lower, 1ULL << i, static_cast<unsigned long long>(count));
+    }
+  }
+}
+
+/**
+ * @brief sleep_for()の超過時間を測る
+ *
+ * PreciseWaiterと同じ区間で集計するため、超過時間はPreciseWaitStatsの形にまとめる。
+ */
+PreciseWaitStats measure_sleep_for(std::chrono::microseconds duration) {
+  PreciseWaitStats stats{};
+  for (size_t i = 0; i < WAIT_COUNT; ++i) {
+    const auto deadline = Clock::now() + duration;
+    std::this_thread::sleep_for(duration);
+    const auto overshoot_ns =
+        static_cast<uint64_t>(std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - deadline).count(), 0));
+    const auto bucket = std::min<size_t>(std::bit_width(overshoot_ns / 1'000), PreciseWaitStats::BUCKET_COUNT - 1);
+    stats.wait_count++;
+    stats.overshoot_histogram[bucket]++;
+    stats.max_overshoot_ns = std::max(stats.max_overshoot_ns, overshoot_ns);
+  }
+  return stats;
+}
+
+/**
+ * @brief PreciseWaiterの超過時間を測る
+ */
+PreciseWaitStats measure_precise_wait(std::chrono::microseconds duration) {
+  PreciseWaiter waiter;
+  for (size_t i = 0; i < WAIT_COUNT; ++i) waiter.wait_for(duration);
+  return waiter.stats();
+}
+
+/**
+ * @brief 新しいスレッドで測る
+ *
+ * @param reduce_slack 測る前にタイマースラックを最小にするかどうか
+ */
+template <typename F>
+PreciseWaitStats run_on_thread(F f, bool reduce_slack) {
+  PreciseWaitStats stats{};
+  std::thread thread{[&] {
+    if (reduce_slack) reduce_timer_slack();
+    stats = f();
+  }};
+  thread.join();
+  return stats;
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  for (const auto duration : {std::chrono::microseconds(50), std::chrono::microseconds(200), std::chrono::microseconds(1'000)}) {
+    print_stats("sleep_for", duration, run_on_thread([&] { return measure_sleep_for(duration); }, false));
+    print_stats("sleep_for (timer slack 1 ns)", duration, run_on_thread([&] { return measure_sleep_for(duration); }, true));
+    print_stats("PreciseWaiter", duration, run_on_thread([&] { return measure_precise_wait(duration); }, false));
+  }
+  return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file report_coalescer.cpp
+ * @brief キーボードレポートをまとめる処理を確かめるベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 1回のkeyboard_task()に見立てたトランザクションの中でレポートを送り、ReportCoalescerが送信したレポートの列を確かめる。
+ * 修飾キーを足してから非修飾キーを押すような途中経過はまとめ、修飾キーだけのタップや押し直しはまとめないことを確かめる。
+ * また、1つのレポートを受け取るのにかかる時間を測る。
+ */
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include "bench.hpp"
+#include "report_coalescer.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t TRANSACTION_COUNT = 1'000'000;  ///< 時間を測るときのトランザクションの数
+
+/**
+ * @brief 修飾キーと非修飾キーからレポートを作る
+ */
+report_keyboard_t make_report(uint8_t mods, std::initializer_list<uint8_t> keys) noexcept {
+  report_keyboard_t report{};
+#ifdef NKRO_ENABLE
+  report.nkro.mods = mods;
+  for (const auto key : keys) report.nkro.bits[key / 8] |= static_cast<uint8_t>(1 << (key % 8));
+#else
+  report.mods = mods;
+  std::copy(keys.begin(), keys.end(), report.keys);
+#endif
+  return report;
+}
+
+/**
+ * @brief レポートの列を1つのトランザクションで送り、送信されたレポートが期待通りかを調べる
+ *
+ * @param name 確かめる項目の名前
+ * @param reports トランザクションの中で送るレポート
+ * @param expected 送信されるはずのレポート
+ */
+bool expect(const char* name, std::initializer_list<report_keyboard_t> reports, std::initializer_list<report_keyboard_t> expected) {
+  std::vector<ReportKeyset> sent;
+  const auto send = [&](const report_keyboard_t& report) { sent.push_back(ReportKeyset::from(report)); };
+
+  ReportCoalescer coalescer;
+  coalescer.begin();
+  for (const auto& report : reports) coalescer.push(report, send);
+  coalescer.commit(send);
+
+  bool ok = sent.size() == expected.size();
+  for (size_t i = 0; ok && i < sent.size(); ++i) {
+    const auto keyset = ReportKeyset::from(expected.begin()[i]);
+    ok = sent[i].keys == keyset.keys && sent[i].mods == keyset.mods;
+  }
+  std::printf("%-32s %zu reports, %s\n", name, sent.size(), ok ? "ok" : "MISMATCH");
+  return ok;
+}
+
+/**
+ * @brief まとめる場合とまとめない場合を確かめる
+ */
+bool verify() {
+  const uint8_t shift = MOD_BIT(KC_LSHIFT);
+  const uint8_t ctrl = MOD_BIT(KC_LCTRL);
+  bool ok = true;
+
+  // 修飾キーを足してから非修飾キーを押す途中経過はまとめる
+  ok = expect("ctrl then ctrl+A", {make_report(ctrl, {}), make_report(ctrl, {KC_A})}, {make_report(ctrl, {KC_A})}) && ok;
+
+  // 非修飾キーを押したときの修飾キー状態は保つ
+  ok = expect("shift+A then A", {make_report(shift, {KC_A}), make_report(0, {KC_A})}, {make_report(shift, {KC_A}), make_report(0, {KC_A})}) && ok;
+
+  // 非修飾キーのタップはまとめない
+  ok = expect("tap A", {make_report(0, {KC_A}), make_report(0, {})}, {make_report(0, {KC_A}), make_report(0, {})}) && ok;
+
+  // 修飾キーだけのタップもまとめない
+  ok = expect("tap shift", {make_report(shift, {}), make_report(0, {})}, {make_report(shift, {}), make_report(0, {})}) && ok;
+
+  // 離した修飾キーの押し直しもまとめない
+  ok = expect("tap and re-press shift", {make_report(shift, {}), make_report(0, {}), make_report(shift, {})},
+              {make_report(shift, {}), make_report(0, {}), make_report(shift, {})}) &&
+       ok;
+  return ok;
+}
+
+/**
+ * @brief 1つのレポートを受け取るのにかかる時間を測る
+ *
+ * 修飾キーを足してから非修飾キーを押し、離すまでを1つのトランザクションとする。
+ */
+void run_push() {
+  ReportCoalescer coalescer;
+  size_t sent_count = 0;
+  const auto send = [&](const report_keyboard_t&) { sent_count++; };
+  const report_keyboard_t reports[] = {
+      make_report(MOD_BIT(KC_LSHIFT), {}),
+      make_report(MOD_BIT(KC_LSHIFT), {KC_A}),
+      make_report(0, {}),
+  };
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < TRANSACTION_COUNT; ++i) {
+      coalescer.begin();
+      for (const auto& report : reports) coalescer.push(report, send);
+      coalescer.commit(send);
+    }
+  });
+  report("push report", TRANSACTION_COUNT * std::size(reports), ns);
+  std::printf("%zu reports received, %zu sent\n", TRANSACTION_COUNT * std::size(reports), sent_count);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop::bench;
+
+  if (!verify()) {
+    std::printf("MISMATCH between pushed and coalesced keyboard reports\n");
+    return 1;
+  }
+  run_push();
+  return 0;
+}
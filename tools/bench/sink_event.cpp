@@ -0,0 +1,188 @@
+/**
+ * @file sink_event.cpp
+ * @brief SinkEventの受け渡しにかかる時間を測るベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 現在の実装は、ヘッドレス環境のsrc/sink.cppをそのまま動かし、send_to_sink()からSinkが処理し終えるまでを測る。
+ * 以前の実装 (std::deque + Mutex + std::visit) はこのファイルで再現したもので、受け渡しと振り分けだけを含む。
+ * 現在の実装はそれに加えて、キー状態の差分を取って出力を記録する分を含む。
+ */
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <exception>
+#include <thread>
+#include <variant>
+#include <cstdio>
+#include <cstdlib>
+#include <tmk_desktop/sink.hpp>
+#include "bench.hpp"
+
+namespace {
+std::atomic<size_t> allocation_count_{0};  ///< ヒープ確保の回数
+}  // namespace
+
+void* operator new(size_t size) {
+  allocation_count_.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size)) return p;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+namespace tmk_desktop {
+void on_sink_error(std::exception& e) noexcept {
+  std::fprintf(stderr, "sink: %s\n", e.what());
+}
+}  // namespace tmk_desktop
+
+namespace tmk_desktop::bench {
+namespace {
+/**
+ * @brief 以前のSinkEvent
+ */
+using LegacySinkEvent = std::variant<report_keyboard_t, report_mouse_t, HidUsage, NativeSinkEvent, SinkSignal>;
+
+static constexpr size_t KEYSTROKE_COUNT = 1'000'000;  ///< 打鍵数
+static constexpr size_t EVENTS_PER_KEYSTROKE = 3;     ///< 1打鍵あたりのイベント数
+static constexpr size_t EVENT_COUNT = KEYSTROKE_COUNT * EVENTS_PER_KEYSTROKE;
+
+/**
+ * @brief 1打鍵で発生するイベント列を作る
+ *
+ * 押したときのKEY_REPEAT_ENDとレポート、離したときのレポートからなる。
+ */
+template <typename Event>
+std::array<Event, EVENTS_PER_KEYSTROKE> make_keystroke() {
+  report_keyboard_t pressed{};
+  pressed.keys[0] = KC_A;
+  return {Event{SinkSignal::KEY_REPEAT_END}, Event{pressed}, Event{report_keyboard_t{}}};
+}
+
+/**
+ * @brief 受け取ったイベントを数えるvisitor
+ */
+struct CountingVisitor {
+  size_t count = 0;
+  uint8_t last_key = 0;
+
+  void operator()(const report_keyboard_t& report) noexcept {
+    last_key = report.keys[0];
+    count++;
+  }
+  void operator()(const report_mouse_t&) noexcept {
+    count++;
+  }
+  void operator()(const HidUsage&) noexcept {
+    count++;
+  }
+  void operator()(const NativeSinkEvent&) noexcept {
+    count++;
+  }
+  void operator()(SinkSignal) noexcept {
+    count++;
+  }
+};
+
+/**
+ * @brief 以前の実装 (std::deque + Mutex + std::visit) を測る
+ */
+double run_legacy() {
+  std::deque<LegacySinkEvent> queue;
+  std::mutex mtx;
+  std::condition_variable cv;
+  CountingVisitor visitor;
+
+  std::thread consumer([&] {
+    while (visitor.count < EVENT_COUNT) {
+      LegacySinkEvent event;
+      {
+        std::unique_lock lock{mtx};
+        cv.wait(lock, [&] { return !queue.empty(); });
+        event = queue.front();
+        queue.pop_front();
+      }
+      std::visit(visitor, event);
+      std::this_thread::yield();
+    }
+  });
+
+  const auto keystroke = make_keystroke<LegacySinkEvent>();
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < KEYSTROKE_COUNT; ++i) {
+      for (const auto& event : keystroke) {
+        {
+          std::lock_guard lock{mtx};
+          queue.push_back(event);
+        }
+        cv.notify_one();
+      }
+    }
+    consumer.join();
+  });
+  do_not_optimize(visitor.last_key);
+  return ns;
+}
+
+/**
+ * @brief 現在の実装 (src/sink.cpp) を測る
+ *
+ * このスレッドをKeyboardに見立ててsend_to_sink()で送り、Sinkがすべて処理し終えるまでの時間を測る。
+ * Sinkが記録した出力は読み出さないので、出力のバッファが溢れた分は捨てられる。
+ */
+double run_current() {
+  // スレッドが動き出す前に積んだイベントは、キューが満杯になると捨てられるので待つ
+  start_sink();
+  while (get_sink_status() != SinkStatus::RUNNING) std::this_thread::yield();
+  const auto processed_before = get_sink_stats().counters.processed_count;
+
+  const auto keystroke = make_keystroke<SinkEvent>();
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < KEYSTROKE_COUNT; ++i) {
+      for (const auto& event : keystroke) send_to_sink(event);
+    }
+    while (get_sink_stats().counters.processed_count - processed_before < EVENT_COUNT) std::this_thread::yield();
+  });
+
+  stop_sink();
+  return ns;
+}
+
+/**
+ * @brief 測定結果を表示する
+ */
+void print_result(const char* name, double ns, size_t allocations, size_t event_size) {
+  report(name, EVENT_COUNT, ns);
+  // キューへの書き込みと読み出しで1イベントにつき2回コピーされる
+  std::printf("%-40s %12zu B/event %12zu B/keystroke %8.3f alloc/keystroke\n", "", event_size, event_size * EVENTS_PER_KEYSTROKE * 2,
+              static_cast<double>(allocations) / KEYSTROKE_COUNT);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  std::printf("%zu keystrokes, %zu events per keystroke\n", KEYSTROKE_COUNT, EVENTS_PER_KEYSTROKE);
+
+  auto allocations = allocation_count_.load();
+  const auto legacy_ns = run_legacy();
+  print_result("before: deque<variant> + mutex + visit", legacy_ns, allocation_count_.load() - allocations, sizeof(LegacySinkEvent));
+
+  allocations = allocation_count_.load();
+  const auto current_ns = run_current();
+  print_result("after: send_to_sink() (headless)", current_ns, allocation_count_.load() - allocations, sizeof(SinkEvent));
+
+  return 0;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file timer_clock.cpp
+ * @brief TMKのタイマーが読む時計のベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 各時計を1回読むのにかかる時間と、steady_clockとのずれを測る。
+ * また、1回のkeyboard_task()でTMKがタイマーを何度も読む状況を模して、時刻を固定したときとの差を測る。
+ */
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include "bench.hpp"
+#include "timer_clock.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t ITERATION_COUNT = 10'000'000;                  ///< 各時計を読む回数
+static constexpr size_t TASK_COUNT = 1'000'000;                        ///< keyboard_task()を模した処理の回数
+static constexpr size_t READS_PER_TASK = 8;                            ///< 1回の処理でタイマーを読む回数
+static constexpr auto DRIFT_TIME = std::chrono::seconds(3);            ///< ずれを測る時間
+static constexpr auto DRIFT_INTERVAL = std::chrono::milliseconds(10);  ///< ずれを測る間隔
+
+/**
+ * @brief 以前のタイマーと同じく、high_resolution_clockを読む時計
+ */
+struct HighResolutionTimerClock {
+  void calibrate() noexcept {}
+
+  auto now() const noexcept {
+    return std::chrono::high_resolution_clock::now();
+  }
+
+  const char* name() const noexcept {
+    return "high_resolution_clock";
+  }
+};
+
+/**
+ * @brief timer_read()と同じく、ミリ秒単位の経過時間に換算する
+ */
+template <typename TimePoint>
+uint16_t to_timer_value(TimePoint tp, TimePoint zero_tp) noexcept {
+  return std::chrono::duration_cast<std::chrono::duration<uint16_t, std::milli>>(tp - zero_tp).count();
+}
+
+/**
+ * @brief 1回読むのにかかる時間を測る
+ */
+template <typename TimerClockT>
+void run_read(TimerClockT& clock) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "now (%s)", clock.name());
+  uint64_t hash = 0;
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < ITERATION_COUNT; ++i) hash += clock.now().time_since_epoch().count();
+  });
+  report(name, ITERATION_COUNT, ns);
+  do_not_optimize(hash);
+}
+
+/**
+ * @brief keyboard_task()を模して、1回の処理でタイマーを何度も読む時間を測る
+ *
+ * @param snapshot 処理ごとに時刻を1回だけ読むかどうか
+ */
+template <typename TimerClockT>
+void run_task(TimerClockT& clock, bool snapshot) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "%zu reads (%s, %s)", READS_PER_TASK, clock.name(),
+                snapshot ? "snapshot" : "each");
+  const auto zero_tp = clock.now();
+  uint64_t hash = 0;
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < TASK_COUNT; ++i) {
+      const auto fixed_tp = clock.now();
+      for (size_t j = 0; j < READS_PER_TASK; ++j) {
+        const auto tp = snapshot ? fixed_tp : clock.now();
+        hash = hash * 31 + to_timer_value(tp, zero_tp);
+      }
+    }
+  });
+  report(name, TASK_COUNT, ns);
+  do_not_optimize(hash);
+}
+
+/**
+ * @brief steady_clockとのずれを測る
+ *
+ * DRIFT_INTERVALごとに時計とsteady_clockを続けて読み、その差を集計する。
+ */
+template <typename TimerClockT>
+void run_drift(TimerClockT& clock) {
+  double max_ahead_us = 0.0;
+  double max_behind_us = 0.0;
+  double sum_us = 0.0;
+  double last_us = 0.0;
+  size_t count = 0;
+  const auto end = Clock::now() + DRIFT_TIME;
+  while (Clock::now() < end) {
+    const auto tp = clock.now();
+    const auto steady_tp = Clock::now();
+    last_us = std::chrono::duration<double, std::micro>(tp - steady_tp).count();
+    max_ahead_us = std::max(max_ahead_us, last_us);
+    max_behind_us = std::max(max_behind_us, -last_us);
+    sum_us += last_us;
+    count++;
+    std::this_thread::sleep_for(DRIFT_INTERVAL);
+  }
+  std::printf("drift (%s): mean %+.2f us, ahead <= %.2f us, behind <= %.2f us, last %+.2f us\n", clock.name(),
+              sum_us / count, max_ahead_us, max_behind_us, last_us);
+}
+
+template <typename TimerClockT>
+void run_all(TimerClockT& clock) {
+  clock.calibrate();
+  run_read(clock);
+  run_task(clock, false);
+  run_task(clock, true);
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  HighResolutionTimerClock high_resolution_clock;
+  run_all(high_resolution_clock);
+
+  SteadyTimerClock steady_clock;
+  run_all(steady_clock);
+
+#ifdef __linux__
+  CoarseTimerClock coarse_clock;
+  timespec resolution;
+  ::clock_getres(CLOCK_MONOTONIC_COARSE, &resolution);
+  std::printf("CLOCK_MONOTONIC_COARSE resolution: %.3f ms\n", resolution.tv_nsec / 1e6);
+  run_all(coarse_clock);
+  run_drift(coarse_clock);
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+  TscTimerClock tsc_clock;
+  run_all(tsc_clock);
+  run_drift(tsc_clock);
+  if (TscTimerClock::has_invariant_tsc()) std::printf("TSC frequency: %.3f MHz\n", tsc_clock.frequency() / 1e6);
+#endif
+  return 0;
+}
@@ -0,0 +1,184 @@
+/**
+ * @file timer_wheel.cpp
+ * @brief タイマーホイールのベンチマーク
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 予約しているタイマーの数を変えながら、予約と取り消しにかかる時間をstd::multimapによる実装と比べる。
+ * また、乱数で予約、取り消し、時間経過を繰り返し、multimapと同じ刻みで同じタイマーが発火することを確かめる。
+ */
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <tmk_desktop/timer_wheel.hpp>
+#include "bench.hpp"
+
+namespace tmk_desktop::bench {
+namespace {
+static constexpr size_t OPERATION_COUNT = 2'000'000;  ///< 予約と取り消しを行う回数
+static constexpr size_t VERIFY_STEP_COUNT = 200'000;  ///< 確かめるときの操作の回数
+
+/**
+ * @brief std::multimapで期限を管理する実装
+ */
+class MapTimers {
+public:
+  using Id = std::multimap<Clock::time_point, std::pair<TimerCallback, void*>>::iterator;
+
+  Id schedule(Clock::time_point deadline, TimerCallback callback, void* context) {
+    return timers_.emplace(deadline, std::pair{callback, context});
+  }
+
+  void cancel(Id id) {
+    timers_.erase(id);
+  }
+
+private:
+  std::multimap<Clock::time_point, std::pair<TimerCallback, void*>> timers_;
+};
+
+void noop(void*) noexcept {}
+
+/**
+ * @brief pending個のタイマーを予約した状態で、1つ予約して古いものを1つ取り消す操作を繰り返す
+ */
+template <typename Timers, typename Id>
+void run_schedule_cancel(const char* impl_name, size_t pending) {
+  const auto origin = Clock::now();
+  Timers timers{};
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<int64_t> dist{1, 10'000};
+  std::vector<Id> ids;
+  ids.reserve(pending);
+  for (size_t i = 0; i < pending; ++i) {
+    ids.push_back(timers.schedule(origin + std::chrono::milliseconds(dist(rng)), noop, nullptr));
+  }
+
+  std::vector<int64_t> delays(OPERATION_COUNT);
+  for (auto& delay : delays) delay = dist(rng);
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "schedule+cancel (%s, %zu pending)", impl_name, pending);
+  const auto ns = measure_ns([&] {
+    for (size_t i = 0; i < OPERATION_COUNT; ++i) {
+      auto& id = ids[i % pending];
+      timers.cancel(id);
+      id = timers.schedule(origin + std::chrono::milliseconds(delays[i]), noop, nullptr);
+    }
+  });
+  report(name, OPERATION_COUNT, ns);
+}
+
+/**
+ * @brief pending個のタイマーをすべて発火させる時間を測る
+ */
+void run_expire(size_t pending) {
+  const auto origin = Clock::now();
+  TimerWheel wheel{origin};
+  wheel.reserve(pending);
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<int64_t> dist{1, 10'000};
+  size_t fired = 0;
+  for (size_t i = 0; i < pending; ++i) {
+    wheel.schedule(origin + std::chrono::milliseconds(dist(rng)), [](void* context) { ++*static_cast<size_t*>(context); }, &fired);
+  }
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "run until empty (%zu pending)", pending);
+  const auto ns = measure_ns([&] {
+    // Keyboardのように、次の期限ごとにrun()を呼ぶ
+    while (wheel.size() > 0) wheel.run(wheel.next_deadline());
+  });
+  report(name, pending, ns);
+  do_not_optimize(fired);
+}
+
+std::vector<uint64_t> fired_keys_;  ///< 発火したタイマーのキー
+
+/**
+ * @brief コンテキストとして渡したキーを記録する
+ */
+void record_fired(void* context) {
+  fired_keys_.push_back(reinterpret_cast<uintptr_t>(context));
+}
+
+/**
+ * @brief 乱数で操作を繰り返し、multimapと同じ刻みで同じタイマーが発火することを確かめる
+ */
+bool verify() {
+  const auto origin = Clock::time_point{} + std::chrono::hours(1);
+  TimerWheel wheel{origin};
+  std::mt19937_64 rng{7};
+  std::multimap<uint64_t, uint64_t> expected;  // 期限の刻み -> キー
+  std::map<uint64_t, TimerId> ids;             // キー -> タイマー
+  auto now = origin;
+  uint64_t next_key = 1;
+
+  for (size_t step = 0; step < VERIFY_STEP_COUNT; ++step) {
+    const auto op = rng() % 8;
+    if (op < 4) {
+      // 近い期限から、最上段に収まらない遠い期限まで予約する
+      const uint64_t range = (op == 0) ? (uint64_t{1} << 26) : (op == 1) ? 100'000 : 200;
+      const auto deadline = now + std::chrono::microseconds(static_cast<int64_t>(rng() % (range * 1000)));
+      const uint64_t key = next_key++;
+      const auto elapsed = deadline - origin;
+      const auto tick = static_cast<uint64_t>((elapsed + TimerWheel::TICK_DURATION - Clock::duration{1}) / TimerWheel::TICK_DURATION);
+      const auto now_tick = static_cast<uint64_t>((now - origin) / TimerWheel::TICK_DURATION);
+      const auto id = wheel.schedule(deadline, record_fired, reinterpret_cast<void*>(static_cast<uintptr_t>(key)));
+      expected.emplace(std::max(tick, now_tick + 1), key);
+      ids.emplace(key, id);
+    } else if (op < 6 && !ids.empty()) {
+      auto it = ids.lower_bound(rng() % next_key);
+      if (it == ids.end()) it = ids.begin();
+      if (!wheel.cancel(it->second)) return false;
+      for (auto e = expected.begin(); e != expected.end(); ++e) {
+        if (e->second == it->first) {
+          expected.erase(e);
+          break;
+        }
+      }
+      ids.erase(it);
+    } else {
+      now += std::chrono::microseconds(static_cast<int64_t>(rng() % ((op == 6) ? 3'000 : 50'000'000)));
+      const auto now_tick = static_cast<uint64_t>((now - origin) / TimerWheel::TICK_DURATION);
+      fired_keys_.clear();
+      const size_t count = wheel.run(now);
+      std::vector<uint64_t> expected_keys;
+      while (!expected.empty() && expected.begin()->first <= now_tick) {
+        expected_keys.push_back(expected.begin()->second);
+        ids.erase(expected.begin()->second);
+        expected.erase(expected.begin());
+      }
+      std::sort(fired_keys_.begin(), fired_keys_.end());
+      std::sort(expected_keys.begin(), expected_keys.end());
+      if (count != fired_keys_.size() || fired_keys_ != expected_keys) return false;
+    }
+    if (wheel.size() != expected.size()) return false;
+    // 次の期限は、発火すべき刻みより遅れてはならない
+    if (!expected.empty() && wheel.next_deadline() > origin + expected.begin()->first * TimerWheel::TICK_DURATION) return false;
+  }
+  return true;
+}
+}  // namespace
+}  // namespace tmk_desktop::bench
+
+int main() {
+  using namespace tmk_desktop;
+  using namespace tmk_desktop::bench;
+
+  if (!verify()) {
+    std::printf("MISMATCH between TimerWheel and std::multimap\n");
+    return 1;
+  }
+
+  for (const size_t pending : {16, 1'024, 16'384}) {
+    run_schedule_cancel<TimerWheel, TimerId>("wheel", pending);
+    run_schedule_cancel<MapTimers, MapTimers::Id>("multimap", pending);
+    run_expire(pending);
+  }
+  return 0;
+}
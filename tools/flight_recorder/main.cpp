@@ -0,0 +1,115 @@
+/**
+ * @file main.cpp
+ * @brief フライトレコーダーの記録を読めるように表示するツール
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 使い方：flight_recorder <ファイル>
+ *
+ * 記録を古い順に1行ずつ表示する。時刻は書き出した時刻からの相対値で表す。
+ * レイヤーと既定レイヤーの状態、修飾キーと一時的な修飾キーの状態は16進数で表す。
+ */
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <tmk_desktop/flight_recorder.hpp>
+
+namespace tmk_desktop {
+namespace {
+/**
+ * @brief 書き出した理由の名前を取得する
+ */
+const char* to_string(FlightRecordReason reason) noexcept {
+  switch (reason) {
+    case FlightRecordReason::REQUESTED:
+      return "requested";
+    case FlightRecordReason::SOURCE_ERROR:
+      return "source error";
+    case FlightRecordReason::KEYBOARD_ERROR:
+      return "keyboard error";
+    case FlightRecordReason::SINK_ERROR:
+      return "sink error";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief 記録の種類ごとの中身を表示する
+ */
+void print_body(const FlightRecord& record) {
+  switch (record.type) {
+    case FlightRecordType::KEY_EVENT:
+      std::printf("key    %5u %s", record.code, record.data[0] ? "down" : "up");
+      break;
+    case FlightRecordType::ACTION:
+      std::printf("action 0x%04x at (row %u, col %u)", record.code, record.data[1], record.data[0]);
+      break;
+    case FlightRecordType::SINK_EVENT: {
+      // SinkEventTypeの値に対応する名前
+      static constexpr const char* TYPE_NAMES[] = {"none", "keyboard", "mouse", "usage", "native", "signal"};
+      const char* name = record.code < std::size(TYPE_NAMES) ? TYPE_NAMES[record.code] : "unknown";
+      std::printf("sink   %-8s", name);
+      for (const auto byte : record.data) std::printf(" %02x", byte);
+      break;
+    }
+    default:
+      std::printf("unknown type %u", static_cast<unsigned>(record.type));
+      break;
+  }
+}
+
+/**
+ * @brief ファイルを読み込み、記録を表示する
+ */
+void print_file(const char* path) {
+  std::ifstream input{path, std::ios::binary};
+  if (!input) throw std::runtime_error(std::string{"failed to open '"} + path + "'");
+  const std::vector<char> bytes{std::istreambuf_iterator<char>{input}, std::istreambuf_iterator<char>{}};
+
+  FlightRecordFileHeader header;
+  if (bytes.size() < sizeof(header)) throw std::runtime_error("file is too small");
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (header.magic != FLIGHT_RECORD_FILE_MAGIC) throw std::runtime_error("not a flight record file");
+  if (header.version != FLIGHT_RECORD_FILE_VERSION) throw std::runtime_error("unsupported version");
+  if (header.record_size != sizeof(FlightRecord)) throw std::runtime_error("record size mismatch");
+  if (bytes.size() != sizeof(header) + size_t{header.record_count} * sizeof(FlightRecord)) throw std::runtime_error("file size mismatch");
+  header.message.back() = '\0';
+
+  std::printf("reason: %s\n", to_string(header.reason));
+  if (header.message[0] != '\0') std::printf("message: %s\n", header.message.data());
+  std::printf("records: %u of %llu\n", header.record_count, static_cast<unsigned long long>(header.total_count));
+
+  for (uint32_t i = 0; i < header.record_count; ++i) {
+    FlightRecord record;
+    std::memcpy(&record, bytes.data() + sizeof(header) + i * sizeof(FlightRecord), sizeof(record));
+    std::printf("%12.3f ms  layer %08x/%08x  mods %02x/%02x  ", (record.time_ns - header.dumped_ns) / 1e6, record.layer_state,
+                record.default_layer_state, record.mods, record.weak_mods);
+    print_body(record);
+    std::printf("\n");
+  }
+}
+}  // namespace
+}  // namespace tmk_desktop
+
+int main(int argc, char** argv) {
+  using namespace tmk_desktop;
+
+  if (argc != 2) {
+    std::cerr << "usage: flight_recorder <file>\n";
+    return 2;
+  }
+
+  try {
+    print_file(argv[1]);
+  } catch (std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file keymap_builder.hpp
+ * @brief キーマップファイルを組み立てるクラス
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ */
+#pragma once
+
+#include <array>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tmk_desktop/keymap_file.hpp>
+
+namespace tmk_desktop {
+/**
+ * @brief キーマップファイルを組み立てるクラス
+ *
+ * キーはlayout.hppのLayoutと同じく、追加した順に仮想キーボードのキーに割り当てる。
+ * 定義に誤りがあればinvalid_argumentを投げる。
+ */
+class KeymapFileBuilder final {
+public:
+  /**
+   * @param layer_count レイヤー数
+   */
+  explicit KeymapFileBuilder(size_t layer_count) : layer_count_(layer_count) {
+    if (layer_count == 0 || layer_count > KEYMAP_FILE_MAX_LAYER_COUNT) throw std::invalid_argument("invalid layer count");
+    actions_.assign(layer_count * MATRIX_ROWS * MATRIX_COLS, ACTION_NO.code);
+    keyposes_.fill(0xff);
+  }
+
+  /**
+   * @brief キーを追加する
+   *
+   * @param key 物理キーボードのキー
+   * @param actions レイヤー0から順に並べたアクション。レイヤー数と同じだけ必要
+   * @param tapping 押すと同時に離すと解釈するかどうか
+   */
+  void add_key(Key key, std::span<const action_t> actions, bool tapping = false) {
+    if (actions.size() != layer_count_) throw std::invalid_argument("wrong number of layer actions");
+    if (key >= KEY_COUNT || key == Key{}) throw std::invalid_argument("key out of range");
+    if (keyposes_[key * 2] != 0xff) throw std::invalid_argument("duplicate key");
+    if (key_count_ >= MATRIX_ROWS * MATRIX_COLS) throw std::invalid_argument("too many keys");
+
+    const auto row = static_cast<uint8_t>(key_count_ / MATRIX_COLS);
+    const auto col = static_cast<uint8_t>(key_count_ % MATRIX_COLS);
+    keyposes_[key * 2] = col;
+    keyposes_[key * 2 + 1] = row;
+    tapping_keys_[key] = tapping;
+    for (size_t layer = 0; layer < layer_count_; ++layer) {
+      actions_[(layer * MATRIX_ROWS + row) * MATRIX_COLS + col] = actions[layer].code;
+    }
+    key_count_++;
+  }
+
+  /**
+   * @brief マクロを設定する
+   *
+   * @param id マクロの番号
+   * @param body マクロのバイト列。終端のENDは含めない
+   */
+  void set_macro(uint8_t id, std::span<const macro_t> body) {
+    if (macros_.size() <= id) macros_.resize(id + 1);
+    if (macros_[id]) throw std::invalid_argument("duplicate macro");
+    auto& macro = macros_[id].emplace(body.begin(), body.end());
+    macro.push_back(END);
+  }
+
+  /**
+   * @brief キーマップファイルの内容を作る
+   */
+  std::vector<std::byte> build() const {
+    KeymapFileHeader header{};
+    header.magic = KEYMAP_FILE_MAGIC;
+    header.version = KEYMAP_FILE_VERSION;
+    header.layer_count = static_cast<uint16_t>(layer_count_);
+    header.rows = MATRIX_ROWS;
+    header.cols = MATRIX_COLS;
+    header.key_count = static_cast<uint32_t>(KEY_COUNT);
+    header.macro_count = static_cast<uint32_t>(macros_.size());
+
+    std::vector<std::byte> bytes(sizeof(KeymapFileHeader));
+    header.actions_offset = append(bytes, std::as_bytes(std::span{actions_}), alignof(uint16_t));
+    header.keypos_offset = append(bytes, std::as_bytes(std::span{keyposes_}), 1);
+    header.tapping_offset = append(bytes, std::as_bytes(std::span{tapping_keys_}), 1);
+
+    std::vector<uint32_t> macro_table;
+    std::vector<macro_t> macro_data;
+    for (const auto& macro : macros_) {
+      if (!macro) {
+        macro_table.push_back(KEYMAP_FILE_NO_MACRO);
+        continue;
+      }
+      macro_table.push_back(static_cast<uint32_t>(macro_data.size()));
+      macro_data.insert(macro_data.end(), macro->begin(), macro->end());
+    }
+    header.macro_table_offset = append(bytes, std::as_bytes(std::span{macro_table}), alignof(uint32_t));
+    header.macro_data_offset = append(bytes, std::as_bytes(std::span{macro_data}), 1);
+    header.macro_data_size = static_cast<uint32_t>(macro_data.size());
+
+    header.file_size = static_cast<uint32_t>(bytes.size());
+    header.checksum = compute_keymap_file_checksum(std::span{bytes}.subspan(sizeof(KeymapFileHeader)));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    return bytes;
+  }
+
+private:
+  /**
+   * @brief 整列させてからバイト列を追加する
+   *
+   * @return 追加した位置
+   */
+  static uint32_t append(std::vector<std::byte>& bytes, std::span<const std::byte> data, size_t alignment) {
+    bytes.resize((bytes.size() + alignment - 1) / alignment * alignment);
+    const auto offset = static_cast<uint32_t>(bytes.size());
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    return offset;
+  }
+
+  size_t layer_count_;                                       ///< レイヤー数
+  size_t key_count_ = 0;                                     ///< 追加したキーの数
+  std::vector<uint16_t> actions_;                            ///< アクションの表
+  std::array<uint8_t, KEY_COUNT * 2> keyposes_{};            ///< キーからキーの位置への変換表
+  std::array<uint8_t, KEY_COUNT> tapping_keys_{};            ///< 押すと同時に離すと解釈するかどうかのフラグ列
+  std::vector<std::optional<std::vector<macro_t>>> macros_;  ///< マクロ本体。終端のENDを含む
+};
+}  // namespace tmk_desktop
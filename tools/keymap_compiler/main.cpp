@@ -0,0 +1,257 @@
+/**
+ * @file main.cpp
+ * @brief テキストで書いたキーマップをキーマップファイルに変換するツール
+ * @copyright Copyright 2021 sgawarat <sgawarat@gmail.com>
+ * @license This program is licensed under the GPLv2 or later. For more details, see LICENSE.
+ *
+ * 使い方：keymap_compiler <入力> <出力>
+ *
+ * 入力は1行に1つの定義を書く。#から行末まではコメントとして無視する。数値は10進数か0xで始まる16進数で書く。
+ * - layers <レイヤー数>
+ *   - 最初に書く。
+ * - key <キー> [tap] : <アクション>...
+ *   - 物理キーボードのキーと、レイヤー0から順に並べたアクションを定義する。tapを付けると押すと同時に離すと解釈する。
+ *   - キーは並べた順に仮想キーボードのキーに割り当てる。
+ * - macro <番号> : <ステップ>...
+ *   - ACTION_MACROで参照するマクロを定義する。
+ *
+ * アクションには以下を書ける。
+ * - NO、TRNS、<アクションコード>
+ * - KEY(kc)、MODS_KEY(mods,kc)、MODS_TAP_KEY(mods,kc)
+ * - LAYER_MOMENTARY(layer)、LAYER_TAP_KEY(layer,kc)
+ * - MACRO(id)、FUNCTION(id)、FUNCTION_TAP(id)
+ *
+ * ステップには以下を書ける。
+ * - D(kc)：押す、U(kc)：離す、T(kc)：押して離す、W(ms)：待つ、I(ms)：ステップ間の待ち時間を設定する
+ * - MS：修飾キーの状態を保存する、MR：復元する、MC：解除する
+ *
+ * 出力は別のファイルに書いてから置き換えるので、監視中のエンジンが書きかけのファイルを読むことはない。
+ */
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include "keymap_builder.hpp"
+
+namespace tmk_desktop {
+namespace {
+/**
+ * @brief 数値を読み取る
+ */
+uint32_t parse_number(std::string_view token) {
+  const std::string str{token};
+  char* end = nullptr;
+  const auto value = std::strtoul(str.c_str(), &end, 0);
+  if (str.empty() || *end != '\0') throw std::invalid_argument("invalid number '" + str + "'");
+  if (value > UINT32_MAX) throw std::invalid_argument("number out of range '" + str + "'");
+  return static_cast<uint32_t>(value);
+}
+
+/**
+ * @brief NAME(arg,...)の形の字句を名前と引数に分ける
+ */
+std::string_view split_call(std::string_view token, std::vector<uint32_t>& args) {
+  args.clear();
+  const auto open = token.find('(');
+  if (open == std::string_view::npos) return token;
+  if (token.back() != ')') throw std::invalid_argument("missing ')' in '" + std::string{token} + "'");
+
+  auto rest = token.substr(open + 1, token.size() - open - 2);
+  while (!rest.empty()) {
+    const auto comma = rest.find(',');
+    args.push_back(parse_number(rest.substr(0, comma)));
+    if (comma == std::string_view::npos) break;
+    rest.remove_prefix(comma + 1);
+  }
+  return token.substr(0, open);
+}
+
+/**
+ * @brief 引数の数を確かめる
+ */
+void expect_args(std::string_view name, const std::vector<uint32_t>& args, size_t count) {
+  if (args.size() != count) throw std::invalid_argument("wrong number of arguments for '" + std::string{name} + "'");
+}
+
+/**
+ * @brief アクションを読み取る
+ */
+action_t parse_action(std::string_view token) {
+  static constexpr uint32_t KEY_MAX = 0xff;    ///< キーコードは8ビット
+  static constexpr uint32_t MODS_MAX = 0x1f;   ///< 修飾キーは左右を区別するビットと4つのキーの5ビット
+  static constexpr uint32_t LAYER_MAX = 0x1f;  ///< レイヤーは5ビット
+  static constexpr uint32_t ID_MAX = 0xff;     ///< マクロと関数の番号は8ビット
+
+  std::vector<uint32_t> args;
+  const auto name = split_call(token, args);
+  // 範囲外の値は他のビットにはみ出し、別のアクションになってしまうので弾く
+  const auto arg = [&](size_t index, uint32_t max) {
+    if (args[index] > max) throw std::invalid_argument("argument out of range in '" + std::string{token} + "'");
+    return args[index];
+  };
+  if (name == "NO") return expect_args(name, args, 0), action_t{ACTION_NO};
+  if (name == "TRNS") return expect_args(name, args, 0), action_t{ACTION_TRANSPARENT};
+  if (name == "KEY") return expect_args(name, args, 1), action_t{ACTION_KEY(arg(0, KEY_MAX))};
+  if (name == "MODS_KEY") return expect_args(name, args, 2), action_t{ACTION_MODS_KEY(arg(0, MODS_MAX), arg(1, KEY_MAX))};
+  if (name == "MODS_TAP_KEY") return expect_args(name, args, 2), action_t{ACTION_MODS_TAP_KEY(arg(0, MODS_MAX), arg(1, KEY_MAX))};
+  if (name == "LAYER_MOMENTARY") return expect_args(name, args, 1), action_t{ACTION_LAYER_MOMENTARY(arg(0, LAYER_MAX))};
+  if (name == "LAYER_TAP_KEY") return expect_args(name, args, 2), action_t{ACTION_LAYER_TAP_KEY(arg(0, LAYER_MAX), arg(1, KEY_MAX))};
+  if (name == "MACRO") return expect_args(name, args, 1), action_t{ACTION_MACRO(arg(0, ID_MAX))};
+  if (name == "FUNCTION") return expect_args(name, args, 1), action_t{ACTION_FUNCTION(arg(0, ID_MAX))};
+  if (name == "FUNCTION_TAP") return expect_args(name, args, 1), action_t{ACTION_FUNCTION_TAP(arg(0, ID_MAX))};
+  if (args.empty() && !name.empty() && name[0] >= '0' && name[0] <= '9') {
+    const auto code = parse_number(name);
+    if (code > 0xffff) throw std::invalid_argument("action code out of range");
+    return action_t{.code = static_cast<uint16_t>(code)};
+  }
+  throw std::invalid_argument("unknown action '" + std::string{token} + "'");
+}
+
+/**
+ * @brief マクロのステップを読み取り、バイト列に追加する
+ */
+void parse_step(std::string_view token, std::vector<macro_t>& body) {
+  std::vector<uint32_t> args;
+  const auto name = split_call(token, args);
+  const auto arg = [&] {
+    expect_args(name, args, 1);
+    if (args[0] > 0xff) throw std::invalid_argument("argument out of range in '" + std::string{token} + "'");
+    return static_cast<macro_t>(args[0]);
+  };
+  if (name == "D") {
+    body.insert(body.end(), {KEY_DOWN, arg()});
+  } else if (name == "U") {
+    body.insert(body.end(), {KEY_UP, arg()});
+  } else if (name == "T") {
+    const auto kc = arg();
+    body.insert(body.end(), {KEY_DOWN, kc, KEY_UP, kc});
+  } else if (name == "W") {
+    body.insert(body.end(), {WAIT, arg()});
+  } else if (name == "I") {
+    body.insert(body.end(), {INTERVAL, arg()});
+  } else if (name == "MS" && args.empty()) {
+    body.push_back(MOD_STORE);
+  } else if (name == "MR" && args.empty()) {
+    body.push_back(MOD_RESTORE);
+  } else if (name == "MC" && args.empty()) {
+    body.push_back(MOD_CLEAR);
+  } else {
+    throw std::invalid_argument("unknown macro step '" + std::string{token} + "'");
+  }
+}
+
+/**
+ * @brief 空白で区切られた字句に分ける
+ *
+ * コメントを取り除き、':'は1つの字句として扱う。
+ */
+std::vector<std::string> tokenize(std::string line) {
+  if (const auto comment = line.find('#'); comment != std::string::npos) line.erase(comment);
+  std::vector<std::string> tokens;
+  std::istringstream stream{line};
+  for (std::string token; stream >> token;) {
+    for (size_t begin = 0; begin < token.size();) {
+      const auto colon = token.find(':', begin);
+      if (colon != begin) tokens.push_back(token.substr(begin, colon - begin));
+      if (colon == std::string::npos) break;
+      tokens.emplace_back(":");
+      begin = colon + 1;
+    }
+  }
+  return tokens;
+}
+
+/**
+ * @brief テキストのキーマップを読み取り、キーマップファイルの内容を作る
+ */
+std::vector<std::byte> compile(std::istream& input, const std::string& input_name) {
+  std::optional<KeymapFileBuilder> builder;
+  std::vector<action_t> actions;
+  std::vector<macro_t> body;
+  size_t line_number = 0;
+  for (std::string line; std::getline(input, line);) {
+    line_number++;
+    try {
+      const auto tokens = tokenize(line);
+      if (tokens.empty()) continue;
+
+      const auto& command = tokens[0];
+      if (command == "layers") {
+        if (builder) throw std::invalid_argument("layers is already defined");
+        if (tokens.size() != 2) throw std::invalid_argument("usage: layers <count>");
+        builder.emplace(parse_number(tokens[1]));
+        continue;
+      }
+      if (!builder) throw std::invalid_argument("layers must be defined first");
+
+      if (command == "key") {
+        const bool tapping = tokens.size() > 2 && tokens[2] == "tap";
+        const size_t colon = tapping ? 3 : 2;
+        if (tokens.size() <= colon || tokens[colon] != ":") throw std::invalid_argument("usage: key <key> [tap] : <action>...");
+        const auto key = parse_number(tokens[1]);
+        if (key > 0xffff) throw std::invalid_argument("key out of range");
+        actions.clear();
+        for (size_t i = colon + 1; i < tokens.size(); ++i) actions.push_back(parse_action(tokens[i]));
+        builder->add_key(static_cast<Key>(key), actions, tapping);
+      } else if (command == "macro") {
+        if (tokens.size() < 3 || tokens[2] != ":") throw std::invalid_argument("usage: macro <id> : <step>...");
+        const auto id = parse_number(tokens[1]);
+        if (id > 0xff) throw std::invalid_argument("macro id out of range");
+        body.clear();
+        for (size_t i = 3; i < tokens.size(); ++i) parse_step(tokens[i], body);
+        builder->set_macro(static_cast<uint8_t>(id), body);
+      } else {
+        throw std::invalid_argument("unknown command '" + command + "'");
+      }
+    } catch (std::invalid_argument& e) {
+      throw std::invalid_argument(input_name + ":" + std::to_string(line_number) + ": " + e.what());
+    }
+  }
+  if (!builder) throw std::invalid_argument(input_name + ": layers is not defined");
+  return builder->build();
+}
+
+/**
+ * @brief 別のファイルに書いてから置き換える
+ */
+void write_file(const std::filesystem::path& path, std::span<const std::byte> bytes) {
+  auto temp_path = path;
+  temp_path += ".tmp";
+  {
+    std::ofstream output{temp_path, std::ios::binary | std::ios::trunc};
+    output.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!output) throw std::runtime_error("failed to write '" + temp_path.string() + "'");
+  }
+  std::filesystem::rename(temp_path, path);
+}
+}  // namespace
+}  // namespace tmk_desktop
+
+int main(int argc, char** argv) {
+  using namespace tmk_desktop;
+
+  if (argc != 3) {
+    std::cerr << "usage: keymap_compiler <input> <output>\n";
+    return 2;
+  }
+
+  try {
+    std::ifstream input{argv[1]};
+    if (!input) throw std::runtime_error(std::string{"failed to open '"} + argv[1] + "'");
+    const auto bytes = compile(input, argv[1]);
+    if (const char* error = KeymapFileView::validate(bytes)) throw std::logic_error(std::string{"broken output: "} + error);
+    write_file(argv[2], bytes);
+    std::cout << argv[2] << ": " << bytes.size() << " bytes\n";
+  } catch (std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}